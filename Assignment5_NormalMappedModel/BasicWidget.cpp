@@ -1,6 +1,17 @@
 #include "BasicWidget.h"
 #include "OBJLoader.h"
 
+static QString vertexFormatToString(VertexFormat format) {
+	switch (format) {
+	case VertexFormat::FULL:
+		return "Full";
+	case VertexFormat::PACKED:
+		return "Packed";
+	case VertexFormat::PACKED_QUANTIZED:
+		return "Packed with quantized positions";
+	}
+}
+
 static QString drawModeToString(DrawMode drawMode) {
 	switch (drawMode) {
 	case DrawMode::DEFAULT:
@@ -18,7 +29,7 @@ static QString drawModeToString(DrawMode drawMode) {
 
 //////////////////////////////////////////////////////////////////////
 // Publics
-BasicWidget::BasicWidget(QList<QDir> objectFiles, QWidget* parent) : QOpenGLWidget(parent), camera_(QVector3D(0, 0, 2)), objectFiles_(objectFiles), logger_(this), drawMode_(DrawMode::DEFAULT), currObj_(0), paused_(true)
+BasicWidget::BasicWidget(QList<QDir> objectFiles, QWidget* parent) : QOpenGLWidget(parent), camera_(QVector3D(0, 0, 2)), objectFiles_(objectFiles), logger_(this), drawMode_(DrawMode::DEFAULT), currObj_(0), paused_(true), lastLod_(-1)
 {
   setFocusPolicy(Qt::StrongFocus);
 	world_.setToIdentity();
@@ -31,12 +42,45 @@ BasicWidget::~BasicWidget()
 		delete renderable;
 	}
 	renderables_.clear();
+	TextureLoader::instance().clear();
+	ShaderCache::instance().clear();
 }
 
 //////////////////////////////////////////////////////////////////////
 // Privates
 ///////////////////////////////////////////////////////////////////////
 // Protected
+void BasicWidget::loadObjects() {
+	for (auto renderable : renderables_) {
+		delete renderable;
+	}
+	renderables_.clear();
+
+	qDebug() << "Loading objects...";
+	int vertexBytes = 0;
+	for (QDir& obj : objectFiles_) {
+		QString path = obj.path();
+		qDebug() << "  Loading" << path.right(path.size() - path.lastIndexOf("/") - 1);
+		Renderable* ren = OBJLoader::loadOBJ(path);
+		if (ren) {
+			qDebug() << "    Success";
+			renderables_.push_back(ren);
+			vertexBytes += ren->vertexBufferBytes();
+		}
+		else {
+			qDebug() << "    Failure";
+		}
+	}
+	qDebug().noquote() << QString("Vertex format: %1, %2 KB of vertex buffers")
+		.arg(vertexFormatToString(Renderable::defaultVertexFormat()))
+		.arg(vertexBytes / 1024.0, 0, 'f', 1);
+	currObj_ = qMin(currObj_, qMax(renderables_.size() - 1, 0));
+	if (TextureLoader::instance().pending() > 0) {
+		qDebug() << "Loading" << TextureLoader::instance().pending() << "textures in the background";
+		textureTimer_.start();
+	}
+}
+
 void BasicWidget::quit(QString message, int exitCode) {
 	qDebug() << "Quitting:" << message;
 	close();
@@ -89,6 +133,29 @@ void BasicWidget::keyReleaseEvent(QKeyEvent* keyEvent)
 			paused_ = !paused_;
 			qDebug() << "Rotation" << (paused_ ? "paused." : "unpaused.");
 			break;
+		case Qt::Key_U:
+			Renderable::setUberShader(!Renderable::uberShader());
+			qDebug() << (Renderable::uberShader() ? "Using the runtime-branching uber shader." : "Using specialized shader variants.");
+			update();
+			break;
+		case Qt::Key_V:
+			// Reload everything in the next vertex format
+			Renderable::setDefaultVertexFormat(VertexFormat((int(Renderable::defaultVertexFormat()) + 1) % 3));
+			makeCurrent();
+			loadObjects();
+			update();
+			break;
+		case Qt::Key_O:
+			// Cycle through automatic LOD selection and each fixed level
+			Renderable::setForcedLod(Renderable::forcedLod() + 1 < Renderable::MAX_LODS ? Renderable::forcedLod() + 1 : -1);
+			if (Renderable::forcedLod() < 0) {
+				qDebug() << "LOD: picked by screen size";
+			}
+			else {
+				qDebug() << "LOD: fixed at level" << Renderable::forcedLod();
+			}
+			update();
+			break;
 		case Qt::Key_R:
 			camera_.reset();
 			qDebug() << "Camera orientation reset.";
@@ -109,6 +176,7 @@ void BasicWidget::mousePressEvent(QMouseEvent* mouseEvent)
 		mouseAction_ = Zoom;
 	}
 	lastMouseLoc_ = mouseEvent->pos();
+	pressLoc_ = mouseEvent->pos();
 }
 
 void BasicWidget::mouseMoveEvent(QMouseEvent* mouseEvent)
@@ -132,9 +200,42 @@ void BasicWidget::mouseMoveEvent(QMouseEvent* mouseEvent)
 
 void BasicWidget::mouseReleaseEvent(QMouseEvent* mouseEvent)
 {
+	if (mouseEvent->button() == Qt::LeftButton && (mouseEvent->pos() - pressLoc_).manhattanLength() <= CLICK_PIXELS) {
+		pick(mouseEvent->pos());
+	}
 	mouseAction_ = NoAction;
 }
 
+void BasicWidget::pick(const QPoint& pixel)
+{
+	if (renderables_.isEmpty()) {
+		return;
+	}
+	QElapsedTimer timer;
+	timer.start();
+
+	// Cast through the pixel's centre, then carry the ray into the object's model space to
+	// use its BVH as built. The direction isn't renormalized there, so t stays a world distance.
+	QVector3D origin, direction;
+	camera_.rayThrough(2.0f * (pixel.x() + 0.5f) / width() - 1.0f, 1.0f - 2.0f * (pixel.y() + 0.5f) / height(), origin, direction);
+	const Renderable* renderable = renderables_[currObj_];
+	const QMatrix4x4 toModel = (world_ * renderable->animatedModelMatrix()).inverted();
+	Bvh::Hit hit;
+	const bool found = renderable->bvh().intersect(Vec3(toModel.map(origin)), Vec3(toModel.mapVector(direction)), hit);
+	const double us = timer.nsecsElapsed() / 1e3;
+
+	if (!found) {
+		qDebug().noquote() << QString("Picked nothing (%1 us)").arg(us, 0, 'f', 1);
+		return;
+	}
+	const QVector3D position = origin + direction * hit.t;
+	qDebug().noquote() << QString("Picked object %1, triangle %2 of %3, barycentrics (%4, %5, %6), at (%7, %8, %9) (%10 us)")
+		.arg(currObj_).arg(hit.face).arg(renderable->bvh().faceOrder().size())
+		.arg(1.0f - hit.u - hit.v, 0, 'f', 3).arg(hit.u, 0, 'f', 3).arg(hit.v, 0, 'f', 3)
+		.arg(position.x(), 0, 'f', 3).arg(position.y(), 0, 'f', 3).arg(position.z(), 0, 'f', 3)
+		.arg(us, 0, 'f', 1);
+}
+
 void BasicWidget::initializeGL()
 {
   makeCurrent();
@@ -159,19 +260,7 @@ void BasicWidget::initializeGL()
 	}
 	
 	// Load objects
-	qDebug() << "Loading objects...";
-	for (QDir& obj : objectFiles_) {
-		QString path = obj.path();
-		qDebug() << "  Loading" << path.right(path.size() - path.lastIndexOf("/") - 1);
-		Renderable* ren = OBJLoader::loadOBJ(path);
-		if (ren) {
-			qDebug() << "    Success";
-			renderables_.push_back(ren);
-		}
-		else {
-			qDebug() << "    Failure";
-		}
-	}
+	loadObjects();
 
 	if (renderables_.isEmpty()) {
 		quit("No objects loaded correctly", 1);
@@ -185,6 +274,7 @@ void BasicWidget::initializeGL()
 		"  Camera Controls:\n" <<
 		"    Left click and drag to move the camera.\n" <<
 		"    Right click and drag to zoom the camera in/out.\n" <<
+		"    Left click without dragging to pick the triangle under the cursor.\n" <<
 		"    Press R to reset the camera to its original orientation.\n" <<
 		"  Model Controls:\n" <<
 		"    Press left and right arrow keys to cycle through models.\n" <<
@@ -195,6 +285,9 @@ void BasicWidget::initializeGL()
 		"    Press N to enter normal debug mode. Press again to return to default.\n" <<
 		"    Press L to enter lighting debug mode. Press again to return to default.\n" <<
 		"    Press D to return to default drawing mode.\n" <<
+		"    Press U to switch between specialized shader variants and the uber shader.\n" <<
+		"    Press V to reload the models in the next vertex format (full, packed, packed with quantized positions).\n" <<
+		"    Press O to cycle between picking the level of detail by screen size and fixing it at each level.\n" <<
 		"  Quitting:\n" <<
 		"    Press Q to quit.\n\n";
 	
@@ -219,6 +312,7 @@ void BasicWidget::resizeGL(int w, int h)
   glViewport(0, 0, w, h);
 
 	camera_.setPerspective(70.f, (float)w / (float)h, 0.001, 1000.0);
+	Renderable::setViewportHeight(h);
   glViewport(0, 0, w, h);
 }
 
@@ -231,6 +325,18 @@ void BasicWidget::paintGL()
   glClearColor(0.1f, 0.1f, 0.1f, 1.f);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+	// Bring in a few decoded textures each frame rather than stalling on all of them
+	TextureLoader& textures = TextureLoader::instance();
+	if (textures.pending() > 0) {
+		textures.upload(TEXTURE_UPLOAD_BUDGET_MS);
+		if (textures.pending() == 0) {
+			qDebug().noquote() << QString("Textures loaded %1 ms after the objects: %2 textures (%3 from the mip cache), %4 MB, %5 ms uploading on the render thread")
+				.arg(textureTimer_.nsecsElapsed() / 1e6, 0, 'f', 1)
+				.arg(textures.uploadedCount()).arg(textures.cachedCount()).arg(textures.uploadedBytes() / (1024.0 * 1024.0), 0, 'f', 1)
+				.arg(textures.uploadMs(), 0, 'f', 1);
+		}
+	}
+
 	// update all renderables, but only draw the selected one
 	for (int ii = 0; ii < renderables_.size(); ++ii) {
 		Renderable* renderable = renderables_[ii];
@@ -239,6 +345,10 @@ void BasicWidget::paintGL()
 		}
 		if (ii == currObj_) {
 			renderable->draw(world_, camera_.getViewMatrix(), camera_.getProjectionMatrix(), camera_.position(), drawMode_);
+			if (renderable->currentLod() != lastLod_) {
+				lastLod_ = renderable->currentLod();
+				qDebug().noquote() << QString("LOD %1 of %2: %3 triangles").arg(lastLod_).arg(renderable->lodCount()).arg(renderable->drawnTriangles());
+			}
 		}
   }
 	
@@ -28,11 +28,20 @@ private:
 	DrawMode drawMode_;
 	int currObj_;
 	bool paused_;
+	// Level of detail the current object last drew at, to report changes
+	int lastLod_;
+	// Decoded textures are uploaded for at most this long each frame
+	static constexpr double TEXTURE_UPLOAD_BUDGET_MS = 2.0;
+	// Time from loading the objects until the last texture was uploaded
+	QElapsedTimer textureTimer_;
 
 	// Mouse controls.
 	enum MouseControl { NoAction = 0, Rotate, Zoom };
 	QPoint lastMouseLoc_;
 	MouseControl mouseAction_;
+	// A left press released within CLICK_PIXELS of where it went down picks instead
+	QPoint pressLoc_;
+	static const int CLICK_PIXELS = 3;
 
 protected:
   // Required interaction overrides
@@ -46,8 +55,11 @@ protected:
   void resizeGL(int w, int h) override;
   void paintGL() override;
 
+	void loadObjects();
 	void quit(QString message, int exitCode);
 	void setDrawMode(DrawMode drawMode);
+	// Find the triangle of the current object under a point in the widget and log it
+	void pick(const QPoint& pixel);
   
 public:
   BasicWidget(QList<QDir> objectFiles, QWidget* parent=nullptr);
@@ -0,0 +1,537 @@
+#include "Benchmarks.h"
+#include "Camera.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "OBJLoader.h"
+#include "RayTracer.h"
+#include "TangentSpace.h"
+#include "TextureCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+static QStringList findObjFiles(const QString& objectsDir)
+{
+	QDirIterator it(objectsDir, QStringList() << "*.obj", QDir::Files, QDirIterator::Subdirectories);
+	QStringList files;
+	while (it.hasNext()) {
+		files << it.next();
+	}
+	files.sort();
+	if (files.isEmpty()) {
+		qDebug() << "No .obj files found in" << objectsDir;
+	}
+	return files;
+}
+
+int runMeshOptimizationReport(const QString& objectsDir)
+{
+	const QStringList files = findObjFiles(objectsDir);
+	if (files.isEmpty()) {
+		return 1;
+	}
+
+	qDebug().noquote() << QString("Mesh optimization: FIFO cache of 16 vertices, %1 models in %2").arg(files.size()).arg(objectsDir);
+	for (const QString& path : files) {
+		QVector<Vertex> vertices;
+		QVector<Face> faces;
+		QString diffuseMap, normalMap;
+		if (!OBJLoader::loadMesh(path, vertices, faces, diffuseMap, normalMap)) {
+			continue;
+		}
+
+		const MeshOptimizer::CacheStats before = MeshOptimizer::analyzeVertexCache(faces, vertices.size());
+		QElapsedTimer timer;
+		timer.start();
+		MeshOptimizer::optimize(vertices, faces);
+		const double optimizeMs = timer.nsecsElapsed() / 1e6;
+		const MeshOptimizer::CacheStats after = MeshOptimizer::analyzeVertexCache(faces, vertices.size());
+
+		qDebug().noquote() << QString("  %1 %2 tris, %3 verts | ACMR %4 -> %5 | ATVR %6 -> %7 | %8 ms")
+			.arg(QDir(objectsDir).relativeFilePath(path), -32)
+			.arg(faces.size(), 6).arg(vertices.size(), 6)
+			.arg(before.acmr, 0, 'f', 3).arg(after.acmr, 0, 'f', 3)
+			.arg(before.atvr, 0, 'f', 3).arg(after.atvr, 0, 'f', 3)
+			.arg(optimizeMs, 0, 'f', 2);
+	}
+	return 0;
+}
+
+int runLodGeneration(const QString& objectsDir)
+{
+	const QStringList files = findObjFiles(objectsDir);
+	if (files.isEmpty()) {
+		return 1;
+	}
+
+	qDebug().noquote() << QString("LOD generation: up to %1 levels, %2 models in %3").arg(int(Renderable::MAX_LODS)).arg(files.size()).arg(objectsDir);
+	int failures = 0;
+	for (const QString& path : files) {
+		QVector<Vertex> vertices;
+		QVector<Face> faces;
+		QString diffuseMap, normalMap;
+		if (!OBJLoader::loadMesh(path, vertices, faces, diffuseMap, normalMap)) {
+			++failures;
+			continue;
+		}
+		// The same preparation loadOBJ does, so the cache matches what it sees
+		MeshOptimizer::optimize(vertices, faces);
+
+		QElapsedTimer timer;
+		timer.start();
+		const QVector<MeshLod> lods = MeshSimplifier::generateLods(vertices, faces, Renderable::MAX_LODS);
+		const double simplifyMs = timer.nsecsElapsed() / 1e6;
+		const QString lodPath = MeshSimplifier::lodPath(path);
+		if (!MeshSimplifier::saveLods(lodPath, lods)) {
+			++failures;
+		}
+
+		QString levels;
+		for (const MeshLod& lod : lods) {
+			levels += QString(" | %1 tris, %2%").arg(lod.faces.size(), 6).arg(lod.error * 100.0f, 0, 'f', 2);
+		}
+		qDebug().noquote() << QString("  %1%2 | %3 ms")
+			.arg(QDir(objectsDir).relativeFilePath(path), -32)
+			.arg(levels)
+			.arg(simplifyMs, 0, 'f', 2);
+	}
+	return failures == 0 ? 0 : 1;
+}
+
+// Average ms per TangentSpace::generate over enough runs to take at least 100 ms
+static double timeTangents(QVector<Vertex>& vertices, const QVector<Face>& faces, int threadCount)
+{
+	QElapsedTimer timer;
+	timer.start();
+	int runs = 0;
+	do {
+		TangentSpace::generate(vertices, faces, threadCount);
+		++runs;
+	} while (timer.elapsed() < 100);
+	return timer.nsecsElapsed() / 1e6 / runs;
+}
+
+int runTangentBenchmark(const QString& objectsDir)
+{
+	const QStringList files = findObjFiles(objectsDir);
+	if (files.isEmpty()) {
+		return 1;
+	}
+
+	struct Mesh {
+		QString path;
+		QVector<Vertex> vertices;
+		QVector<Face> faces;
+	};
+	QVector<Mesh> meshes;
+	for (const QString& path : files) {
+		Mesh mesh;
+		mesh.path = path;
+		QString diffuseMap, normalMap;
+		if (OBJLoader::loadMesh(path, mesh.vertices, mesh.faces, diffuseMap, normalMap)) {
+			meshes << mesh;
+		}
+	}
+	std::sort(meshes.begin(), meshes.end(), [](const Mesh& a, const Mesh& b) { return a.faces.size() > b.faces.size(); });
+
+	const int threads = int(std::max(std::thread::hardware_concurrency(), 1u));
+	qDebug().noquote() << QString("Tangent frames: 1 vs. %1 threads, %2 models in %3").arg(threads).arg(meshes.size()).arg(objectsDir);
+	bool allMatch = true;
+	for (Mesh& mesh : meshes) {
+		QVector<Vertex> serial = mesh.vertices;
+		const TangentSpace::Stats stats = TangentSpace::generate(serial, mesh.faces, 1);
+		QVector<Vertex> parallel = mesh.vertices;
+		TangentSpace::generate(parallel, mesh.faces, threads);
+		// Every vertex sums its faces in the same order however the work is split
+		const bool match = serial == parallel;
+		allMatch = allMatch && match;
+
+		const double serialMs = timeTangents(serial, mesh.faces, 1);
+		const double parallelMs = timeTangents(parallel, mesh.faces, threads);
+		qDebug().noquote() << QString("  %1 %2 tris, %3 verts | %4 degenerate, %5 mirrored | %6 ms -> %7 ms (%8 Mtris/s)%9")
+			.arg(QDir(objectsDir).relativeFilePath(mesh.path), -32)
+			.arg(mesh.faces.size(), 6).arg(mesh.vertices.size(), 6)
+			.arg(stats.degenerateFaces).arg(stats.leftHanded)
+			.arg(serialMs, 0, 'f', 3).arg(parallelMs, 0, 'f', 3)
+			.arg(mesh.faces.size() / parallelMs / 1000.0, 0, 'f', 1)
+			.arg(match ? "" : " | MISMATCH");
+	}
+	return allMatch ? 0 : 1;
+}
+
+int runTextureCacheBenchmark(const QString& objectsDir)
+{
+	const QStringList scene = QStringList() << "chapel" << "house" << "windmill";
+
+	// The maps the viewer would load for the scene's models, each once
+	struct Texture {
+		QString path;
+		TextureCache::Content content;
+	};
+	QVector<Texture> textures;
+	QStringList seen;
+	for (const QString& path : findObjFiles(objectsDir)) {
+		if (!scene.contains(QFileInfo(path).dir().dirName())) {
+			continue;
+		}
+		QVector<Vertex> vertices;
+		QVector<Face> faces;
+		QString diffuseMap, normalMap;
+		if (!OBJLoader::loadMesh(path, vertices, faces, diffuseMap, normalMap)) {
+			continue;
+		}
+		if (!diffuseMap.isEmpty() && !seen.contains(diffuseMap)) {
+			seen << diffuseMap;
+			textures << Texture{ diffuseMap, TextureCache::Content::Color };
+		}
+		if (!normalMap.isEmpty() && !seen.contains(normalMap)) {
+			seen << normalMap;
+			textures << Texture{ normalMap, TextureCache::Content::Normal };
+		}
+	}
+	if (textures.isEmpty()) {
+		qDebug() << "No chapel, house or windmill textures found in" << objectsDir;
+		return 1;
+	}
+
+	qDebug().noquote() << QString("Texture cache: %1 textures of the chapel, house and windmill in %2").arg(textures.size()).arg(objectsDir);
+	double decodeTotal = 0.0, coldTotal = 0.0, warmTotal = 0.0;
+	qint64 bytesTotal = 0;
+	int failures = 0;
+	for (const Texture& texture : textures) {
+		QElapsedTimer timer;
+
+		// What a load cost before the cache: decode only, with the driver left to build mips
+		timer.start();
+		const QImage image = QImage(texture.path).convertToFormat(QImage::Format_RGBA8888);
+		const double decodeMs = timer.nsecsElapsed() / 1e6;
+		if (image.isNull()) {
+			++failures;
+			continue;
+		}
+
+		timer.restart();
+		TextureCache::build(image, texture.content, TextureCache::Filter::Box);
+		const double boxMs = timer.nsecsElapsed() / 1e6;
+		timer.restart();
+		TextureCache::build(image, texture.content, TextureCache::Filter::Kaiser);
+		const double kaiserMs = timer.nsecsElapsed() / 1e6;
+
+		// Cold: decode, filter and write the cache
+		QFile::remove(TextureCache::cachePath(texture.path, QSize(), false, texture.content));
+		bool cacheHit = false;
+		timer.restart();
+		const qint64 bytes = TextureCache::load(texture.path, QSize(), false, texture.content, 0, &cacheHit).bytes();
+		const double coldMs = timer.nsecsElapsed() / 1e6;
+
+		// Warm: map the cache and read every byte, as the upload's copy into the pixel buffer would
+		timer.restart();
+		const TextureCache::MipChain warm = TextureCache::load(texture.path, QSize(), false, texture.content, 0, &cacheHit);
+		quint32 checksum = 0;
+		for (const TextureCache::Level& level : warm.levels) {
+			const quint32* pixels = reinterpret_cast<const quint32*>(level.bits);
+			for (int i = 0; i < level.width * level.height; ++i) {
+				checksum += pixels[i];
+			}
+		}
+		const double warmMs = timer.nsecsElapsed() / 1e6;
+		if (!cacheHit) {
+			++failures;
+		}
+
+		decodeTotal += decodeMs;
+		coldTotal += coldMs;
+		warmTotal += warmMs;
+		bytesTotal += bytes;
+		qDebug().noquote() << QString("  %1 %2x%3 | decode %4 ms | box %5 ms, kaiser %6 ms | cold %7 ms | warm %8 ms%9 (%10)")
+			.arg(QDir(objectsDir).relativeFilePath(texture.path), -32)
+			.arg(image.width()).arg(image.height())
+			.arg(decodeMs, 0, 'f', 1).arg(boxMs, 0, 'f', 1).arg(kaiserMs, 0, 'f', 1)
+			.arg(coldMs, 0, 'f', 1).arg(warmMs, 0, 'f', 2)
+			.arg(cacheHit ? "" : " | NOT CACHED")
+			.arg(checksum, 8, 16, QChar('0'));
+	}
+
+	qDebug().noquote() << QString("Scene textures: decode only %1 ms, cold %2 ms, warm %3 ms (%4x faster than decoding), %5 MB of mip chains")
+		.arg(decodeTotal, 0, 'f', 1).arg(coldTotal, 0, 'f', 1).arg(warmTotal, 0, 'f', 1)
+		.arg(warmTotal > 0.0 ? decodeTotal / warmTotal : 0.0, 0, 'f', 1)
+		.arg(bytesTotal / (1024.0 * 1024.0), 0, 'f', 1);
+	return failures == 0 ? 0 : 1;
+}
+
+// Average ms per Bvh::build over enough runs to take at least 100 ms
+static double timeBvhBuild(Bvh& bvh, const QVector<Vertex>& vertices, const QVector<Face>& faces, int threadCount)
+{
+	QElapsedTimer timer;
+	timer.start();
+	int runs = 0;
+	do {
+		bvh.build(vertices, faces, threadCount);
+		++runs;
+	} while (timer.elapsed() < 100);
+	return timer.nsecsElapsed() / 1e6 / runs;
+}
+
+int runRayTraceBenchmark(const QString& objectsDir)
+{
+	const int size = 512;
+	QStringList files;
+	for (const QString& path : findObjFiles(objectsDir)) {
+		const QFileInfo info(path);
+		if (info.completeBaseName() == "bunny" || info.dir().dirName() == "chapel" || info.dir().dirName() == "house") {
+			files << path;
+		}
+	}
+	if (files.isEmpty()) {
+		qDebug() << "No bunny, chapel or house found in" << objectsDir;
+		return 1;
+	}
+
+	const int threads = int(std::max(std::thread::hardware_concurrency(), 1u));
+	qDebug().noquote() << QString("Ray tracing: %1x%1, 1 vs. %2 threads, %3 models in %4").arg(size).arg(threads).arg(files.size()).arg(objectsDir);
+	int failures = 0;
+	for (const QString& path : files) {
+		QVector<Vertex> vertices;
+		QVector<Face> faces;
+		QString diffuseMap, normalMap;
+		if (!OBJLoader::loadMesh(path, vertices, faces, diffuseMap, normalMap)) {
+			++failures;
+			continue;
+		}
+
+		// The tree comes out the same however many threads build it
+		Bvh serial;
+		const Bvh::Stats stats = serial.build(vertices, faces, 1);
+		Bvh bvh;
+		bvh.build(vertices, faces, threads);
+		const bool sameTree = serial.nodes().size() == bvh.nodes().size() && serial.faceOrder() == bvh.faceOrder() &&
+			std::memcmp(serial.nodes().data(), bvh.nodes().data(), bvh.nodes().size() * sizeof(Bvh::Node)) == 0;
+		const double serialBuildMs = timeBvhBuild(serial, vertices, faces, 1);
+		const double buildMs = timeBvhBuild(bvh, vertices, faces, threads);
+
+		// Look at the middle of the mesh from the front and a little above, with the viewer's
+		// field of view, from far enough away to fit its bounds
+		const Bvh::Node& root = bvh.nodes()[0];
+		const QVector3D lower(root.lower[0], root.lower[1], root.lower[2]);
+		const QVector3D upper(root.upper[0], root.upper[1], root.upper[2]);
+		const QVector3D center = (lower + upper) * 0.5f;
+		const float radius = (upper - lower).length() * 0.5f;
+		RayTracer::View view;
+		view.fov = 70.0f;
+		view.lookAt = center;
+		view.up = QVector3D(0.0f, 1.0f, 0.0f);
+		view.position = center + QVector3D(0.0f, 0.3f, 1.0f).normalized() * (radius / std::sin(qDegreesToRadians(view.fov) * 0.5f));
+
+		RayTracer tracer(vertices, faces, bvh);
+		tracer.setLights(Renderable::defaultLights());
+		tracer.setDiffuseMap(diffuseMap.isEmpty() ? QImage() : QImage(diffuseMap));
+		tracer.setNormalMap(normalMap.isEmpty() ? QImage() : QImage(normalMap));
+		std::vector<quint8> serialPixels, pixels;
+		const RayTracer::Stats serialStats = tracer.render(view, size, size, serialPixels, 1);
+		const RayTracer::Stats parallelStats = tracer.render(view, size, size, pixels, threads);
+		// Tiles are traced whole by one thread, so the split can't change a pixel
+		const bool samePixels = serialPixels == pixels;
+
+		const QString output = QFileInfo(path).completeBaseName() + ".ppm";
+		if (!sameTree || !samePixels || !RayTracer::writePpm(output, size, size, pixels)) {
+			++failures;
+		}
+		const qint64 rays = parallelStats.primaryRays + parallelStats.shadowRays;
+		qDebug().noquote() << QString("  %1 %2 tris | %3 nodes, depth %4, SAH %5 | build %6 ms -> %7 ms | %8 + %9 rays | %10 ms -> %11 ms (%12 Mrays/s) -> %13%14")
+			.arg(QDir(objectsDir).relativeFilePath(path), -32)
+			.arg(faces.size(), 6)
+			.arg(stats.nodes).arg(stats.depth).arg(stats.sahCost, 0, 'f', 1)
+			.arg(serialBuildMs, 0, 'f', 2).arg(buildMs, 0, 'f', 2)
+			.arg(parallelStats.primaryRays).arg(parallelStats.shadowRays)
+			.arg(serialStats.ms, 0, 'f', 1).arg(parallelStats.ms, 0, 'f', 1)
+			.arg(rays / parallelStats.ms / 1000.0, 0, 'f', 2)
+			.arg(output)
+			.arg(sameTree ? (samePixels ? "" : " | PIXELS DIFFER") : " | TREES DIFFER");
+
+		// Primary rays only, on one thread so packets are compared with single rays and not
+		// with the split. Packets must find exactly what single rays do, down to the pixel.
+		QString packets;
+		std::vector<Bvh::Hit> singleHits;
+		double singleMs = 0.0;
+		for (int packetSize : { 1, 4, 8 }) {
+			tracer.setPacketSize(packetSize);
+			std::vector<Bvh::Hit> hits;
+			const RayTracer::Stats primary = tracer.castPrimary(view, size, size, hits, 1);
+			bool sameHits = true;
+			if (packetSize == 1) {
+				singleHits = hits;
+				singleMs = primary.ms;
+			} else {
+				for (size_t ii = 0; ii < hits.size() && sameHits; ++ii) {
+					sameHits = hits[ii].face == singleHits[ii].face && (hits[ii].face < 0 ||
+						(hits[ii].t == singleHits[ii].t && hits[ii].u == singleHits[ii].u && hits[ii].v == singleHits[ii].v));
+				}
+				std::vector<quint8> packetPixels;
+				tracer.render(view, size, size, packetPixels, 1);
+				sameHits = sameHits && packetPixels == serialPixels;
+			}
+			if (!sameHits) {
+				++failures;
+			}
+			packets += QString(" | %1: %2 ms (%3 Mrays/s, x%4)%5").arg(packetSize).arg(primary.ms, 0, 'f', 1)
+				.arg(primary.primaryRays / primary.ms / 1000.0, 0, 'f', 2).arg(singleMs / primary.ms, 0, 'f', 2)
+				.arg(sameHits ? "" : " HITS DIFFER");
+		}
+		qDebug().noquote() << QString("  %1 primary rays per packet%2").arg("", -32).arg(packets);
+	}
+	return failures == 0 ? 0 : 1;
+}
+
+// Closest triangle along the ray by testing every one, to check picks against
+static int pickByBruteForce(const QVector<Vertex>& vertices, const QVector<Face>& faces, const Vec3& origin, const Vec3& direction, float& closest)
+{
+	closest = 1e30f;
+	int face = -1;
+	for (int ii = 0; ii < faces.size(); ++ii) {
+		const QVector3D o(origin.x, origin.y, origin.z);
+		const QVector3D d(direction.x, direction.y, direction.z);
+		const QVector3D v0(vertices[faces[ii].a].position.x, vertices[faces[ii].a].position.y, vertices[faces[ii].a].position.z);
+		const QVector3D e1 = QVector3D(vertices[faces[ii].b].position.x, vertices[faces[ii].b].position.y, vertices[faces[ii].b].position.z) - v0;
+		const QVector3D e2 = QVector3D(vertices[faces[ii].c].position.x, vertices[faces[ii].c].position.y, vertices[faces[ii].c].position.z) - v0;
+		const QVector3D p = QVector3D::crossProduct(d, e2);
+		const float determinant = QVector3D::dotProduct(e1, p);
+		if (determinant == 0.0f) {
+			continue;
+		}
+		const QVector3D s = o - v0;
+		const float u = QVector3D::dotProduct(s, p) / determinant;
+		const QVector3D q = QVector3D::crossProduct(s, e1);
+		const float v = QVector3D::dotProduct(d, q) / determinant;
+		const float t = QVector3D::dotProduct(e2, q) / determinant;
+		if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 0.0f && t < closest) {
+			closest = t;
+			face = ii;
+		}
+	}
+	return face;
+}
+
+int runPickBenchmark(const QString& objectsDir)
+{
+	const int width = 800, height = 600;
+	const int picks = 10000;
+	const int checked = 100;
+	const int tiledTriangles = 1000000;
+
+	const QStringList files = findObjFiles(objectsDir);
+	if (files.isEmpty()) {
+		return 1;
+	}
+	struct Model {
+		QString name;
+		QVector<Vertex> vertices;
+		QVector<Face> faces;
+	};
+	QVector<Model> models;
+	for (const QString& path : files) {
+		Model model;
+		model.name = QDir(objectsDir).relativeFilePath(path);
+		QString diffuseMap, normalMap;
+		if (OBJLoader::loadMesh(path, model.vertices, model.faces, diffuseMap, normalMap) && !model.faces.isEmpty()) {
+			models << model;
+		}
+	}
+	if (models.isEmpty()) {
+		return 1;
+	}
+
+	// The largest model laid out on a grid, copies a little apart, until there are a million
+	// triangles
+	const Model* largest = &models[0];
+	for (const Model& model : models) {
+		largest = model.faces.size() > largest->faces.size() ? &model : largest;
+	}
+	Model tiled;
+	{
+		Vec3 lower = largest->vertices[0].position, upper = lower;
+		for (const Vertex& vertex : largest->vertices) {
+			for (int axis = 0; axis < 3; ++axis) {
+				lower[axis] = qMin(lower[axis], vertex.position[axis]);
+				upper[axis] = qMax(upper[axis], vertex.position[axis]);
+			}
+		}
+		const int copies = (tiledTriangles + largest->faces.size() - 1) / largest->faces.size();
+		const int columns = int(std::ceil(std::sqrt(double(copies))));
+		const float spacing = qMax(upper.x - lower.x, upper.z - lower.z) * 1.1f;
+		tiled.name = QString("%1 x%2").arg(largest->name).arg(copies);
+		for (int copy = 0; copy < copies; ++copy) {
+			const unsigned int base = tiled.vertices.size();
+			for (Vertex vertex : largest->vertices) {
+				vertex.position.x += (copy % columns) * spacing;
+				vertex.position.z += (copy / columns) * spacing;
+				tiled.vertices << vertex;
+			}
+			for (const Face& face : largest->faces) {
+				tiled.faces << Face(base + face.a, base + face.b, base + face.c);
+			}
+		}
+	}
+	models << tiled;
+
+	qDebug().noquote() << QString("Picking: %1 random pixels of a %2x%3 view per model, %4 checked against every triangle")
+		.arg(picks).arg(width).arg(height).arg(checked);
+	int failures = 0;
+	for (const Model& model : models) {
+		QElapsedTimer timer;
+		timer.start();
+		Bvh bvh;
+		bvh.build(model.vertices, model.faces);
+		const double buildMs = timer.nsecsElapsed() / 1e6;
+
+		// The viewer's camera, backed off to fit the model, and a model matrix turned a little
+		// so the ray really is carried into model space
+		const Bvh::Node& root = bvh.nodes()[0];
+		const QVector3D lower(root.lower[0], root.lower[1], root.lower[2]);
+		const QVector3D upper(root.upper[0], root.upper[1], root.upper[2]);
+		const QVector3D center = (lower + upper) * 0.5f;
+		const float radius = (upper - lower).length() * 0.5f;
+		QMatrix4x4 modelMatrix;
+		modelMatrix.rotate(30.0f, 0.0f, 1.0f, 0.0f);
+		modelMatrix.translate(-center);
+		Camera camera(QVector3D(0.0f, 0.3f, 1.0f).normalized() * (radius / std::sin(qDegreesToRadians(35.0f))));
+		camera.setPerspective(70.f, float(width) / float(height), 0.001f, 1000.0f);
+		const QMatrix4x4 toModel = modelMatrix.inverted();
+
+		// The same steps as BasicWidget::pick()
+		srand(1);
+		double totalUs = 0.0, maxUs = 0.0;
+		int hits = 0, mismatches = 0;
+		for (int pick = 0; pick < picks; ++pick) {
+			const QPoint pixel(rand() % width, rand() % height);
+			timer.restart();
+			QVector3D origin, direction;
+			camera.rayThrough(2.0f * (pixel.x() + 0.5f) / width - 1.0f, 1.0f - 2.0f * (pixel.y() + 0.5f) / height, origin, direction);
+			const Vec3 modelOrigin(toModel.map(origin));
+			const Vec3 modelDirection(toModel.mapVector(direction));
+			Bvh::Hit hit;
+			const bool found = bvh.intersect(modelOrigin, modelDirection, hit);
+			const double us = timer.nsecsElapsed() / 1e3;
+			totalUs += us;
+			maxUs = std::max(maxUs, us);
+			hits += found ? 1 : 0;
+
+			if (pick < checked) {
+				float closest;
+				const int face = pickByBruteForce(model.vertices, model.faces, modelOrigin, modelDirection, closest);
+				// Either the same triangle, or one just as near where the ray crosses an edge
+				if ((face >= 0) != found || (found && face != hit.face && std::fabs(closest - hit.t) > 1e-4f * closest)) {
+					++mismatches;
+				}
+			}
+		}
+		failures += mismatches;
+		qDebug().noquote() << QString("  %1 %2 tris | build %3 ms | %4 hits | %5 us mean, %6 us max%7")
+			.arg(model.name, -32).arg(model.faces.size(), 7)
+			.arg(buildMs, 0, 'f', 1).arg(hits, 5)
+			.arg(totalUs / picks, 0, 'f', 2).arg(maxUs, 0, 'f', 1)
+			.arg(mismatches == 0 ? QString() : QString(" | %1 DIFFER").arg(mismatches));
+	}
+	return failures == 0 ? 0 : 1;
+}
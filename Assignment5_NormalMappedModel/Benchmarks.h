@@ -0,0 +1,33 @@
+#pragma once
+
+#include <QtCore>
+
+// Headless reports, run from the command line instead of opening a window.
+// See main.cpp for the flags that select them.
+
+// Load every .obj under objectsDir and report vertex cache efficiency before and
+// after mesh optimization
+int runMeshOptimizationReport(const QString& objectsDir);
+
+// Simplify every .obj under objectsDir into levels of detail, write them next to each
+// .obj for the viewer to load, and report each level's triangles and error
+int runLodGeneration(const QString& objectsDir);
+
+// Time tangent frame generation on every .obj under objectsDir, largest first, on one
+// thread and on all of them
+int runTangentBenchmark(const QString& objectsDir);
+
+// Load the chapel, house and windmill textures from their sources with no mip cache, then
+// again from the cache files that run wrote, and compare the two
+int runTextureCacheBenchmark(const QString& objectsDir);
+
+// Build a BVH over the bunny, chapel and house and ray trace each with its textures and the
+// viewer's lights, on one thread and on all of them. Writes the images as .ppm files to the
+// current directory and reports rays per second. Then times the primary rays alone, one at a
+// time and in packets of 4 and 8, checking every packet size hits the same triangles.
+int runRayTraceBenchmark(const QString& objectsDir);
+
+// Pick random pixels of every .obj under objectsDir the way the viewer does on a click, and
+// of the largest tiled out to a million triangles. Reports the time per pick and checks
+// the first few against testing every triangle.
+int runPickBenchmark(const QString& objectsDir);
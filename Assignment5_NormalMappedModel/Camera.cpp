@@ -130,6 +130,15 @@ QMatrix4x4 Camera::getProjectionMatrix() const
 	return projection_;
 }
 
+void Camera::rayThrough(float x, float y, QVector3D& origin, QVector3D& direction) const
+{
+	// The projection scales view-space x and y by these before the divide by depth, so
+	// dividing them back out gives the view-space direction at depth 1
+	const QVector3D viewDirection(x / projection_(0, 0), y / projection_(1, 1), -1.0f);
+	origin = position_;
+	direction = getViewMatrix().inverted().mapVector(viewDirection).normalized();
+}
+
 void Camera::reset()
 {
 	position_ = initialPosition_;
@@ -0,0 +1,330 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+// ~~~~~~~~~~ ANALYSIS ~~~~~~~~~~
+MeshOptimizer::CacheStats MeshOptimizer::analyzeVertexCache(const QVector<Face>& faces, int vertexCount, int cacheSize) {
+	// Timestamp each vertex entered the cache; it's still cached while within cacheSize misses
+	QVector<int> cachedAt(vertexCount, -cacheSize - 1);
+	QVector<bool> used(vertexCount, false);
+	int misses = 0;
+	for (const Face& face : faces) {
+		for (int jj = 0; jj < 3; ++jj) {
+			const unsigned int v = face[jj];
+			if (misses - cachedAt[v] > cacheSize) {
+				cachedAt[v] = misses;
+				++misses;
+			}
+			used[v] = true;
+		}
+	}
+
+	const int usedCount = int(std::count(used.begin(), used.end(), true));
+	CacheStats stats;
+	stats.acmr = faces.isEmpty() ? 0.0f : float(misses) / faces.size();
+	stats.atvr = usedCount == 0 ? 0.0f : float(misses) / usedCount;
+	return stats;
+}
+
+// ~~~~~~~~~~ VERTEX CACHE ~~~~~~~~~~
+// Scoring from "Linear-Speed Vertex Cache Optimisation", Tom Forsyth, 2006
+static const int CACHE_SIZE = 32;
+static const int MAX_VALENCE = 32;
+static const float CACHE_DECAY_POWER = 1.5f;
+static const float LAST_TRIANGLE_SCORE = 0.75f;
+static const float VALENCE_BOOST_SCALE = 2.0f;
+static const float VALENCE_BOOST_POWER = 0.5f;
+
+static float cacheScore(int position) {
+	if (position < 0) {
+		return 0.0f;
+	}
+	// The last triangle's vertices score the same, so its winding doesn't matter
+	if (position < 3) {
+		return LAST_TRIANGLE_SCORE;
+	}
+	const float scaler = 1.0f / (CACHE_SIZE - 3);
+	return std::pow(1.0f - (position - 3) * scaler, CACHE_DECAY_POWER);
+}
+
+static float valenceScore(int remaining) {
+	// Favor vertices with few triangles left, so they get finished and leave the cache
+	return remaining == 0 ? 0.0f : VALENCE_BOOST_SCALE * std::pow(float(remaining), -VALENCE_BOOST_POWER);
+}
+
+void MeshOptimizer::optimizeVertexCache(QVector<Face>& faces, int vertexCount) {
+	const int faceCount = faces.size();
+	if (faceCount == 0) {
+		return;
+	}
+
+	// Score tables
+	float cacheScores[CACHE_SIZE];
+	for (int ii = 0; ii < CACHE_SIZE; ++ii) {
+		cacheScores[ii] = cacheScore(ii);
+	}
+	float valenceScores[MAX_VALENCE + 1];
+	for (int ii = 0; ii <= MAX_VALENCE; ++ii) {
+		valenceScores[ii] = valenceScore(ii);
+	}
+	auto vertexScore = [&](int position, int remaining) -> float {
+		return (position >= 0 ? cacheScores[position] : 0.0f) + valenceScores[qMin(remaining, MAX_VALENCE)];
+	};
+
+	// Triangles around each vertex; each vertex's list shrinks as its triangles are emitted
+	QVector<int> remaining(vertexCount, 0);
+	for (const Face& face : faces) {
+		for (int jj = 0; jj < 3; ++jj) {
+			++remaining[face[jj]];
+		}
+	}
+	QVector<int> adjacencyOffsets(vertexCount + 1, 0);
+	for (int v = 0; v < vertexCount; ++v) {
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + remaining[v];
+	}
+	QVector<int> adjacency(adjacencyOffsets[vertexCount]);
+	{
+		QVector<int> fill = adjacencyOffsets;
+		for (int t = 0; t < faceCount; ++t) {
+			for (int jj = 0; jj < 3; ++jj) {
+				adjacency[fill[faces[t][jj]]++] = t;
+			}
+		}
+	}
+
+	QVector<int> cachePosition(vertexCount, -1);
+	QVector<float> vertexScores(vertexCount);
+	for (int v = 0; v < vertexCount; ++v) {
+		vertexScores[v] = vertexScore(-1, remaining[v]);
+	}
+	QVector<float> triangleScores(faceCount);
+	for (int t = 0; t < faceCount; ++t) {
+		triangleScores[t] = vertexScores[faces[t].a] + vertexScores[faces[t].b] + vertexScores[faces[t].c];
+	}
+	QVector<bool> emitted(faceCount, false);
+
+	// LRU cache, with room for the 3 vertices pushed in before the overflow is dropped
+	int cache[CACHE_SIZE + 3];
+	int cacheCount = 0;
+
+	QVector<Face> result;
+	result.reserve(faceCount);
+	int bestTriangle = 0;
+	int inputCursor = 0;
+	while (result.size() < faceCount) {
+		if (bestTriangle < 0) {
+			// Nothing in the cache has triangles left; continue with the next unused one
+			while (emitted[inputCursor]) {
+				++inputCursor;
+			}
+			bestTriangle = inputCursor;
+		}
+
+		const Face face = faces[bestTriangle];
+		result << face;
+		emitted[bestTriangle] = true;
+
+		// Take the triangle off its vertices' lists
+		for (int jj = 0; jj < 3; ++jj) {
+			const int v = face[jj];
+			int* begin = adjacency.data() + adjacencyOffsets[v];
+			int* end = begin + remaining[v];
+			int* it = std::find(begin, end, bestTriangle);
+			*it = *(end - 1);
+			--remaining[v];
+		}
+
+		// Move its vertices to the front of the cache
+		int newCache[CACHE_SIZE + 3];
+		int newCount = 0;
+		for (int jj = 0; jj < 3; ++jj) {
+			// Degenerate triangles repeat a vertex
+			if (std::find(newCache, newCache + newCount, int(face[jj])) == newCache + newCount) {
+				newCache[newCount++] = face[jj];
+			}
+		}
+		for (int ii = 0; ii < cacheCount; ++ii) {
+			const int v = cache[ii];
+			if (v != int(face.a) && v != int(face.b) && v != int(face.c)) {
+				newCache[newCount++] = v;
+			}
+		}
+
+		// Rescore every vertex whose position changed, including those pushed out,
+		// and the triangles around them, keeping the best for the next step
+		bestTriangle = -1;
+		float bestScore = -1.0f;
+		for (int ii = 0; ii < newCount; ++ii) {
+			const int v = newCache[ii];
+			const int position = ii < CACHE_SIZE ? ii : -1;
+			cachePosition[v] = position;
+			const float score = vertexScore(position, remaining[v]);
+			const float delta = score - vertexScores[v];
+			vertexScores[v] = score;
+
+			const int* adjacent = adjacency.constData() + adjacencyOffsets[v];
+			for (int kk = 0; kk < remaining[v]; ++kk) {
+				const int t = adjacent[kk];
+				triangleScores[t] += delta;
+				if (position >= 0 && triangleScores[t] > bestScore) {
+					bestScore = triangleScores[t];
+					bestTriangle = t;
+				}
+			}
+		}
+		cacheCount = qMin(newCount, CACHE_SIZE);
+		std::copy(newCache, newCache + cacheCount, cache);
+	}
+
+	faces = result;
+}
+
+// ~~~~~~~~~~ OVERDRAW ~~~~~~~~~~
+// FIFO cache misses for one triangle, using timestamps as in analyzeVertexCache
+static int cacheMisses(const Face& face, QVector<int>& cachedAt, int& time, int cacheSize) {
+	int misses = 0;
+	for (int jj = 0; jj < 3; ++jj) {
+		const unsigned int v = face[jj];
+		if (time - cachedAt[v] > cacheSize) {
+			cachedAt[v] = time;
+			++time;
+			++misses;
+		}
+	}
+	return misses;
+}
+
+void MeshOptimizer::optimizeOverdraw(QVector<Face>& faces, const QVector<Vertex>& vertices, float threshold) {
+	// Based on "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw",
+	// Sander, Nehab and Barczak, 2007
+	const int faceCount = faces.size();
+	const int cacheSize = 16;
+	if (faceCount == 0) {
+		return;
+	}
+
+	// Hard boundaries: where the cache starts over, so moving clusters costs no extra misses
+	QVector<int> hardBoundaries;
+	{
+		QVector<int> cachedAt(vertices.size(), -cacheSize - 1);
+		int time = 0;
+		for (int t = 0; t < faceCount; ++t) {
+			if (cacheMisses(faces[t], cachedAt, time, cacheSize) == 3) {
+				hardBoundaries << t;
+			}
+		}
+		if (hardBoundaries.isEmpty() || hardBoundaries[0] != 0) {
+			hardBoundaries.prepend(0);
+		}
+		hardBoundaries << faceCount;
+	}
+
+	// Soft boundaries: split each hard cluster where its cache efficiency so far is
+	// already within threshold of the whole cluster's
+	QVector<int> clusters;
+	QVector<int> cachedAt(vertices.size(), -cacheSize - 1);
+	int time = 0;
+	for (int h = 0; h + 1 < hardBoundaries.size(); ++h) {
+		const int start = hardBoundaries[h];
+		const int end = hardBoundaries[h + 1];
+
+		time += cacheSize + 1;
+		int clusterMisses = 0;
+		for (int t = start; t < end; ++t) {
+			clusterMisses += cacheMisses(faces[t], cachedAt, time, cacheSize);
+		}
+		const float clusterThreshold = threshold * float(clusterMisses) / (end - start);
+
+		clusters << start;
+		time += cacheSize + 1;
+		int runningMisses = 0;
+		int runningFaces = 0;
+		for (int t = start; t < end; ++t) {
+			runningMisses += cacheMisses(faces[t], cachedAt, time, cacheSize);
+			++runningFaces;
+			if (t + 1 < end && float(runningMisses) / runningFaces <= clusterThreshold) {
+				clusters << t + 1;
+				time += cacheSize + 1;
+				runningMisses = 0;
+				runningFaces = 0;
+			}
+		}
+	}
+	clusters << faceCount;
+
+	// Area weighted centroid and normal of the mesh and each cluster
+	struct Cluster {
+		int start;
+		int end;
+		float sortKey;
+	};
+	auto accumulate = [&](int start, int end, QVector3D& centroid, QVector3D& normal) {
+		float area = 0.0f;
+		centroid = QVector3D();
+		normal = QVector3D();
+		for (int t = start; t < end; ++t) {
+			const Vec3& p0 = vertices[faces[t].a].position;
+			const Vec3& p1 = vertices[faces[t].b].position;
+			const Vec3& p2 = vertices[faces[t].c].position;
+			const QVector3D a(p0.x, p0.y, p0.z), b(p1.x, p1.y, p1.z), c(p2.x, p2.y, p2.z);
+			const QVector3D cross = QVector3D::crossProduct(b - a, c - a);
+			const float triangleArea = cross.length();
+			centroid += (a + b + c) * (triangleArea / 3.0f);
+			normal += cross;
+			area += triangleArea;
+		}
+		if (area > 0.0f) {
+			centroid /= area;
+		}
+		normal.normalize();
+	};
+
+	QVector3D meshCentroid, meshNormal;
+	accumulate(0, faceCount, meshCentroid, meshNormal);
+
+	QVector<Cluster> sorted;
+	sorted.reserve(clusters.size() - 1);
+	for (int c = 0; c + 1 < clusters.size(); ++c) {
+		QVector3D centroid, normal;
+		accumulate(clusters[c], clusters[c + 1], centroid, normal);
+		// Clusters facing away from the middle of the mesh tend to be in front of it
+		sorted << Cluster{ clusters[c], clusters[c + 1], QVector3D::dotProduct(centroid - meshCentroid, normal) };
+	}
+	std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& lhs, const Cluster& rhs) {
+		return lhs.sortKey > rhs.sortKey;
+	});
+
+	QVector<Face> result;
+	result.reserve(faceCount);
+	for (const Cluster& cluster : sorted) {
+		for (int t = cluster.start; t < cluster.end; ++t) {
+			result << faces[t];
+		}
+	}
+	faces = result;
+}
+
+// ~~~~~~~~~~ VERTEX FETCH ~~~~~~~~~~
+void MeshOptimizer::optimizeVertexFetch(QVector<Vertex>& vertices, QVector<Face>& faces) {
+	QVector<int> remap(vertices.size(), -1);
+	QVector<Vertex> result;
+	result.reserve(vertices.size());
+	for (Face& face : faces) {
+		for (int jj = 0; jj < 3; ++jj) {
+			int& index = remap[face[jj]];
+			if (index < 0) {
+				index = result.size();
+				result << vertices[face[jj]];
+			}
+			face[jj] = index;
+		}
+	}
+	vertices = result;
+}
+
+void MeshOptimizer::optimize(QVector<Vertex>& vertices, QVector<Face>& faces) {
+	optimizeVertexCache(faces, vertices.size());
+	optimizeOverdraw(faces, vertices);
+	optimizeVertexFetch(vertices, faces);
+}
@@ -0,0 +1,33 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include "Structs.h"
+
+// Reorders a mesh's triangles and vertices for the GPU without changing what it draws:
+// triangles for the post-transform vertex cache and then for less overdraw, and
+// vertices into the order the triangles first use them.
+class MeshOptimizer {
+public:
+	// Post-transform cache efficiency, simulated with a FIFO cache like most GPUs use.
+	// ACMR is vertex shader runs per triangle (0.5 at best, 3 at worst), ATVR is runs
+	// per unique vertex (1 at best).
+	struct CacheStats {
+		float acmr;
+		float atvr;
+	};
+	static CacheStats analyzeVertexCache(const QVector<Face>& faces, int vertexCount, int cacheSize = 16);
+
+	// Tom Forsyth's linear-speed vertex cache optimization
+	static void optimizeVertexCache(QVector<Face>& faces, int vertexCount);
+	// Split cache-optimized triangles into clusters, keeping the cache efficiency within
+	// threshold of the original, and draw outward-facing clusters first so they occlude the rest
+	static void optimizeOverdraw(QVector<Face>& faces, const QVector<Vertex>& vertices, float threshold = 1.05f);
+	// Renumber vertices in order of first use so fetches walk memory linearly.
+	// Vertices no triangle uses are dropped.
+	static void optimizeVertexFetch(QVector<Vertex>& vertices, QVector<Face>& faces);
+
+	// All three, in order
+	static void optimize(QVector<Vertex>& vertices, QVector<Face>& faces);
+};
+
+#endif
@@ -0,0 +1,483 @@
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Seam and border edges get a quadric for the plane through the edge, perpendicular to its
+// triangle, so collapses can slide along them but not pull them in. Weighted well above the
+// triangles so silhouettes and UV seams hold their shape.
+static const double BORDER_WEIGHT = 10.0;
+// Reject collapses that turn a triangle more than ~75 degrees
+static const double FLIP_COSINE = 0.25;
+// Worst error (as a fraction of the mesh's size) a generated level may have
+static const float MAX_LOD_ERROR = 0.1f;
+// Stop generating levels once a level keeps more than this much of the one before
+static const float MIN_LOD_REDUCTION = 0.8f;
+static const quint32 LOD_FILE_MAGIC = 0x31444f4c;	// "LOD1"
+
+static inline Vec3 cross(const Vec3& a, const Vec3& b) {
+	return Vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+static inline double dot(const Vec3& a, const Vec3& b) {
+	return double(a.x) * b.x + double(a.y) * b.y + double(a.z) * b.z;
+}
+
+static inline quint64 edgeKey(unsigned int a, unsigned int b) {
+	return a < b ? (quint64(a) << 32) | b : (quint64(b) << 32) | a;
+}
+
+// ~~~~~~~~~~ QUADRICS ~~~~~~~~~~
+// Sum of weighted squared distances to a set of planes, as a symmetric 4x4 matrix
+struct Quadric {
+	double a00, a01, a02, a11, a12, a22;
+	double b0, b1, b2;
+	double c;
+	double weight;
+
+	Quadric() : a00(0), a01(0), a02(0), a11(0), a12(0), a22(0), b0(0), b1(0), b2(0), c(0), weight(0) {}
+
+	// The plane dot(normal, p) + d = 0, normal being unit length
+	Quadric(const Vec3& normal, double d, double w) :
+		a00(w * normal.x * normal.x), a01(w * normal.x * normal.y), a02(w * normal.x * normal.z),
+		a11(w * normal.y * normal.y), a12(w * normal.y * normal.z), a22(w * normal.z * normal.z),
+		b0(w * normal.x * d), b1(w * normal.y * d), b2(w * normal.z * d),
+		c(w * d * d), weight(w) {}
+
+	Quadric& operator+=(const Quadric& o) {
+		a00 += o.a00; a01 += o.a01; a02 += o.a02;
+		a11 += o.a11; a12 += o.a12; a22 += o.a22;
+		b0 += o.b0; b1 += o.b1; b2 += o.b2;
+		c += o.c;
+		weight += o.weight;
+		return *this;
+	}
+
+	Quadric operator+(const Quadric& o) const {
+		Quadric sum = *this;
+		sum += o;
+		return sum;
+	}
+
+	// Mean squared distance from p to the planes
+	double error(const Vec3& p) const {
+		const double x = p.x, y = p.y, z = p.z;
+		const double e =
+			a00 * x * x + a11 * y * y + a22 * z * z +
+			2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+			2.0 * (b0 * x + b1 * y + b2 * z) + c;
+		return weight > 0.0 ? std::fabs(e) / weight : 0.0;
+	}
+};
+
+// ~~~~~~~~~~ SIMPLIFICATION ~~~~~~~~~~
+enum VertexKind {
+	MANIFOLD,	// Interior, one set of attributes; collapses anywhere
+	BORDER,		// On an open edge of the mesh; collapses along it
+	SEAM,		// One of two copies on a UV or normal seam; collapses along it with its twin
+	LOCKED		// Corners, non-manifold and many-way seams; never moves
+};
+
+QVector<Face> MeshSimplifier::simplify(const QVector<Vertex>& vertices, const QVector<Face>& faces, int targetFaceCount, float targetError, float* resultError) {
+	QVector<Face> result = faces;
+	const int vertexCount = vertices.size();
+	if (resultError) {
+		*resultError = 0.0f;
+	}
+	if (result.size() <= targetFaceCount || vertexCount == 0) {
+		return result;
+	}
+
+	// Vertices at the same position share an id, so seams can find their twins
+	QVector<int> order(vertexCount);
+	for (int ii = 0; ii < vertexCount; ++ii) {
+		order[ii] = ii;
+	}
+	std::sort(order.begin(), order.end(), [&vertices](int a, int b) {
+		const Vec3& pa = vertices[a].position;
+		const Vec3& pb = vertices[b].position;
+		return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z;
+	});
+	QVector<int> positionId(vertexCount);
+	int positionCount = 0;
+	for (int ii = 0; ii < vertexCount; ++ii) {
+		if (ii > 0 && !(vertices[order[ii]].position == vertices[order[ii - 1]].position)) {
+			++positionCount;
+		}
+		positionId[order[ii]] = positionCount;
+	}
+	++positionCount;
+
+	// Errors are relative to the mesh's size
+	Vec3 boundsMin = vertices[0].position;
+	Vec3 boundsMax = vertices[0].position;
+	for (const Vertex& vertex : vertices) {
+		for (int ii = 0; ii < 3; ++ii) {
+			boundsMin[ii] = qMin(boundsMin[ii], vertex.position[ii]);
+			boundsMax[ii] = qMax(boundsMax[ii], vertex.position[ii]);
+		}
+	}
+	const Vec3 extent = boundsMax - boundsMin;
+	const double scale = qMax(qMax(extent.x, extent.y), qMax(extent.z, 1e-6f));
+	const double maxCost = double(targetError) * targetError * scale * scale;
+
+	// Quadrics of the planes around each vertex, plus its open edges
+	QVector<Quadric> quadrics(vertexCount);
+	QHash<quint64, int> edgeUses;
+	edgeUses.reserve(result.size() * 3);
+	for (const Face& face : result) {
+		for (int jj = 0; jj < 3; ++jj) {
+			++edgeUses[edgeKey(face[jj], face[(jj + 1) % 3])];
+		}
+	}
+	for (const Face& face : result) {
+		const Vec3& p0 = vertices[face.a].position;
+		Vec3 normal = cross(vertices[face.b].position - p0, vertices[face.c].position - p0);
+		const float doubleArea = normal.length();
+		if (doubleArea == 0.0f) {
+			continue;
+		}
+		normal = Vec3(normal.x / doubleArea, normal.y / doubleArea, normal.z / doubleArea);
+		const Quadric plane(normal, -dot(normal, p0), 0.5 * doubleArea);
+		for (int jj = 0; jj < 3; ++jj) {
+			quadrics[face[jj]] += plane;
+		}
+
+		for (int jj = 0; jj < 3; ++jj) {
+			const unsigned int a = face[jj];
+			const unsigned int b = face[(jj + 1) % 3];
+			if (edgeUses.value(edgeKey(a, b)) != 1) {
+				continue;
+			}
+			const Vec3 edge = vertices[b].position - vertices[a].position;
+			const Vec3 edgeNormal = cross(edge, normal).normalized();
+			const double edgeLength = edge.length();
+			const Quadric edgePlane(edgeNormal, -dot(edgeNormal, vertices[a].position), BORDER_WEIGHT * edgeLength * edgeLength);
+			quadrics[a] += edgePlane;
+			quadrics[b] += edgePlane;
+		}
+	}
+
+	QVector<unsigned int> remap(vertexCount);
+	QVector<char> kind(vertexCount);
+	QVector<char> touched(vertexCount);
+	QVector<int> twin(vertexCount);
+	QVector<int> wedgeFirst(positionCount);
+	QVector<int> wedgeSize(positionCount);
+	QVector<int> openEdges(vertexCount);
+	QVector<int> faceStart(vertexCount + 1);
+	QVector<int> faceList;
+	QVector<double> bestCost(vertexCount);
+	QVector<int> bestTo(vertexCount);
+	QVector<int> bestTwinFrom(vertexCount);
+	QVector<int> bestTwinTo(vertexCount);
+	double reached = 0.0;
+
+	while (result.size() > targetFaceCount) {
+		const int faceCount = result.size();
+
+		// Topology of what's left
+		edgeUses.clear();
+		for (const Face& face : result) {
+			for (int jj = 0; jj < 3; ++jj) {
+				++edgeUses[edgeKey(face[jj], face[(jj + 1) % 3])];
+			}
+		}
+		openEdges.fill(0);
+		kind.fill(char(LOCKED));
+		for (auto it = edgeUses.constBegin(); it != edgeUses.constEnd(); ++it) {
+			const unsigned int a = static_cast<unsigned int>(it.key() >> 32);
+			const unsigned int b = static_cast<unsigned int>(it.key() & 0xffffffffu);
+			// Edges shared by three or more triangles lock both ends
+			const int weight = it.value() == 1 ? 1 : it.value() == 2 ? 0 : 1000;
+			openEdges[a] += weight;
+			openEdges[b] += weight;
+		}
+
+		// Faces around each vertex, and the live copies of each position
+		faceStart.fill(0);
+		wedgeFirst.fill(-1);
+		wedgeSize.fill(0);
+		for (const Face& face : result) {
+			for (int jj = 0; jj < 3; ++jj) {
+				++faceStart[face[jj] + 1];
+			}
+		}
+		for (int ii = 0; ii < vertexCount; ++ii) {
+			if (faceStart[ii + 1] > 0) {
+				const int id = positionId[ii];
+				twin[ii] = wedgeFirst[id];
+				if (wedgeFirst[id] >= 0) {
+					twin[wedgeFirst[id]] = ii;
+				}
+				else {
+					wedgeFirst[id] = ii;
+				}
+				++wedgeSize[id];
+			}
+			faceStart[ii + 1] += faceStart[ii];
+		}
+		faceList.resize(faceCount * 3);
+		QVector<int> cursor = faceStart;
+		for (int ii = 0; ii < faceCount; ++ii) {
+			for (int jj = 0; jj < 3; ++jj) {
+				faceList[cursor[result[ii][jj]]++] = ii;
+			}
+		}
+		for (int ii = 0; ii < vertexCount; ++ii) {
+			if (faceStart[ii + 1] == faceStart[ii]) {
+				continue;
+			}
+			const int copies = wedgeSize[positionId[ii]];
+			if (copies == 1) {
+				kind[ii] = char(openEdges[ii] == 0 ? MANIFOLD : openEdges[ii] == 2 ? BORDER : LOCKED);
+			}
+			else if (copies == 2 && openEdges[ii] == 2) {
+				kind[ii] = char(SEAM);
+			}
+		}
+
+		// Along a seam, the twin's matching edge ends at the same position as this one
+		auto twinTarget = [&](int v, int u) {
+			const int twinV = twin[v];
+			for (int kk = faceStart[twinV]; kk < faceStart[twinV + 1]; ++kk) {
+				const Face& face = result[faceList[kk]];
+				for (int jj = 0; jj < 3; ++jj) {
+					const int w = int(face[jj]);
+					if (positionId[w] == positionId[u] && edgeUses.value(edgeKey(twinV, w)) == 1) {
+						return w;
+					}
+				}
+			}
+			return -1;
+		};
+
+		// Cheapest allowed collapse out of each vertex
+		bestCost.fill(std::numeric_limits<double>::max());
+		bestTo.fill(-1);
+		for (const Face& face : result) {
+			for (int jj = 0; jj < 3; ++jj) {
+				const int v = int(face[jj]);
+				if (kind[v] == LOCKED) {
+					continue;
+				}
+				for (int kk = 1; kk < 3; ++kk) {
+					const int u = int(face[(jj + kk) % 3]);
+					if (u == v || positionId[u] == positionId[v]) {
+						continue;
+					}
+					int twinFrom = -1;
+					int twinTo = -1;
+					if (kind[v] != MANIFOLD && edgeUses.value(edgeKey(v, u)) != 1) {
+						continue;
+					}
+					if (kind[v] == SEAM) {
+						twinFrom = twin[v];
+						twinTo = twinTarget(v, u);
+						if (twinTo < 0) {
+							continue;
+						}
+					}
+					double cost = (quadrics[v] + quadrics[u]).error(vertices[u].position);
+					if (twinFrom >= 0) {
+						cost += (quadrics[twinFrom] + quadrics[twinTo]).error(vertices[twinTo].position);
+					}
+					if (cost < bestCost[v]) {
+						bestCost[v] = cost;
+						bestTo[v] = u;
+						bestTwinFrom[v] = twinFrom;
+						bestTwinTo[v] = twinTo;
+					}
+				}
+			}
+		}
+
+		QVector<int> candidates;
+		for (int ii = 0; ii < vertexCount; ++ii) {
+			if (bestTo[ii] >= 0 && bestCost[ii] <= maxCost) {
+				candidates << ii;
+			}
+		}
+		std::sort(candidates.begin(), candidates.end(), [&bestCost](int a, int b) { return bestCost[a] < bestCost[b]; });
+
+		// Would moving v onto u flip or crush any triangle that survives the collapse?
+		auto flips = [&](int v, int u) {
+			const Vec3& target = vertices[u].position;
+			for (int kk = faceStart[v]; kk < faceStart[v + 1]; ++kk) {
+				const Face& face = result[faceList[kk]];
+				if (int(face.a) == u || int(face.b) == u || int(face.c) == u) {
+					continue;
+				}
+				Vec3 corners[3];
+				Vec3 moved[3];
+				for (int jj = 0; jj < 3; ++jj) {
+					corners[jj] = vertices[face[jj]].position;
+					moved[jj] = int(face[jj]) == v ? target : corners[jj];
+				}
+				const Vec3 before = cross(corners[1] - corners[0], corners[2] - corners[0]);
+				const Vec3 after = cross(moved[1] - moved[0], moved[2] - moved[0]);
+				const double afterLength = after.length();
+				if (afterLength == 0.0 || dot(before, after) < FLIP_COSINE * before.length() * afterLength) {
+					return true;
+				}
+			}
+			return false;
+		};
+		auto removedFaces = [&](int v, int u) {
+			int count = 0;
+			for (int kk = faceStart[v]; kk < faceStart[v + 1]; ++kk) {
+				const Face& face = result[faceList[kk]];
+				count += int(face.a) == u || int(face.b) == u || int(face.c) == u;
+			}
+			return count;
+		};
+		auto touch = [&](int v) {
+			for (int kk = faceStart[v]; kk < faceStart[v + 1]; ++kk) {
+				const Face& face = result[faceList[kk]];
+				touched[face.a] = touched[face.b] = touched[face.c] = 1;
+			}
+		};
+
+		// Collapse cheapest first. A collapse changes the triangles around it, so anything
+		// next to one waits for the next pass.
+		for (int ii = 0; ii < vertexCount; ++ii) {
+			remap[ii] = ii;
+		}
+		touched.fill(0);
+		int remaining = faceCount;
+		int collapses = 0;
+		for (int v : candidates) {
+			if (remaining <= targetFaceCount) {
+				break;
+			}
+			const int u = bestTo[v];
+			const int twinFrom = bestTwinFrom[v];
+			const int twinTo = bestTwinTo[v];
+			if (touched[v] || touched[u] || (twinFrom >= 0 && (touched[twinFrom] || touched[twinTo]))) {
+				continue;
+			}
+			if (flips(v, u) || (twinFrom >= 0 && flips(twinFrom, twinTo))) {
+				continue;
+			}
+
+			remaining -= removedFaces(v, u);
+			touch(v);
+			remap[v] = u;
+			quadrics[u] += quadrics[v];
+			if (twinFrom >= 0) {
+				remaining -= removedFaces(twinFrom, twinTo);
+				touch(twinFrom);
+				remap[twinFrom] = twinTo;
+				quadrics[twinTo] += quadrics[twinFrom];
+			}
+			reached = qMax(reached, bestCost[v]);
+			++collapses;
+		}
+		if (collapses == 0) {
+			break;
+		}
+
+		// Drop the triangles the collapses crushed
+		QVector<Face> next;
+		next.reserve(remaining);
+		for (const Face& face : result) {
+			const Face moved(remap[face.a], remap[face.b], remap[face.c]);
+			if (moved.a != moved.b && moved.b != moved.c && moved.a != moved.c) {
+				next << moved;
+			}
+		}
+		result.swap(next);
+	}
+
+	if (resultError) {
+		*resultError = float(std::sqrt(reached) / scale);
+	}
+	return result;
+}
+
+QVector<MeshLod> MeshSimplifier::generateLods(const QVector<Vertex>& vertices, const QVector<Face>& faces, int maxLevels) {
+	QVector<MeshLod> lods;
+	lods << MeshLod(faces, 0.0f);
+	// Simplify the full mesh each time, so each level's error is measured against it
+	for (int level = 1; level < maxLevels; ++level) {
+		const int previousCount = lods.last().faces.size();
+		float error = 0.0f;
+		QVector<Face> simplified = simplify(vertices, faces, faces.size() >> level, MAX_LOD_ERROR, &error);
+		if (simplified.size() > previousCount * MIN_LOD_REDUCTION) {
+			break;
+		}
+		MeshOptimizer::optimizeVertexCache(simplified, vertices.size());
+		lods << MeshLod(simplified, error);
+	}
+	return lods;
+}
+
+// ~~~~~~~~~~ OFFLINE CACHE ~~~~~~~~~~
+QString MeshSimplifier::lodPath(const QString& objPath) {
+	const QFileInfo info(objPath);
+	return info.path() + "/" + info.completeBaseName() + ".lod";
+}
+
+bool MeshSimplifier::saveLods(const QString& path, const QVector<MeshLod>& lods) {
+	QFile file(path);
+	if (!file.open(QIODevice::WriteOnly)) {
+		qDebug() << "Could not write" << path;
+		return false;
+	}
+	QDataStream out(&file);
+	out << LOD_FILE_MAGIC << quint32(lods.size());
+	for (const MeshLod& lod : lods) {
+		out << lod.error << quint32(lod.faces.size());
+		out.writeRawData(reinterpret_cast<const char*>(lod.faces.constData()), lod.faces.size() * int(sizeof(Face)));
+	}
+	return out.status() == QDataStream::Ok;
+}
+
+bool MeshSimplifier::loadLods(const QString& path, const QString& objPath, const QVector<Face>& faces, QVector<MeshLod>& lods) {
+	const QFileInfo info(path);
+	if (!info.exists() || info.lastModified() < QFileInfo(objPath).lastModified()) {
+		return false;
+	}
+	QFile file(path);
+	if (!file.open(QIODevice::ReadOnly)) {
+		return false;
+	}
+	QDataStream in(&file);
+	quint32 magic = 0;
+	quint32 levelCount = 0;
+	in >> magic >> levelCount;
+	if (magic != LOD_FILE_MAGIC || levelCount == 0 || levelCount > 16) {
+		return false;
+	}
+
+	unsigned int maxIndex = 0;
+	for (const Face& face : faces) {
+		maxIndex = qMax(maxIndex, qMax(face.a, qMax(face.b, face.c)));
+	}
+	QVector<MeshLod> loaded(static_cast<int>(levelCount));
+	for (MeshLod& lod : loaded) {
+		quint32 faceCount = 0;
+		in >> lod.error >> faceCount;
+		if (in.status() != QDataStream::Ok || faceCount > quint32(faces.size())) {
+			return false;
+		}
+		lod.faces.resize(int(faceCount));
+		const int bytes = int(faceCount * sizeof(Face));
+		if (in.readRawData(reinterpret_cast<char*>(lod.faces.data()), bytes) != bytes) {
+			return false;
+		}
+		for (const Face& face : lod.faces) {
+			if (qMax(face.a, qMax(face.b, face.c)) > maxIndex) {
+				return false;
+			}
+		}
+	}
+	// Written for a different parse or optimization of the mesh
+	if (loaded[0].faces != faces) {
+		return false;
+	}
+	lods = loaded;
+	return true;
+}
@@ -0,0 +1,30 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include "Structs.h"
+
+// Builds levels of detail by collapsing edges in order of quadric error (Garland and
+// Heckbert, "Surface Simplification Using Quadric Error Metrics", 1997).
+// Collapses only ever move a vertex onto one of its neighbors, so every level indexes the
+// original vertex buffer and keeps its texture coordinates, normals and tangents.
+// Vertices on a UV or normal seam only collapse along the seam, together with their
+// twin on the other side, so seams never tear open.
+class MeshSimplifier {
+public:
+	// Collapse edges until at most targetFaceCount triangles are left, or until the next
+	// collapse would move the surface further than targetError (a fraction of the mesh's
+	// size). The error actually reached is written to resultError.
+	static QVector<Face> simplify(const QVector<Vertex>& vertices, const QVector<Face>& faces, int targetFaceCount, float targetError, float* resultError = nullptr);
+
+	// The full mesh followed by levels of roughly half the triangles of the one before,
+	// each optimized for the vertex cache. Stops early once the mesh won't simplify further.
+	static QVector<MeshLod> generateLods(const QVector<Vertex>& vertices, const QVector<Face>& faces, int maxLevels = 4);
+
+	// Offline LODs, stored next to the .obj. A cache only loads if it's newer than the .obj
+	// and its first level matches faces, so a stale file is regenerated rather than used.
+	static bool saveLods(const QString& path, const QVector<MeshLod>& lods);
+	static bool loadLods(const QString& path, const QString& objPath, const QVector<Face>& faces, QVector<MeshLod>& lods);
+	static QString lodPath(const QString& objPath);
+};
+
+#endif
@@ -1,51 +1,9 @@
 #include "OBJLoader.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "TangentSpace.h"
 #include <fstream>
 
-QVector<Vec3> getFaceTangents(const QVector<Face>& faces, const QVector<Vertex>& vertices) {
-	QVector<Vec3> tangents(faces.size());
-	for (int ii = 0; ii < faces.size(); ++ii) {
-		Face face = faces[ii];
-
-		Vertex v1 = vertices[face.a];
-		Vertex v2 = vertices[face.b];
-		Vertex v3 = vertices[face.c];
-
-		Vec3 edge1 = v2.position - v1.position;
-		Vec3 edge2 = v3.position - v1.position;
-
-		Vec2 deltaUV1 = v2.texCoord - v1.texCoord;
-		Vec2 deltaUV2 = v3.texCoord - v1.texCoord;
-
-		float f = 1.0f / (deltaUV1.u * deltaUV2.v - deltaUV2.u * deltaUV1.v);
-
-		Vec3 tangent;
-		tangent.x = f * (deltaUV2.v * edge1.x - deltaUV1.v * edge2.x);
-		tangent.y = f * (deltaUV2.v * edge1.y - deltaUV1.v * edge2.y);
-		tangent.z = f * (deltaUV2.v * edge1.z - deltaUV1.v * edge2.z);
-		tangent.normalize();
-
-		tangents[ii] = tangent;
-	}
-
-	return tangents;
-}
-
-void setVertexTangents(const QVector<Vec3> faceTangents, const QVector<Face>& faces, QVector<Vertex>& vertices) {
-	// Calculate cumulative tangents for each vertex
-	// Don't need to average because we normalize it anyway
-	for (int ii = 0; ii < faces.size(); ++ii) {
-		Face face = faces[ii];
-		for (int jj = 0; jj < 3; ++jj) {
-			vertices[face[jj]].tangent += faceTangents[ii];
-		}
-	}
-	
-	// Normalize each vertex's tangent
-	for (Vertex& vert : vertices) {
-		vert.tangent.normalize();
-	}
-}
-
 bool OBJLoader::isOBJFile(QString filePath) {
 	// find last occurence of a period in the string, so we can get the file extension
 	return filePath.contains(".obj");
@@ -92,11 +50,16 @@ void loadFace(const QStringList& line, const QVector<Vec3>& positions, const QVe
 		QString str = line[ii];
 		QStringList indices = str.split('/');
 
-		// Construct vertex and add to list of vertices if it is unique
+		// Construct vertex and add to list of vertices if it is unique.
+		// Texture coords and normals are optional, as in "1//1".
 		Vertex vert;
 		vert.position = positions[indices[0].toUInt() - 1];
-		vert.texCoord = texCoords[indices[1].toUInt() - 1];
-		vert.normal = normals[indices[2].toUInt() - 1];
+		if (indices.size() > 1 && !indices[1].isEmpty()) {
+			vert.texCoord = texCoords[indices[1].toUInt() - 1];
+		}
+		if (indices.size() > 2 && !indices[2].isEmpty()) {
+			vert.normal = normals[indices[2].toUInt() - 1];
+		}
 		
 		// if vertex is new, give existing index to face. otherwise, add vertex to list and give index
 		int index = vertices.indexOf(vert);
@@ -111,36 +74,40 @@ void loadFace(const QStringList& line, const QVector<Vec3>& positions, const QVe
 	faces << face;
 }
 
-Renderable* OBJLoader::loadOBJ(QString filePath) {
+bool OBJLoader::loadMesh(QString filePath, QVector<Vertex>& vertices, QVector<Face>& faces, QString& diffuseMap, QString& normalMap) {
 	// check that we have been given a .obj file
 	if (!isOBJFile(filePath)) {
 		qDebug() << "ERROR: Expected a .obj file for constructing a model, got" << filePath;
-		return nullptr;
+		return false;
 	}
 	
 	// open the file
 	QFile file(filePath);
 	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
 		qDebug() << "ERROR: Failed to open .obj file" << filePath;
-		return nullptr;
+		return false;
 	}
 	
 	// prepare textureFile
-	QString diffuseMap = "";
-	QString normalMap = "";
+	diffuseMap = "";
+	normalMap = "";
 	
 	// read positions, texture coords, and normals from the file
 	QVector<Vec3> positions;
 	QVector<Vec2> texCoords;
 	QVector<Vec3> normals;
 	// read faces from file and create list of unique vertices
-	QVector<Face> faces;
-	QVector<Vertex> vertices;
+	faces.clear();
+	vertices.clear();
 	
 	// process the file
 	QTextStream in(&file);
 	while (!in.atEnd()) {
-		QStringList line = in.readLine().split(' ');
+		// Skipping empty parts tolerates trailing and repeated spaces
+		QStringList line = in.readLine().split(' ', QString::SkipEmptyParts);
+		if (line.isEmpty()) {
+			continue;
+		}
 		
 		QString lineType = line[0];
 		if (lineType == "mtllib") {
@@ -160,10 +127,8 @@ Renderable* OBJLoader::loadOBJ(QString filePath) {
 		}
 	}
 
-	// calculate tangents (per face) after reading all file data
-	QVector<Vec3> faceTangents = getFaceTangents(faces, vertices);
-	// set vertex tangents based on all faces a vertex is part of
-	setVertexTangents(faceTangents, faces, vertices);
+	// calculate tangent frames after reading all file data
+	TangentSpace::generate(vertices, faces);
 	
 	/*
 	qDebug() << "Positions";
@@ -181,11 +146,6 @@ Renderable* OBJLoader::loadOBJ(QString filePath) {
 		qDebug() << norm.x << norm.y << norm.z;
 	}
 
-	qDebug() << "Face Tangents";
-	for (const Vec3& tan : faceTangents) {
-		qDebug() << tan.x << tan.y << tan.z;
-	}
-
 	qDebug() << "Vertex Tangents";
 	for (const Vertex& vert : vertices) {
 		qDebug() << vert.tangent.x << vert.tangent.y << vert.tangent.z;
@@ -208,8 +168,40 @@ Renderable* OBJLoader::loadOBJ(QString filePath) {
 	qDebug() << normalMap;
 	*/
 	
+	return true;
+}
+
+Renderable* OBJLoader::loadOBJ(QString filePath) {
+	QString diffuseMap;
+	QString normalMap;
+	QVector<Face> faces;
+	QVector<Vertex> vertices;
+	if (!loadMesh(filePath, vertices, faces, diffuseMap, normalMap)) {
+		return nullptr;
+	}
+
+	// Reorder for the GPU's vertex cache, overdraw and vertex fetch
+	const MeshOptimizer::CacheStats before = MeshOptimizer::analyzeVertexCache(faces, vertices.size());
+	MeshOptimizer::optimize(vertices, faces);
+	const MeshOptimizer::CacheStats after = MeshOptimizer::analyzeVertexCache(faces, vertices.size());
+	qDebug().noquote() << QString("    ACMR %1 -> %2, ATVR %3 -> %4")
+		.arg(before.acmr, 0, 'f', 3).arg(after.acmr, 0, 'f', 3)
+		.arg(before.atvr, 0, 'f', 3).arg(after.atvr, 0, 'f', 3);
+	
+	// Levels of detail, from the offline cache when it's up to date
+	QVector<MeshLod> lods;
+	const bool cached = MeshSimplifier::loadLods(MeshSimplifier::lodPath(filePath), filePath, faces, lods);
+	if (!cached) {
+		lods = MeshSimplifier::generateLods(vertices, faces, Renderable::MAX_LODS);
+	}
+	QString lodSizes;
+	for (const MeshLod& lod : lods) {
+		lodSizes += QString(" %1").arg(lod.faces.size());
+	}
+	qDebug().noquote() << QString("    LODs:%1 triangles%2").arg(lodSizes).arg(cached ? " (cached)" : "");
+	
 	Renderable* ren = new Renderable();
-	ren->init(vertices, faces, diffuseMap, normalMap);
+	ren->init(vertices, lods, diffuseMap, normalMap);
 	
 	return ren;
 }
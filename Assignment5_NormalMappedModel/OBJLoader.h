@@ -7,6 +7,9 @@ class OBJLoader {
 private:
 	static bool isOBJFile(QString filePath);
 public:
+	// Parse a .obj file (and its .mtl) into unique vertices and triangles with tangents
+	static bool loadMesh(QString filePath, QVector<Vertex>& vertices, QVector<Face>& faces, QString& diffuseMap, QString& normalMap);
+	// Load, optimize and upload a .obj file
 	static Renderable* loadOBJ(QString filePath);
 };
 
@@ -0,0 +1,306 @@
+#include "RayTracer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+// Pixels per side of the square tiles threads take
+static const int TILE_SIZE = 16;
+// Shadow rays start this far from the surface, as a fraction of the mesh's size
+static const float SHADOW_BIAS = 1e-4f;
+// glClearColor in BasicWidget
+static const float BACKGROUND = 0.1f;
+
+static inline Vec3 add(const Vec3& a, const Vec3& b) {
+	return Vec3(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
+static inline Vec3 scaled(const Vec3& a, float s) {
+	return Vec3(a.x * s, a.y * s, a.z * s);
+}
+
+static inline Vec3 multiplied(const Vec3& a, const Vec3& b) {
+	return Vec3(a.x * b.x, a.y * b.y, a.z * b.z);
+}
+
+static inline float dot(const Vec3& a, const Vec3& b) {
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline Vec3 cross(const Vec3& a, const Vec3& b) {
+	return Vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+// Corners of a face weighted by barycentrics
+static inline Vec3 interpolate(const Vec3& a, const Vec3& b, const Vec3& c, float u, float v) {
+	return add(add(scaled(a, 1.0f - u - v), scaled(b, u)), scaled(c, v));
+}
+
+static inline quint8 toByte(float value) {
+	return quint8(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+// Hand out the width by height image's tiles to threadCount threads, calling
+// tile(thread, x0, y0, x1, y1) for each, and return how long that took in ms
+template<typename Tile>
+static double forEachTile(int width, int height, int threadCount, Tile tile) {
+	const int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	const int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	std::atomic<int> nextTile(0);
+	const auto work = [&](int thread) {
+		for (int index = nextTile++; index < tilesX * tilesY; index = nextTile++) {
+			const int x0 = (index % tilesX) * TILE_SIZE;
+			const int y0 = (index / tilesX) * TILE_SIZE;
+			tile(thread, x0, y0, std::min(width, x0 + TILE_SIZE), std::min(height, y0 + TILE_SIZE));
+		}
+	};
+
+	QElapsedTimer timer;
+	timer.start();
+	std::vector<std::thread> threads;
+	for (int thread = 1; thread < threadCount; ++thread) {
+		threads.emplace_back(work, thread);
+	}
+	work(0);
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	return timer.nsecsElapsed() / 1e6;
+}
+
+RayTracer::RayTracer(const QVector<Vertex>& vertices, const QVector<Face>& faces, const Bvh& bvh) : vertices_(vertices), faces_(faces), bvh_(bvh), shadowBias_(0.0f), packetSize_(8)
+{
+	diffuseMap_.width = diffuseMap_.height = 0;
+	normalMap_.width = normalMap_.height = 0;
+	if (!bvh_.isEmpty()) {
+		const Bvh::Node& root = bvh_.nodes()[0];
+		const Vec3 extent(root.upper[0] - root.lower[0], root.upper[1] - root.lower[1], root.upper[2] - root.lower[2]);
+		shadowBias_ = extent.length() * SHADOW_BIAS;
+	}
+}
+
+void RayTracer::setLights(const QVector<PointLight>& lights)
+{
+	lights_ = lights;
+}
+
+void RayTracer::setDiffuseMap(const QImage& image)
+{
+	loadMap(image, diffuseMap_);
+}
+
+void RayTracer::setNormalMap(const QImage& image)
+{
+	loadMap(image, normalMap_);
+}
+
+void RayTracer::loadMap(const QImage& image, Map& map)
+{
+	map.width = map.height = 0;
+	map.rgb.clear();
+	if (image.isNull()) {
+		return;
+	}
+	const QImage rgb = image.convertToFormat(QImage::Format_RGB888);
+	map.width = rgb.width();
+	map.height = rgb.height();
+	map.rgb.resize(size_t(map.width) * map.height * 3);
+	for (int y = 0; y < map.height; ++y) {
+		std::copy(rgb.constScanLine(y), rgb.constScanLine(y) + map.width * 3, map.rgb.begin() + size_t(y) * map.width * 3);
+	}
+}
+
+Vec3 RayTracer::sample(const Map& map, float u, float v)
+{
+	// Texel centres sit at half texels, as in GL
+	const float x = u * map.width - 0.5f;
+	const float y = v * map.height - 0.5f;
+	const float x0 = std::floor(x);
+	const float y0 = std::floor(y);
+	const float fx = x - x0;
+	const float fy = y - y0;
+	const auto wrap = [](int value, int size) { return ((value % size) + size) % size; };
+	const int xs[2] = { wrap(int(x0), map.width), wrap(int(x0) + 1, map.width) };
+	const int ys[2] = { wrap(int(y0), map.height), wrap(int(y0) + 1, map.height) };
+	const float weights[4] = { (1.0f - fx) * (1.0f - fy), fx * (1.0f - fy), (1.0f - fx) * fy, fx * fy };
+
+	Vec3 color(0.0f, 0.0f, 0.0f);
+	for (int ii = 0; ii < 4; ++ii) {
+		const quint8* texel = map.rgb.data() + (size_t(ys[ii / 2]) * map.width + xs[ii % 2]) * 3;
+		color = add(color, scaled(Vec3(texel[0], texel[1], texel[2]), weights[ii] / 255.0f));
+	}
+	return color;
+}
+
+RayTracer::Frame::Frame(const View& view, int width, int height) : origin(view.position), width(width), height(height)
+{
+	forward = (view.lookAt - view.position).normalized();
+	right = QVector3D::crossProduct(forward, view.up).normalized();
+	up = QVector3D::crossProduct(right, forward);
+	tanHalfFov = std::tan(qDegreesToRadians(view.fov) * 0.5f);
+	aspect = float(width) / float(height);
+}
+
+Vec3 RayTracer::Frame::direction(int x, int y) const
+{
+	const float sx = (2.0f * (x + 0.5f) / width - 1.0f) * tanHalfFov * aspect;
+	const float sy = (1.0f - 2.0f * (y + 0.5f) / height) * tanHalfFov;
+	return Vec3(forward + right * sx + up * sy).normalized();
+}
+
+template<typename OnHit>
+void RayTracer::traceTile(const Frame& frame, int x0, int y0, int x1, int y1, OnHit onHit) const
+{
+	if (packetSize_ <= 1) {
+		for (int y = y0; y < y1; ++y) {
+			for (int x = x0; x < x1; ++x) {
+				const Vec3 direction = frame.direction(x, y);
+				Bvh::Hit hit;
+				bvh_.intersect(frame.origin, direction, hit);
+				onHit(x, y, direction, hit);
+			}
+		}
+		return;
+	}
+
+	// Blocks of pixels two high, as wide as the packet needs
+	const int blockWidth = packetSize_ / 2;
+	Bvh::Packet packet;
+	Bvh::Hit hits[Bvh::MAX_PACKET];
+	int xs[Bvh::MAX_PACKET], ys[Bvh::MAX_PACKET];
+	for (int by = y0; by < y1; by += 2) {
+		for (int bx = x0; bx < x1; bx += blockWidth) {
+			int count = 0;
+			for (int y = by; y < std::min(y1, by + 2); ++y) {
+				for (int x = bx; x < std::min(x1, bx + blockWidth); ++x) {
+					const Vec3 direction = frame.direction(x, y);
+					for (int axis = 0; axis < 3; ++axis) {
+						packet.origin[axis][count] = frame.origin[axis];
+						packet.direction[axis][count] = direction[axis];
+					}
+					packet.tMax[count] = 1e30f;
+					xs[count] = x;
+					ys[count] = y;
+					++count;
+				}
+			}
+			bvh_.intersect(packet, count, hits);
+			for (int ii = 0; ii < count; ++ii) {
+				onHit(xs[ii], ys[ii], Vec3(packet.direction[0][ii], packet.direction[1][ii], packet.direction[2][ii]), hits[ii]);
+			}
+		}
+	}
+}
+
+Vec3 RayTracer::shade(const Vec3& origin, const Vec3& direction, const Bvh::Hit& hit, qint64& shadowRays) const
+{
+	if (hit.face < 0) {
+		return Vec3(BACKGROUND, BACKGROUND, BACKGROUND);
+	}
+
+	const Face& face = faces_[hit.face];
+	const Vertex& a = vertices_[face.a];
+	const Vertex& b = vertices_[face.b];
+	const Vertex& c = vertices_[face.c];
+	const Vec3 position = add(origin, scaled(direction, hit.t));
+	const Vec3 texCoord = interpolate(Vec3(a.texCoord.u, a.texCoord.v, 0.0f), Vec3(b.texCoord.u, b.texCoord.v, 0.0f), Vec3(c.texCoord.u, c.texCoord.v, 0.0f), hit.u, hit.v);
+	Vec3 normal = interpolate(a.normal, b.normal, c.normal, hit.u, hit.v).normalized();
+
+	// Normal mapping, with the same tangent frame vert.glsl builds
+	if (!normalMap_.rgb.empty()) {
+		Vec3 tangent = interpolate(a.tangent, b.tangent, c.tangent, hit.u, hit.v);
+		tangent = (tangent - scaled(normal, dot(tangent, normal))).normalized();
+		const Vec3 bitangent = scaled(cross(normal, tangent), a.handedness < 0.0f ? -1.0f : 1.0f);
+		const Vec3 mapped = sample(normalMap_, texCoord.x, texCoord.y);
+		normal = add(add(scaled(tangent, mapped.x * 2.0f - 1.0f), scaled(bitangent, mapped.y * 2.0f - 1.0f)), scaled(normal, mapped.z * 2.0f - 1.0f)).normalized();
+	}
+
+	const Vec3 diffuseColor = diffuseMap_.rgb.empty() ? Vec3(1.0f, 1.0f, 1.0f) : sample(diffuseMap_, texCoord.x, texCoord.y);
+	const Vec3 viewDir = (-direction).normalized();
+
+	// calcPointLight, with the diffuse and specular terms only where the light is unblocked
+	Vec3 lighting(0.0f, 0.0f, 0.0f);
+	for (const PointLight& light : lights_) {
+		const Vec3 color(light.color);
+		const Vec3 toLight = Vec3(light.position) - position;
+		const float lightDistance = toLight.length();
+		const Vec3 lightDir = scaled(toLight, 1.0f / lightDistance);
+		const float attenuation = 1.0f / (light.constant + light.linear * lightDistance + light.quadratic * (lightDistance * lightDistance));
+		lighting = add(lighting, scaled(color, light.ambientIntensity * attenuation));
+
+		const float diffImpact = std::max(dot(normal, lightDir), 0.0f);
+		// reflect(-lightDir, normal)
+		const Vec3 reflectDir = add(-lightDir, scaled(normal, 2.0f * dot(normal, lightDir)));
+		const float spec = std::pow(std::max(dot(viewDir, reflectDir), 0.0f), 100.0f);
+		const float lit = diffImpact + light.specularIntensity * spec;
+		if (lit <= 0.0f) {
+			continue;
+		}
+		++shadowRays;
+		if (!bvh_.occluded(add(position, scaled(lightDir, shadowBias_)), lightDir, lightDistance - 2.0f * shadowBias_)) {
+			lighting = add(lighting, scaled(color, lit * attenuation));
+		}
+	}
+	return multiplied(diffuseColor, lighting);
+}
+
+RayTracer::Stats RayTracer::render(const View& view, int width, int height, std::vector<quint8>& pixels, int threadCount) const
+{
+	if (threadCount <= 0) {
+		threadCount = int(std::max(std::thread::hardware_concurrency(), 1u));
+	}
+	pixels.resize(size_t(width) * height * 3);
+
+	const Frame frame(view, width, height);
+	std::vector<qint64> shadowRays(threadCount, 0);
+	Stats stats;
+	stats.ms = forEachTile(width, height, threadCount, [&](int thread, int x0, int y0, int x1, int y1) {
+		qint64 rays = 0;
+		traceTile(frame, x0, y0, x1, y1, [&](int x, int y, const Vec3& direction, const Bvh::Hit& hit) {
+			const Vec3 color = shade(frame.origin, direction, hit, rays);
+			quint8* pixel = pixels.data() + (size_t(y) * width + x) * 3;
+			pixel[0] = toByte(color.x);
+			pixel[1] = toByte(color.y);
+			pixel[2] = toByte(color.z);
+		});
+		shadowRays[thread] += rays;
+	});
+	stats.primaryRays = qint64(width) * height;
+	stats.shadowRays = 0;
+	for (qint64 rays : shadowRays) {
+		stats.shadowRays += rays;
+	}
+	return stats;
+}
+
+RayTracer::Stats RayTracer::castPrimary(const View& view, int width, int height, std::vector<Bvh::Hit>& hits, int threadCount) const
+{
+	if (threadCount <= 0) {
+		threadCount = int(std::max(std::thread::hardware_concurrency(), 1u));
+	}
+	hits.resize(size_t(width) * height);
+
+	const Frame frame(view, width, height);
+	Stats stats;
+	stats.ms = forEachTile(width, height, threadCount, [&](int, int x0, int y0, int x1, int y1) {
+		traceTile(frame, x0, y0, x1, y1, [&](int x, int y, const Vec3&, const Bvh::Hit& hit) {
+			hits[size_t(y) * width + x] = hit;
+		});
+	});
+	stats.primaryRays = qint64(width) * height;
+	stats.shadowRays = 0;
+	return stats;
+}
+
+bool RayTracer::writePpm(const QString& path, int width, int height, const std::vector<quint8>& pixels)
+{
+	QFile file(path);
+	if (!file.open(QIODevice::WriteOnly)) {
+		qDebug() << "Could not write" << path;
+		return false;
+	}
+	file.write(QString("P6\n%1 %2\n255\n").arg(width).arg(height).toLatin1());
+	file.write(reinterpret_cast<const char*>(pixels.data()), qint64(pixels.size()));
+	return true;
+}
@@ -0,0 +1,91 @@
+#ifndef RAY_TRACER_H
+#define RAY_TRACER_H
+
+#include "Bvh.h"
+
+#include <vector>
+
+// Renders a mesh on the CPU, lit the way frag.glsl's default mode lights it: calcPointLight
+// for every light, normal mapped and times the diffuse map. Where a shadow ray finds
+// something between a point and a light, that light adds only its ambient term.
+// One primary ray per pixel, through its centre, traced in packets of neighbouring pixels.
+// The image is cut into tiles that threads take in turn, and every pixel comes out the same
+// whichever thread traces it and however big the packets are.
+class RayTracer {
+public:
+	struct View {
+		QVector3D position;
+		QVector3D lookAt;
+		QVector3D up;
+		float fov;		// Vertical, in degrees
+	};
+
+	struct Stats {
+		qint64 primaryRays;
+		qint64 shadowRays;
+		double ms;
+	};
+
+	// The mesh must outlive the tracer, and bvh must be built over it
+	RayTracer(const QVector<Vertex>& vertices, const QVector<Face>& faces, const Bvh& bvh);
+
+	void setLights(const QVector<PointLight>& lights);
+	// Maps sampled at the vertices' texCoords, rows top first as the viewer uploads them.
+	// A null image leaves the map out.
+	void setDiffuseMap(const QImage& image);
+	void setNormalMap(const QImage& image);
+	// Primary rays per packet: 1, 4 (2x2 pixels) or 8 (4x2); 8 by default
+	inline void setPacketSize(int rays) { packetSize_ = rays; }
+	inline int packetSize() const { return packetSize_; }
+
+	// Trace width by height pixels into pixels as RGB bytes, top row first. threadCount 0
+	// uses every core.
+	Stats render(const View& view, int width, int height, std::vector<quint8>& pixels, int threadCount = 0) const;
+	// Trace only the primary rays, with no shading or shadow rays, to time traversal on its
+	// own. hits is filled in the same order as render's pixels.
+	Stats castPrimary(const View& view, int width, int height, std::vector<Bvh::Hit>& hits, int threadCount = 0) const;
+
+	// Write pixels as a binary PPM
+	static bool writePpm(const QString& path, int width, int height, const std::vector<quint8>& pixels);
+
+private:
+	struct Map {
+		int width, height;
+		std::vector<quint8> rgb;
+	};
+
+	static void loadMap(const QImage& image, Map& map);
+	// Bilinear, repeating past the edges like the viewer's textures; RGB in [0, 1]
+	static Vec3 sample(const Map& map, float u, float v);
+
+	// Camera basis, the same frame QMatrix4x4::lookAt and perspective make
+	struct Frame {
+		Vec3 origin;
+		QVector3D forward, right, up;
+		float tanHalfFov;
+		float aspect;
+		int width, height;
+
+		Frame(const View& view, int width, int height);
+		Vec3 direction(int x, int y) const;
+	};
+
+	// Trace the primary rays of the pixels from (x0, y0) up to (x1, y1), calling
+	// onHit(x, y, direction, hit) for each
+	template<typename OnHit>
+	void traceTile(const Frame& frame, int x0, int y0, int x1, int y1, OnHit onHit) const;
+	// Colour of the surface a ray from origin in direction hit
+	Vec3 shade(const Vec3& origin, const Vec3& direction, const Bvh::Hit& hit, qint64& shadowRays) const;
+
+	const QVector<Vertex>& vertices_;
+	const QVector<Face>& faces_;
+	const Bvh& bvh_;
+	QVector<PointLight> lights_;
+	Map diffuseMap_;
+	Map normalMap_;
+	// How far shadow rays start from the surface, scaled to the mesh
+	float shadowBias_;
+	int packetSize_;
+};
+
+#endif
@@ -4,14 +4,23 @@
 #include <QtGui>
 #include <QtOpenGL>
 #include <QOpenGLFunctions_3_3_core>
+#include <cstddef>
 
-Renderable::Renderable() : vbo_(QOpenGLBuffer::VertexBuffer), ibo_(QOpenGLBuffer::IndexBuffer), diffuseMap_(QOpenGLTexture::Target2D), normalMap_(QOpenGLTexture::Target2D), numTris_(0), vertexSize_(0), rotationAxis_(0.0, 1.0, 0.0), rotationSpeed_(0.1)
+bool Renderable::uberShader_ = false;
+VertexFormat Renderable::defaultVertexFormat_ = VertexFormat::FULL;
+int Renderable::forcedLod_ = -1;
+float Renderable::lodPixelError_ = 1.0f;
+int Renderable::viewportHeight_ = 600;
+
+Renderable::Renderable() : shader_(nullptr), vbo_(QOpenGLBuffer::VertexBuffer), ibo_(QOpenGLBuffer::IndexBuffer), diffuseMap_(QOpenGLTexture::Target2D), normalMap_(QOpenGLTexture::Target2D), numTris_(0), currentLod_(0), boundsRadius_(0.0f), boundsSize_(0.0f), vertexSize_(0), vertexFormat_(VertexFormat::FULL), vertexBufferBytes_(0), positionScale_(1.0f, 1.0f, 1.0f), rotationAxis_(0.0, 1.0, 0.0), rotationSpeed_(0.1)
 {
 	rotationAngle_ = 0.0;
 }
 
 Renderable::~Renderable()
 {
+	TextureLoader::instance().cancel(&diffuseMap_);
+	TextureLoader::instance().cancel(&normalMap_);
 	if (diffuseMap_.isCreated()) {
 		diffuseMap_.destroy();
 	}
@@ -31,41 +40,95 @@ Renderable::~Renderable()
 
 void Renderable::createShaders()
 {
-	QString vertexFilename = "../../vert.glsl";
-	bool ok = shader_.addShaderFromSourceFile(QOpenGLShader::Vertex, vertexFilename);
-	if (!ok) {
-		qDebug() << shader_.log();
+	// Vertex inputs are the same in every variant, so set them up with the default one
+	shader_ = shaderFor(DrawMode::DEFAULT, false, 1);
+}
+
+QOpenGLShaderProgram* Renderable::shaderFor(DrawMode drawMode, bool normalMap, int lightCount)
+{
+	// Only the lit modes use lights, and only lit modes and normal debug use the normal map,
+	// so leave them out of the other variants rather than compiling duplicates
+	const bool lit = drawMode == DrawMode::DEFAULT || drawMode == DrawMode::LIGHTING_DEBUG;
+	normalMap = normalMap && (lit || drawMode == DrawMode::NORM_DEBUG);
+	lightCount = lit ? qBound(0, lightCount, int(MAX_POINT_LIGHTS)) : 0;
+
+	const int key = uberShader_ ? -1 : (int(drawMode) << 8) | (normalMap ? 1 << 7 : 0) | lightCount;
+	auto it = permutations_.find(key);
+	if (it != permutations_.end()) {
+		return it.value();
 	}
-	QString fragmentFilename = "../../frag.glsl";
-	ok = shader_.addShaderFromSourceFile(QOpenGLShader::Fragment, fragmentFilename);
-	if (!ok) {
-		qDebug() << shader_.log();
+
+	QStringList defines;
+	if (uberShader_) {
+		defines << "UBER_SHADER";
 	}
-	ok = shader_.link();
-	if (!ok) {
-		qDebug() << shader_.log();
+	else {
+		defines << QString("DRAW_MODE %1").arg(int(drawMode)) << QString("NUM_POINT_LIGHTS %1").arg(lightCount);
+		if (normalMap) {
+			defines << "NORMAL_MAP";
+		}
 	}
+	QOpenGLShaderProgram* program = ShaderCache::instance().program("../../vert.glsl", "../../frag.glsl", defines);
+	permutations_.insert(key, program);
+	return program;
 }
 
 void Renderable::init(const QVector<Vertex>& vertices, const QVector<Face>& faces, const QString& diffuseMap, const QString& normalMap)
+{
+	init(vertices, QVector<MeshLod>() << MeshLod(faces, 0.0f), diffuseMap, normalMap);
+}
+
+void Renderable::init(const QVector<Vertex>& vertices, const QVector<MeshLod>& lods, const QString& diffuseMap, const QString& normalMap)
 {
 	initializeOpenGLFunctions();
 
 	// Set our model matrix to identity
 	modelMatrix_.setToIdentity();
-	// Load diffuse map
-	diffuseMap_.setData(QImage(diffuseMap));
+	// Load diffuse map. Both maps are decoded in the background; until then the model
+	// draws plain white and unperturbed normals.
+	TextureLoader::instance().load(&diffuseMap_, diffuseMap, Qt::white);
 
 	// Load normal map
 	if (!normalMap.isEmpty()) {
-		normalMap_.setData(QImage(normalMap));
+		TextureLoader::instance().load(&normalMap_, normalMap, QColor(128, 128, 255), TextureCache::Content::Normal);
 	}
 	
 	// set our vertex size
-	vertexSize_ = sizeof(Vertex);
+	vertexFormat_ = defaultVertexFormat_;
+	switch (vertexFormat_) {
+	case VertexFormat::FULL:
+		vertexSize_ = sizeof(Vertex);
+		break;
+	case VertexFormat::PACKED:
+		vertexSize_ = sizeof(PackedVertex);
+		break;
+	case VertexFormat::PACKED_QUANTIZED:
+		vertexSize_ = sizeof(QuantizedVertex);
+		break;
+	}
+	vertexBufferBytes_ = vertices.size() * vertexSize_;
 	
 	// set our number of triangles.
-	numTris_ = faces.size();
+	numTris_ = lods[0].faces.size();
+	currentLod_ = 0;
+
+	// Bounds, for quantizing positions and sizing the mesh on screen
+	Vec3 boundsMin = vertices[0].position;
+	Vec3 boundsMax = vertices[0].position;
+	for (const Vertex& vertex : vertices) {
+		for (int ii = 0; ii < 3; ++ii) {
+			boundsMin[ii] = qMin(boundsMin[ii], vertex.position[ii]);
+			boundsMax[ii] = qMax(boundsMax[ii], vertex.position[ii]);
+		}
+	}
+	const Vec3 boundsExtent = boundsMax - boundsMin;
+	boundsCenter_ = QVector3D(boundsMin.x + boundsMax.x, boundsMin.y + boundsMax.y, boundsMin.z + boundsMax.z) * 0.5f;
+	boundsRadius_ = boundsExtent.length() * 0.5f;
+	boundsSize_ = qMax(boundsExtent.x, qMax(boundsExtent.y, boundsExtent.z));
+
+	// Full-precision positions, whatever format the GPU gets, so picks land where the
+	// full mesh is
+	bvh_.build(vertices, lods[0].faces);
 
 	// Setup our shader.
 	createShaders();
@@ -77,27 +140,82 @@ void Renderable::init(const QVector<Vertex>& vertices, const QVector<Face>& face
 	vbo_.create();
 	vbo_.setUsagePattern(QOpenGLBuffer::StaticDraw);
 	vbo_.bind();
-	vbo_.allocate(&vertices[0], vertices.size() * vertexSize_);
+	positionOffset_ = QVector3D(0.0f, 0.0f, 0.0f);
+	positionScale_ = QVector3D(1.0f, 1.0f, 1.0f);
+	if (vertexFormat_ == VertexFormat::FULL) {
+		vbo_.allocate(&vertices[0], vertexBufferBytes_);
+	}
+	else if (vertexFormat_ == VertexFormat::PACKED) {
+		QVector<PackedVertex> packed;
+		packed.reserve(vertices.size());
+		for (const Vertex& vertex : vertices) {
+			packed << PackedVertex(vertex);
+		}
+		vbo_.allocate(packed.constData(), vertexBufferBytes_);
+	}
+	else {
+		// Quantize against the mesh's bounds
+		QVector<QuantizedVertex> quantized;
+		quantized.reserve(vertices.size());
+		for (const Vertex& vertex : vertices) {
+			quantized << QuantizedVertex(vertex, boundsMin, boundsExtent);
+		}
+		vbo_.allocate(quantized.constData(), vertexBufferBytes_);
+		positionOffset_ = QVector3D(boundsMin.x, boundsMin.y, boundsMin.z);
+		positionScale_ = QVector3D(boundsExtent.x, boundsExtent.y, boundsExtent.z);
+	}
 
-	// Create our index buffer
+	// Create our index buffer, with every level of detail back to back
+	QVector<Face> faces;
+	lods_.clear();
+	for (const MeshLod& lod : lods) {
+		LodRange range;
+		range.firstIndex = faces.size() * 3;
+		range.indexCount = lod.faces.size() * 3;
+		range.error = lod.error;
+		lods_ << range;
+		faces << lod.faces;
+	}
 	ibo_.create();
 	ibo_.bind();
 	ibo_.setUsagePattern(QOpenGLBuffer::StaticDraw);
 	ibo_.allocate(&faces[0], faces.size() * sizeof(Face));
 
 	// Make sure we setup our shader inputs properly
-	// position
-	shader_.enableAttributeArray(0);
-	shader_.setAttributeBuffer(0, GL_FLOAT, 0, 3, vertexSize_);
-	// texture coords
-	shader_.enableAttributeArray(1);
-	shader_.setAttributeBuffer(1, GL_FLOAT, 3 * sizeof(float), 2, vertexSize_);
-	// normal
-	shader_.enableAttributeArray(2);
-	shader_.setAttributeBuffer(2, GL_FLOAT, 5 * sizeof(float), 3, vertexSize_);
-	// tangent
-	shader_.enableAttributeArray(3);
-	shader_.setAttributeBuffer(3, GL_FLOAT, 8 * sizeof(float), 3, vertexSize_);
+	if (vertexFormat_ == VertexFormat::FULL) {
+		// position
+		shader_->enableAttributeArray(0);
+		shader_->setAttributeBuffer(0, GL_FLOAT, 0, 3, vertexSize_);
+		// texture coords
+		shader_->enableAttributeArray(1);
+		shader_->setAttributeBuffer(1, GL_FLOAT, 3 * sizeof(float), 2, vertexSize_);
+		// normal
+		shader_->enableAttributeArray(2);
+		shader_->setAttributeBuffer(2, GL_FLOAT, 5 * sizeof(float), 3, vertexSize_);
+		// tangent, with the bitangent handedness in w
+		shader_->enableAttributeArray(3);
+		shader_->setAttributeBuffer(3, GL_FLOAT, 8 * sizeof(float), 4, vertexSize_);
+	}
+	else {
+		// The GL decodes packed attributes on fetch, so the shader sees plain floats.
+		// Quantized positions normalize to [0, 1]; the vertex shader rescales them.
+		const bool quantized = vertexFormat_ == VertexFormat::PACKED_QUANTIZED;
+		const int texCoordOffset = quantized ? offsetof(QuantizedVertex, texCoord) : offsetof(PackedVertex, texCoord);
+		const int normalOffset = quantized ? offsetof(QuantizedVertex, normal) : offsetof(PackedVertex, normal);
+		const int tangentOffset = quantized ? offsetof(QuantizedVertex, tangent) : offsetof(PackedVertex, tangent);
+		// position
+		shader_->enableAttributeArray(0);
+		glVertexAttribPointer(0, 3, quantized ? GL_UNSIGNED_SHORT : GL_FLOAT, quantized ? GL_TRUE : GL_FALSE, vertexSize_, 0);
+		// texture coords
+		shader_->enableAttributeArray(1);
+		glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, vertexSize_, reinterpret_cast<const void*>(qintptr(texCoordOffset)));
+		// normal
+		shader_->enableAttributeArray(2);
+		glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, vertexSize_, reinterpret_cast<const void*>(qintptr(normalOffset)));
+		// tangent, with the bitangent handedness in w
+		shader_->enableAttributeArray(3);
+		glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, vertexSize_, reinterpret_cast<const void*>(qintptr(tangentOffset)));
+	}
 
 	// Release our vao and THEN release our buffers.
 	vao_.release();
@@ -105,7 +223,20 @@ void Renderable::init(const QVector<Vertex>& vertices, const QVector<Face>& face
 	ibo_.release();
 
 	// Set up our lights
-	lights_ << PointLight(QVector3D(0.0f, 1.0f, 4.0f), QVector3D(1.0f, 1.0f, 1.0f), 0.2f, 0.8f);
+	lights_ = defaultLights();
+}
+
+QVector<PointLight> Renderable::defaultLights()
+{
+	return QVector<PointLight>() << PointLight(QVector3D(0.0f, 1.0f, 4.0f), QVector3D(1.0f, 1.0f, 1.0f), 0.2f, 0.8f);
+}
+
+QMatrix4x4 Renderable::animatedModelMatrix() const
+{
+	QMatrix4x4 rotMatrix;
+	rotMatrix.setToIdentity();
+	rotMatrix.rotate(rotationAngle_, rotationAxis_);
+	return modelMatrix_ * rotMatrix;
 }
 
 void Renderable::update(const qint64 msSinceLastFrame)
@@ -119,47 +250,72 @@ void Renderable::update(const qint64 msSinceLastFrame)
 	}
 }
 
+int Renderable::selectLod(const QMatrix4x4& modelMatrix, const QMatrix4x4& viewMatrix, const QMatrix4x4& projection) const
+{
+	if (forcedLod_ >= 0) {
+		return qMin(forcedLod_, lods_.size() - 1);
+	}
+	// Distance from the eye to the nearest point of the bounding sphere
+	const float scale = qMax(modelMatrix.column(0).toVector3D().length(), qMax(modelMatrix.column(1).toVector3D().length(), modelMatrix.column(2).toVector3D().length()));
+	const QVector3D center = (viewMatrix * modelMatrix).map(boundsCenter_);
+	const float distance = -center.z() - boundsRadius_ * scale;
+	if (distance <= 0.0f) {
+		return 0;
+	}
+	// Size of the mesh in pixels at that distance; projection(1, 1) is cot(fov / 2)
+	const float projectedSize = boundsSize_ * scale * projection(1, 1) * 0.5f * viewportHeight_ / distance;
+	int lod = 0;
+	while (lod + 1 < lods_.size() && lods_[lod + 1].error * projectedSize <= lodPixelError_) {
+		++lod;
+	}
+	return lod;
+}
+
 void Renderable::draw(const QMatrix4x4& worldMatrix, const QMatrix4x4& viewMatrix, const QMatrix4x4& projection, const QVector3D& viewPosition, const DrawMode drawMode)
 {
 	// Create model matrix
-	QMatrix4x4 rotMatrix;
-	rotMatrix.setToIdentity();
-	rotMatrix.rotate(rotationAngle_, rotationAxis_);
-	QMatrix4x4 modelMat = modelMatrix_ * rotMatrix;
-	modelMat = worldMatrix * modelMat;
+	QMatrix4x4 modelMat = worldMatrix * animatedModelMatrix();
 	QMatrix3x3 normalMat = modelMat.normalMatrix();
 
-	// Bind shader
-	shader_.bind();
-	
 	bool hasNormalMap = normalMap_.isCreated();
+	const int lightCount = qMin(lights_.size(), int(MAX_POINT_LIGHTS));
+
+	// Bind the variant specialized for this draw
+	shader_ = shaderFor(drawMode, hasNormalMap, lightCount);
+	shader_->bind();
 
 	// Set our matrix uniforms!
-	shader_.setUniformValue("modelMatrix", modelMat);
-	shader_.setUniformValue("viewMatrix", viewMatrix);
-	shader_.setUniformValue("projectionMatrix", projection);
-	shader_.setUniformValue("normalMatrix", normalMat);
-	shader_.setUniformValue("viewPosition", viewPosition);
-	shader_.setUniformValue("drawMode", (int)drawMode);
-	shader_.setUniformValue("hasNormalMap", hasNormalMap);
-	for (int ii = 0; ii < lights_.size(); ++ii) {
+	shader_->setUniformValue("modelMatrix", modelMat);
+	shader_->setUniformValue("viewMatrix", viewMatrix);
+	shader_->setUniformValue("projectionMatrix", projection);
+	shader_->setUniformValue("normalMatrix", normalMat);
+	shader_->setUniformValue("positionOffset", positionOffset_);
+	shader_->setUniformValue("positionScale", positionScale_);
+	shader_->setUniformValue("viewPosition", viewPosition);
+	if (uberShader_) {
+		shader_->setUniformValue("drawMode", (int)drawMode);
+		shader_->setUniformValue("hasNormalMap", hasNormalMap);
+		shader_->setUniformValue("pointLightCount", lightCount);
+	}
+	const bool lit = uberShader_ || drawMode == DrawMode::DEFAULT || drawMode == DrawMode::LIGHTING_DEBUG;
+	for (int ii = 0; lit && ii < lightCount; ++ii) {
 		const PointLight& light = lights_[ii];
 		char buffer[64];
 
 		sprintf(buffer, "pointLights[%i].position", ii);
-		shader_.setUniformValue(buffer, light.position);
+		shader_->setUniformValue(buffer, light.position);
 		sprintf(buffer, "pointLights[%i].color", ii);
-		shader_.setUniformValue(buffer, light.color);
+		shader_->setUniformValue(buffer, light.color);
 		sprintf(buffer, "pointLights[%i].ambientIntensity", ii);
-		shader_.setUniformValue(buffer, light.ambientIntensity);
+		shader_->setUniformValue(buffer, light.ambientIntensity);
 		sprintf(buffer, "pointLights[%i].specularIntensity", ii);
-		shader_.setUniformValue(buffer, light.specularIntensity);
+		shader_->setUniformValue(buffer, light.specularIntensity);
 		sprintf(buffer, "pointLights[%i].constant", ii);
-		shader_.setUniformValue(buffer, light.constant);
+		shader_->setUniformValue(buffer, light.constant);
 		sprintf(buffer, "pointLights[%i].linear", ii);
-		shader_.setUniformValue(buffer, light.linear);
+		shader_->setUniformValue(buffer, light.linear);
 		sprintf(buffer, "pointLights[%i].quadratic", ii);
-		shader_.setUniformValue(buffer, light.quadratic);
+		shader_->setUniformValue(buffer, light.quadratic);
 	}
 
 	// Bind VAO
@@ -168,15 +324,18 @@ void Renderable::draw(const QMatrix4x4& worldMatrix, const QMatrix4x4& viewMatri
 	// Bind textures
 	glActiveTexture(GL_TEXTURE0);
 	diffuseMap_.bind();
-	shader_.setUniformValue(shader_.attributeLocation("diffuseMap"), GL_TEXTURE0);
+	shader_->setUniformValue(shader_->attributeLocation("diffuseMap"), GL_TEXTURE0);
 	if (hasNormalMap) {
 		glActiveTexture(GL_TEXTURE1);
 		normalMap_.bind();
-		shader_.setUniformValue("normalMap", GL_TEXTURE1 - GL_TEXTURE0);
+		shader_->setUniformValue("normalMap", GL_TEXTURE1 - GL_TEXTURE0);
 	}
 
 	// Draw!
-	glDrawElements(GL_TRIANGLES, numTris_ * 3, GL_UNSIGNED_INT, 0);
+	currentLod_ = selectLod(modelMat, viewMatrix, projection);
+	const LodRange& lod = lods_[currentLod_];
+	numTris_ = lod.indexCount / 3;
+	glDrawElements(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_INT, reinterpret_cast<const void*>(qintptr(lod.firstIndex * sizeof(unsigned int))));
 
 	// Un-bind textures
 	diffuseMap_.release();
@@ -186,7 +345,7 @@ void Renderable::draw(const QMatrix4x4& worldMatrix, const QMatrix4x4& viewMatri
 
 	// Un-bind VAO and shader
 	vao_.release();
-	shader_.release();
+	shader_->release();
 }
 
 void Renderable::setModelMatrix(const QMatrix4x4& transform)
@@ -3,7 +3,10 @@
 #include <QtCore>
 #include <QtGui>
 #include <QtOpenGL>
+#include "ShaderCache.h"
+#include "TextureLoader.h"
 #include "Structs.h"
+#include "Bvh.h"
 
 enum class DrawMode {
 	DEFAULT = 0,
@@ -13,13 +16,23 @@ enum class DrawMode {
 	LIGHTING_DEBUG = 4
 };
 
+// Layout of the vertex buffer Renderable uploads
+enum class VertexFormat {
+	FULL = 0,				// Vertex as-is, 48 bytes
+	PACKED = 1,				// PackedVertex, 24 bytes
+	PACKED_QUANTIZED = 2	// QuantizedVertex, 20 bytes
+};
+
 class Renderable: protected QOpenGLFunctions
 {
 protected:
 	// Each renderable has its own model matrix
 	QMatrix4x4 modelMatrix_;
-	// For now, we have only one shader per object
-	QOpenGLShaderProgram shader_;
+	// The shader variant for the current draw. Variants are shared by every Renderable
+	// using the same shaders; the ShaderCache owns them.
+	QOpenGLShaderProgram* shader_;
+	// Variants we've already looked up, keyed by draw mode, normal map and light count
+	QHash<int, QOpenGLShaderProgram*> permutations_;
 	// Diffuse map for the object
 	QOpenGLTexture diffuseMap_;
 	// Normal map for the object
@@ -34,7 +47,26 @@ protected:
 	QVector<PointLight> lights_;
 	// Keep track of how many triangles we actually have to draw in our ibo
 	unsigned int numTris_;
+	// Levels of detail share the vbo; their triangles sit one after another in the ibo
+	struct LodRange {
+		int firstIndex;
+		int indexCount;
+		float error;
+	};
+	QVector<LodRange> lods_;
+	int currentLod_;
+	// Bounding sphere, and the size LOD errors are relative to
+	QVector3D boundsCenter_;
+	float boundsRadius_;
+	float boundsSize_;
 	int vertexSize_;
+	VertexFormat vertexFormat_;
+	int vertexBufferBytes_;
+	// Quantized positions decode as positionOffset_ + position * positionScale_
+	QVector3D positionOffset_;
+	QVector3D positionScale_;
+	// The full-detail triangles in model space, for picking
+	Bvh bvh_;
 
 	// Define our axis of rotation for animation
 	QVector3D rotationAxis_;
@@ -43,19 +75,62 @@ protected:
 
 	// Create our shader and fix it up
 	void createShaders();
+	// Get the shader compiled for exactly this combination of features
+	QOpenGLShaderProgram* shaderFor(DrawMode drawMode, bool normalMap, int lightCount);
+	// Coarsest level whose error projects to at most lodPixelError_ pixels on screen
+	int selectLod(const QMatrix4x4& modelMatrix, const QMatrix4x4& viewMatrix, const QMatrix4x4& projection) const;
+
+	// Use the single runtime-branching shader instead of specialized variants
+	static bool uberShader_;
+	// Format init() uploads vertices in
+	static VertexFormat defaultVertexFormat_;
+	// LOD selection: a fixed level (or -1 to pick by screen size), the on-screen error
+	// allowed in pixels, and the viewport height that error is measured against
+	static int forcedLod_;
+	static float lodPixelError_;
+	static int viewportHeight_;
 
 public:
 	Renderable();
 	virtual ~Renderable();
 
 	virtual void init(const QVector<Vertex>& vertices, const QVector<Face>& faces, const QString& diffuseMap, const QString& normalMap);
+	// lods[0] is the full mesh; every level indexes the same vertices
+	virtual void init(const QVector<Vertex>& vertices, const QVector<MeshLod>& lods, const QString& diffuseMap, const QString& normalMap);
 	virtual void update(const qint64 msSinceLastFrame);
 	virtual void draw(const QMatrix4x4& worldMatrix, const QMatrix4x4& viewMatrix, const QMatrix4x4& projection, const QVector3D& viewPosition, const DrawMode drawMode);
 
 	void setModelMatrix(const QMatrix4x4& transform);
+	// The model matrix with the current rotation applied, as draw() places the mesh
+	QMatrix4x4 animatedModelMatrix() const;
 	void setRotationAxis(const QVector3D& axis);
 	void setRotationSpeed(float speed);
 
+	inline VertexFormat vertexFormat() const { return vertexFormat_; }
+	inline int vertexBufferBytes() const { return vertexBufferBytes_; }
+	inline int lodCount() const { return lods_.size(); }
+	// Level and triangle count of the last draw
+	inline int currentLod() const { return currentLod_; }
+	inline unsigned int drawnTriangles() const { return numTris_; }
+	// Faces hit are indices into lods[0], the full mesh
+	inline const Bvh& bvh() const { return bvh_; }
+
+	// Applies to Renderables initialized afterwards
+	static inline void setDefaultVertexFormat(VertexFormat format) { defaultVertexFormat_ = format; }
+	static inline VertexFormat defaultVertexFormat() { return defaultVertexFormat_; }
+	static inline void setUberShader(bool enabled) { uberShader_ = enabled; }
+	static inline bool uberShader() { return uberShader_; }
+	static inline void setForcedLod(int lod) { forcedLod_ = lod; }
+	static inline int forcedLod() { return forcedLod_; }
+	static inline void setLodPixelError(float pixels) { lodPixelError_ = pixels; }
+	static inline void setViewportHeight(int height) { viewportHeight_ = height; }
+	// The lights every Renderable starts with
+	static QVector<PointLight> defaultLights();
+	// Most point lights one shader variant supports
+	static const int MAX_POINT_LIGHTS = 8;
+	// Most levels of detail the loader generates per mesh
+	static const int MAX_LODS = 4;
+
 private:
 
 };
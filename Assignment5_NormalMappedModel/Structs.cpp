@@ -1,5 +1,6 @@
 #include "Structs.h"
 #include <cmath>
+#include <cstring>
 
 // ~~~~~~~~~~ VEC3 ~~~~~~~~~~
 Vec3::Vec3() : x(0), y(0), z(0) {}
@@ -92,16 +93,89 @@ const float& Vec2::operator[](int i) const {
 
 
 // ~~~~~~~~~~ VERTEX ~~~~~~~~~~
-Vertex::Vertex() : position(), texCoord(), normal(), tangent() {}
+Vertex::Vertex() : position(), texCoord(), normal(), tangent(), handedness(1.0f) {}
 
-Vertex::Vertex(Vec3 pos, Vec2 tex, Vec3 norm, Vec3 tan) : position(pos), texCoord(tex), normal(norm), tangent(tan) {}
+Vertex::Vertex(Vec3 pos, Vec2 tex, Vec3 norm, Vec3 tan, float handedness) : position(pos), texCoord(tex), normal(norm), tangent(tan), handedness(handedness) {}
 
 bool Vertex::operator==(Vertex other) const {
 	return
 		position == other.position &&
 		texCoord == other.texCoord &&
 		normal == other.normal &&
-		tangent == other.tangent;
+		tangent == other.tangent &&
+		handedness == other.handedness;
+}
+
+
+// ~~~~~~~~~~ PACKED VERTICES ~~~~~~~~~~
+// IEEE half float, rounding to nearest even
+static quint16 toHalf(float value) {
+	quint32 bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	const quint32 sign = (bits >> 16) & 0x8000;
+	const quint32 floatExponent = (bits >> 23) & 0xFF;
+	quint32 mantissa = bits & 0x7FFFFF;
+	if (floatExponent == 0xFF) {
+		// Infinity or NaN
+		return quint16(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+	}
+	const int exponent = int(floatExponent) - 127 + 15;
+	if (exponent >= 31) {
+		return quint16(sign | 0x7C00);
+	}
+	if (exponent <= 0) {
+		// Subnormal half, or too small for one
+		if (exponent < -10) {
+			return quint16(sign);
+		}
+		mantissa |= 0x800000;
+		const int shift = 14 - exponent;
+		quint32 half = mantissa >> shift;
+		const quint32 remainder = mantissa & ((1u << shift) - 1);
+		const quint32 halfway = 1u << (shift - 1);
+		if (remainder > halfway || (remainder == halfway && (half & 1))) {
+			++half;
+		}
+		return quint16(sign | half);
+	}
+	quint32 half = (quint32(exponent) << 10) | (mantissa >> 13);
+	const quint32 remainder = mantissa & 0x1FFF;
+	// A carry out of the mantissa correctly bumps the exponent
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+		++half;
+	}
+	return quint16(sign | half);
+}
+
+// Signed normalized 2_10_10_10, as read by GL_INT_2_10_10_10_REV: x in the low bits, w in the top two
+static quint32 packSnorm1010102(const Vec3& vec, float w) {
+	auto snorm10 = [](float value) -> quint32 {
+		return quint32(qRound(qBound(-1.0f, value, 1.0f) * 511.0f)) & 0x3FF;
+	};
+	const quint32 sign = w < 0.0f ? 0x3 : 0x1;
+	return snorm10(vec.x) | (snorm10(vec.y) << 10) | (snorm10(vec.z) << 20) | (sign << 30);
+}
+
+PackedVertex::PackedVertex() : position{ 0, 0, 0 }, texCoord{ 0, 0 }, normal(0), tangent(0) {}
+
+PackedVertex::PackedVertex(const Vertex& vertex) :
+	position{ vertex.position.x, vertex.position.y, vertex.position.z },
+	texCoord{ toHalf(vertex.texCoord.u), toHalf(vertex.texCoord.v) },
+	normal(packSnorm1010102(vertex.normal, 0.0f)),
+	tangent(packSnorm1010102(vertex.tangent, vertex.handedness)) {}
+
+QuantizedVertex::QuantizedVertex() : position{ 0, 0, 0, 0 }, texCoord{ 0, 0 }, normal(0), tangent(0) {}
+
+QuantizedVertex::QuantizedVertex(const Vertex& vertex, const Vec3& boundsMin, const Vec3& boundsExtent) :
+	position{ 0, 0, 0, 0 },
+	texCoord{ toHalf(vertex.texCoord.u), toHalf(vertex.texCoord.v) },
+	normal(packSnorm1010102(vertex.normal, 0.0f)),
+	tangent(packSnorm1010102(vertex.tangent, vertex.handedness))
+{
+	for (int ii = 0; ii < 3; ++ii) {
+		const float fraction = boundsExtent[ii] > 0.0f ? (vertex.position[ii] - boundsMin[ii]) / boundsExtent[ii] : 0.0f;
+		position[ii] = quint16(qRound(qBound(0.0f, fraction, 1.0f) * 65535.0f));
+	}
 }
 
 
@@ -125,6 +199,11 @@ const unsigned int& Face::operator[](int i) const {
 	return ((&a)[i]);
 }
 
+// ~~~~~~~~~~ MESH LOD ~~~~~~~~~~
+MeshLod::MeshLod() : error(0.0f) {}
+
+MeshLod::MeshLod(const QVector<Face>& faces, float error) : faces(faces), error(error) {}
+
 
 // ~~~~~~~~~~ POINTLIGHT ~~~~~~~~~~
 PointLight::PointLight() : position(), color(), ambientIntensity(0), specularIntensity(0), constant(0), linear(0), quadratic(0) {}
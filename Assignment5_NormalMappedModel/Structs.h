@@ -43,13 +43,39 @@ struct Vertex {
 	Vec2 texCoord;
 	Vec3 normal;
 	Vec3 tangent;
+	// -1 where the UVs are mirrored, so the bitangent is -cross(normal, tangent)
+	float handedness;
 
 	Vertex();
-	Vertex(Vec3 pos, Vec2 tex, Vec3 norm, Vec3 tan);
+	Vertex(Vec3 pos, Vec2 tex, Vec3 norm, Vec3 tan, float handedness = 1.0f);
 
 	bool operator==(Vertex other) const;
 };
 
+// Compact Vertex for upload: fp32 position, half float UVs, and normal and tangent as
+// signed normalized 2_10_10_10. The tangent's w holds the bitangent handedness.
+// 24 bytes instead of 48.
+struct PackedVertex {
+	float position[3];
+	quint16 texCoord[2];
+	quint32 normal;
+	quint32 tangent;
+
+	PackedVertex();
+	PackedVertex(const Vertex& vertex);
+};
+
+// PackedVertex with the position stored as 16 bit fractions of the mesh bounds. 20 bytes.
+struct QuantizedVertex {
+	quint16 position[4];	// [3] pads the position to 4 byte alignment
+	quint16 texCoord[2];
+	quint32 normal;
+	quint32 tangent;
+
+	QuantizedVertex();
+	QuantizedVertex(const Vertex& vertex, const Vec3& boundsMin, const Vec3& boundsExtent);
+};
+
 struct Face {
 	unsigned int a, b, c;
 
@@ -61,6 +87,16 @@ struct Face {
 	const unsigned int& operator[](int i) const;
 };
 
+// One level of detail: the triangles to draw and how far (as a fraction of the mesh's size)
+// they stray from the full mesh
+struct MeshLod {
+	QVector<Face> faces;
+	float error;
+
+	MeshLod();
+	MeshLod(const QVector<Face>& faces, float error);
+};
+
 struct PointLight {
 	QVector3D position;
 	QVector3D color;
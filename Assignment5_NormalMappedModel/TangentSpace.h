@@ -0,0 +1,22 @@
+#ifndef TANGENT_SPACE_H
+#define TANGENT_SPACE_H
+
+#include "Structs.h"
+
+// Per-vertex tangent frames for normal mapping, after Lengyel's "Computing Tangent Space
+// Basis Vectors for an Arbitrary Mesh". Face frames are computed four at a time with SSE,
+// then each vertex gathers the frames of the faces around it, so threads never write to
+// the same vertex.
+class TangentSpace {
+public:
+	struct Stats {
+		int degenerateFaces;	// No area or no UV area, so no frame of their own
+		int leftHanded;			// Vertices whose UVs are mirrored
+	};
+
+	// Set every vertex's tangent, orthogonalized against its normal, and the handedness of
+	// its bitangent. threadCount 0 picks one from the mesh's size.
+	static Stats generate(QVector<Vertex>& vertices, const QVector<Face>& faces, int threadCount = 0);
+};
+
+#endif
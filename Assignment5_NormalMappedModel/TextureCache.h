@@ -0,0 +1,52 @@
+#pragma once
+
+#include <QtCore>
+#include <QtGui>
+
+// Full mip chains stored next to their source images, so a warm start maps the file and
+// uploads it without decoding anything or asking the driver to build mipmaps.
+//
+// Chains are built on the CPU with a Kaiser-windowed sinc (or a plain box) filter. Colors
+// are averaged in linear light rather than on their sRGB values, and normals are
+// renormalized after each step.
+class TextureCache {
+public:
+	enum class Content { Color, Normal };
+	enum class Filter { Box, Kaiser };
+
+	// One level of RGBA8 pixels, rows tightly packed
+	struct Level {
+		const uchar* bits;
+		int width;
+		int height;
+	};
+
+	// Levels largest first, down to 1x1. The pixels are owned either by images, when the
+	// chain was built in memory, or by file, when it was mapped from the cache.
+	struct MipChain {
+		QVector<Level> levels;
+		QVector<QImage> images;
+		QSharedPointer<QFile> file;
+
+		inline bool isNull() const { return levels.isEmpty(); }
+		qint64 bytes() const;
+	};
+
+	// Build the chain of image in memory
+	static MipChain build(const QImage& image, Content content = Content::Color, Filter filter = Filter::Kaiser);
+
+	// Scale image to size if it's valid, flip it to bottom-up rows if mirror is set, and
+	// surround it with gutter texels wrapped around from its opposite edges. The gutter
+	// keeps filtering seamless when the image repeats inside a texture atlas.
+	static QImage prepare(const QImage& image, const QSize& size, bool mirror, int gutter = 0);
+
+	// The chain of sourcePath after prepare(). Maps the cache file when it was made from
+	// this exact source file with these settings; otherwise decodes the source, builds the
+	// chain and rewrites the cache. Returns a null chain if the source can't be loaded.
+	// Safe to call from any thread.
+	static MipChain load(const QString& sourcePath, const QSize& size, bool mirror, Content content = Content::Color, int gutter = 0, bool* cacheHit = nullptr);
+
+	// The cache file of sourcePath loaded with these settings. Each combination of settings
+	// gets its own file, named by a short hash of them.
+	static QString cachePath(const QString& sourcePath, const QSize& size, bool mirror, Content content = Content::Color, int gutter = 0);
+};
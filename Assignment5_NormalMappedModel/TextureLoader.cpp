@@ -0,0 +1,292 @@
+#include "TextureLoader.h"
+
+#include <cstring>
+
+// Loads one file's mip chain, or builds one image's, on a pool thread and hands it back
+// to the loader
+class TextureLoader::DecodeTask : public QRunnable
+{
+public:
+	DecodeTask(TextureLoader* loader, int id, const QString& path, const QImage& image, const QSize& size, bool mirror,
+		TextureCache::Content content, int gutter) :
+		loader_(loader), id_(id), path_(path), image_(image), size_(size), mirror_(mirror), content_(content), gutter_(gutter)
+	{}
+
+	void run() override
+	{
+		bool cacheHit = false;
+		TextureCache::MipChain chain;
+		if (!path_.isEmpty()) {
+			chain = TextureCache::load(path_, size_, mirror_, content_, gutter_, &cacheHit);
+		} else if (!image_.isNull()) {
+			chain = TextureCache::build(TextureCache::prepare(image_, size_, mirror_, gutter_), content_);
+		}
+		if (chain.isNull() && size_.isValid()) {
+			// Missing layers show up as plain white rather than garbage
+			QImage white(size_, QImage::Format_RGBA8888);
+			white.fill(Qt::white);
+			chain = TextureCache::build(TextureCache::prepare(white, size_, false, gutter_), content_);
+		}
+		loader_->finished(id_, chain, cacheHit);
+	}
+
+private:
+	TextureLoader* loader_;
+	int id_;
+	QString path_;
+	QImage image_;
+	QSize size_;
+	bool mirror_;
+	TextureCache::Content content_;
+	int gutter_;
+};
+
+TextureLoader& TextureLoader::instance()
+{
+	static TextureLoader loader;
+	return loader;
+}
+
+TextureLoader::TextureLoader() : context_(nullptr), pixelBuffer_(0), nextId_(0), currentLevel_(-1),
+	uploadedCount_(0), cachedCount_(0), uploadedBytes_(0), uploadMs_(0.0)
+{}
+
+void TextureLoader::initialize()
+{
+	QOpenGLContext* context = QOpenGLContext::currentContext();
+	if (context == context_) {
+		return;
+	}
+	if (context_ && !jobs_.isEmpty()) {
+		qDebug() << "TextureLoader: loads from a previous context were not cleared";
+	}
+	context_ = context;
+	initializeOpenGLFunctions();
+	glGenBuffers(1, &pixelBuffer_);
+}
+
+void TextureLoader::load(QOpenGLTexture* texture, const QString& path, const QColor& placeholder, TextureCache::Content content)
+{
+	initialize();
+	cancel(texture);
+
+	if (texture->isCreated()) {
+		texture->destroy();
+	}
+	QImage pixel(1, 1, QImage::Format_RGBA8888);
+	pixel.fill(placeholder);
+	texture->setData(pixel, QOpenGLTexture::DontGenerateMipMaps);
+	texture->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+
+	// QOpenGLTexture::setData(QImage) doesn't flip rows, so neither do we
+	queue({ texture, -1, QPoint(0, 0), path }, QImage(), QSize(), false, content, 0);
+}
+
+void TextureLoader::loadLayer(QOpenGLTexture* arrayTexture, int layer, const QString& path, const QSize& size, TextureCache::Content content,
+	const QPoint& offset, int gutter)
+{
+	initialize();
+	++remainingLayers_[arrayTexture];
+	queue({ arrayTexture, layer, offset, path }, QImage(), size, true, content, gutter);
+}
+
+void TextureLoader::loadLayer(QOpenGLTexture* arrayTexture, int layer, const QImage& image, const QSize& size, TextureCache::Content content,
+	const QPoint& offset, int gutter)
+{
+	initialize();
+	++remainingLayers_[arrayTexture];
+	queue({ arrayTexture, layer, offset, QString() }, image, size, true, content, gutter);
+}
+
+int TextureLoader::queue(const Job& job, const QImage& image, const QSize& size, bool mirror, TextureCache::Content content, int gutter)
+{
+	const int id = nextId_++;
+	jobs_.insert(id, job);
+	QThreadPool::globalInstance()->start(new DecodeTask(this, id, job.path, image, size, mirror, content, gutter));
+	return id;
+}
+
+void TextureLoader::finished(int id, const TextureCache::MipChain& chain, bool cacheHit)
+{
+	QMutexLocker lock(&mutex_);
+	decoded_ << Decoded{ id, chain, cacheHit };
+}
+
+void TextureLoader::cancel(QOpenGLTexture* texture)
+{
+	// Decodes already running can't be stopped; their results are dropped in upload()
+	for (auto it = jobs_.begin(); it != jobs_.end();) {
+		if (it.value().texture == texture) {
+			it = jobs_.erase(it);
+		} else {
+			++it;
+		}
+	}
+	remainingLayers_.remove(texture);
+	if (currentLevel_ >= 0 && !jobs_.contains(current_.id)) {
+		resetCurrent();
+	}
+}
+
+void TextureLoader::resetCurrent()
+{
+	// Releases the chain's pixels, or unmaps its cache file
+	current_ = Decoded();
+	currentLevel_ = -1;
+}
+
+int TextureLoader::upload(double budgetMs)
+{
+	if (jobs_.isEmpty()) {
+		// Anything still decoded belongs to cancelled loads
+		QMutexLocker lock(&mutex_);
+		decoded_.clear();
+		return 0;
+	}
+	initialize();
+
+	QElapsedTimer timer;
+	timer.start();
+	int count = 0;
+	while (count == 0 || timer.nsecsElapsed() / 1e6 < budgetMs) {
+		if (currentLevel_ < 0 && !beginNext()) {
+			break;
+		}
+
+		const Job& job = jobs_[current_.id];
+		uploadLevel(job, current_.chain.levels[currentLevel_], currentLevel_);
+		++count;
+
+		if (--currentLevel_ < 0) {
+			const Job done = jobs_.take(current_.id);
+			if (done.layer >= 0) {
+				layerDone(done.texture);
+			}
+			++uploadedCount_;
+			if (current_.cacheHit) {
+				++cachedCount_;
+			}
+			resetCurrent();
+		}
+	}
+
+	uploadMs_ += timer.nsecsElapsed() / 1e6;
+	return count;
+}
+
+bool TextureLoader::beginNext()
+{
+	while (true) {
+		Decoded next;
+		{
+			QMutexLocker lock(&mutex_);
+			if (decoded_.isEmpty()) {
+				return false;
+			}
+			next = decoded_.takeFirst();
+		}
+
+		auto it = jobs_.find(next.id);
+		if (it == jobs_.end()) {
+			continue;
+		}
+		const Job job = it.value();
+		QOpenGLTexture* texture = job.texture;
+		const TextureCache::MipChain& chain = next.chain;
+
+		if (chain.isNull()) {
+			// Keep the placeholder
+			qDebug() << "TextureLoader: could not load" << job.path;
+			jobs_.erase(it);
+			if (job.layer >= 0) {
+				layerDone(texture);
+			}
+			continue;
+		}
+
+		int levels = chain.levels.size();
+		if (job.layer < 0) {
+			// Storage for the whole chain replaces the placeholder. Only the levels uploaded
+			// so far are sampled, starting from the 1x1 one.
+			texture->destroy();
+			texture->create();
+			texture->setSize(chain.levels[0].width, chain.levels[0].height);
+			texture->setFormat(QOpenGLTexture::RGBA8_UNorm);
+			texture->setMipLevels(levels);
+			texture->allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8);
+			texture->setMipBaseLevel(levels - 1);
+			texture->setMinMagFilters(QOpenGLTexture::LinearMipMapLinear, QOpenGLTexture::Linear);
+		} else if (job.offset.x() + chain.levels[0].width > texture->width() || job.offset.y() + chain.levels[0].height > texture->height()) {
+			qDebug() << "TextureLoader:" << job.path << "doesn't fit in its array";
+			jobs_.erase(it);
+			layerDone(texture);
+			continue;
+		} else {
+			levels = qMin(levels, texture->mipLevels());
+		}
+
+		current_ = next;
+		currentLevel_ = levels - 1;
+		return true;
+	}
+}
+
+void TextureLoader::uploadLevel(const Job& job, const TextureCache::Level& level, int index)
+{
+	QOpenGLTexture* texture = job.texture;
+
+	// Orphan the buffer so the driver doesn't wait on the previous upload, copy the pixels
+	// in, and let the texture read them from there
+	const int bytes = level.width * level.height * 4;
+	const void* pixels = nullptr;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer_);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+	void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (mapped) {
+		std::memcpy(mapped, level.bits, bytes);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	} else {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		pixels = level.bits;
+	}
+
+	texture->bind();
+	if (job.layer < 0) {
+		glTexSubImage2D(GL_TEXTURE_2D, index, 0, 0, level.width, level.height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	} else {
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, index, job.offset.x() >> index, job.offset.y() >> index, job.layer,
+			level.width, level.height, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	texture->release();
+
+	if (job.layer < 0) {
+		texture->setMipBaseLevel(index);
+	}
+	uploadedBytes_ += bytes;
+}
+
+void TextureLoader::layerDone(QOpenGLTexture* texture)
+{
+	if (--remainingLayers_[texture] == 0) {
+		// Every layer is in, so show the full chains instead of the placeholder level
+		remainingLayers_.remove(texture);
+		texture->setMipBaseLevel(0);
+	}
+}
+
+void TextureLoader::clear()
+{
+	jobs_.clear();
+	remainingLayers_.clear();
+	resetCurrent();
+	{
+		QMutexLocker lock(&mutex_);
+		decoded_.clear();
+	}
+	if (pixelBuffer_) {
+		glDeleteBuffers(1, &pixelBuffer_);
+		pixelBuffer_ = 0;
+	}
+	context_ = nullptr;
+}
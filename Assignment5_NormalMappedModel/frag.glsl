@@ -1,7 +1,38 @@
 #version 330
 
-// ~~~~~~~~~~ CONSTANTS ~~~~~~~~~~
+// ~~~~~~~~~~ PERMUTATIONS ~~~~~~~~~~
+// Renderable compiles one variant of this shader per combination of these defines,
+// so the compiler strips every branch and light the variant doesn't use.
+//   DRAW_MODE         0 default, 1 wireframe, 2 texture debug, 3 normal debug, 4 lighting debug
+//   NORMAL_MAP        defined when the object has a normal map
+//   NUM_POINT_LIGHTS  number of point lights
+// UBER_SHADER instead builds the single runtime-branching shader, for comparison.
+#ifdef UBER_SHADER
+#define NUM_POINT_LIGHTS 8
+uniform int drawMode;
+uniform bool hasNormalMap;
+uniform int pointLightCount;
+#define DRAW_MODE drawMode
+#define HAS_NORMAL_MAP hasNormalMap
+#define POINT_LIGHT_COUNT min(pointLightCount, NUM_POINT_LIGHTS)
+#else
+#ifndef DRAW_MODE
+#define DRAW_MODE 0
+#endif
+#ifndef NUM_POINT_LIGHTS
 #define NUM_POINT_LIGHTS 1
+#endif
+#ifdef NORMAL_MAP
+#define HAS_NORMAL_MAP true
+#else
+#define HAS_NORMAL_MAP false
+#endif
+#define POINT_LIGHT_COUNT NUM_POINT_LIGHTS
+#endif
+// Only normal mapping needs the tangent basis; vert.glsl skips it otherwise
+#if defined(NORMAL_MAP) || defined(UBER_SHADER)
+#define TANGENT_SPACE
+#endif
 
 // ~~~~~~~~~~ STRUCTS ~~~~~~~~~~
 struct PointLight {
@@ -19,8 +50,10 @@ in VS_OUT {
 	vec3 fragPos;
 	vec2 texCoords;
 	vec3 norm;
+#ifdef TANGENT_SPACE
 	vec3 tang;
 	mat3 tangentToWorld;
+#endif
 } fs_in;
 
 // ~~~~~~~~~~ OUTPUTS ~~~~~~~~~~
@@ -28,25 +61,25 @@ out vec4 fragColor;
 
 // ~~~~~~~~~~ UNIFORMS ~~~~~~~~~~
 uniform vec3 viewPosition;
-uniform int drawMode;
-uniform bool hasNormalMap;
 uniform sampler2D diffuseMap;
 uniform sampler2D normalMap;
+#if NUM_POINT_LIGHTS > 0
 uniform PointLight pointLights[NUM_POINT_LIGHTS];
+#endif
 
 vec3 allPointLights(vec3 normal, vec3 viewDir);
 vec3 calcPointLight(PointLight light, vec3 normal, vec3 viewDir); 
 
 void main() {
 	// Calculate normal in world space based on normal map
-	vec3 normal;
-	if (hasNormalMap) {
+	vec3 normal = fs_in.norm;
+#ifdef TANGENT_SPACE
+	if (HAS_NORMAL_MAP) {
 		normal = texture(normalMap, fs_in.texCoords).rgb;
 		normal = normal * 2.0 - 1.0;
 		normal = normalize(fs_in.tangentToWorld * normal);
-	} else {
-		normal = fs_in.norm;
 	}
+#endif
 
 	// Get view direction
 	vec3 viewDir = normalize(viewPosition - fs_in.fragPos);
@@ -56,24 +89,24 @@ void main() {
 
 	// ~~~~~~~~~~ DRAWING MODES ~~~~~~~~~~
 	// Default mode
-	if (drawMode == 0) {
+	if (DRAW_MODE == 0) {
 		vec3 lighting = allPointLights(normal, viewDir);
 		fragColor = vec4(diffuseColor * lighting, 1.0);
 	} 
 	// Wireframe mode
-	else if (drawMode == 1) {
+	else if (DRAW_MODE == 1) {
 		fragColor = vec4(1.0, 1.0, 1.0, 1.0);
 	}
 	// Texture debug mode
-	else if (drawMode == 2) {
+	else if (DRAW_MODE == 2) {
 		fragColor = vec4(fs_in.texCoords, 0.0, 1.0);
 	}
 	// Normal debug mode
-	else if (drawMode == 3) {
+	else if (DRAW_MODE == 3) {
 		fragColor = vec4(normal * 0.5 + 0.5, 1.0);
 	}
 	// Lighting debug mode
-	else if (drawMode == 4) {
+	else if (DRAW_MODE == 4) {
 		vec3 lighting = allPointLights(normal, viewDir);
 		fragColor = vec4(lighting, 1.0);
 	}
@@ -82,9 +115,11 @@ void main() {
 vec3 allPointLights(vec3 normal, vec3 viewDir) {
 	vec3 lighting = vec3(0);
 
-	for (int ii = 0; ii < NUM_POINT_LIGHTS; ++ii) {
+#if NUM_POINT_LIGHTS > 0
+	for (int ii = 0; ii < POINT_LIGHT_COUNT; ++ii) {
 		lighting += calcPointLight(pointLights[ii], normal, viewDir);
 	}
+#endif
 
 	return lighting;
 }
@@ -7,8 +7,42 @@
 #include <QtOpenGL>
 
 #include "App.h"
+#include "Benchmarks.h"
 
 int main(int argc, char** argv) {
+  // Headless tools: ./App --mesh-report [objectsDir]
+  //                 ./App --generate-lods [objectsDir]
+  //                 ./App --tangent-benchmark [objectsDir]
+  //                 ./App --texture-cache-benchmark [objectsDir]
+  //                 ./App --raytrace-benchmark [objectsDir]
+  //                 ./App --pick-benchmark [objectsDir]
+  if (argc > 1 && (QString(argv[1]) == "--mesh-report" || QString(argv[1]) == "--generate-lods" || QString(argv[1]) == "--tangent-benchmark" ||
+      QString(argv[1]) == "--texture-cache-benchmark" || QString(argv[1]) == "--raytrace-benchmark" || QString(argv[1]) == "--pick-benchmark")) {
+    QString objectsDir = argc > 2 ? QString(argv[2]) : QString();
+    if (objectsDir.isEmpty()) {
+      // Find the objects dir the same way the viewer does
+      QDir dir = QDir::current();
+      while (!dir.exists("objects") && dir.cdUp()) {}
+      objectsDir = dir.filePath("objects");
+    }
+    if (QString(argv[1]) == "--generate-lods") {
+      return runLodGeneration(objectsDir);
+    }
+    if (QString(argv[1]) == "--tangent-benchmark") {
+      return runTangentBenchmark(objectsDir);
+    }
+    if (QString(argv[1]) == "--texture-cache-benchmark") {
+      return runTextureCacheBenchmark(objectsDir);
+    }
+    if (QString(argv[1]) == "--raytrace-benchmark") {
+      return runRayTraceBenchmark(objectsDir);
+    }
+    if (QString(argv[1]) == "--pick-benchmark") {
+      return runPickBenchmark(objectsDir);
+    }
+    return runMeshOptimizationReport(objectsDir);
+  }
+
   QApplication a(argc, argv);
   QString appDir = a.applicationDirPath();
   QDir::setCurrent(appDir);
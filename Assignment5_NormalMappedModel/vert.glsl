@@ -1,18 +1,26 @@
 #version 330
 
+// Only normal mapping needs the tangent basis (see the permutations in frag.glsl)
+#if defined(NORMAL_MAP) || defined(UBER_SHADER)
+#define TANGENT_SPACE
+#endif
+
 // ~~~~~~~~~~ INPUTS ~~~~~~~~~~
-layout(location = 0) in vec3 position;
+// Renderable may upload these packed; the GL unpacks them to floats on fetch
+layout(location = 0) in vec3 position;		// within [0, 1] of the mesh bounds when quantized
 layout(location = 1) in vec2 textureCoords;
 layout(location = 2) in vec3 normal;
-layout(location = 3) in vec3 tangent;
+layout(location = 3) in vec4 tangent;		// w < 0 for a left-handed tangent basis
 
 // ~~~~~~~~~~ OUTPUTS ~~~~~~~~~~
 out VS_OUT {
 	vec3 fragPos;
 	vec2 texCoords;
 	vec3 norm;
+#ifdef TANGENT_SPACE
 	vec3 tang;
 	mat3 tangentToWorld;
+#endif
 } vs_out;
 
 // ~~~~~~~~~~ UNIFORMS ~~~~~~~~~~
@@ -20,11 +28,16 @@ uniform mat4 modelMatrix;
 uniform mat4 viewMatrix;
 uniform mat4 projectionMatrix;
 uniform mat3 normalMatrix;
+// Undo position quantization; offset 0 and scale 1 for unquantized vertices
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
 
 void main()
 {
+	vec4 modelPosition = vec4(positionOffset + position * positionScale, 1.0);
+
 	// Output fragment position
-	vs_out.fragPos = vec3(modelMatrix * vec4(position, 1.0));
+	vs_out.fragPos = vec3(modelMatrix * modelPosition);
 
 	// Output texture coords
 	vs_out.texCoords = textureCoords;
@@ -32,16 +45,18 @@ void main()
 	// Output normal (in world space)
 	vs_out.norm = normalize(normalMatrix * normal);
 
+#ifdef TANGENT_SPACE
 	// Create world-to-tangent space matrix
-	vec3 T = normalize(normalMatrix * tangent);
+	vec3 T = normalize(normalMatrix * tangent.xyz);
 	vec3 N = normalize(normalMatrix * normal);
 	// re-orthogonalize T with respect to N
 	T = normalize(T - dot(T, N) * N);
 	vs_out.tang = T;
 	// then retrieve perpendicular vector B with the cross product of T and N
-	vec3 B = cross(N, T);
+	vec3 B = cross(N, T) * (tangent.w < 0.0 ? -1.0 : 1.0);
 	vs_out.tangentToWorld = mat3(T, B, N);
+#endif
 
 	// Output vertex position
-	gl_Position = projectionMatrix*viewMatrix*modelMatrix*vec4(position, 1.0);
+	gl_Position = projectionMatrix*viewMatrix*modelMatrix*modelPosition;
 }
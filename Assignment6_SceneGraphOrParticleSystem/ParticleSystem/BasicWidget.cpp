@@ -0,0 +1,412 @@
+#include "BasicWidget.h"
+
+#include "OBJLoader.h"
+#include "Sphere.h"
+
+#include <algorithm>
+
+namespace {
+	// Most particles alive at once in each fountain
+	const int FOUNTAIN_CAPACITY = 8000;
+	// GPU fountains launch this many times as many particles, into this many times the slots
+	const int GPU_FOUNTAIN_SCALE = 16;
+	// Distance between neighboring fountains
+	const float FOUNTAIN_SPACING = 6.0f;
+	// Ground samples along each side, and the distance between them
+	const int GROUND_SAMPLES = 81;
+	const float GROUND_SPACING = 0.5f;
+	const QVector3D GROUND_COLOR(0.3f, 0.32f, 0.25f);
+	// Fountains take their colors from here in turn
+	const QVector3D FOUNTAIN_COLORS[] = {
+		QVector3D(0.3f, 0.55f, 1.0f), QVector3D(1.0f, 0.6f, 0.25f), QVector3D(0.4f, 0.9f, 0.4f),
+		QVector3D(0.9f, 0.35f, 0.6f), QVector3D(0.95f, 0.9f, 0.4f)
+	};
+}
+
+//////////////////////////////////////////////////////////////////////
+// Publics
+BasicWidget::BasicWidget(QList<QDir> objectFiles, QWidget* parent) : QOpenGLWidget(parent), camera_(QVector3D(0, 5, 25), QVector3D(0, 4, 0)), objectFiles_(objectFiles),
+	ground_(GROUND_SAMPLES, GROUND_SAMPLES, GROUND_SPACING), groundMesh_(-1), gpuParticles_(false), translucent_(false), framesSinceStats_(0), updateMsSinceStats_(0.0), writeMsSinceStats_(0.0), waitMsSinceStats_(0.0),
+	sortMsSinceStats_(0.0), logger_(this), paused_(false), mouseAction_(MouseControl::NoAction)
+{
+  setFocusPolicy(Qt::StrongFocus);
+}
+
+BasicWidget::~BasicWidget()
+{
+	makeCurrent();
+	renderer_.destroy();
+	for (Fountain& fountain : fountains_) {
+		delete fountain.particles;
+		delete fountain.depthOrder;
+		fountain.gpuParticles->destroy();
+		delete fountain.gpuParticles;
+	}
+}
+
+void BasicWidget::updateScene(const qint64 msSinceLastFrame)
+{
+	if (paused_) {
+		return;
+	}
+	// Don't let a long stall launch a burst of particles all at once
+	const float dt = qMin(msSinceLastFrame, qint64(100)) / 1000.0f;
+	QElapsedTimer timer;
+	timer.start();
+	for (Fountain& fountain : fountains_) {
+		if (gpuParticles_) {
+			fountain.gpuParticles->update(dt);
+			continue;
+		}
+		ParticleSystem* particles = fountain.particles;
+		particles->update(dt, &taskPool_);
+		updateMsSinceStats_ += particles->integrateMs() + particles->interactMs() + particles->compactMs() + particles->emitMs();
+	}
+	if (gpuParticles_) {
+		// Only the time to issue the updates; the GPU does the work later
+		updateMsSinceStats_ += timer.nsecsElapsed() / 1e6;
+	}
+}
+
+void BasicWidget::renderScene()
+{
+	glEnable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+
+	glClearColor(0.01f, 0.01f, 0.01f, 1.f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	// One instanced draw per fountain, whatever its particle count
+	const QMatrix4x4 view = camera_.getViewMatrix();
+	renderer_.beginFrame(view, camera_.getProjectionMatrix());
+	renderer_.drawMesh(groundMesh_, GROUND_COLOR);
+	if (gpuParticles_) {
+		for (const Fountain& fountain : fountains_) {
+			renderer_.draw(fountain.mesh, *fountain.gpuParticles, fountain.color);
+		}
+	}
+	else if (translucent_) {
+		// Blended fountains go farthest first too; each sorts its own particles
+		QVector<const Fountain*> order;
+		for (const Fountain& fountain : fountains_) {
+			order << &fountain;
+		}
+		std::sort(order.begin(), order.end(), [&view](const Fountain* a, const Fountain* b) {
+			return view.map(a->position).z() < view.map(b->position).z();
+		});
+		for (const Fountain* fountain : order) {
+			renderer_.draw(fountain->mesh, fountain->particles->particles(), fountain->color, &taskPool_, fountain->depthOrder);
+		}
+	}
+	else {
+		for (const Fountain& fountain : fountains_) {
+			renderer_.draw(fountain.mesh, fountain.particles->particles(), fountain.color, &taskPool_);
+		}
+	}
+	renderer_.endFrame();
+	writeMsSinceStats_ += renderer_.writeMs();
+	waitMsSinceStats_ += renderer_.waitMs();
+	sortMsSinceStats_ += renderer_.sortMs();
+	logFrameStats();
+
+	// Swap buffers
+	update();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Protected
+void BasicWidget::loadFountains()
+{
+	// Every fountain gets a mesh: the sphere, then each model that loads
+	QVector<QVector<Vertex>> meshVertices;
+	QVector<QVector<Face>> meshFaces;
+	Sphere sphere;
+	meshVertices << sphere.vertices();
+	meshFaces << sphere.faces();
+
+	qDebug() << "Loading objects...";
+	for (QDir& obj : objectFiles_) {
+		QString path = obj.path();
+		qDebug() << "  Loading" << path.right(path.size() - path.lastIndexOf("/") - 1);
+		QVector<Vertex> vertices;
+		QVector<Face> faces;
+		QString diffuseMap;
+		QString normalMap;
+		if (OBJLoader::loadMesh(path, vertices, faces, diffuseMap, normalMap)) {
+			qDebug() << "    Success";
+			meshVertices << vertices;
+			meshFaces << faces;
+		}
+		else {
+			qDebug() << "    Failure";
+		}
+	}
+
+	// The ground, low enough everywhere that the fountains stand above it
+	ground_.generateHills(-1.5f, 1.0f, 30.0f, 7);
+	QVector<Vertex> groundVertices;
+	QVector<Face> groundFaces;
+	ground_.buildMesh(groundVertices, groundFaces);
+	groundMesh_ = renderer_.addMesh(groundVertices, groundFaces, false);
+
+	const int fountainCount = meshVertices.size();
+	const int colorCount = sizeof(FOUNTAIN_COLORS) / sizeof(FOUNTAIN_COLORS[0]);
+	for (int ii = 0; ii < fountainCount; ++ii) {
+		Fountain fountain;
+		fountain.mesh = renderer_.addMesh(meshVertices[ii], meshFaces[ii]);
+		fountain.color = FOUNTAIN_COLORS[ii % colorCount];
+		fountain.particles = new ParticleSystem(FOUNTAIN_CAPACITY);
+		fountain.depthOrder = new RadixSort();
+		fountain.particles->setGravity(QVector3D(0, -4, 0));
+		ParticleInteractions& interactions = fountain.particles->interactions();
+		ParticleInteractions::Settings interactionSettings;
+		interactionSettings.radius = 0.6f;
+		interactions.setSettings(interactionSettings);
+		interactions.setGround(&ground_);
+
+		Emitter::Settings settings;
+		settings.position = QVector3D((ii - (fountainCount - 1) * 0.5f) * FOUNTAIN_SPACING, 0, 0);
+		fountain.position = settings.position;
+		settings.rate = 1500.0f;
+		settings.speed = 9.0f;
+		settings.spread = 0.25f;
+		settings.scale = 0.25f;
+		settings.scaleJitter = 0.05f;
+		settings.scaleRate = -0.04f;
+		fountain.particles->addEmitter(settings, ii + 1);
+
+		fountain.gpuParticles = new GpuParticleSystem(FOUNTAIN_CAPACITY * GPU_FOUNTAIN_SCALE);
+		if (!fountain.gpuParticles->create()) {
+			quit("Could not create GPU particles", 1);
+		}
+		fountain.gpuParticles->setGravity(fountain.particles->gravity());
+		settings.rate *= GPU_FOUNTAIN_SCALE;
+		fountain.gpuParticles->addEmitter(settings, ii + 1);
+		fountains_ << fountain;
+	}
+}
+
+void BasicWidget::logFrameStats()
+{
+	++framesSinceStats_;
+	if (statsTimer_.elapsed() < 1000) {
+		return;
+	}
+	if (gpuParticles_) {
+		// Counting live GPU particles would mean reading them back, so report slots instead
+		qDebug().noquote() << QString("Frame stats: %1 fps, %2 GPU particle slots, %3 draw calls, %4 ms/frame issuing updates")
+			.arg(framesSinceStats_)
+			.arg(renderer_.instancesDrawn())
+			.arg(renderer_.drawCalls())
+			.arg(updateMsSinceStats_ / framesSinceStats_, 0, 'f', 3);
+		framesSinceStats_ = 0;
+		updateMsSinceStats_ = 0.0;
+		statsTimer_.restart();
+		return;
+	}
+	int particleCount = 0;
+	for (const Fountain& fountain : fountains_) {
+		particleCount += fountain.particles->particles().size();
+	}
+	qDebug().noquote() << QString("Frame stats: %1 fps, %2 particles, %3 draw calls, %4 instances, %5 ms/frame updating (%6 integrator, interactions %7)")
+		.arg(framesSinceStats_)
+		.arg(particleCount)
+		.arg(renderer_.drawCalls())
+		.arg(renderer_.instancesDrawn())
+		.arg(updateMsSinceStats_ / framesSinceStats_, 0, 'f', 3)
+		.arg(fountains_.isEmpty() || fountains_[0].particles->particles().integrator() == ParticlePool::Integrator::Simd ? "SIMD" : "scalar")
+		.arg(!fountains_.isEmpty() && fountains_[0].particles->interactions().neighborsEnabled() ? "on" : "off");
+	qDebug().noquote() << QString("  Instance streaming (%1): %2 ms/frame writing, %3 ms/frame waiting on the GPU")
+		.arg(renderer_.streaming() == ParticleRenderer::Streaming::Ring ? "fenced ring" : "orphaning")
+		.arg(writeMsSinceStats_ / framesSinceStats_, 0, 'f', 3)
+		.arg(waitMsSinceStats_ / framesSinceStats_, 0, 'f', 3);
+	if (translucent_ && !fountains_.isEmpty()) {
+		static const char* paths[] = { "empty", "still sorted", "repaired", "radix sorted" };
+		const RadixSort* depthOrder = fountains_[0].depthOrder;
+		qDebug().noquote() << QString("  Back to front: %1 ms/frame sorting, first fountain's last order %2 (%3 items moved)")
+			.arg(sortMsSinceStats_ / framesSinceStats_, 0, 'f', 3)
+			.arg(paths[int(depthOrder->lastPath())])
+			.arg(depthOrder->repairedCount());
+	}
+	framesSinceStats_ = 0;
+	updateMsSinceStats_ = 0.0;
+	writeMsSinceStats_ = 0.0;
+	waitMsSinceStats_ = 0.0;
+	sortMsSinceStats_ = 0.0;
+	statsTimer_.restart();
+}
+
+void BasicWidget::quit(QString message, int exitCode) {
+	qDebug() << "Quitting:" << message;
+	close();
+	((QWidget*)parent())->close();
+	delete this;
+	exit(exitCode);
+}
+
+void BasicWidget::keyReleaseEvent(QKeyEvent* keyEvent)
+{
+  // Handle key events here.
+	switch (keyEvent->key()) {
+		case Qt::Key_Q:
+			quit("Manual quit", 0);
+			break;
+		case Qt::Key_Space:
+			paused_ = !paused_;
+			qDebug() << "Particles" << (paused_ ? "paused." : "unpaused.");
+			break;
+		case Qt::Key_I: {
+			const bool simd = fountains_.isEmpty() || fountains_[0].particles->particles().integrator() == ParticlePool::Integrator::Simd;
+			for (Fountain& fountain : fountains_) {
+				fountain.particles->particles().setIntegrator(simd ? ParticlePool::Integrator::Scalar : ParticlePool::Integrator::Simd);
+			}
+			qDebug() << (simd ? "Using the scalar integrator." : "Using the SIMD integrator.");
+			break;
+		}
+		case Qt::Key_K: {
+			const bool enabled = !fountains_.isEmpty() && !fountains_[0].particles->interactions().neighborsEnabled();
+			for (Fountain& fountain : fountains_) {
+				fountain.particles->interactions().setNeighborsEnabled(enabled);
+			}
+			qDebug() << (enabled ? "Particles push each other apart." : "Particles ignore each other.");
+			break;
+		}
+		case Qt::Key_G:
+			gpuParticles_ = !gpuParticles_;
+			qDebug() << (gpuParticles_ ? "Simulating particles on the GPU with transform feedback." : "Simulating particles on the CPU.");
+			break;
+		case Qt::Key_T:
+			translucent_ = !translucent_;
+			qDebug() << (translucent_ ? "Drawing CPU particles translucent, sorted back to front." : "Drawing CPU particles opaque.");
+			break;
+		case Qt::Key_O:
+			makeCurrent();
+			renderer_.setStreaming(renderer_.streaming() == ParticleRenderer::Streaming::Ring ? ParticleRenderer::Streaming::Orphan : ParticleRenderer::Streaming::Ring);
+			qDebug() << (renderer_.streaming() == ParticleRenderer::Streaming::Ring ? "Streaming instances through the fenced ring." : "Streaming instances by orphaning the buffer.");
+			break;
+		case Qt::Key_R:
+			camera_.reset();
+			qDebug() << "Camera orientation reset.";
+			update();
+			break;
+		default:
+			qDebug() << "You Pressed an unsupported Key!";
+			break;
+	}
+}
+
+void BasicWidget::mousePressEvent(QMouseEvent* mouseEvent)
+{
+	if (mouseEvent->button() == Qt::LeftButton) {
+		mouseAction_ = MouseControl::Rotate;
+	}
+	else if (mouseEvent->button() == Qt::RightButton) {
+		mouseAction_ = MouseControl::Zoom;
+	}
+	lastMouseLoc_ = mouseEvent->pos();
+}
+
+void BasicWidget::mouseMoveEvent(QMouseEvent* mouseEvent)
+{
+	if (mouseAction_ == MouseControl::NoAction) {
+		return;
+	}
+	QPoint delta = mouseEvent->pos() - lastMouseLoc_;
+	lastMouseLoc_ = mouseEvent->pos();
+	if (mouseAction_ == MouseControl::Rotate) {
+		camera_.rotateAboutFocus(delta.x(), delta.y());
+	}
+	else if (mouseAction_ == MouseControl::Zoom) {
+		float zoomScale = 0.1f;
+		camera_.zoomCamera(delta.y() * zoomScale);
+	}
+	update();
+}
+
+void BasicWidget::mouseReleaseEvent(QMouseEvent* mouseEvent)
+{
+	mouseAction_ = MouseControl::NoAction;
+}
+
+void BasicWidget::initializeGL()
+{
+  makeCurrent();
+  initializeOpenGLFunctions();
+
+	qDebug() << "Current path:";
+  qDebug() << QDir::currentPath();
+
+	// Declare object files if none are given
+	if (objectFiles_.isEmpty()) {
+		// Find objects dir
+		QDir dir = QDir::current();
+		while (!dir.exists("objects")) {
+			dir.cdUp();
+		}
+		dir.cd("objects");
+
+		objectFiles_ = {
+			dir.filePath("bunny_centered.obj"),
+			dir.filePath("monkey_centered.obj"),
+			dir.filePath("cube.obj")
+		};
+	}
+
+	// Each fountain has a mesh, so fountains are made once the renderer can take them
+	const int maxFountains = objectFiles_.size() + 1;
+	if (!renderer_.create(maxFountains * FOUNTAIN_CAPACITY)) {
+		quit("Could not create the particle renderer", 1);
+	}
+	loadFountains();
+
+	// Print instructions
+	qDebug() << "\n\nPass object files to the program like so: ./App \"path/to/object1.obj\" \"path/to/object2.obj\" ...";
+	qDebug() << "Each model gets a fountain of its own, next to a fountain of spheres. Without any, the bunny, monkey and cube are loaded.";
+	qDebug() <<
+		"Hotkeys:\n" <<
+		"  Camera Controls:\n" <<
+		"    Left click and drag to move the camera.\n" <<
+		"    Right click and drag to zoom the camera in/out.\n" <<
+		"    Press R to reset the camera to its original orientation.\n" <<
+		"  Particle Controls:\n" <<
+		"    Press spacebar to pause the fountains.\n" <<
+		"    Press I to switch between the SIMD and scalar integrators.\n" <<
+		"    Press O to switch between streaming instances through a fenced ring and orphaning.\n" <<
+		"    Press K to make CPU particles push each other apart, or stop them.\n" <<
+		"    Press G to switch between CPU particles and 16 times as many GPU particles.\n" <<
+		"    Press T to draw CPU particles translucent, sorted back to front, or opaque.\n" <<
+		"  Quitting:\n" <<
+		"    Press Q to quit.\n\n";
+
+	// Prepare for render
+	glViewport(0, 0, width(), height());
+	frameTimer_.start();
+	statsTimer_.start();
+}
+
+void BasicWidget::resizeGL(int w, int h)
+{
+	if (!logger_.isLogging()) {
+		logger_.initialize();
+		// Setup the logger for real-time messaging
+		connect(&logger_, &QOpenGLDebugLogger::messageLogged, [=]() {
+			const QList<QOpenGLDebugMessage> messages = logger_.loggedMessages();
+			for (auto msg : messages) {
+				qDebug() << msg;
+			}
+		});
+		logger_.startLogging();
+	}
+
+	camera_.setPerspective(70.f, (float)w / (float)h, 0.1, 1000.0);
+  glViewport(0, 0, w, h);
+}
+
+void BasicWidget::paintGL()
+{
+  qint64 msSinceRestart = frameTimer_.restart();
+
+	updateScene(msSinceRestart);
+
+	renderScene();
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <QtGui>
+#include <QtWidgets>
+#include <QtOpenGL>
+
+#include "Camera.h"
+#include "GpuParticleSystem.h"
+#include "Heightfield.h"
+#include "ParticleRenderer.h"
+#include "ParticleSystem.h"
+#include "TaskPool.h"
+
+/**
+ * A row of fountains, one per model, each spraying instances of its model onto hilly ground.
+ */
+class BasicWidget : public QOpenGLWidget, protected QOpenGLFunctions
+{
+  Q_OBJECT
+
+private:
+	// A fountain's particles all share one mesh and color. It has a CPU and a GPU system
+	// with the same emitter; only the one in use is updated. Its CPU particles keep their
+	// back to front order for when they're translucent.
+	struct Fountain {
+		ParticleSystem* particles;
+		GpuParticleSystem* gpuParticles;
+		RadixSort* depthOrder;
+		int mesh;
+		QVector3D color;
+		QVector3D position;
+	};
+
+	Camera camera_;
+	QList<QDir> objectFiles_;
+  QVector<Fountain> fountains_;
+  // Rolling ground the CPU particles land on
+  Heightfield ground_;
+  int groundMesh_;
+  ParticleRenderer renderer_;
+  TaskPool taskPool_;
+  bool gpuParticles_;
+  bool translucent_;
+
+  QElapsedTimer frameTimer_;
+  // Frame stats, logged once per second
+  QElapsedTimer statsTimer_;
+  int framesSinceStats_;
+  double updateMsSinceStats_;
+  double writeMsSinceStats_;
+  double waitMsSinceStats_;
+  double sortMsSinceStats_;
+
+  QOpenGLDebugLogger logger_;
+
+	bool paused_;
+
+	// Mouse controls.
+	enum class MouseControl { NoAction = 0, Rotate, Zoom };
+	QPoint lastMouseLoc_;
+	MouseControl mouseAction_;
+
+protected:
+  void loadFountains();
+  void logFrameStats();
+
+  // Required interaction overrides
+  void keyReleaseEvent(QKeyEvent* keyEvent) override;
+	void mousePressEvent(QMouseEvent* mouseEvent) override;
+	void mouseMoveEvent(QMouseEvent* mouseEvent) override;
+	void mouseReleaseEvent(QMouseEvent* mouseEvent) override;
+
+  // Required overrides form QOpenGLWidget
+  void initializeGL() override;
+  void resizeGL(int w, int h) override;
+  void paintGL() override;
+
+	void quit(QString message, int exitCode);
+
+public:
+  BasicWidget(QList<QDir> objectFiles, QWidget* parent=nullptr);
+  virtual ~BasicWidget();
+
+  void updateScene(const qint64 msSinceLastFrame);
+  void renderScene();
+
+  // Make sure we have some size that makes sense.
+  QSize sizeHint() const {return QSize(800,600);}
+};
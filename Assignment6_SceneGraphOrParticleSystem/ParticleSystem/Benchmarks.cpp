@@ -0,0 +1,485 @@
+#include "Benchmarks.h"
+#include "GpuParticleSystem.h"
+#include "Heightfield.h"
+#include "ParticleRenderer.h"
+#include "ParticleSystem.h"
+#include "RadixSort.h"
+#include "TaskPool.h"
+
+#include <QtGui>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+	const float FRAME_SECONDS = 1.0f / 60.0f;
+	const int EMITTER_COUNT = 8;
+
+	// Thread counts to time: the powers of two below maxThreads, then maxThreads itself
+	QVector<int> threadCounts(int maxThreads)
+	{
+		QVector<int> counts;
+		for (int threads = 1; threads < maxThreads; threads *= 2) {
+			counts << threads;
+		}
+		counts << maxThreads;
+		return counts;
+	}
+
+	struct ParticleRun {
+		double integrateMs = 0.0;
+		double compactMs = 0.0;
+		double emitMs = 0.0;
+		// Interactions, split into hashing, neighbor sums and collisions
+		double hashMs = 0.0;
+		double neighborMs = 0.0;
+		double collideMs = 0.0;
+		qint64 pairs = 0;
+		qint64 updated = 0;
+		QVector<float> finalState;
+
+		inline double interactMs() const { return hashMs + neighborMs + collideMs; }
+		inline double totalMs() const { return integrateMs + compactMs + emitMs + interactMs(); }
+	};
+}
+
+// A ring of fountains that keeps a pool of particleCount particles about full: they emit a
+// quarter faster than particles die, and the pool turns the excess away.
+static Emitter::Settings fountainSettings(int fountain, int particleCount)
+{
+	const float angle = fountain * 6.28318531f / EMITTER_COUNT;
+	Emitter::Settings settings;
+	settings.position = QVector3D(10.0f * std::cos(angle), 0.0f, 10.0f * std::sin(angle));
+	settings.rate = 1.25f * particleCount / (EMITTER_COUNT * settings.lifespan);
+	return settings;
+}
+
+static void buildFountains(ParticleSystem& system, int particleCount)
+{
+	for (int ii = 0; ii < EMITTER_COUNT; ++ii) {
+		system.addEmitter(fountainSettings(ii, particleCount), 1 + ii);
+	}
+}
+
+// Enough frames for the first particles launched to have died
+static int warmUpFrames(const Emitter::Settings& settings)
+{
+	return int((settings.lifespan + settings.lifespanJitter) / FRAME_SECONDS) + 1;
+}
+
+// Warm a fresh system up to its steady state, then time frames of it. Given ground, the
+// particles also push each other apart and land on it.
+static ParticleRun timeParticles(int particleCount, int frames, ParticlePool::Integrator integrator, TaskPool* pool, const Heightfield* ground = nullptr)
+{
+	ParticleSystem system(particleCount);
+	system.particles().setIntegrator(integrator);
+	buildFountains(system, particleCount);
+	if (ground) {
+		system.interactions().setNeighborsEnabled(true);
+		system.interactions().setGround(ground);
+	}
+	const int warmFrames = warmUpFrames(system.emitters().first()->settings());
+	for (int frame = 0; frame < warmFrames; ++frame) {
+		system.update(FRAME_SECONDS, pool);
+	}
+
+	ParticleRun run;
+	for (int frame = 0; frame < frames; ++frame) {
+		run.updated += system.particles().size();
+		system.update(FRAME_SECONDS, pool);
+		run.integrateMs += system.integrateMs();
+		run.compactMs += system.compactMs();
+		run.emitMs += system.emitMs();
+		run.hashMs += system.interactions().hashMs();
+		run.neighborMs += system.interactions().neighborMs();
+		run.collideMs += system.interactions().collideMs();
+		run.pairs += system.interactions().pairCount();
+	}
+
+	const ParticlePool& particles = system.particles();
+	run.finalState.resize(particles.size() * ParticlePool::STREAM_COUNT);
+	for (int ii = 0; ii < ParticlePool::STREAM_COUNT; ++ii) {
+		std::memcpy(run.finalState.data() + particles.size() * ii, particles.stream(ParticlePool::Stream(ii)), particles.size() * sizeof(float));
+	}
+	return run;
+}
+
+static QString describeRun(const ParticleRun& run, int frames)
+{
+	return QString("%1 ms/frame (integrate %2, compact %3, emit %4), %5 M particles/s")
+		.arg(run.totalMs() / frames, 0, 'f', 3)
+		.arg(run.integrateMs / frames, 0, 'f', 3)
+		.arg(run.compactMs / frames, 0, 'f', 3)
+		.arg(run.emitMs / frames, 0, 'f', 3)
+		.arg(run.updated / (run.totalMs() * 1e3), 0, 'f', 1);
+}
+
+int runParticleBenchmark(int particleCount)
+{
+	const int frames = 200;
+	const int maxThreads = qMax(1, (int)std::thread::hardware_concurrency());
+
+	qDebug().noquote() << QString("Particle benchmark: %1 particles from %2 emitters, %3 frames after warming up, up to %4 threads")
+		.arg(particleCount).arg(EMITTER_COUNT).arg(frames).arg(maxThreads);
+
+	const ParticleRun scalar = timeParticles(particleCount, frames, ParticlePool::Integrator::Scalar, nullptr);
+	qDebug().noquote() << "  scalar, 1 thread:" << describeRun(scalar, frames);
+
+	// Same operations on the same particles in every run, so all of them should be bit for
+	// bit equal to the scalar run
+	bool allMatch = true;
+	for (int threads : threadCounts(maxThreads)) {
+		TaskPool pool(threads);
+		const ParticleRun run = timeParticles(particleCount, frames, ParticlePool::Integrator::Simd, threads > 1 ? &pool : nullptr);
+		const bool match = run.finalState.size() == scalar.finalState.size() &&
+			std::memcmp(run.finalState.constData(), scalar.finalState.constData(), run.finalState.size() * sizeof(float)) == 0;
+		allMatch = allMatch && match;
+
+		qDebug().noquote() << QString("  SIMD, %1 threads: %2, %3x scalar, %4")
+			.arg(threads)
+			.arg(describeRun(run, frames))
+			.arg(scalar.totalMs() / run.totalMs(), 0, 'f', 2)
+			.arg(match ? "matches scalar" : "DIFFERS FROM SCALAR");
+	}
+	return allMatch ? 0 : 1;
+}
+
+// Scatter particleCount particles through a box around the origin and check the hash finds
+// exactly the pairs a brute-force search over every pair does
+static bool checkNeighbors(int particleCount)
+{
+	const float side = 12.0f;
+	// xorshift32, as the emitters use
+	quint32 state = 1u;
+	auto random = [&state]() {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return (state >> 8) * (1.0f / 16777216.0f);
+	};
+
+	std::vector<float> values(size_t(particleCount) * ParticlePool::STREAM_COUNT, 0.0f);
+	const float* streams[ParticlePool::STREAM_COUNT];
+	for (int ii = 0; ii < ParticlePool::STREAM_COUNT; ++ii) {
+		streams[ii] = values.data() + size_t(particleCount) * ii;
+	}
+	for (int ii = 0; ii < 3 * particleCount; ++ii) {
+		values[ii] = (random() - 0.5f) * side;
+	}
+	ParticlePool particles(particleCount);
+	particles.append(streams, particleCount);
+
+	// No limit on neighbors, so every pair in range counts
+	ParticleInteractions interactions;
+	ParticleInteractions::Settings settings = interactions.settings();
+	settings.maxNeighbors = particleCount;
+	interactions.setSettings(settings);
+	interactions.setNeighborsEnabled(true);
+	interactions.apply(particles, FRAME_SECONDS);
+
+	const float rangeSquared = settings.radius * settings.radius;
+	const float* x = streams[ParticlePool::PositionX];
+	const float* y = streams[ParticlePool::PositionY];
+	const float* z = streams[ParticlePool::PositionZ];
+	qint64 pairs = 0;
+	for (int ii = 0; ii < particleCount; ++ii) {
+		for (int jj = 0; jj < particleCount; ++jj) {
+			const float dx = x[ii] - x[jj];
+			const float dy = y[ii] - y[jj];
+			const float dz = z[ii] - z[jj];
+			const float distanceSquared = dx * dx + dy * dy + dz * dz;
+			if (ii != jj && distanceSquared < rangeSquared && distanceSquared >= 1e-12f) {
+				++pairs;
+			}
+		}
+	}
+
+	const bool match = interactions.pairCount() == pairs;
+	qDebug().noquote() << QString("  neighbor check, %1 particles: hash found %2 pairs, brute force %3, %4")
+		.arg(particleCount).arg(interactions.pairCount()).arg(pairs)
+		.arg(match ? "matches" : "DIFFERS");
+	return match;
+}
+
+int runInteractionBenchmark(int particleCount)
+{
+	const int frames = 100;
+	const int maxThreads = qMax(1, (int)std::thread::hardware_concurrency());
+
+	// Hills under the whole ring of fountains, below their nozzles
+	Heightfield ground(61, 61, 0.5f);
+	ground.generateHills(-1.5f, 1.0f, 20.0f, 7);
+
+	qDebug().noquote() << QString("Interaction benchmark: %1 particles from %2 emitters pushing each other and landing on a %3x%4 heightfield, %5 frames after warming up, up to %6 threads")
+		.arg(particleCount).arg(EMITTER_COUNT).arg(ground.columns()).arg(ground.rows()).arg(frames).arg(maxThreads);
+
+	// Every thread count must give exactly the single thread's particles
+	ParticleRun single;
+	bool allMatch = checkNeighbors(2000);
+	for (int threads : threadCounts(maxThreads)) {
+		TaskPool pool(threads);
+		const ParticleRun run = timeParticles(particleCount, frames, ParticlePool::Integrator::Simd, threads > 1 ? &pool : nullptr, &ground);
+		if (threads == 1) {
+			single = run;
+		}
+		const bool match = run.finalState.size() == single.finalState.size() &&
+			std::memcmp(run.finalState.constData(), single.finalState.constData(), run.finalState.size() * sizeof(float)) == 0;
+		allMatch = allMatch && match;
+
+		qDebug().noquote() << QString("  %1 threads: %2 ms/frame interacting (hash %3, neighbors %4, collide %5), %6 neighbors per particle, %7 M particles/s overall, %8x 1 thread, %9")
+			.arg(threads)
+			.arg(run.interactMs() / frames, 0, 'f', 3)
+			.arg(run.hashMs / frames, 0, 'f', 3)
+			.arg(run.neighborMs / frames, 0, 'f', 3)
+			.arg(run.collideMs / frames, 0, 'f', 3)
+			.arg(double(run.pairs) / qMax(run.updated, qint64(1)), 0, 'f', 1)
+			.arg(run.updated / (run.totalMs() * 1e3), 0, 'f', 2)
+			.arg(single.interactMs() / run.interactMs(), 0, 'f', 2)
+			.arg(match ? "matches 1 thread" : "DIFFERS FROM 1 THREAD");
+	}
+	return allMatch ? 0 : 1;
+}
+
+int runSortBenchmark(int particleCount)
+{
+	const int frames = 40;
+	const int maxThreads = qMax(1, (int)std::thread::hardware_concurrency());
+	// The particles move under a still camera, then stop, then the camera slowly orbits them
+	const int PHASES = 3;
+	const char* phaseNames[PHASES] = { "particles moving, camera still", "particles paused, camera still", "particles paused, camera orbiting" };
+	const float orbitDegreesPerFrame = 0.1f;
+
+	qDebug().noquote() << QString("Sort benchmark: %1 particles from %2 emitters sorted back to front, %3 frames per phase after warming up, up to %4 threads")
+		.arg(particleCount).arg(EMITTER_COUNT).arg(frames).arg(maxThreads);
+
+	// One sorter per method and thread count, each keeping its own last order across frames
+	struct Sorter {
+		int threads;
+		bool coherent;
+		TaskPool* pool;
+		RadixSort sort;
+		double ms[PHASES] = {};
+		int paths[PHASES][4] = {};
+		qint64 repaired[PHASES] = {};
+		bool valid = true;
+		bool matchesSingle = true;
+	};
+	QVector<TaskPool*> pools;
+	for (int threads : threadCounts(maxThreads)) {
+		pools << (threads > 1 ? new TaskPool(threads) : nullptr);
+	}
+	std::vector<Sorter*> sorters;
+	for (int coherent = 0; coherent < 2; ++coherent) {
+		for (TaskPool* pool : pools) {
+			Sorter* sorter = new Sorter();
+			sorter->threads = pool ? pool->threadCount() : 1;
+			sorter->coherent = coherent == 1;
+			sorter->pool = pool;
+			sorter->sort.setCoherent(sorter->coherent);
+			sorters.push_back(sorter);
+		}
+	}
+
+	ParticleSystem system(particleCount);
+	system.particles().setIntegrator(ParticlePool::Integrator::Simd);
+	buildFountains(system, particleCount);
+	const int warmFrames = warmUpFrames(system.emitters().first()->settings());
+	for (int frame = 0; frame < warmFrames; ++frame) {
+		system.update(FRAME_SECONDS);
+	}
+
+	std::vector<float> depths;
+	std::vector<std::pair<float, quint32>> reference;
+	std::vector<quint8> seen;
+	double referenceMs[PHASES] = {};
+	qint64 sorted[PHASES] = {};
+	for (int frame = 0; frame < PHASES * frames; ++frame) {
+		const int phase = frame / frames;
+		QMatrix4x4 view;
+		view.lookAt(QVector3D(0, 8, 30), QVector3D(0, 2, 0), QVector3D(0, 1, 0));
+		if (phase == 0) {
+			system.update(FRAME_SECONDS);
+		}
+		else if (phase == 2) {
+			view.rotate((frame - 2 * frames) * orbitDegreesPerFrame, 0, 1, 0);
+		}
+		const ParticlePool& particles = system.particles();
+		const int count = particles.size();
+		depths.resize(count);
+		ParticleRenderer::writeDepths(depths.data(), particles, count, view);
+		sorted[phase] += count;
+
+		QElapsedTimer timer;
+		timer.start();
+		reference.resize(count);
+		for (int ii = 0; ii < count; ++ii) {
+			reference[ii] = std::make_pair(depths[ii], quint32(ii));
+		}
+		std::sort(reference.begin(), reference.end());
+		referenceMs[phase] += timer.nsecsElapsed() / 1e6;
+
+		const Sorter* single = nullptr;
+		for (Sorter* sorter : sorters) {
+			timer.start();
+			sorter->sort.sort(depths.data(), count, sorter->pool);
+			sorter->ms[phase] += timer.nsecsElapsed() / 1e6;
+			++sorter->paths[phase][int(sorter->sort.lastPath())];
+			sorter->repaired[phase] += sorter->sort.repairedCount();
+
+			// Same depths as std::sort in the same order, each particle exactly once; ties
+			// may come in any order
+			const quint32* order = sorter->sort.order();
+			seen.assign(count, 0);
+			bool valid = sorter->sort.size() == count;
+			for (int ii = 0; valid && ii < count; ++ii) {
+				valid = order[ii] < quint32(count) && !seen[order[ii]] && depths[order[ii]] == reference[ii].first;
+				if (valid) {
+					seen[order[ii]] = 1;
+				}
+			}
+			sorter->valid = sorter->valid && valid;
+			if (sorter->threads == 1) {
+				single = sorter;
+			}
+			else {
+				sorter->matchesSingle = sorter->matchesSingle && std::equal(order, order + count, single->sort.order());
+			}
+		}
+	}
+
+	bool allGood = true;
+	for (const Sorter* sorter : sorters) {
+		allGood = allGood && sorter->valid && sorter->matchesSingle;
+	}
+	for (int phase = 0; phase < PHASES; ++phase) {
+		qDebug().noquote() << QString("  %1:").arg(phaseNames[phase]);
+		qDebug().noquote() << QString("    std::sort, 1 thread: %1 ms/frame, %2 M keys/s")
+			.arg(referenceMs[phase] / frames, 0, 'f', 3)
+			.arg(sorted[phase] / (referenceMs[phase] * 1e3), 0, 'f', 1);
+		for (const Sorter* sorter : sorters) {
+			const int* paths = sorter->paths[phase];
+			QString line = QString("    %1, %2 threads: %3 ms/frame, %4 M keys/s, %5x std::sort, %6")
+				.arg(sorter->coherent ? "radix from last order" : "radix from scratch")
+				.arg(sorter->threads)
+				.arg(sorter->ms[phase] / frames, 0, 'f', 3)
+				.arg(sorted[phase] / (sorter->ms[phase] * 1e3), 0, 'f', 1)
+				.arg(referenceMs[phase] / sorter->ms[phase], 0, 'f', 2)
+				.arg(!sorter->valid ? "WRONG ORDER" : sorter->matchesSingle ? "sorted, matches 1 thread" : "sorted, DIFFERS FROM 1 THREAD");
+			if (sorter->coherent) {
+				const int repairs = paths[int(RadixSort::Path::Repaired)];
+				line += QString(" (frames still sorted %1, repaired %2 with %3 items moved on average, radix sorted %4)")
+					.arg(paths[int(RadixSort::Path::Coherent)])
+					.arg(repairs)
+					.arg(repairs > 0 ? sorter->repaired[phase] / repairs : 0)
+					.arg(paths[int(RadixSort::Path::Radix)]);
+			}
+			qDebug().noquote() << line;
+		}
+	}
+	for (Sorter* sorter : sorters) {
+		delete sorter;
+	}
+	qDeleteAll(pools);
+	return allGood ? 0 : 1;
+}
+
+int runGpuParticleBenchmark(int particleCount)
+{
+	const int frames = 200;
+	const int threads = qMax(1, (int)std::thread::hardware_concurrency());
+
+	QOffscreenSurface surface;
+	surface.create();
+	QOpenGLContext context;
+	if (!context.create() || !context.makeCurrent(&surface)) {
+		qDebug() << "GPU particle benchmark: could not create a GL context";
+		return 1;
+	}
+	QOpenGLExtraFunctions* gl = context.extraFunctions();
+	qDebug().noquote() << QString("GPU particle benchmark: %1 particles from %2 emitters, %3 frames after warming up, on %4")
+		.arg(particleCount).arg(EMITTER_COUNT).arg(frames)
+		.arg(reinterpret_cast<const char*>(gl->glGetString(GL_RENDERER)));
+
+	// CPU path as the widget runs it: SIMD update on every thread, then the particles
+	// converted to instances and uploaded for drawing
+	double cpuMs = 0.0;
+	qint64 cpuUpdated = 0;
+	int cpuAlive = 0;
+	{
+		TaskPool pool(threads);
+		ParticleSystem system(particleCount);
+		system.particles().setIntegrator(ParticlePool::Integrator::Simd);
+		buildFountains(system, particleCount);
+		QVector<ParticleInstance> instances(particleCount);
+		GLuint buffer = 0;
+		gl->glGenBuffers(1, &buffer);
+		gl->glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+		const int warmFrames = warmUpFrames(system.emitters().first()->settings());
+		for (int frame = 0; frame < warmFrames; ++frame) {
+			system.update(FRAME_SECONDS, &pool);
+		}
+		gl->glFinish();
+		QElapsedTimer timer;
+		timer.start();
+		for (int frame = 0; frame < frames; ++frame) {
+			system.update(FRAME_SECONDS, &pool);
+			const ParticlePool& particles = system.particles();
+			ParticleRenderer::writeInstances(instances.data(), particles, particles.size(), QVector3D(1, 1, 1), &pool);
+			gl->glBufferData(GL_ARRAY_BUFFER, qint64(particles.size()) * sizeof(ParticleInstance), instances.constData(), GL_STREAM_DRAW);
+			cpuUpdated += particles.size();
+		}
+		gl->glFinish();
+		cpuMs = timer.nsecsElapsed() / 1e6;
+		cpuAlive = system.particles().size();
+
+		gl->glBindBuffer(GL_ARRAY_BUFFER, 0);
+		gl->glDeleteBuffers(1, &buffer);
+	}
+	qDebug().noquote() << QString("  CPU SoA, %1 threads: %2 ms/frame, %3 M particles/s, %4 KB uploaded per frame, %5 alive")
+		.arg(threads)
+		.arg(cpuMs / frames, 0, 'f', 3)
+		.arg(cpuUpdated / (cpuMs * 1e3), 0, 'f', 1)
+		.arg(cpuUpdated * sizeof(ParticleInstance) / (1024.0 * frames), 0, 'f', 1)
+		.arg(cpuAlive);
+
+	// GPU path: every slot is advanced each update, and only uniforms go up
+	GpuParticleSystem system(particleCount);
+	if (!system.create()) {
+		return 1;
+	}
+	system.setGravity(QVector3D(0, -1, 0));
+	for (int ii = 0; ii < EMITTER_COUNT; ++ii) {
+		system.addEmitter(fountainSettings(ii, particleCount), 1 + ii);
+	}
+	const int warmFrames = warmUpFrames(system.emitters().first()->settings());
+	for (int frame = 0; frame < warmFrames; ++frame) {
+		system.update(FRAME_SECONDS);
+	}
+	gl->glFinish();
+	QElapsedTimer timer;
+	timer.start();
+	for (int frame = 0; frame < frames; ++frame) {
+		system.update(FRAME_SECONDS);
+	}
+	gl->glFinish();
+	const double gpuMs = timer.nsecsElapsed() / 1e6;
+	const qint64 gpuUpdated = qint64(system.capacity()) * frames;
+	const int gpuAlive = system.countAlive();
+	system.destroy();
+
+	// Uniform bytes per update: the globals plus each emitter's block
+	const int uniformBytes = 4 * 7 + EMITTER_COUNT * 4 * (2 + 4 * 5 + 1);
+	qDebug().noquote() << QString("  GPU transform feedback: %1 ms/frame, %2 M particles/s, %3 bytes of uniforms per frame, %4 alive, %5x CPU")
+		.arg(gpuMs / frames, 0, 'f', 3)
+		.arg(gpuUpdated / (gpuMs * 1e3), 0, 'f', 1)
+		.arg(uniformBytes)
+		.arg(gpuAlive)
+		.arg(cpuMs / gpuMs, 0, 'f', 2);
+
+	context.doneCurrent();
+	return 0;
+}
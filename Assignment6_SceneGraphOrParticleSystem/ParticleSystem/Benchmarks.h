@@ -0,0 +1,28 @@
+#pragma once
+
+#include <QtCore>
+
+// Headless benchmarks, run from the command line instead of opening a window.
+// See main.cpp for the flags that select them.
+
+// Run a steady-state system of particleCount particles with the scalar and SIMD integrators
+// and across thread counts, reporting particles updated per second and checking every
+// run ends with the same particles
+int runParticleBenchmark(int particleCount);
+
+// Run a steady-state system whose particles push each other apart and land on a heightfield,
+// across thread counts, reporting the time spent hashing, summing neighbors and colliding,
+// and checking every thread count ends with the same particles. First checks the hash finds
+// every neighbor a brute-force search does.
+int runInteractionBenchmark(int particleCount);
+
+// Sort a steady-state system's particles back to front every frame, as translucent drawing
+// does: with std::sort, with RadixSort from scratch and with RadixSort starting from the last
+// frame's order, across thread counts. Reports keys sorted per second, how often the last
+// order could be kept or repaired, and checks every sort against std::sort.
+int runSortBenchmark(int particleCount);
+
+// Run the same fountains through the CPU SoA path, including converting and uploading the
+// instances, and through GpuParticleSystem, reporting time per frame, particles per second
+// and what each sends to the GPU. Needs an OpenGL 3.3 context, which may be software.
+int runGpuParticleBenchmark(int particleCount);
@@ -0,0 +1,67 @@
+#include "Emitter.h"
+#include "ParticlePool.h"
+
+#include <cmath>
+
+Emitter::Settings::Settings() : position(0, 0, 0), direction(0, 1, 0), spread(0.3f), rate(200.0f), speed(6.0f), speedJitter(1.5f),
+	lifespan(4.0f), lifespanJitter(1.0f), scale(0.5f), scaleJitter(0.1f), scaleRate(-0.1f), spin(2.0f)
+{}
+
+Emitter::Emitter(const Settings& settings, quint32 seed) : settings_(settings), state_(seed ? seed : 1), owed_(0.0f)
+{}
+
+int Emitter::spawnCount(float dt)
+{
+	owed_ += settings_.rate * dt;
+	const int count = int(owed_);
+	owed_ -= count;
+	return count;
+}
+
+float Emitter::random()
+{
+	// xorshift32; the top 24 bits fill a float's mantissa exactly
+	state_ ^= state_ << 13;
+	state_ ^= state_ >> 17;
+	state_ ^= state_ << 5;
+	return (state_ >> 8) * (1.0f / 16777216.0f);
+}
+
+void Emitter::launchFrame(QVector3D& axis, QVector3D& side, QVector3D& forward) const
+{
+	axis = settings_.direction.normalized();
+	const QVector3D helper = std::fabs(axis.y()) < 0.99f ? QVector3D(0, 1, 0) : QVector3D(1, 0, 0);
+	side = QVector3D::crossProduct(helper, axis).normalized();
+	forward = QVector3D::crossProduct(axis, side);
+}
+
+void Emitter::spawn(float* const* streams, int count)
+{
+	QVector3D axis;
+	QVector3D side;
+	QVector3D forward;
+	launchFrame(axis, side, forward);
+	const float minCos = std::cos(settings_.spread);
+	const float twoPi = 6.28318531f;
+
+	for (int ii = 0; ii < count; ++ii) {
+		// Uniform over the cone's cap of the unit sphere
+		const float cosTheta = 1.0f - random() * (1.0f - minCos);
+		const float sinTheta = std::sqrt(qMax(0.0f, 1.0f - cosTheta * cosTheta));
+		const float phi = random() * twoPi;
+		const QVector3D direction = axis * cosTheta + (side * std::cos(phi) + forward * std::sin(phi)) * sinTheta;
+		const QVector3D velocity = direction * jitter(settings_.speed, settings_.speedJitter);
+
+		streams[ParticlePool::PositionX][ii] = settings_.position.x();
+		streams[ParticlePool::PositionY][ii] = settings_.position.y();
+		streams[ParticlePool::PositionZ][ii] = settings_.position.z();
+		streams[ParticlePool::VelocityX][ii] = velocity.x();
+		streams[ParticlePool::VelocityY][ii] = velocity.y();
+		streams[ParticlePool::VelocityZ][ii] = velocity.z();
+		streams[ParticlePool::Life][ii] = qMax(jitter(settings_.lifespan, settings_.lifespanJitter), 0.01f);
+		streams[ParticlePool::Scale][ii] = qMax(jitter(settings_.scale, settings_.scaleJitter), 0.0f);
+		streams[ParticlePool::ScaleRate][ii] = settings_.scaleRate;
+		streams[ParticlePool::Angle][ii] = random() * twoPi;
+		streams[ParticlePool::Spin][ii] = jitter(0.0f, settings_.spin);
+	}
+}
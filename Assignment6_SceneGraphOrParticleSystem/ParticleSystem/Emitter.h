@@ -0,0 +1,54 @@
+#pragma once
+
+#include <QtCore>
+#include <QtGui/QVector3D>
+
+// Launches particles from a point at a steady rate, up along a direction and spread out
+// over a cone around it, like a fountain. Each emitter has its own random sequence, so a
+// run with the same seeds always produces the same particles.
+class Emitter
+{
+public:
+	// Defaults make a gentle fountain at the origin
+	struct Settings {
+		QVector3D position;
+		QVector3D direction;
+		// Half-angle of the launch cone, in radians
+		float spread;
+		// Particles per second
+		float rate;
+		// Each value is picked uniformly within base +/- jitter
+		float speed;
+		float speedJitter;
+		float lifespan;
+		float lifespanJitter;
+		float scale;
+		float scaleJitter;
+		float scaleRate;
+		float spin;
+
+		Settings();
+	};
+
+	explicit Emitter(const Settings& settings = Settings(), quint32 seed = 1);
+
+	inline Settings& settings() { return settings_; }
+	inline const Settings& settings() const { return settings_; }
+
+	// How many particles are due after dt more seconds. Fractions carry over between calls.
+	int spawnCount(float dt);
+	// Write count new particles into streams, laid out as for ParticlePool::append
+	void spawn(float* const* streams, int count);
+	// The unit launch direction and two unit vectors across it, which cone samples are
+	// taken around
+	void launchFrame(QVector3D& axis, QVector3D& side, QVector3D& forward) const;
+
+private:
+	// Uniform in [0, 1)
+	float random();
+	inline float jitter(float base, float amount) { return base + (2.0f * random() - 1.0f) * amount; }
+
+	Settings settings_;
+	quint32 state_;
+	float owed_;
+};
@@ -0,0 +1,165 @@
+#include "GpuParticleSystem.h"
+
+#include <cmath>
+#include <cstddef>
+
+GpuParticleSystem::GpuParticleSystem(int capacity) : gravity_(0, -1, 0), capacity_(qMax(capacity, 1)), buffers_(), vaos_(),
+	current_(0), nextSlot_(0), frame_(0), emitted_(0)
+{}
+
+GpuParticleSystem::~GpuParticleSystem()
+{
+	// GL objects have to go in destroy(), with the context current
+	qDeleteAll(emitters_);
+}
+
+bool GpuParticleSystem::create()
+{
+	initializeOpenGLFunctions();
+
+	// The captured outputs have to be named before linking
+	if (!update_.addShaderFromSourceFile(QOpenGLShader::Vertex, "../../ParticleUpdate.glsl")) {
+		qDebug() << "GpuParticleSystem: could not compile the update shader:" << update_.log();
+		return false;
+	}
+	const char* varyings[] = { "outPositionScale", "outVelocityLife", "outSpin" };
+	glTransformFeedbackVaryings(update_.programId(), 3, varyings, GL_INTERLEAVED_ATTRIBS);
+	if (!update_.link()) {
+		qDebug() << "GpuParticleSystem: could not link the update shader:" << update_.log();
+		return false;
+	}
+
+	glGenBuffers(2, buffers_);
+	glGenVertexArrays(2, vaos_);
+	for (int ii = 0; ii < 2; ++ii) {
+		glBindVertexArray(vaos_[ii]);
+		glBindBuffer(GL_ARRAY_BUFFER, buffers_[ii]);
+		glBufferData(GL_ARRAY_BUFFER, qint64(capacity_) * sizeof(Slot), nullptr, GL_DYNAMIC_COPY);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Slot), reinterpret_cast<void*>(offsetof(Slot, positionScale)));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Slot), reinterpret_cast<void*>(offsetof(Slot, velocityLife)));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Slot), reinterpret_cast<void*>(offsetof(Slot, spin)));
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	clear();
+	return true;
+}
+
+void GpuParticleSystem::destroy()
+{
+	if (buffers_[0]) {
+		glDeleteBuffers(2, buffers_);
+		glDeleteVertexArrays(2, vaos_);
+		buffers_[0] = buffers_[1] = 0;
+		vaos_[0] = vaos_[1] = 0;
+	}
+	update_.removeAllShaders();
+}
+
+Emitter* GpuParticleSystem::addEmitter(const Emitter::Settings& settings, quint32 seed)
+{
+	if (emitters_.size() == MAX_EMITTERS) {
+		return nullptr;
+	}
+	Emitter* emitter = new Emitter(settings, seed);
+	emitters_ << emitter;
+	return emitter;
+}
+
+void GpuParticleSystem::clear()
+{
+	// All zeros is a dead slot: no life left and no scale
+	const QVector<Slot> empty(capacity_, Slot());
+	glBindBuffer(GL_ARRAY_BUFFER, buffers_[current_]);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, qint64(capacity_) * sizeof(Slot), empty.constData());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	nextSlot_ = 0;
+}
+
+void GpuParticleSystem::update(float dt)
+{
+	// Hand each emitter the next run of slots, no more than the whole ring in total
+	GLint starts[MAX_EMITTERS];
+	GLint counts[MAX_EMITTERS];
+	QVector4D origins[MAX_EMITTERS];
+	QVector4D axes[MAX_EMITTERS];
+	QVector4D sides[MAX_EMITTERS];
+	QVector4D forwards[MAX_EMITTERS];
+	QVector4D shapes[MAX_EMITTERS];
+	GLfloat spins[MAX_EMITTERS];
+	int room = capacity_;
+	emitted_ = 0;
+	for (int ii = 0; ii < emitters_.size(); ++ii) {
+		Emitter* emitter = emitters_[ii];
+		const Emitter::Settings& settings = emitter->settings();
+		const int count = qMin(emitter->spawnCount(dt), room);
+		starts[ii] = (nextSlot_ + emitted_) % capacity_;
+		counts[ii] = count;
+		emitted_ += count;
+		room -= count;
+
+		QVector3D axis;
+		QVector3D side;
+		QVector3D forward;
+		emitter->launchFrame(axis, side, forward);
+		origins[ii] = QVector4D(settings.position, std::cos(settings.spread));
+		axes[ii] = QVector4D(axis, settings.speed);
+		sides[ii] = QVector4D(side, settings.speedJitter);
+		forwards[ii] = QVector4D(forward, settings.lifespan);
+		shapes[ii] = QVector4D(settings.lifespanJitter, settings.scale, settings.scaleJitter, settings.scaleRate);
+		spins[ii] = settings.spin;
+	}
+	nextSlot_ = (nextSlot_ + emitted_) % capacity_;
+
+	const int emitterCount = emitters_.size();
+	update_.bind();
+	update_.setUniformValue("dt", dt);
+	update_.setUniformValue("gravity", gravity_);
+	update_.setUniformValue("capacity", capacity_);
+	glUniform1ui(update_.uniformLocation("seed"), ++frame_);
+	update_.setUniformValue("emitterCount", emitterCount);
+	if (emitterCount > 0) {
+		glUniform1iv(update_.uniformLocation("emitStart"), emitterCount, starts);
+		glUniform1iv(update_.uniformLocation("emitCount"), emitterCount, counts);
+		update_.setUniformValueArray("emitOrigin", origins, emitterCount);
+		update_.setUniformValueArray("emitAxis", axes, emitterCount);
+		update_.setUniformValueArray("emitSide", sides, emitterCount);
+		update_.setUniformValueArray("emitForward", forwards, emitterCount);
+		update_.setUniformValueArray("emitShape", shapes, emitterCount);
+		update_.setUniformValueArray("emitSpin", spins, emitterCount, 1);
+	}
+
+	// One point per slot, read from the current buffer and captured into the other
+	const int next = 1 - current_;
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBindVertexArray(vaos_[current_]);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffers_[next]);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, capacity_);
+	glEndTransformFeedback();
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glBindVertexArray(0);
+	glDisable(GL_RASTERIZER_DISCARD);
+	update_.release();
+	current_ = next;
+}
+
+int GpuParticleSystem::countAlive()
+{
+	int alive = 0;
+	glBindBuffer(GL_ARRAY_BUFFER, buffers_[current_]);
+	const Slot* state = static_cast<const Slot*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, qint64(capacity_) * sizeof(Slot), GL_MAP_READ_BIT));
+	if (state) {
+		for (int ii = 0; ii < capacity_; ++ii) {
+			if (state[ii].velocityLife[3] > 0.0f) {
+				++alive;
+			}
+		}
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return alive;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <QtCore>
+#include <QtGui>
+#include <QtOpenGL>
+
+#include "Emitter.h"
+
+// Particles that live entirely on the GPU. Their state sits in two buffers of capacity
+// slots, and each update is a point draw over every slot with rasterization off: the vertex
+// shader reads a slot from one buffer and transform feedback captures the advanced slot
+// into the other. The CPU uploads nothing but uniforms.
+//
+// New particles take slots in ring order. Each update the emitters' new particles are
+// given the next run of slots, and the shader launches a fresh particle in every slot of
+// that run. With lifespans near the average, the slot reused is the one whose particle died
+// longest ago; when emission outpaces the capacity, the oldest live particles are recycled.
+//
+// Everything runs on GL 3.3 core, so it works on software drivers such as llvmpipe.
+class GpuParticleSystem : protected QOpenGLExtraFunctions
+{
+public:
+	// Most emitters one system can have; each is a handful of uniforms
+	static const int MAX_EMITTERS = 8;
+
+	explicit GpuParticleSystem(int capacity);
+	~GpuParticleSystem();
+
+	// Build the update shader and the state buffers, every slot empty. Must be called with
+	// a current GL context. Returns false if the shader doesn't build.
+	bool create();
+	// Free every GL object; the owning context must be current
+	void destroy();
+
+	// The system owns its emitters. Returns nullptr past MAX_EMITTERS.
+	Emitter* addEmitter(const Emitter::Settings& settings, quint32 seed);
+	inline const QVector<Emitter*>& emitters() const { return emitters_; }
+
+	inline const QVector3D& gravity() const { return gravity_; }
+	inline void setGravity(const QVector3D& gravity) { gravity_ = gravity; }
+
+	// Advance by dt seconds and launch the particles due. Must be called with the context current.
+	void update(float dt);
+	// Empty every slot
+	void clear();
+
+	inline int capacity() const { return capacity_; }
+	// Buffer holding the latest state, one Slot per particle. Dead slots have zero scale.
+	inline GLuint stateBuffer() const { return buffers_[current_]; }
+	// Particles launched by the last update
+	inline int emittedCount() const { return emitted_; }
+	// Read the state back and count the live particles. Stalls until the GPU catches up,
+	// so it's for stats and benchmarks only.
+	int countAlive();
+
+	// One slot of state, as stored in the buffers and captured by transform feedback
+	struct Slot {
+		float positionScale[4];		// Position, then scale
+		float velocityLife[4];		// Velocity, then seconds left to live
+		float spin[4];				// Angle, radians per second, change in scale per second, unused
+	};
+
+private:
+	QOpenGLShaderProgram update_;
+	QVector<Emitter*> emitters_;
+	QVector3D gravity_;
+
+	int capacity_;
+	// Updates read buffers_[current_] and write the other
+	GLuint buffers_[2];
+	// Attribute bindings for reading each buffer
+	GLuint vaos_[2];
+	int current_;
+	// First slot of the next run of new particles
+	int nextSlot_;
+	// Seeds the shader's random numbers, so every update launches different particles
+	quint32 frame_;
+	int emitted_;
+};
@@ -0,0 +1,124 @@
+#include "Heightfield.h"
+
+#include <cmath>
+
+namespace {
+	// Sine waves summed by generateHills
+	const int HILL_WAVES = 4;
+}
+
+Heightfield::Heightfield(int columns, int rows, float spacing) : columns_(qMax(columns, 2)), rows_(qMax(rows, 2)), spacing_(spacing),
+	originX_(-0.5f * (columns_ - 1) * spacing), originZ_(-0.5f * (rows_ - 1) * spacing), heights_(columns_ * rows_, 0.0f)
+{}
+
+void Heightfield::generateHills(float base, float amplitude, float wavelength, quint32 seed)
+{
+	// xorshift32, as the emitters use
+	quint32 state = seed ? seed : 1u;
+	auto random = [&state]() {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return (state >> 8) * (1.0f / 16777216.0f);
+	};
+
+	float directionX[HILL_WAVES];
+	float directionZ[HILL_WAVES];
+	float frequency[HILL_WAVES];
+	float phase[HILL_WAVES];
+	float weight[HILL_WAVES];
+	float totalWeight = 0.0f;
+	for (int ii = 0; ii < HILL_WAVES; ++ii) {
+		const float angle = random() * 6.28318531f;
+		directionX[ii] = std::cos(angle);
+		directionZ[ii] = std::sin(angle);
+		// Each wave half as long and half as tall as the last
+		frequency[ii] = 6.28318531f * (1 << ii) / wavelength;
+		phase[ii] = random() * 6.28318531f;
+		weight[ii] = 1.0f / (1 << ii);
+		totalWeight += weight[ii];
+	}
+
+	for (int row = 0; row < rows_; ++row) {
+		for (int column = 0; column < columns_; ++column) {
+			const float x = originX_ + column * spacing_;
+			const float z = originZ_ + row * spacing_;
+			float sum = 0.0f;
+			for (int ii = 0; ii < HILL_WAVES; ++ii) {
+				sum += weight[ii] * std::sin((x * directionX[ii] + z * directionZ[ii]) * frequency[ii] + phase[ii]);
+			}
+			at(column, row) = base + amplitude * sum / totalWeight;
+		}
+	}
+}
+
+void Heightfield::locate(float x, float z, int& column, int& row, float& u, float& v) const
+{
+	const float gridX = qBound(0.0f, (x - originX_) / spacing_, float(columns_ - 1));
+	const float gridZ = qBound(0.0f, (z - originZ_) / spacing_, float(rows_ - 1));
+	column = qMin(int(gridX), columns_ - 2);
+	row = qMin(int(gridZ), rows_ - 2);
+	u = gridX - column;
+	v = gridZ - row;
+}
+
+float Heightfield::height(float x, float z) const
+{
+	int column, row;
+	float u, v;
+	locate(x, z, column, row, u, v);
+	const float h00 = at(column, row);
+	const float h10 = at(column + 1, row);
+	const float h01 = at(column, row + 1);
+	const float h11 = at(column + 1, row + 1);
+	return (h00 * (1.0f - u) + h10 * u) * (1.0f - v) + (h01 * (1.0f - u) + h11 * u) * v;
+}
+
+float Heightfield::sample(float x, float z, QVector3D& normal) const
+{
+	int column, row;
+	float u, v;
+	locate(x, z, column, row, u, v);
+	const float h00 = at(column, row);
+	const float h10 = at(column + 1, row);
+	const float h01 = at(column, row + 1);
+	const float h11 = at(column + 1, row + 1);
+
+	// Slopes of the bilinear patch. The flat border past an edge has no slope across it.
+	const bool insideX = x > originX_ && x < originX_ + (columns_ - 1) * spacing_;
+	const bool insideZ = z > originZ_ && z < originZ_ + (rows_ - 1) * spacing_;
+	const float slopeX = insideX ? ((h10 - h00) * (1.0f - v) + (h11 - h01) * v) / spacing_ : 0.0f;
+	const float slopeZ = insideZ ? ((h01 - h00) * (1.0f - u) + (h11 - h10) * u) / spacing_ : 0.0f;
+	normal = QVector3D(-slopeX, 1.0f, -slopeZ).normalized();
+	return (h00 * (1.0f - u) + h10 * u) * (1.0f - v) + (h01 * (1.0f - u) + h11 * u) * v;
+}
+
+void Heightfield::buildMesh(QVector<Vertex>& vertices, QVector<Face>& faces) const
+{
+	vertices.clear();
+	faces.clear();
+	vertices.reserve(columns_ * rows_);
+	for (int row = 0; row < rows_; ++row) {
+		for (int column = 0; column < columns_; ++column) {
+			// Central differences, which are smoother across squares than the patch slopes
+			const float left = at(qMax(column - 1, 0), row);
+			const float right = at(qMin(column + 1, columns_ - 1), row);
+			const float back = at(column, qMax(row - 1, 0));
+			const float front = at(column, qMin(row + 1, rows_ - 1));
+			const Vec3 normal = Vec3(left - right, 2.0f * spacing_, back - front).normalized();
+
+			const Vec3 position(originX_ + column * spacing_, at(column, row), originZ_ + row * spacing_);
+			const Vec2 texCoord(float(column) / (columns_ - 1), float(row) / (rows_ - 1));
+			vertices << Vertex(position, texCoord, normal, Vec3(1, 0, 0));
+		}
+	}
+
+	faces.reserve((columns_ - 1) * (rows_ - 1) * 2);
+	for (int row = 0; row + 1 < rows_; ++row) {
+		for (int column = 0; column + 1 < columns_; ++column) {
+			const unsigned int corner = row * columns_ + column;
+			faces << Face(corner, corner + columns_, corner + 1);
+			faces << Face(corner + 1, corner + columns_, corner + columns_ + 1);
+		}
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <QtCore>
+#include <QtGui/QVector3D>
+
+#include "Structs.h"
+
+// Terrain as a grid of heights, columns along x and rows along z, centered on the origin.
+// Between samples the surface is bilinear, and height() and normal() agree with it exactly,
+// so what particles collide with is the surface the mesh approximates.
+class Heightfield
+{
+public:
+	Heightfield(int columns, int rows, float spacing);
+
+	inline int columns() const { return columns_; }
+	inline int rows() const { return rows_; }
+	inline float spacing() const { return spacing_; }
+	inline float& at(int column, int row) { return heights_[row * columns_ + column]; }
+	inline float at(int column, int row) const { return heights_[row * columns_ + column]; }
+
+	// Rolling hills: a few sine waves in random directions, summed to within amplitude of
+	// base, the longest wavelength long
+	void generateHills(float base, float amplitude, float wavelength, quint32 seed);
+
+	// Surface height and unit normal below (x, z). Past the edges the border continues flat.
+	float height(float x, float z) const;
+	float sample(float x, float z, QVector3D& normal) const;
+
+	// Two triangles per grid square, in world space, laid out as Renderable does
+	void buildMesh(QVector<Vertex>& vertices, QVector<Face>& faces) const;
+
+private:
+	// The grid square holding (x, z), clamped to the grid, and where in it (x, z) falls
+	void locate(float x, float z, int& column, int& row, float& u, float& v) const;
+
+	int columns_;
+	int rows_;
+	float spacing_;
+	float originX_;
+	float originZ_;
+	QVector<float> heights_;
+};
@@ -0,0 +1,15 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <QtCore>
+#include "Structs.h"
+
+class OBJLoader {
+private:
+	static bool isOBJFile(QString filePath);
+public:
+	// Parse a .obj file (and its .mtl) into unique vertices and triangles with tangents
+	static bool loadMesh(QString filePath, QVector<Vertex>& vertices, QVector<Face>& faces, QString& diffuseMap, QString& normalMap);
+};
+
+#endif
@@ -0,0 +1,15 @@
+#version 330
+in vec3 worldNormal;
+in vec3 color;
+
+out vec4 fragColor;
+
+uniform float opacity;
+
+const vec3 lightDirection = vec3(-0.4, 0.8, 0.45);
+
+void main() {
+	// Lit from above by one directional light, with some ambient so the shadowed side shows
+	float diffuse = max(dot(normalize(worldNormal), normalize(lightDirection)), 0.0);
+	fragColor = vec4(color * (0.25 + 0.75 * diffuse), opacity);
+}
@@ -0,0 +1,235 @@
+#include "ParticleInteractions.h"
+#include "Heightfield.h"
+#include "TaskPool.h"
+
+#include <cmath>
+
+namespace {
+	// Particles copied or resolved per task
+	const int TASK_PARTICLES = 16384;
+	// Buckets of neighbor sums per task
+	const int TASK_BUCKETS = 4096;
+	// Particles checked per neighbor allowed. Fresh particles crowd the nozzles, so without
+	// a limit each of them would check every other one there.
+	const int CANDIDATES_PER_NEIGHBOR = 4;
+
+	// Run body(index) for every index below count, across pool's threads when given
+	template <typename Body>
+	void runTasks(TaskPool* pool, int count, Body body)
+	{
+		if (!pool || pool->threadCount() == 1 || count == 1) {
+			for (int ii = 0; ii < count; ++ii) {
+				body(ii);
+			}
+			return;
+		}
+		TaskGroup group;
+		for (int ii = 0; ii < count; ++ii) {
+			pool->run(group, [&body, ii]() { body(ii); });
+		}
+		pool->wait(group);
+	}
+}
+
+ParticleInteractions::Settings::Settings() : radius(1.0f), stiffness(20.0f), restitution(0.3f), friction(0.2f), maxNeighbors(24)
+{}
+
+ParticleInteractions::ParticleInteractions() : neighborsEnabled_(false), ground_(nullptr),
+	hashMs_(0.0), neighborMs_(0.0), collideMs_(0.0), pairs_(0)
+{}
+
+void ParticleInteractions::apply(ParticlePool& particles, float dt, TaskPool* pool)
+{
+	const int count = particles.size();
+	const int chunks = (count + TASK_PARTICLES - 1) / TASK_PARTICLES;
+	hashMs_ = 0.0;
+	neighborMs_ = 0.0;
+	pairs_ = 0;
+
+	QElapsedTimer timer;
+	if (neighborsEnabled_ && count > 0) {
+		timer.start();
+		hash_.setCellSize(2.0f * settings_.radius);
+		hash_.build(particles.stream(ParticlePool::PositionX), particles.stream(ParticlePool::PositionY),
+			particles.stream(ParticlePool::PositionZ), count, pool);
+
+		// Copy what the neighbor sums read into hash order
+		sorted_.resize(count);
+		const float* px = particles.stream(ParticlePool::PositionX);
+		const float* py = particles.stream(ParticlePool::PositionY);
+		const float* pz = particles.stream(ParticlePool::PositionZ);
+		const float* vx = particles.stream(ParticlePool::VelocityX);
+		const float* vy = particles.stream(ParticlePool::VelocityY);
+		const float* vz = particles.stream(ParticlePool::VelocityZ);
+		const float* scale = particles.stream(ParticlePool::Scale);
+		const int* order = hash_.sortedIndices();
+		runTasks(pool, chunks, [&](int chunk) {
+			const int end = qMin(count, (chunk + 1) * TASK_PARTICLES);
+			for (int ii = chunk * TASK_PARTICLES; ii < end; ++ii) {
+				const int index = order[ii];
+				Neighbor& neighbor = sorted_[ii];
+				neighbor.position[0] = px[index];
+				neighbor.position[1] = py[index];
+				neighbor.position[2] = pz[index];
+				neighbor.radius = scale[index];
+				neighbor.velocity[0] = vx[index];
+				neighbor.velocity[1] = vy[index];
+				neighbor.velocity[2] = vz[index];
+				neighbor.unused = 0.0f;
+			}
+		});
+		hashMs_ = timer.nsecsElapsed() / 1e6;
+
+		timer.restart();
+		deltaX_.resize(count);
+		deltaY_.resize(count);
+		deltaZ_.resize(count);
+		const int ranges = (hash_.bucketCount() + TASK_BUCKETS - 1) / TASK_BUCKETS;
+		rangePairs_.assign(ranges, 0);
+		runTasks(pool, ranges, [&](int range) {
+			rangePairs_[range] = gatherRange(range * TASK_BUCKETS, qMin(hash_.bucketCount(), (range + 1) * TASK_BUCKETS), dt);
+		});
+		for (qint64 pairs : rangePairs_) {
+			pairs_ += pairs;
+		}
+		neighborMs_ = timer.nsecsElapsed() / 1e6;
+	}
+
+	timer.restart();
+	runTasks(pool, chunks, [&](int chunk) {
+		resolveRange(particles, chunk * TASK_PARTICLES, qMin(count, (chunk + 1) * TASK_PARTICLES));
+	});
+	collideMs_ = timer.nsecsElapsed() / 1e6;
+}
+
+qint64 ParticleInteractions::gatherRange(int begin, int end, float dt)
+{
+	const Neighbor* neighborData = sorted_.data();
+	const int* order = hash_.sortedIndices();
+	const float range = settings_.radius;
+	const float rangeSquared = range * range;
+	const float push = settings_.stiffness * dt;
+	const float bounce = 0.5f * (1.0f + settings_.restitution);
+	const int maxCandidates = settings_.maxNeighbors * CANDIDATES_PER_NEIGHBOR;
+	qint64 pairs = 0;
+
+	for (int bucket = begin; bucket < end; ++bucket) {
+		for (int self = hash_.bucketBegin(bucket); self < hash_.bucketEnd(bucket); ++self) {
+			const Neighbor& particle = neighborData[self];
+			// Cells are twice as wide as the radius, so every neighbor is within half a cell
+			// along each axis, in the particle's own cell or the one on the nearer side
+			const float gx = hash_.cellPosition(particle.position[0]);
+			const float gy = hash_.cellPosition(particle.position[1]);
+			const float gz = hash_.cellPosition(particle.position[2]);
+			const int cx = int(std::floor(gx));
+			const int cy = int(std::floor(gy));
+			const int cz = int(std::floor(gz));
+			const int sideX = gx - cx < 0.5f ? -1 : 1;
+			const int sideY = gy - cy < 0.5f ? -1 : 1;
+			const int sideZ = gz - cz < 0.5f ? -1 : 1;
+			float dvx = 0.0f;
+			float dvy = 0.0f;
+			float dvz = 0.0f;
+			int neighbors = 0;
+			int candidates = 0;
+
+			// Own cell first. Cells can share a bucket, so each bucket is searched once.
+			int visited[8];
+			int visitedCount = 0;
+			for (int cell = 0; cell < 8 && neighbors < settings_.maxNeighbors && candidates < maxCandidates; ++cell) {
+				const int key = hash_.bucket(cx + (cell & 1 ? sideX : 0), cy + (cell & 2 ? sideY : 0), cz + (cell & 4 ? sideZ : 0));
+				bool seen = false;
+				for (int ii = 0; ii < visitedCount; ++ii) {
+					seen = seen || visited[ii] == key;
+				}
+				if (seen) {
+					continue;
+				}
+				visited[visitedCount++] = key;
+
+				const int last = qMin(hash_.bucketEnd(key), hash_.bucketBegin(key) + maxCandidates - candidates);
+				candidates += last - hash_.bucketBegin(key);
+				for (int other = hash_.bucketBegin(key); other < last && neighbors < settings_.maxNeighbors; ++other) {
+					const Neighbor& neighbor = neighborData[other];
+					const float dx = particle.position[0] - neighbor.position[0];
+					const float dy = particle.position[1] - neighbor.position[1];
+					const float dz = particle.position[2] - neighbor.position[2];
+					const float distanceSquared = dx * dx + dy * dy + dz * dz;
+					// Particles at the very same spot have no direction to push in
+					if (other == self || distanceSquared >= rangeSquared || distanceSquared < 1e-12f) {
+						continue;
+					}
+					++neighbors;
+					const float distance = std::sqrt(distanceSquared);
+					const float nx = dx / distance;
+					const float ny = dy / distance;
+					const float nz = dz / distance;
+
+					// Pressure-like push, strongest up close
+					const float falloff = 1.0f - distance / range;
+					float speed = push * falloff * falloff;
+
+					// Touching particles moving together bounce; each takes half the impulse
+					const float closing = (particle.velocity[0] - neighbor.velocity[0]) * nx +
+						(particle.velocity[1] - neighbor.velocity[1]) * ny + (particle.velocity[2] - neighbor.velocity[2]) * nz;
+					if (closing < 0.0f && distance < particle.radius + neighbor.radius) {
+						speed -= bounce * closing;
+					}
+					dvx += nx * speed;
+					dvy += ny * speed;
+					dvz += nz * speed;
+				}
+			}
+
+			const int index = order[self];
+			deltaX_[index] = dvx;
+			deltaY_[index] = dvy;
+			deltaZ_[index] = dvz;
+			pairs += neighbors;
+		}
+	}
+	return pairs;
+}
+
+void ParticleInteractions::resolveRange(ParticlePool& particles, int begin, int end)
+{
+	float* px = particles.stream(ParticlePool::PositionX);
+	float* py = particles.stream(ParticlePool::PositionY);
+	float* pz = particles.stream(ParticlePool::PositionZ);
+	float* vx = particles.stream(ParticlePool::VelocityX);
+	float* vy = particles.stream(ParticlePool::VelocityY);
+	float* vz = particles.stream(ParticlePool::VelocityZ);
+	const float* scale = particles.stream(ParticlePool::Scale);
+
+	if (neighborsEnabled_) {
+		for (int ii = begin; ii < end; ++ii) {
+			vx[ii] += deltaX_[ii];
+			vy[ii] += deltaY_[ii];
+			vz[ii] += deltaZ_[ii];
+		}
+	}
+	if (!ground_) {
+		return;
+	}
+
+	const float keep = 1.0f - settings_.friction;
+	for (int ii = begin; ii < end; ++ii) {
+		QVector3D normal;
+		const float lowest = ground_->sample(px[ii], pz[ii], normal) + scale[ii];
+		if (py[ii] >= lowest) {
+			continue;
+		}
+		py[ii] = lowest;
+		// Reflect the speed into the ground and slow the slide along it
+		const QVector3D velocity(vx[ii], vy[ii], vz[ii]);
+		const float into = QVector3D::dotProduct(velocity, normal);
+		if (into >= 0.0f) {
+			continue;
+		}
+		const QVector3D along = velocity - normal * into;
+		const QVector3D bounced = along * keep - normal * (into * settings_.restitution);
+		vx[ii] = bounced.x();
+		vy[ii] = bounced.y();
+		vz[ii] = bounced.z();
+	}
+}
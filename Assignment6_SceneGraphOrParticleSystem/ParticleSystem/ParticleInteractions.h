@@ -0,0 +1,96 @@
+#pragma once
+
+#include <QtCore>
+
+#include <vector>
+
+#include "ParticlePool.h"
+#include "SpatialHash.h"
+
+class Heightfield;
+class TaskPool;
+
+// Particles pushing each other apart and bouncing off the ground. Each update hashes the
+// particles into a grid of cells twice as wide as the interaction radius. A neighbor is then
+// at most half a cell away along each axis, so it's in the 2x2x2 block of cells nearest
+// the particle.
+//
+// Particles only ever read their neighbors and write their own change in velocity, so
+// cells can be processed in parallel with no locking. Each particle visits its neighbors in
+// the hash's order, which doesn't depend on the threads, so the results are identical
+// whatever the number of threads.
+class ParticleInteractions
+{
+public:
+	struct Settings {
+		// Particles closer than this push each other apart
+		float radius;
+		// Push between particles at the same spot, per second; it falls off to zero at radius
+		float stiffness;
+		// Fraction of the closing speed kept when touching particles or the ground collide
+		float restitution;
+		// Fraction of the speed along the ground lost when a particle hits it
+		float friction;
+		// Most neighbors one particle reacts to. A particle checks at most a few times this
+		// many others, so a crowd costs a bounded amount.
+		int maxNeighbors;
+
+		Settings();
+	};
+
+	ParticleInteractions();
+
+	inline const Settings& settings() const { return settings_; }
+	inline void setSettings(const Settings& settings) { settings_ = settings; }
+
+	inline bool neighborsEnabled() const { return neighborsEnabled_; }
+	inline void setNeighborsEnabled(bool enabled) { neighborsEnabled_ = enabled; }
+	// Particles land on ground when it's set; the heightfield isn't owned
+	inline const Heightfield* ground() const { return ground_; }
+	inline void setGround(const Heightfield* ground) { ground_ = ground; }
+	inline bool isActive() const { return neighborsEnabled_ || ground_; }
+
+	// Change the particles' velocities by dt seconds of interaction, then move any below
+	// the ground back onto it. A particle's scale is its radius. Work is split across
+	// pool's threads when given.
+	void apply(ParticlePool& particles, float dt, TaskPool* pool = nullptr);
+
+	// Stats from the last update
+	inline double hashMs() const { return hashMs_; }
+	inline double neighborMs() const { return neighborMs_; }
+	inline double collideMs() const { return collideMs_; }
+	// Pairs close enough to interact, counted once from each side
+	inline qint64 pairCount() const { return pairs_; }
+
+private:
+	// What the neighbor sums read of a particle, copied in hash order so a cell's particles
+	// are contiguous and each one is a single cache access
+	struct Neighbor {
+		float position[3];
+		float radius;
+		float velocity[3];
+		float unused;
+	};
+
+	// Sum the push on every particle in buckets [begin, end). Returns the pairs found.
+	qint64 gatherRange(int begin, int end, float dt);
+	// Apply the pushes and collide with the ground, for particles [begin, end)
+	void resolveRange(ParticlePool& particles, int begin, int end);
+
+	Settings settings_;
+	bool neighborsEnabled_;
+	const Heightfield* ground_;
+
+	SpatialHash hash_;
+	std::vector<Neighbor> sorted_;
+	// Change in velocity of each particle, by its index in the pool
+	std::vector<float> deltaX_;
+	std::vector<float> deltaY_;
+	std::vector<float> deltaZ_;
+	std::vector<qint64> rangePairs_;
+
+	double hashMs_;
+	double neighborMs_;
+	double collideMs_;
+	qint64 pairs_;
+};
@@ -0,0 +1,159 @@
+#include "ParticlePool.h"
+#include "TaskPool.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PARTICLE_POOL_SSE
+#endif
+
+namespace {
+	// Floats per cache line; every stream starts on one
+	const int LINE_FLOATS = 16;
+	// Particles integrated per task when the update is split across threads
+	const int TASK_PARTICLES = 16384;
+}
+
+ParticlePool::ParticlePool(int capacity) : capacity_(0), size_(0), integrator_(Integrator::Simd)
+{
+	setCapacity(capacity);
+}
+
+void ParticlePool::setCapacity(int capacity)
+{
+	capacity_ = qMax(capacity, 0);
+	size_ = 0;
+
+	// Round each stream up to whole cache lines, which also covers the padding to a
+	// multiple of four, and leave room to align the first one
+	const int stride = (capacity_ + LINE_FLOATS - 1) / LINE_FLOATS * LINE_FLOATS;
+	storage_.reset(new float[size_t(stride) * STREAM_COUNT + LINE_FLOATS]());
+	const quintptr address = quintptr(storage_.get());
+	const quintptr lineBytes = LINE_FLOATS * sizeof(float);
+	float* first = reinterpret_cast<float*>((address + lineBytes - 1) / lineBytes * lineBytes);
+	for (int ii = 0; ii < STREAM_COUNT; ++ii) {
+		streams_[ii] = first + size_t(stride) * ii;
+	}
+}
+
+void ParticlePool::clear()
+{
+	size_ = 0;
+}
+
+int ParticlePool::append(const float* const* streams, int count)
+{
+	count = qMin(count, capacity_ - size_);
+	if (count <= 0) {
+		return 0;
+	}
+	for (int ii = 0; ii < STREAM_COUNT; ++ii) {
+		std::memcpy(streams_[ii] + size_, streams[ii], count * sizeof(float));
+	}
+	size_ += count;
+	return count;
+}
+
+void ParticlePool::integrate(float dt, const QVector3D& gravity, TaskPool* pool)
+{
+	if (!pool || pool->threadCount() == 1 || size_ <= TASK_PARTICLES) {
+		integrateRange(0, size_, dt, gravity);
+		return;
+	}
+
+	// Particles don't depend on each other, so chunks can go in any order
+	TaskGroup group;
+	for (int begin = 0; begin < size_; begin += TASK_PARTICLES) {
+		const int end = qMin(begin + TASK_PARTICLES, size_);
+		pool->run(group, [this, begin, end, dt, gravity]() { integrateRange(begin, end, dt, gravity); });
+	}
+	pool->wait(group);
+}
+
+void ParticlePool::integrateRange(int begin, int end, float dt, const QVector3D& gravity)
+{
+	float* px = streams_[PositionX];
+	float* py = streams_[PositionY];
+	float* pz = streams_[PositionZ];
+	float* vx = streams_[VelocityX];
+	float* vy = streams_[VelocityY];
+	float* vz = streams_[VelocityZ];
+	float* life = streams_[Life];
+	float* scale = streams_[Scale];
+	const float* scaleRate = streams_[ScaleRate];
+	float* angle = streams_[Angle];
+	const float* spin = streams_[Spin];
+	const float gx = gravity.x() * dt;
+	const float gy = gravity.y() * dt;
+	const float gz = gravity.z() * dt;
+
+	int ii = begin;
+#ifdef PARTICLE_POOL_SSE
+	if (integrator_ == Integrator::Simd) {
+		// The streams are padded to a multiple of four, so the last partial group can be
+		// processed whole; the spare values it touches are never read as particles.
+		const int simdEnd = (end + 3) & ~3;
+		const __m128 dtv = _mm_set1_ps(dt);
+		const __m128 gxv = _mm_set1_ps(gx);
+		const __m128 gyv = _mm_set1_ps(gy);
+		const __m128 gzv = _mm_set1_ps(gz);
+		const __m128 zero = _mm_setzero_ps();
+		for (; ii < simdEnd; ii += 4) {
+			const __m128 nvx = _mm_add_ps(_mm_load_ps(vx + ii), gxv);
+			const __m128 nvy = _mm_add_ps(_mm_load_ps(vy + ii), gyv);
+			const __m128 nvz = _mm_add_ps(_mm_load_ps(vz + ii), gzv);
+			_mm_store_ps(vx + ii, nvx);
+			_mm_store_ps(vy + ii, nvy);
+			_mm_store_ps(vz + ii, nvz);
+			_mm_store_ps(px + ii, _mm_add_ps(_mm_load_ps(px + ii), _mm_mul_ps(nvx, dtv)));
+			_mm_store_ps(py + ii, _mm_add_ps(_mm_load_ps(py + ii), _mm_mul_ps(nvy, dtv)));
+			_mm_store_ps(pz + ii, _mm_add_ps(_mm_load_ps(pz + ii), _mm_mul_ps(nvz, dtv)));
+			_mm_store_ps(life + ii, _mm_sub_ps(_mm_load_ps(life + ii), dtv));
+			const __m128 grown = _mm_add_ps(_mm_load_ps(scale + ii), _mm_mul_ps(_mm_load_ps(scaleRate + ii), dtv));
+			_mm_store_ps(scale + ii, _mm_max_ps(grown, zero));
+			_mm_store_ps(angle + ii, _mm_add_ps(_mm_load_ps(angle + ii), _mm_mul_ps(_mm_load_ps(spin + ii), dtv)));
+		}
+		return;
+	}
+#endif
+	// Same operations in the same order as the SSE path, so both give identical results
+	for (; ii < end; ++ii) {
+		vx[ii] += gx;
+		vy[ii] += gy;
+		vz[ii] += gz;
+		px[ii] += vx[ii] * dt;
+		py[ii] += vy[ii] * dt;
+		pz[ii] += vz[ii] * dt;
+		life[ii] -= dt;
+		const float grown = scale[ii] + scaleRate[ii] * dt;
+		scale[ii] = grown > 0.0f ? grown : 0.0f;
+		angle[ii] += spin[ii] * dt;
+	}
+}
+
+int ParticlePool::compact()
+{
+	const float* life = streams_[Life];
+	const int before = size_;
+	int ii = 0;
+	while (ii < size_) {
+#ifdef PARTICLE_POOL_SSE
+		// Most particles survive a frame, so skip over groups of four that are all alive
+		if (ii + 4 <= size_ && _mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(life + ii), _mm_setzero_ps())) == 0) {
+			ii += 4;
+			continue;
+		}
+#endif
+		if (life[ii] > 0.0f) {
+			++ii;
+			continue;
+		}
+		// Move the last particle into the hole; it was integrated too, so check it next
+		--size_;
+		for (int stream = 0; stream < STREAM_COUNT; ++stream) {
+			streams_[stream][ii] = streams_[stream][size_];
+		}
+	}
+	return before - size_;
+}
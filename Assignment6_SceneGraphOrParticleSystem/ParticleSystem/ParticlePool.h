@@ -0,0 +1,68 @@
+#pragma once
+
+#include <QtCore>
+#include <QtGui/QVector3D>
+
+#include <memory>
+
+class TaskPool;
+
+// Live particles stored as a structure of arrays: one float array per attribute, so the
+// update streams through memory four particles per SSE register. Live particles are always
+// packed at the front of the arrays. A dead particle is removed by moving the last one into
+// its slot, so removal is O(1) and the order of particles carries no meaning.
+//
+// Every array is allocated once, at full capacity; nothing is allocated per particle.
+class ParticlePool
+{
+public:
+	enum Stream {
+		PositionX, PositionY, PositionZ,
+		VelocityX, VelocityY, VelocityZ,
+		Life,		// Seconds left to live
+		Scale,
+		ScaleRate,	// Change in scale per second
+		Angle,		// Rotation about the particle's spin axis, in radians
+		Spin,		// Radians per second
+		STREAM_COUNT
+	};
+	enum class Integrator { Scalar, Simd };
+
+	explicit ParticlePool(int capacity = 0);
+
+	// Drop every particle and reallocate for capacity
+	void setCapacity(int capacity);
+	void clear();
+
+	inline int capacity() const { return capacity_; }
+	inline int size() const { return size_; }
+	inline bool isFull() const { return size_ == capacity_; }
+
+	// Each stream holds size() live values, padded with spare values up to a multiple of
+	// four. Streams start on cache line boundaries.
+	inline float* stream(Stream stream) { return streams_[stream]; }
+	inline const float* stream(Stream stream) const { return streams_[stream]; }
+
+	// Append count particles, given as STREAM_COUNT arrays of count values, in Stream
+	// order. Particles past the capacity are dropped. Returns how many were added.
+	int append(const float* const* streams, int count);
+
+	// Move every particle forward by dt seconds under gravity: velocity, position, life,
+	// scale (clamped at zero) and angle. Work is split across pool's threads when given.
+	void integrate(float dt, const QVector3D& gravity, TaskPool* pool = nullptr);
+	// Remove every particle whose life has run out. Returns how many were removed.
+	int compact();
+
+	inline Integrator integrator() const { return integrator_; }
+	inline void setIntegrator(Integrator integrator) { integrator_ = integrator; }
+
+private:
+	// Integrate the particles in [begin, end); begin is a multiple of four
+	void integrateRange(int begin, int end, float dt, const QVector3D& gravity);
+
+	std::unique_ptr<float[]> storage_;
+	float* streams_[STREAM_COUNT];
+	int capacity_;
+	int size_;
+	Integrator integrator_;
+};
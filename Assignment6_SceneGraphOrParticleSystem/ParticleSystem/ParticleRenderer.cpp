@@ -0,0 +1,433 @@
+#include "ParticleRenderer.h"
+#include "TaskPool.h"
+
+#include <cstddef>
+
+namespace {
+	// Particles fade to black over their last this many seconds
+	const float FADE_SECONDS = 0.5f;
+	// Alpha of particles drawn translucent
+	const float TRANSLUCENT_OPACITY = 0.45f;
+	// Instances written per task when filling is split across threads
+	const int TASK_INSTANCES = 16384;
+	// Instance blocks start on this boundary
+	const int INSTANCE_ALIGNMENT = 64;
+	// Attribute locations of the per-instance data
+	const GLuint POSITION_SCALE_ATTRIBUTE = 4;
+	const GLuint ANGLE_COLOR_ATTRIBUTE = 5;
+	// Only read by the GPU particle variant, which takes the life from ANGLE_COLOR_ATTRIBUTE
+	const GLuint SPIN_ATTRIBUTE = 6;
+}
+
+ParticleRenderer::ParticleRenderer() : boundShader_(nullptr), spinAxis_(QVector3D(1, 1, 0).normalized()), instanceBuffer_(0), maxInstances_(0),
+	streaming_(Streaming::Ring), ring_(0, INSTANCE_ALIGNMENT), fences_(), firstFence_(0),
+	drawCalls_(0), instancesDrawn_(0), waitMs_(0.0), writeMs_(0.0), sortMs_(0.0)
+{}
+
+ParticleRenderer::~ParticleRenderer()
+{
+	// GL objects have to go in destroy(), with the context current
+}
+
+bool ParticleRenderer::create(int maxInstances)
+{
+	initializeOpenGLFunctions();
+
+	if (!buildShader(shader_, QByteArray()) || !buildShader(gpuShader_, "#define GPU_STATE\n")) {
+		return false;
+	}
+
+	maxInstances_ = maxInstances;
+	glGenBuffers(1, &instanceBuffer_);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer_);
+	glBufferData(GL_ARRAY_BUFFER, qint64(FRAMES_IN_FLIGHT) * maxInstances_ * sizeof(ParticleInstance), nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	resetFrames();
+	return true;
+}
+
+bool ParticleRenderer::buildShader(QOpenGLShaderProgram& shader, const QByteArray& defines)
+{
+	// Defines have to follow the #version line
+	QFile file("../../ParticleVert.glsl");
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		qDebug() << "ParticleRenderer: could not open ParticleVert.glsl";
+		return false;
+	}
+	QByteArray source = file.readAll();
+	const int versionEnd = source.indexOf('\n') + 1;
+	source.insert(versionEnd, defines);
+
+	if (!shader.addShaderFromSourceCode(QOpenGLShader::Vertex, source) ||
+		!shader.addShaderFromSourceFile(QOpenGLShader::Fragment, "../../ParticleFrag.glsl") ||
+		!shader.link()) {
+		qDebug() << "ParticleRenderer: could not build the particle shader:" << shader.log();
+		return false;
+	}
+	return true;
+}
+
+void ParticleRenderer::destroy()
+{
+	resetFrames();
+	qDeleteAll(meshes_);
+	meshes_.clear();
+	if (instanceBuffer_) {
+		glDeleteBuffers(1, &instanceBuffer_);
+		instanceBuffer_ = 0;
+	}
+	shader_.removeAllShaders();
+	gpuShader_.removeAllShaders();
+}
+
+int ParticleRenderer::addMesh(const QVector<Vertex>& vertices, const QVector<Face>& faces, bool unitSize)
+{
+	if (!unitSize) {
+		return uploadMesh(vertices, faces);
+	}
+
+	// Models come in all sizes, so center each and scale it to the unit sphere; the particle's
+	// scale is then its size in the world
+	Vec3 low = vertices.isEmpty() ? Vec3() : vertices[0].position;
+	Vec3 high = low;
+	for (const Vertex& vertex : vertices) {
+		for (int axis = 0; axis < 3; ++axis) {
+			low[axis] = qMin(low[axis], vertex.position[axis]);
+			high[axis] = qMax(high[axis], vertex.position[axis]);
+		}
+	}
+	const Vec3 center((low.x + high.x) * 0.5f, (low.y + high.y) * 0.5f, (low.z + high.z) * 0.5f);
+	float radius = 0.0f;
+	for (const Vertex& vertex : vertices) {
+		radius = qMax(radius, (vertex.position - center).length());
+	}
+	const float normalize = radius > 0.0f ? 1.0f / radius : 1.0f;
+	QVector<Vertex> unitVertices = vertices;
+	for (Vertex& vertex : unitVertices) {
+		const Vec3 offset = vertex.position - center;
+		vertex.position = Vec3(offset.x * normalize, offset.y * normalize, offset.z * normalize);
+	}
+	return uploadMesh(unitVertices, faces);
+}
+
+int ParticleRenderer::uploadMesh(const QVector<Vertex>& vertices, const QVector<Face>& faces)
+{
+	Mesh* mesh = new Mesh();
+	mesh->indexCount = faces.size() * 3;
+	mesh->vao.create();
+	mesh->vao.bind();
+	mesh->vbo.create();
+	mesh->vbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+	mesh->vbo.bind();
+	mesh->vbo.allocate(vertices.constData(), vertices.size() * sizeof(Vertex));
+	mesh->ibo.create();
+	mesh->ibo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+	mesh->ibo.bind();
+	mesh->ibo.allocate(faces.constData(), faces.size() * sizeof(Face));
+
+	// Position and normal, as Renderable lays them out
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void*>(offsetof(Vertex, position)));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void*>(offsetof(Vertex, normal)));
+	// The instance attributes point into a different block every draw, so they're set there
+	glEnableVertexAttribArray(POSITION_SCALE_ATTRIBUTE);
+	glVertexAttribDivisor(POSITION_SCALE_ATTRIBUTE, 1);
+	glEnableVertexAttribArray(ANGLE_COLOR_ATTRIBUTE);
+	glVertexAttribDivisor(ANGLE_COLOR_ATTRIBUTE, 1);
+
+	mesh->vao.release();
+	mesh->vbo.release();
+	meshes_ << mesh;
+	return meshes_.size() - 1;
+}
+
+void ParticleRenderer::beginFrame(const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix)
+{
+	drawCalls_ = 0;
+	instancesDrawn_ = 0;
+	waitMs_ = 0.0;
+	writeMs_ = 0.0;
+	sortMs_ = 0.0;
+
+	// Release whatever the GPU has finished with, then make room for this frame
+	while (ring_.framesInFlight() > 0) {
+		const GLenum status = glClientWaitSync(fences_[firstFence_], 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+			break;
+		}
+		retireOldestFrame();
+	}
+	while (ring_.framesInFlight() >= FRAMES_IN_FLIGHT) {
+		retireOldestFrame();
+	}
+
+	viewMatrix_ = viewMatrix;
+	projectionMatrix_ = projectionMatrix;
+	boundShader_ = nullptr;
+}
+
+void ParticleRenderer::bindShader(QOpenGLShaderProgram* shader)
+{
+	if (shader == boundShader_) {
+		return;
+	}
+	shader->bind();
+	shader->setUniformValue("view", viewMatrix_);
+	shader->setUniformValue("projection", projectionMatrix_);
+	shader->setUniformValue("spinAxis", spinAxis_);
+	shader->setUniformValue("fadeSeconds", FADE_SECONDS);
+	shader->setUniformValue("opacity", 1.0f);
+	boundShader_ = shader;
+}
+
+void ParticleRenderer::draw(int mesh, const ParticlePool& particles, const QVector3D& color, TaskPool* pool, RadixSort* depthOrder)
+{
+	const int count = qMin(particles.size(), maxInstances_);
+	if (count == 0) {
+		return;
+	}
+	const qint64 bytes = qint64(count) * sizeof(ParticleInstance);
+
+	QElapsedTimer timer;
+	timer.start();
+	const quint32* order = nullptr;
+	if (depthOrder) {
+		depths_.resize(count);
+		writeDepths(depths_.data(), particles, count, viewMatrix_, pool);
+		depthOrder->sort(depths_.constData(), count, pool);
+		order = depthOrder->order();
+		sortMs_ += timer.nsecsElapsed() / 1e6;
+		timer.start();
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer_);
+	qint64 offset = 0;
+	void* mapped = nullptr;
+	if (streaming_ == Streaming::Ring) {
+		offset = ring_.allocate(bytes);
+		while (offset < 0 && ring_.framesInFlight() > 0) {
+			retireOldestFrame();
+			offset = ring_.allocate(bytes);
+		}
+		if (offset < 0) {
+			// This frame alone has drawn more than maxInstances
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			return;
+		}
+		// The fences guarantee the GPU is done with this block, so the driver needn't check
+		mapped = glMapBufferRange(GL_ARRAY_BUFFER, offset, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	}
+	else {
+		// Detach the storage the GPU may still be reading and write into fresh storage
+		glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+		mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	}
+	if (mapped) {
+		writeInstances(static_cast<ParticleInstance*>(mapped), particles, count, color, pool, order);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	}
+	else {
+		staging_.resize(count);
+		writeInstances(staging_.data(), particles, count, color, pool, order);
+		glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, staging_.constData());
+	}
+	writeMs_ += timer.nsecsElapsed() / 1e6;
+
+	bindShader(&shader_);
+	Mesh* target = meshes_[mesh];
+	target->vao.bind();
+	glVertexAttribPointer(POSITION_SCALE_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleInstance),
+		reinterpret_cast<void*>(offset + offsetof(ParticleInstance, position)));
+	glVertexAttribPointer(ANGLE_COLOR_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleInstance),
+		reinterpret_cast<void*>(offset + offsetof(ParticleInstance, angle)));
+	if (depthOrder) {
+		// Farther particles show through nearer ones, and nothing translucent hides anything
+		shader_.setUniformValue("opacity", TRANSLUCENT_OPACITY);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glDepthMask(GL_FALSE);
+	}
+	glDrawElementsInstanced(GL_TRIANGLES, target->indexCount, GL_UNSIGNED_INT, 0, count);
+	if (depthOrder) {
+		glDepthMask(GL_TRUE);
+		glDisable(GL_BLEND);
+		shader_.setUniformValue("opacity", 1.0f);
+	}
+	target->vao.release();
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	++drawCalls_;
+	instancesDrawn_ += count;
+}
+
+void ParticleRenderer::draw(int mesh, const GpuParticleSystem& particles, const QVector3D& color)
+{
+	bindShader(&gpuShader_);
+	gpuShader_.setUniformValue("tint", color);
+
+	Mesh* target = meshes_[mesh];
+	target->vao.bind();
+	glBindBuffer(GL_ARRAY_BUFFER, particles.stateBuffer());
+	const GLsizei stride = sizeof(GpuParticleSystem::Slot);
+	glVertexAttribPointer(POSITION_SCALE_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, stride,
+		reinterpret_cast<void*>(offsetof(GpuParticleSystem::Slot, positionScale)));
+	glVertexAttribPointer(ANGLE_COLOR_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, stride,
+		reinterpret_cast<void*>(offsetof(GpuParticleSystem::Slot, velocityLife)));
+	glEnableVertexAttribArray(SPIN_ATTRIBUTE);
+	glVertexAttribDivisor(SPIN_ATTRIBUTE, 1);
+	glVertexAttribPointer(SPIN_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, stride,
+		reinterpret_cast<void*>(offsetof(GpuParticleSystem::Slot, spin)));
+	// Empty slots have zero scale, so they collapse to nothing
+	glDrawElementsInstanced(GL_TRIANGLES, target->indexCount, GL_UNSIGNED_INT, 0, particles.capacity());
+	glDisableVertexAttribArray(SPIN_ATTRIBUTE);
+	target->vao.release();
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	++drawCalls_;
+	instancesDrawn_ += particles.capacity();
+}
+
+void ParticleRenderer::drawMesh(int mesh, const QVector3D& color)
+{
+	bindShader(&shader_);
+	Mesh* target = meshes_[mesh];
+	target->vao.bind();
+	// With their arrays off, the instance attributes take one constant value: at the origin,
+	// full size, unspun
+	glDisableVertexAttribArray(POSITION_SCALE_ATTRIBUTE);
+	glDisableVertexAttribArray(ANGLE_COLOR_ATTRIBUTE);
+	glVertexAttrib4f(POSITION_SCALE_ATTRIBUTE, 0.0f, 0.0f, 0.0f, 1.0f);
+	glVertexAttrib4f(ANGLE_COLOR_ATTRIBUTE, 0.0f, color.x(), color.y(), color.z());
+	glDrawElements(GL_TRIANGLES, target->indexCount, GL_UNSIGNED_INT, 0);
+	glEnableVertexAttribArray(POSITION_SCALE_ATTRIBUTE);
+	glEnableVertexAttribArray(ANGLE_COLOR_ATTRIBUTE);
+	target->vao.release();
+
+	++drawCalls_;
+}
+
+void ParticleRenderer::endFrame()
+{
+	if (boundShader_) {
+		boundShader_->release();
+		boundShader_ = nullptr;
+	}
+	if (streaming_ == Streaming::Ring) {
+		fences_[(firstFence_ + ring_.framesInFlight()) % FRAMES_IN_FLIGHT] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		ring_.endFrame();
+	}
+}
+
+void ParticleRenderer::setStreaming(Streaming streaming)
+{
+	if (streaming == streaming_) {
+		return;
+	}
+	streaming_ = streaming;
+
+	// Fresh storage, so no fences are needed for what the GPU is still reading
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer_);
+	glBufferData(GL_ARRAY_BUFFER, qint64(FRAMES_IN_FLIGHT) * maxInstances_ * sizeof(ParticleInstance), nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	resetFrames();
+}
+
+void ParticleRenderer::retireOldestFrame()
+{
+	QElapsedTimer timer;
+	timer.start();
+	GLsync fence = fences_[firstFence_];
+	GLenum status = GL_TIMEOUT_EXPIRED;
+	while (status == GL_TIMEOUT_EXPIRED) {
+		status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+	}
+	glDeleteSync(fence);
+	fences_[firstFence_] = 0;
+	firstFence_ = (firstFence_ + 1) % FRAMES_IN_FLIGHT;
+	ring_.retireFrame();
+	waitMs_ += timer.nsecsElapsed() / 1e6;
+}
+
+void ParticleRenderer::resetFrames()
+{
+	for (int ii = 0; ii < ring_.framesInFlight(); ++ii) {
+		glDeleteSync(fences_[(firstFence_ + ii) % FRAMES_IN_FLIGHT]);
+	}
+	for (GLsync& fence : fences_) {
+		fence = 0;
+	}
+	firstFence_ = 0;
+	ring_.reset(qint64(FRAMES_IN_FLIGHT) * maxInstances_ * sizeof(ParticleInstance));
+}
+
+void ParticleRenderer::writeInstances(ParticleInstance* instances, const ParticlePool& particles, int count, const QVector3D& color, TaskPool* pool,
+	const quint32* order)
+{
+	const float* px = particles.stream(ParticlePool::PositionX);
+	const float* py = particles.stream(ParticlePool::PositionY);
+	const float* pz = particles.stream(ParticlePool::PositionZ);
+	const float* life = particles.stream(ParticlePool::Life);
+	const float* scale = particles.stream(ParticlePool::Scale);
+	const float* angle = particles.stream(ParticlePool::Angle);
+	const float red = color.x();
+	const float green = color.y();
+	const float blue = color.z();
+
+	// Mapped memory is usually write-combined, so every field is written once, in order
+	auto fill = [=](int begin, int end) {
+		for (int ii = begin; ii < end; ++ii) {
+			const int source = order ? int(order[ii]) : ii;
+			const float fade = qMin(life[source] * (1.0f / FADE_SECONDS), 1.0f);
+			ParticleInstance& instance = instances[ii];
+			instance.position[0] = px[source];
+			instance.position[1] = py[source];
+			instance.position[2] = pz[source];
+			instance.scale = scale[source];
+			instance.angle = angle[source];
+			instance.color[0] = red * fade;
+			instance.color[1] = green * fade;
+			instance.color[2] = blue * fade;
+		}
+	};
+
+	if (!pool || pool->threadCount() == 1 || count <= TASK_INSTANCES) {
+		fill(0, count);
+		return;
+	}
+	TaskGroup group;
+	for (int begin = 0; begin < count; begin += TASK_INSTANCES) {
+		const int end = qMin(begin + TASK_INSTANCES, count);
+		pool->run(group, [=]() { fill(begin, end); });
+	}
+	pool->wait(group);
+}
+
+void ParticleRenderer::writeDepths(float* depths, const ParticlePool& particles, int count, const QMatrix4x4& viewMatrix, TaskPool* pool)
+{
+	const float* px = particles.stream(ParticlePool::PositionX);
+	const float* py = particles.stream(ParticlePool::PositionY);
+	const float* pz = particles.stream(ParticlePool::PositionZ);
+	// The camera looks down its -z axis, so the third row gives depth, farthest lowest
+	const QVector4D row = viewMatrix.row(2);
+	const float rx = row.x();
+	const float ry = row.y();
+	const float rz = row.z();
+	const float rw = row.w();
+
+	auto fill = [=](int begin, int end) {
+		for (int ii = begin; ii < end; ++ii) {
+			depths[ii] = rx * px[ii] + ry * py[ii] + rz * pz[ii] + rw;
+		}
+	};
+
+	if (!pool || pool->threadCount() == 1 || count <= TASK_INSTANCES) {
+		fill(0, count);
+		return;
+	}
+	TaskGroup group;
+	for (int begin = 0; begin < count; begin += TASK_INSTANCES) {
+		const int end = qMin(begin + TASK_INSTANCES, count);
+		pool->run(group, [=]() { fill(begin, end); });
+	}
+	pool->wait(group);
+}
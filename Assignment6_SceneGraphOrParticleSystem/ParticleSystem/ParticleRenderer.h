@@ -0,0 +1,131 @@
+#pragma once
+
+#include <QtCore>
+#include <QtGui>
+#include <QtOpenGL>
+
+#include "GpuParticleSystem.h"
+#include "ParticlePool.h"
+#include "RadixSort.h"
+#include "RingAllocator.h"
+#include "Structs.h"
+
+class TaskPool;
+
+// Draws pools of particles as instanced meshes. Every frame the live particles are
+// converted to ParticleInstances, written straight into a GL buffer, and each draw() is a
+// single glDrawElementsInstanced however many particles there are.
+//
+// The instance buffer holds FRAMES_IN_FLIGHT frames of instances, handed out by a
+// RingAllocator. A frame's blocks are written through unsynchronized maps, which is safe
+// because a fence tells us when the GPU has finished reading them; with three frames in
+// flight the CPU normally never waits for the GPU. Orphaning the buffer on every draw, the
+// usual alternative, can be switched to for comparison.
+//
+// GPU particle systems need no streaming at all: their state buffers are read as the
+// instance data directly.
+//
+// Translucent particles have to be drawn back to front. Their view depths are sorted with a
+// RadixSort, which keeps the last frame's order to start from, and the instances are
+// written in that order.
+class ParticleRenderer : protected QOpenGLExtraFunctions
+{
+public:
+	enum class Streaming { Ring, Orphan };
+
+	static const int FRAMES_IN_FLIGHT = 3;
+
+	ParticleRenderer();
+	~ParticleRenderer();
+
+	// Build the shader and room for maxInstances instances per frame. Must be called with a
+	// current GL context. Returns false if the shader doesn't build.
+	bool create(int maxInstances);
+	// Free every GL object; the owning context must be current
+	void destroy();
+
+	// Upload a mesh, laid out as Renderable does, and return its index. Particle meshes are
+	// centered and scaled to the unit sphere; pass unitSize false to keep world coordinates.
+	int addMesh(const QVector<Vertex>& vertices, const QVector<Face>& faces, bool unitSize = true);
+	inline int meshCount() const { return meshes_.size(); }
+
+	// Particles spin about this axis by their angle
+	inline void setSpinAxis(const QVector3D& axis) { spinAxis_ = axis.normalized(); }
+
+	// Start a frame, waiting for the GPU only if it still reads the oldest frame's instances
+	void beginFrame(const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix);
+	// Draw every particle as mesh, tinted color and fading out over its last moments. The
+	// instances are filled on pool's threads when given. With depthOrder the particles are
+	// translucent, sorted back to front by it; draw them after everything opaque.
+	void draw(int mesh, const ParticlePool& particles, const QVector3D& color, TaskPool* pool = nullptr, RadixSort* depthOrder = nullptr);
+	// Draw every slot of a GPU particle system as mesh, straight from its state buffer
+	void draw(int mesh, const GpuParticleSystem& particles, const QVector3D& color);
+	// Draw a mesh once, as it is, in color; for scenery such as the ground
+	void drawMesh(int mesh, const QVector3D& color);
+	// Fence the frame's instances
+	void endFrame();
+
+	// Convert the first count particles to instances, tinted color and faded by their life.
+	// Instance ii is particle order[ii] when order is given. The work is split across pool's
+	// threads when given.
+	static void writeInstances(ParticleInstance* instances, const ParticlePool& particles, int count, const QVector3D& color, TaskPool* pool = nullptr,
+		const quint32* order = nullptr);
+	// Each of the first count particles' depth along the view's z axis; lower is farther away
+	static void writeDepths(float* depths, const ParticlePool& particles, int count, const QMatrix4x4& viewMatrix, TaskPool* pool = nullptr);
+
+	inline Streaming streaming() const { return streaming_; }
+	void setStreaming(Streaming streaming);
+
+	// Stats from the last frame
+	inline int drawCalls() const { return drawCalls_; }
+	inline int instancesDrawn() const { return instancesDrawn_; }
+	// Time blocked waiting for the GPU to release instance memory, and spent writing it
+	inline double waitMs() const { return waitMs_; }
+	inline double writeMs() const { return writeMs_; }
+	// Time spent finding depths and sorting them
+	inline double sortMs() const { return sortMs_; }
+
+private:
+	struct Mesh {
+		QOpenGLVertexArrayObject vao;
+		QOpenGLBuffer vbo;
+		QOpenGLBuffer ibo;
+		int indexCount;
+
+		Mesh() : ibo(QOpenGLBuffer::IndexBuffer), indexCount(0) {}
+	};
+
+	// Block until the oldest frame in flight is done and release its instances
+	void retireOldestFrame();
+	// Drop every fence and start the ring over; used when the buffer is reallocated
+	void resetFrames();
+	int uploadMesh(const QVector<Vertex>& vertices, const QVector<Face>& faces);
+	bool buildShader(QOpenGLShaderProgram& shader, const QByteArray& defines);
+	void bindShader(QOpenGLShaderProgram* shader);
+
+	QOpenGLShaderProgram shader_;
+	// The same shader reading GpuParticleSystem slots
+	QOpenGLShaderProgram gpuShader_;
+	QOpenGLShaderProgram* boundShader_;
+	QMatrix4x4 viewMatrix_;
+	QMatrix4x4 projectionMatrix_;
+	QVector<Mesh*> meshes_;
+	QVector3D spinAxis_;
+
+	GLuint instanceBuffer_;
+	int maxInstances_;
+	Streaming streaming_;
+	RingAllocator ring_;
+	// One fence per frame in the ring, oldest first from firstFence_
+	GLsync fences_[FRAMES_IN_FLIGHT];
+	int firstFence_;
+	// Used when the driver won't map the buffer
+	QVector<ParticleInstance> staging_;
+	QVector<float> depths_;
+
+	int drawCalls_;
+	int instancesDrawn_;
+	double waitMs_;
+	double writeMs_;
+	double sortMs_;
+};
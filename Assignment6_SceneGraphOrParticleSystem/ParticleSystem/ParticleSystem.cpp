@@ -0,0 +1,111 @@
+#include "ParticleSystem.h"
+#include "TaskPool.h"
+
+namespace {
+	// New particles the scratch ring holds per update; any more are dropped until next frame
+	const int SCRATCH_PARTICLES = 65536;
+	// Emitters spawning fewer particles than this are run on the calling thread
+	const int TASK_SPAWNS = 4096;
+}
+
+ParticleSystem::ParticleSystem(int capacity) : pool_(capacity), gravity_(0, -1, 0),
+	scratch_(new float[ParticlePool::STREAM_COUNT * SCRATCH_PARTICLES]),
+	scratchRing_(qint64(ParticlePool::STREAM_COUNT) * SCRATCH_PARTICLES * sizeof(float)),
+	spawned_(0), removed_(0), dropped_(0), integrateMs_(0.0), interactMs_(0.0), compactMs_(0.0), emitMs_(0.0)
+{}
+
+ParticleSystem::~ParticleSystem()
+{
+	qDeleteAll(emitters_);
+}
+
+Emitter* ParticleSystem::addEmitter(const Emitter::Settings& settings, quint32 seed)
+{
+	Emitter* emitter = new Emitter(settings, seed);
+	emitters_ << emitter;
+	return emitter;
+}
+
+void ParticleSystem::update(float dt, TaskPool* pool)
+{
+	QElapsedTimer timer;
+	timer.start();
+	pool_.integrate(dt, gravity_, pool);
+	integrateMs_ = timer.nsecsElapsed() / 1e6;
+
+	interactMs_ = 0.0;
+	if (interactions_.isActive()) {
+		timer.restart();
+		interactions_.apply(pool_, dt, pool);
+		interactMs_ = timer.nsecsElapsed() / 1e6;
+	}
+
+	timer.restart();
+	removed_ = pool_.compact();
+	compactMs_ = timer.nsecsElapsed() / 1e6;
+
+	timer.restart();
+	spawnParticles(dt, pool);
+	emitMs_ = timer.nsecsElapsed() / 1e6;
+}
+
+void ParticleSystem::spawnParticles(float dt, TaskPool* pool)
+{
+	spawned_ = 0;
+	dropped_ = 0;
+
+	// Carve a block of scratch for each emitter, with room for no more than the pool takes
+	int room = pool_.capacity() - pool_.size();
+	batches_.resize(0);
+	for (Emitter* emitter : emitters_) {
+		const int due = emitter->spawnCount(dt);
+		const int count = qMin(due, room);
+		dropped_ += due - count;
+		if (count == 0) {
+			continue;
+		}
+		// Streams of a multiple of four floats keep every one 16-byte aligned
+		const int stride = (count + 3) & ~3;
+		const qint64 offset = scratchRing_.allocate(qint64(stride) * ParticlePool::STREAM_COUNT * sizeof(float));
+		if (offset < 0) {
+			dropped_ += count;
+			continue;
+		}
+		Batch batch;
+		batch.emitter = emitter;
+		batch.count = count;
+		float* first = scratch_.get() + offset / sizeof(float);
+		for (int ii = 0; ii < ParticlePool::STREAM_COUNT; ++ii) {
+			batch.streams[ii] = first + size_t(stride) * ii;
+		}
+		batches_ << batch;
+		room -= count;
+	}
+
+	// Every emitter draws from its own random sequence, so the order they run in doesn't matter
+	TaskGroup group;
+	for (Batch& batch : batches_) {
+		if (pool && batch.count >= TASK_SPAWNS) {
+			pool->run(group, [&batch]() { batch.emitter->spawn(batch.streams, batch.count); });
+		}
+		else {
+			batch.emitter->spawn(batch.streams, batch.count);
+		}
+	}
+	if (pool) {
+		pool->wait(group);
+	}
+
+	for (const Batch& batch : batches_) {
+		spawned_ += pool_.append(batch.streams, batch.count);
+	}
+
+	// The new particles are in the pool now, so the scratch can be reused next update
+	scratchRing_.endFrame();
+	scratchRing_.retireFrame();
+}
+
+void ParticleSystem::clear()
+{
+	pool_.clear();
+}
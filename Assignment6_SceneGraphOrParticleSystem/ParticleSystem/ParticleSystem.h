@@ -0,0 +1,83 @@
+#pragma once
+
+#include <QtCore>
+#include <QtGui/QVector3D>
+
+#include <memory>
+
+#include "Emitter.h"
+#include "ParticleInteractions.h"
+#include "ParticlePool.h"
+#include "RingAllocator.h"
+
+class TaskPool;
+
+// Emitters feeding one pool of particles under gravity. Each update integrates the live
+// particles, lets them interact when interactions are active, removes the dead ones and
+// appends the new ones, which start moving next frame.
+//
+// New particles are written by their emitters into blocks of a scratch ring, one block per
+// emitter, so emitters can run in parallel and nothing is allocated per frame.
+class ParticleSystem
+{
+public:
+	explicit ParticleSystem(int capacity);
+	~ParticleSystem();
+
+	// The system owns its emitters
+	Emitter* addEmitter(const Emitter::Settings& settings, quint32 seed);
+	inline const QVector<Emitter*>& emitters() const { return emitters_; }
+
+	inline ParticlePool& particles() { return pool_; }
+	inline const ParticlePool& particles() const { return pool_; }
+
+	inline const QVector3D& gravity() const { return gravity_; }
+	inline void setGravity(const QVector3D& gravity) { gravity_ = gravity; }
+
+	// Neighbor pushes and ground collisions, both off to start with
+	inline ParticleInteractions& interactions() { return interactions_; }
+	inline const ParticleInteractions& interactions() const { return interactions_; }
+
+	// Advance by dt seconds. Integration and emission are split across pool's threads when
+	// given; the results are the same either way.
+	void update(float dt, TaskPool* pool = nullptr);
+	// Remove every particle
+	void clear();
+
+	// Stats from the last update
+	inline int spawnedCount() const { return spawned_; }
+	inline int removedCount() const { return removed_; }
+	// Particles due that didn't fit in the pool or the scratch ring
+	inline int droppedCount() const { return dropped_; }
+	inline double integrateMs() const { return integrateMs_; }
+	inline double interactMs() const { return interactMs_; }
+	inline double compactMs() const { return compactMs_; }
+	inline double emitMs() const { return emitMs_; }
+
+private:
+	struct Batch {
+		Emitter* emitter;
+		float* streams[ParticlePool::STREAM_COUNT];
+		int count;
+	};
+
+	void spawnParticles(float dt, TaskPool* pool);
+
+	ParticlePool pool_;
+	QVector<Emitter*> emitters_;
+	QVector3D gravity_;
+	ParticleInteractions interactions_;
+
+	// Scratch for new particles, handed out by scratchRing_ and released every update
+	std::unique_ptr<float[]> scratch_;
+	RingAllocator scratchRing_;
+	QVector<Batch> batches_;
+
+	int spawned_;
+	int removed_;
+	int dropped_;
+	double integrateMs_;
+	double interactMs_;
+	double compactMs_;
+	double emitMs_;
+};
@@ -0,0 +1,92 @@
+#version 330
+
+// Advances one particle slot per vertex; transform feedback captures the outputs.
+// Matches ParticlePool's integration and Emitter's launches.
+
+#define MAX_EMITTERS 8
+
+layout(location = 0) in vec4 positionScale;
+layout(location = 1) in vec4 velocityLife;
+layout(location = 2) in vec4 spin;	// Angle, spin rate, scale rate, unused
+
+out vec4 outPositionScale;
+out vec4 outVelocityLife;
+out vec4 outSpin;
+
+uniform float dt;
+uniform vec3 gravity;
+uniform int capacity;
+uniform uint seed;
+
+// Each emitter launches into the run of emitCount slots starting at emitStart
+uniform int emitterCount;
+uniform int emitStart[MAX_EMITTERS];
+uniform int emitCount[MAX_EMITTERS];
+uniform vec4 emitOrigin[MAX_EMITTERS];	// Position, then the cosine of the cone's half-angle
+uniform vec4 emitAxis[MAX_EMITTERS];	// Launch direction, then speed
+uniform vec4 emitSide[MAX_EMITTERS];	// Across the launch direction, then speed jitter
+uniform vec4 emitForward[MAX_EMITTERS];	// Across both, then lifespan
+uniform vec4 emitShape[MAX_EMITTERS];	// Lifespan jitter, scale, scale jitter, scale rate
+uniform float emitSpin[MAX_EMITTERS];	// Spin jitter around zero
+
+uint state;
+
+// PCG hash; plenty random for launches and cheap enough to run per particle
+uint hash(uint value) {
+	uint word = value * 747796405u + 2891336453u;
+	word = ((word >> ((word >> 28u) + 4u)) ^ word) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+// Uniform in [0, 1)
+float random() {
+	state = hash(state);
+	return float(state >> 8u) * (1.0 / 16777216.0);
+}
+
+float jitter(float base, float amount) {
+	return base + (2.0 * random() - 1.0) * amount;
+}
+
+void launch(int emitter) {
+	state = hash(uint(gl_VertexID) ^ hash(seed));
+
+	// Uniform over the cone's cap of the unit sphere
+	float cosTheta = 1.0 - random() * (1.0 - emitOrigin[emitter].w);
+	float sinTheta = sqrt(max(0.0, 1.0 - cosTheta * cosTheta));
+	float phi = random() * 6.28318531;
+	vec3 direction = emitAxis[emitter].xyz * cosTheta +
+		(emitSide[emitter].xyz * cos(phi) + emitForward[emitter].xyz * sin(phi)) * sinTheta;
+	vec3 velocity = direction * jitter(emitAxis[emitter].w, emitSide[emitter].w);
+
+	float life = max(jitter(emitForward[emitter].w, emitShape[emitter].x), 0.01);
+	float scale = max(jitter(emitShape[emitter].y, emitShape[emitter].z), 0.0);
+	outPositionScale = vec4(emitOrigin[emitter].xyz, scale);
+	outVelocityLife = vec4(velocity, life);
+	outSpin = vec4(random() * 6.28318531, jitter(0.0, emitSpin[emitter]), emitShape[emitter].w, 0.0);
+}
+
+void main() {
+	for (int ii = 0; ii < emitterCount; ++ii) {
+		// Runs can wrap around the end of the ring
+		if ((gl_VertexID - emitStart[ii] + capacity) % capacity < emitCount[ii]) {
+			launch(ii);
+			return;
+		}
+	}
+
+	if (velocityLife.w <= 0.0) {
+		// Empty slot; zero scale keeps it from being drawn
+		outPositionScale = vec4(positionScale.xyz, 0.0);
+		outVelocityLife = velocityLife;
+		outSpin = spin;
+		return;
+	}
+
+	vec3 velocity = velocityLife.xyz + gravity * dt;
+	float life = velocityLife.w - dt;
+	float scale = max(positionScale.w + spin.z * dt, 0.0);
+	outPositionScale = vec4(positionScale.xyz + velocity * dt, life > 0.0 ? scale : 0.0);
+	outVelocityLife = vec4(velocity, life);
+	outSpin = vec4(spin.x + spin.y * dt, spin.yzw);
+}
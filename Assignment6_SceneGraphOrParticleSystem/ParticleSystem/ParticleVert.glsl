@@ -0,0 +1,43 @@
+#version 330
+layout(location = 0) in vec3 position;
+layout(location = 2) in vec3 normal;
+// Per particle: position in xyz and scale in w, then either
+//   GPU_STATE  a GpuParticleSystem slot's velocity and life, and its spin state
+//   otherwise  a ParticleInstance's spin angle in x and color in yzw
+layout(location = 4) in vec4 positionScale;
+#ifdef GPU_STATE
+layout(location = 5) in vec4 velocityLife;
+layout(location = 6) in vec4 spinState;
+
+uniform vec3 tint;
+uniform float fadeSeconds;
+#else
+layout(location = 5) in vec4 angleColor;
+#endif
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 spinAxis;
+
+out vec3 worldNormal;
+out vec3 color;
+
+// Rotate v about the unit axis by angle (Rodrigues' formula)
+vec3 spin(vec3 v, vec3 axis, float angle) {
+	float c = cos(angle);
+	float s = sin(angle);
+	return v * c + cross(axis, v) * s + axis * dot(axis, v) * (1.0 - c);
+}
+
+void main() {
+#ifdef GPU_STATE
+	float angle = spinState.x;
+	color = tint * clamp(velocityLife.w / fadeSeconds, 0.0, 1.0);
+#else
+	float angle = angleColor.x;
+	color = angleColor.yzw;
+#endif
+	vec3 worldPosition = positionScale.xyz + spin(position * positionScale.w, spinAxis, angle);
+	worldNormal = spin(normal, spinAxis, angle);
+	gl_Position = projection * view * vec4(worldPosition, 1.0);
+}
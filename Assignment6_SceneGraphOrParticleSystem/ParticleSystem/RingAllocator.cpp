@@ -0,0 +1,60 @@
+#include "RingAllocator.h"
+
+RingAllocator::RingAllocator(qint64 capacity, int alignment) : capacity_(0), alignment_(qMax(alignment, 1)), head_(0), tail_(0),
+	firstFrame_(0), frameCount_(0)
+{
+	reset(capacity);
+}
+
+void RingAllocator::reset(qint64 capacity)
+{
+	capacity_ = capacity / alignment_ * alignment_;
+	head_.store(0, std::memory_order_relaxed);
+	tail_ = 0;
+	firstFrame_ = 0;
+	frameCount_ = 0;
+}
+
+qint64 RingAllocator::allocate(qint64 bytes)
+{
+	if (bytes <= 0 || bytes > capacity_) {
+		return -1;
+	}
+
+	qint64 head = head_.load(std::memory_order_relaxed);
+	for (;;) {
+		qint64 start = (head + alignment_ - 1) / alignment_ * alignment_;
+		const qint64 offset = start % capacity_;
+		if (offset + bytes > capacity_) {
+			// Skip what's left at the end and start over at the front
+			start += capacity_ - offset;
+		}
+		const qint64 end = start + bytes;
+		if (end - tail_ > capacity_) {
+			return -1;
+		}
+		if (head_.compare_exchange_weak(head, end, std::memory_order_relaxed)) {
+			return start % capacity_;
+		}
+	}
+}
+
+bool RingAllocator::endFrame()
+{
+	if (frameCount_ == MAX_FRAMES) {
+		return false;
+	}
+	frameEnds_[(firstFrame_ + frameCount_) % MAX_FRAMES] = head_.load(std::memory_order_relaxed);
+	++frameCount_;
+	return true;
+}
+
+void RingAllocator::retireFrame()
+{
+	if (frameCount_ == 0) {
+		return;
+	}
+	tail_ = frameEnds_[firstFrame_];
+	firstFrame_ = (firstFrame_ + 1) % MAX_FRAMES;
+	--frameCount_;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QtCore>
+
+#include <atomic>
+
+// Hands out blocks of a fixed-capacity ring. Blocks are never freed one by one: they are
+// released a whole frame at a time, oldest frame first, once whoever reads them (a later
+// stage of the frame, or the GPU) is done. Allocating is a single atomic bump of the head,
+// so it costs nothing per block and never touches the heap.
+//
+// The allocator only deals in offsets; the memory itself can be a CPU array or a GL buffer.
+class RingAllocator
+{
+public:
+	// Most frames that can be open at once, counting the one being allocated
+	static const int MAX_FRAMES = 8;
+
+	explicit RingAllocator(qint64 capacity = 0, int alignment = 16);
+
+	// Forget every block and frame and resize the ring. capacity is rounded down to the
+	// alignment.
+	void reset(qint64 capacity);
+
+	// Offset of a new block of bytes, or -1 if it would overwrite a frame still in flight.
+	// Blocks never straddle the end of the ring. Safe to call from several threads at once.
+	qint64 allocate(qint64 bytes);
+	// Close the frame being allocated; its blocks stay in use until it is retired. Returns
+	// false, and keeps the frame open, if MAX_FRAMES frames are already waiting.
+	bool endFrame();
+	// Release the blocks of the oldest closed frame. Not safe alongside allocate().
+	void retireFrame();
+
+	inline qint64 capacity() const { return capacity_; }
+	// Bytes allocated and not yet retired, including padding skipped at the end of the ring
+	inline qint64 used() const { return head_.load(std::memory_order_relaxed) - tail_; }
+	// Closed frames waiting to be retired
+	inline int framesInFlight() const { return frameCount_; }
+
+private:
+	qint64 capacity_;
+	qint64 alignment_;
+	// Head and tail only ever grow; offsets in the ring are taken modulo the capacity
+	std::atomic<qint64> head_;
+	qint64 tail_;
+	// Where each closed frame ends, oldest first, starting at firstFrame_
+	qint64 frameEnds_[MAX_FRAMES];
+	int firstFrame_;
+	int frameCount_;
+};
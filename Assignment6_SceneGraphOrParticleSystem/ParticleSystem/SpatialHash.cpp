@@ -0,0 +1,116 @@
+#include "SpatialHash.h"
+#include "TaskPool.h"
+
+#include <cstring>
+
+namespace {
+	// Points hashed per chunk; fewer than this and the build runs on the calling thread
+	const int TASK_POINTS = 16384;
+	// Buckets prefix-summed per task
+	const int TASK_BUCKETS = 16384;
+	// Never fewer buckets than this, so small sets rarely collide
+	const int MIN_BUCKETS = 1024;
+
+	// Run body(index) for every index below count, across pool's threads when given
+	template <typename Body>
+	void runTasks(TaskPool* pool, int count, Body body)
+	{
+		if (!pool || count == 1) {
+			for (int ii = 0; ii < count; ++ii) {
+				body(ii);
+			}
+			return;
+		}
+		TaskGroup group;
+		for (int ii = 0; ii < count; ++ii) {
+			pool->run(group, [&body, ii]() { body(ii); });
+		}
+		pool->wait(group);
+	}
+}
+
+SpatialHash::SpatialHash(float cellSize) : cellSize_(cellSize), inverseCellSize_(1.0f / cellSize), count_(0), bucketCount_(MIN_BUCKETS), axisMask_(0),
+	starts_(MIN_BUCKETS + 1, 0)
+{}
+
+void SpatialHash::build(const float* x, const float* y, const float* z, int count, TaskPool* pool)
+{
+	inverseCellSize_ = 1.0f / cellSize_;
+	count_ = count;
+	bucketCount_ = MIN_BUCKETS;
+	int bits = 10;
+	while (bucketCount_ < count) {
+		bucketCount_ *= 2;
+		++bits;
+	}
+	// Enough bits per axis to fill every bucket, up to what spread() takes
+	axisMask_ = (1u << qMin((bits + 2) / 3, 10)) - 1;
+	keys_.resize(count);
+	sorted_.resize(count);
+	starts_.resize(bucketCount_ + 1);
+
+	// One chunk per thread is enough to keep them busy and keeps the histograms small. The
+	// sort is stable, so the chunking doesn't change the result.
+	const int threads = pool ? pool->threadCount() : 1;
+	const int chunks = qMax(1, qMin(threads, count / TASK_POINTS));
+	const int chunkPoints = (count + chunks - 1) / chunks;
+	const int ranges = (bucketCount_ + TASK_BUCKETS - 1) / TASK_BUCKETS;
+	histograms_.resize(size_t(chunks) * bucketCount_);
+	rangeStarts_.resize(ranges);
+	TaskPool* tasks = chunks > 1 ? pool : nullptr;
+
+	// Count each chunk's points per bucket
+	runTasks(tasks, chunks, [&](int chunk) {
+		int* histogram = histograms_.data() + size_t(chunk) * bucketCount_;
+		std::memset(histogram, 0, bucketCount_ * sizeof(int));
+		const int end = qMin(count, (chunk + 1) * chunkPoints);
+		for (int ii = chunk * chunkPoints; ii < end; ++ii) {
+			const int key = bucket(cellCoordinate(x[ii]), cellCoordinate(y[ii]), cellCoordinate(z[ii]));
+			keys_[ii] = key;
+			++histogram[key];
+		}
+	});
+
+	// Total each range of buckets, then find where each range starts
+	runTasks(tasks, ranges, [&](int range) {
+		const int end = qMin(bucketCount_, (range + 1) * TASK_BUCKETS);
+		int total = 0;
+		for (int chunk = 0; chunk < chunks; ++chunk) {
+			const int* histogram = histograms_.data() + size_t(chunk) * bucketCount_;
+			for (int bucket = range * TASK_BUCKETS; bucket < end; ++bucket) {
+				total += histogram[bucket];
+			}
+		}
+		rangeStarts_[range] = total;
+	});
+	int start = 0;
+	for (int& rangeStart : rangeStarts_) {
+		const int total = rangeStart;
+		rangeStart = start;
+		start += total;
+	}
+
+	// Within a bucket, earlier chunks' points go first, so points stay in index order
+	runTasks(tasks, ranges, [&](int range) {
+		const int end = qMin(bucketCount_, (range + 1) * TASK_BUCKETS);
+		int offset = rangeStarts_[range];
+		for (int bucket = range * TASK_BUCKETS; bucket < end; ++bucket) {
+			starts_[bucket] = offset;
+			for (int chunk = 0; chunk < chunks; ++chunk) {
+				int& slot = histograms_[size_t(chunk) * bucketCount_ + bucket];
+				const int points = slot;
+				slot = offset;
+				offset += points;
+			}
+		}
+	});
+	starts_[bucketCount_] = count;
+
+	runTasks(tasks, chunks, [&](int chunk) {
+		int* offsets = histograms_.data() + size_t(chunk) * bucketCount_;
+		const int end = qMin(count, (chunk + 1) * chunkPoints);
+		for (int ii = chunk * chunkPoints; ii < end; ++ii) {
+			sorted_[offsets[keys_[ii]]++] = ii;
+		}
+	});
+}
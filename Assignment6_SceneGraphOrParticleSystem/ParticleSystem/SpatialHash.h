@@ -0,0 +1,79 @@
+#pragma once
+
+#include <QtCore>
+
+#include <cmath>
+#include <vector>
+
+class TaskPool;
+
+// Points binned into a uniform grid of cubic cells, each cell hashed to one of a power of
+// two buckets. Rebuilt from scratch every frame with a counting sort: the points' indices
+// end up grouped by bucket, so a cell's points are one contiguous run.
+//
+// The hash wraps the grid into a block of cells a power of two wide and numbers them in
+// Morton order, so cells near each other in space are mostly near each other in bucket
+// order too. Queries then read neighboring cells from nearby memory, which matters far more
+// than an even spread once there are more points than fit in cache.
+//
+// The sort is stable, so within a bucket points stay in index order whatever the number of
+// threads, and everything built on top of it can be deterministic. Different cells can
+// share a bucket; queries have to check distances anyway, so that costs a little time and
+// never a wrong answer.
+class SpatialHash
+{
+public:
+	explicit SpatialHash(float cellSize = 1.0f);
+
+	inline float cellSize() const { return cellSize_; }
+	// Takes effect at the next build
+	inline void setCellSize(float cellSize) { cellSize_ = cellSize; }
+
+	// Hash count points, given as arrays of coordinates. Work is split across pool's threads
+	// when given; the result is the same either way.
+	void build(const float* x, const float* y, const float* z, int count, TaskPool* pool = nullptr);
+
+	inline int size() const { return count_; }
+	inline int bucketCount() const { return bucketCount_; }
+
+	// A point's coordinate in cell widths, and the cell holding it
+	inline float cellPosition(float value) const { return value * inverseCellSize_; }
+	inline int cellCoordinate(float value) const { return int(std::floor(cellPosition(value))); }
+	// Bucket a cell hashes to
+	inline int bucket(int cx, int cy, int cz) const {
+		const quint32 code = spread(quint32(cx) & axisMask_) | spread(quint32(cy) & axisMask_) << 1 | spread(quint32(cz) & axisMask_) << 2;
+		return int(code & quint32(bucketCount_ - 1));
+	}
+
+	// The points in a bucket are sortedIndices()[bucketBegin(b)] up to bucketEnd(b)
+	inline int bucketBegin(int bucket) const { return starts_[bucket]; }
+	inline int bucketEnd(int bucket) const { return starts_[bucket + 1]; }
+	// Every point's index, grouped by bucket and in index order within each
+	inline const int* sortedIndices() const { return sorted_.data(); }
+	// Bucket of each point, by index
+	inline const int* buckets() const { return keys_.data(); }
+
+private:
+	// Put two zero bits after each of the low ten bits of value
+	static inline quint32 spread(quint32 value) {
+		value = (value | value << 16) & 0x030000FFu;
+		value = (value | value << 8) & 0x0300F00Fu;
+		value = (value | value << 4) & 0x030C30C3u;
+		return (value | value << 2) & 0x09249249u;
+	}
+
+	float cellSize_;
+	float inverseCellSize_;
+	int count_;
+	int bucketCount_;
+	// Cell coordinates wrap at this many bits
+	quint32 axisMask_;
+
+	std::vector<int> keys_;
+	std::vector<int> sorted_;
+	std::vector<int> starts_;
+	// Per chunk of points, its count of each bucket, then where it writes each bucket
+	std::vector<int> histograms_;
+	// Per range of buckets, its points, then where they start
+	std::vector<int> rangeStarts_;
+};
@@ -0,0 +1,97 @@
+// Sphere source code based on http://www.songho.ca/opengl/gl_sphere.html#sphere
+// I was having some issues with the provided implementation so I used this one instead
+
+#include "Sphere.h"
+#include "TangentSpace.h"
+
+// Calls the initalization routine
+Sphere::Sphere() : radius_(1.0), sectorCount_(30), stackCount_(30) {
+	init();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// build vertices of sphere with smooth shading using parametric equation
+// x = r * cos(u) * cos(v)
+// y = r * sin(u)
+// z = r * cos(u) * sin(v)
+// where u: stack(latitude) angle (-90 <= u <= 90)
+//       v: sector(longitude) angle (0 <= v <= 360)
+///////////////////////////////////////////////////////////////////////////////
+void Sphere::init() {
+	double x, y, z, xz;															// vertex position
+	double nx, ny, nz, lengthInv = 1.0 / radius_;		// normal
+	double u, v;																			// texCoord
+
+	double sectorStep = 2 * M_PI / double(sectorCount_);
+	double stackStep = M_PI / double(stackCount_);
+	double sectorAngle, stackAngle;
+
+	for (int i = 0; i <= stackCount_; ++i)
+	{
+		stackAngle = M_PI_2 - i * stackStep;					// starting from pi/2 to -pi/2
+		xz = radius_ * cos(stackAngle);								// r * cos(u)
+		y = radius_ * sin(stackAngle);								// r * sin(u)
+
+		// add (sectorCount+1) vertices per stack
+		// the first and last vertices have same position and normal, but different tex coords
+		for (int j = 0; j <= sectorCount_; ++j)
+		{
+			sectorAngle = j * sectorStep;								// starting from 0 to 2pi
+
+			// vertex position
+			x = xz * cos(sectorAngle);									// r * cos(u) * cos(v)
+			z = xz * sin(sectorAngle);									// r * cos(u) * sin(v)
+			Vec3 pos(x, y, z);
+
+			// normalized vertex normal
+			nx = x * lengthInv;
+			ny = y * lengthInv;
+			nz = z * lengthInv;
+			Vec3 norm(nx, ny, nz);
+
+			// vertex tex coord between [0, 1]
+			u = -(double(j) / double(sectorCount_)) + 1;
+			v = double(i) / double(stackCount_);
+			Vec2 tex(u, v);
+
+			Vertex vert;
+			vert.position = pos;
+			vert.texCoord = tex;
+			vert.normal = norm;
+			vertices_ << vert;
+		}
+	}
+
+	// indices
+	//  k1--k1+1
+	//  |  / |
+	//  | /  |
+	//  k2--k2+1
+	unsigned int k1, k2;
+	for (int i = 0; i < stackCount_; ++i)
+	{
+		k1 = i * (sectorCount_ + 1);									// beginning of current stack
+		k2 = k1 + stackCount_ + 1;										// beginning of next stack
+
+		for (int j = 0; j < sectorCount_; ++j, ++k1, ++k2)
+		{
+			// 2 triangles per sector excluding 1st and last stacks
+			if (i != 0)
+			{
+				Face face(k1, k2, k1 + 1);								// k1---k2---k1+1
+				faces_ << face;
+			}
+
+			if (i != (stackCount_ - 1))
+			{
+				Face face(k1 + 1, k2, k2 + 1);						// k1+1---k2---k2+1
+				faces_ << face;
+			}
+		}
+	}
+
+	// calculate tangent frames once all vertices and faces are in
+	TangentSpace::generate(vertices_, faces_);
+}
+
+
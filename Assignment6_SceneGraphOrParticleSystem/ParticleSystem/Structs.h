@@ -0,0 +1,74 @@
+#pragma once
+
+#include <QtOpenGL>
+
+struct Vec3 {
+	float x, y, z;
+
+	Vec3();
+	Vec3(float x, float y, float z);
+	Vec3(const QVector3D vec);
+
+	float length() const;
+	void normalize();
+	Vec3 normalized() const;
+
+	bool operator==(Vec3 other) const;
+	Vec3& operator+=(const Vec3& other);
+	Vec3 operator-(const Vec3& other) const;
+	Vec3 operator-() const;
+	float& operator[](int i);
+	const float& operator[](int i) const;
+};
+
+struct Vec2 {
+	float u, v;
+
+	Vec2();
+	Vec2(float u, float v);
+	Vec2(const QVector2D vec);
+
+	float length() const;
+	void normalize();
+	Vec2 normalized() const;
+
+	bool operator==(Vec2 other) const;
+	Vec2 operator-(const Vec2& other) const;
+	float& operator[](int i);
+	const float& operator[](int i) const;
+};
+
+struct Vertex {
+	Vec3 position;
+	Vec2 texCoord;
+	Vec3 normal;
+	Vec3 tangent;
+	// -1 where the UVs are mirrored, so the bitangent is -cross(normal, tangent)
+	float handedness;
+
+	Vertex();
+	Vertex(Vec3 pos, Vec2 tex, Vec3 norm, Vec3 tan, float handedness = 1.0f);
+
+	bool operator==(Vertex other) const;
+};
+
+struct Face {
+	unsigned int a, b, c;
+
+	Face();
+	Face(unsigned int v1, unsigned int v2, unsigned int v3);
+
+	bool operator==(Face other) const;
+	unsigned int& operator[](int i);
+	const unsigned int& operator[](int i) const;
+};
+
+// Per-particle data streamed to the GPU for instanced draws. The vertex shader builds
+// the transform from it, so each particle takes 32 bytes rather than the 100 a model and
+// normal matrix would.
+struct ParticleInstance {
+	float position[3];
+	float scale;
+	float angle;	// About the renderer's spin axis, in radians
+	float color[3];
+};
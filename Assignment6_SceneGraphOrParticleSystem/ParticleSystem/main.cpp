@@ -0,0 +1,47 @@
+/**
+ * Support code written by Erik W. Anderson
+ */
+
+#include <QtCore>
+#include <QtGui>
+#include <QtOpenGL>
+
+#include "App.h"
+#include "Benchmarks.h"
+
+int main(int argc, char** argv) {
+  // Headless benchmark: ./App --bench-particles [particleCount]
+  if (argc > 1 && QString(argv[1]) == "--bench-particles") {
+    return runParticleBenchmark(argc > 2 ? QString(argv[2]).toInt() : 1000000);
+  }
+  // Headless benchmark: ./App --bench-interactions [particleCount]
+  if (argc > 1 && QString(argv[1]) == "--bench-interactions") {
+    return runInteractionBenchmark(argc > 2 ? QString(argv[2]).toInt() : 200000);
+  }
+  // Headless benchmark: ./App --bench-sort [particleCount]
+  if (argc > 1 && QString(argv[1]) == "--bench-sort") {
+    return runSortBenchmark(argc > 2 ? QString(argv[2]).toInt() : 1000000);
+  }
+
+  QSurfaceFormat fmt;
+  fmt.setDepthBufferSize(24);
+  fmt.setStencilBufferSize(8);
+  fmt.setVersion(3,3);
+  fmt.setProfile(QSurfaceFormat::CoreProfile);
+  QSurfaceFormat::setDefaultFormat(fmt);
+
+  // Headless benchmark: ./App --bench-gpu-particles [particleCount]
+  if (argc > 1 && QString(argv[1]) == "--bench-gpu-particles") {
+    QGuiApplication headless(argc, argv);
+    QDir::setCurrent(headless.applicationDirPath());
+    return runGpuParticleBenchmark(argc > 2 ? QString(argv[2]).toInt() : 1000000);
+  }
+
+  QApplication a(argc, argv);
+  QString appDir = a.applicationDirPath();
+  QDir::setCurrent(appDir);
+
+  App app(argc, argv);
+  app.show();
+  return QApplication::exec();
+}
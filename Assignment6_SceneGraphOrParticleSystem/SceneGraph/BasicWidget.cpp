@@ -13,13 +13,16 @@ static QString drawModeToString(DrawMode drawMode) {
 		return "Normal debug";
 	case DrawMode::LIGHTING_DEBUG:
 		return "Lighting debug";
+	case DrawMode::GBUFFER:
+		return "G-buffer";
 	}
 }
 
 //////////////////////////////////////////////////////////////////////
 // Publics
-BasicWidget::BasicWidget(QWidget* parent) : QOpenGLWidget(parent), camera_(QVector3D(0, 5, 35)),
-	logger_(this), drawMode_(DrawMode::DEFAULT), paused_(false), mouseAction_(MouseControl::NoAction)
+BasicWidget::BasicWidget(QWidget* parent) : QOpenGLWidget(parent), camera_(QVector3D(0, 5, 35)), solarSystem_(nullptr),
+	culling_(true), occlusion_(true), clustered_(true), deferred_(false), framesSinceStats_(0), gpuTimerFrame_(0), gpuNsSinceStats_(0), gpuSamplesSinceStats_(0),
+	sweepStep_(-1), sweepFrame_(0), sweepGpuNs_(0), sweepSamples_(0), sweepRestoreLights_(0), sweepRestoreDeferred_(false), logger_(this), drawMode_(DrawMode::DEFAULT), paused_(false), mouseAction_(MouseControl::NoAction)
 {
   setFocusPolicy(Qt::StrongFocus);
 }
@@ -28,11 +31,20 @@ BasicWidget::~BasicWidget()
 {
 	makeCurrent();
 	delete root;
+	TextureLoader::instance().clear();
+	ShaderCache::instance().clear();
 }
 
 void BasicWidget::updateScene(const qint64 msSinceLastFrame)
 {
-	root->update(msSinceLastFrame);
+	if (transforms_.needsRebuild()) {
+		transforms_.build(root);
+	}
+	if (!paused_) {
+		transforms_.animate(msSinceLastFrame);
+		solarSystem_->animateLights(msSinceLastFrame);
+	}
+	transforms_.update(&taskPool_);
 }
 
 void BasicWidget::renderScene()
@@ -43,8 +55,53 @@ void BasicWidget::renderScene()
 	glClearColor(0.01f, 0.01f, 0.01f, 1.f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	// Draw our scene
-	drawNode(root);
+	// Gather our scene into batches, then draw each batch with one call
+	renderQueue_.clear();
+	gatherNodes();
+	// Deferred shading only covers the lit modes; debug modes always draw forward
+	const bool deferred = deferred_ && (drawMode_ == DrawMode::DEFAULT || drawMode_ == DrawMode::LIGHTING_DEBUG);
+	const QSize viewportPixels = size() * devicePixelRatio();
+	if (clustered_ && !deferred) {
+		lightClusters_.update(solarSystem_->planetLights(), camera_.getViewMatrix(), camera_.getProjectionMatrix(), viewportPixels);
+	}
+	QOpenGLTimerQuery& gpuTimer = gpuTimers_[gpuTimerFrame_ % GPU_TIMER_COUNT];
+	const bool timing = gpuTimer.isCreated();
+	if (timing) {
+		if (gpuTimerFrame_ >= GPU_TIMER_COUNT && gpuTimer.isResultAvailable()) {
+			const qint64 gpuNs = gpuTimer.waitForResult();
+			gpuNsSinceStats_ += gpuNs;
+			++gpuSamplesSinceStats_;
+			// Skip results from frames issued before this sweep step began
+			if (sweepStep_ >= 0 && sweepFrame_ >= GPU_TIMER_COUNT) {
+				sweepGpuNs_ += gpuNs;
+				++sweepSamples_;
+			}
+		}
+		gpuTimer.begin();
+	}
+	if (deferred) {
+		QVector<PointLight>* lights = solarSystem_->planetLights();
+		deferredRenderer_.beginGeometryPass(viewportPixels);
+		renderQueue_.drawGeometry(camera_.position(), camera_.getViewMatrix(), camera_.getProjectionMatrix(), lights);
+		solarSystem_->asteroids()->draw(camera_.position(), camera_.getViewMatrix(), camera_.getProjectionMatrix(), DrawMode::GBUFFER);
+		deferredRenderer_.lightingPass(defaultFramebufferObject(), lights, camera_.position(), camera_.getViewMatrix(), camera_.getProjectionMatrix(),
+			drawMode_ == DrawMode::LIGHTING_DEBUG);
+		// Nodes with their own lights, like the sun, are drawn forward on top
+		renderQueue_.draw(camera_.position(), camera_.getViewMatrix(), camera_.getProjectionMatrix(), drawMode_, nullptr, lights, &taskPool_);
+	}
+	else {
+		// Before the queue, so its translucent nodes blend over the asteroids
+		solarSystem_->asteroids()->draw(camera_.position(), camera_.getViewMatrix(), camera_.getProjectionMatrix(), drawMode_, clustered_ ? &lightClusters_ : nullptr);
+		renderQueue_.draw(camera_.position(), camera_.getViewMatrix(), camera_.getProjectionMatrix(), drawMode_, clustered_ ? &lightClusters_ : nullptr, nullptr, &taskPool_);
+	}
+	if (timing) {
+		gpuTimer.end();
+		++gpuTimerFrame_;
+	}
+	if (sweepStep_ >= 0) {
+		advanceLightSweep();
+	}
+	logFrameStats();
 
 	// Swap buffers
 	update();
@@ -54,21 +111,157 @@ void BasicWidget::renderScene()
 // Privates
 ///////////////////////////////////////////////////////////////////////
 // Protected
-void BasicWidget::drawNode(SceneNode* node)
+void BasicWidget::gatherNodes()
 {
-	if (node->getRenderable())
+	const QMatrix4x4 viewProjection = camera_.getProjectionMatrix() * camera_.getViewMatrix();
+	if (culling_) {
+		const Frustum frustum(viewProjection);
+		culler_.cull(transforms_, frustum, visibleNodes_);
+	}
+	else {
+		// The flattened hierarchy already lists every node, so no tree walk is needed
+		visibleNodes_.resize(0);
+		for (int ii = 0; ii < transforms_.size(); ++ii) {
+			if (transforms_.node(ii)->getRenderable()) {
+				visibleNodes_ << ii;
+			}
+		}
+	}
+
+	if (occlusion_) {
+		// Draw the occluders still in view, then drop the nodes they hide
+		occlusionCuller_.begin(viewProjection);
+		for (int ii : visibleNodes_) {
+			const SceneNode* node = transforms_.node(ii);
+			if (node->getOccluder()) {
+				QMatrix4x4 toWorld = transforms_.world(ii);
+				toWorld.scale(node->getModelScale());
+				occlusionCuller_.addOccluder(node->getOccluder(), toWorld);
+			}
+		}
+		occlusionCuller_.rasterize(&taskPool_);
+		occlusionCuller_.cull(transforms_, visibleNodes_);
+	}
+
+	for (int ii : visibleNodes_)
 	{
+		const SceneNode* node = transforms_.node(ii);
 		QMatrix4x4 scale = QMatrix4x4();
 		scale.scale(node->getModelScale());
-		const QMatrix4x4 worldSpaceModelMatrix = node->getWorldTransform() * scale;
+		const QMatrix4x4 worldSpaceModelMatrix = transforms_.world(ii) * scale;
 
-		node->draw(worldSpaceModelMatrix, camera_.position(), camera_.getViewMatrix(), camera_.getProjectionMatrix(), drawMode_);
+		renderQueue_.submit(node, worldSpaceModelMatrix);
 	}
 
-	for (auto it = node->begin(); it != node->end(); ++it)
-	{
-		drawNode(*it);
+	// The asteroid belt is culled as a whole, on the GPU where it can be
+	solarSystem_->asteroids()->cull(viewProjection, camera_.position());
+}
+
+void BasicWidget::logFrameStats()
+{
+	++framesSinceStats_;
+	if (statsTimer_.elapsed() < 1000) {
+		return;
+	}
+	qDebug() << "Frame stats:" << framesSinceStats_ << "fps," << renderQueue_.drawCalls() << "draw calls," << renderQueue_.instancesDrawn() << "instances," << renderQueue_.textureBinds() << "texture binds,"
+		<< visibleNodes_.size() << "visible nodes," << (culling_ ? culler_.culledCount() : 0) << "culled nodes";
+	if (occlusion_) {
+		qDebug().noquote() << QString("  Occlusion: %1 of %2 nodes occluded, %3 occluders (%4 triangles) rasterized in %5 ms, tested in %6 ms")
+			.arg(occlusionCuller_.occludedCount()).arg(occlusionCuller_.testedCount())
+			.arg(occlusionCuller_.occluderCount()).arg(occlusionCuller_.trianglesDrawn())
+			.arg(occlusionCuller_.rasterMs(), 0, 'f', 3).arg(occlusionCuller_.testMs(), 0, 'f', 3);
+	}
+	GpuCuller* asteroids = solarSystem_->asteroids();
+	if (asteroids->instanceCount() > 0) {
+		// Reading the GPU's counts back waits for it, but only once a second
+		QStringList levels;
+		int drawn = 0;
+		for (int lod = 0; lod < asteroids->lodCount(); ++lod) {
+			const int count = asteroids->visibleCount(lod);
+			levels << QString::number(count);
+			drawn += count;
+		}
+		qDebug().noquote() << QString("  Asteroids: %1 of %2 drawn (%3 by level of detail), culled on the %4 in %5 ms")
+			.arg(drawn).arg(asteroids->instanceCount()).arg(levels.join(" / "))
+			.arg(asteroids->gpuDriven() ? "GPU" : "CPU").arg(asteroids->cullMs(), 0, 'f', 3);
+	}
+	if (renderQueue_.translucentDrawn() > 0) {
+		static const char* paths[] = { "empty", "still sorted", "repaired", "radix sorted" };
+		qDebug().noquote() << QString("  Translucent: %1 instances drawn back to front, last order %2")
+			.arg(renderQueue_.translucentDrawn())
+			.arg(paths[int(renderQueue_.translucentSortPath())]);
+	}
+	if (gpuSamplesSinceStats_ > 0) {
+		qDebug().noquote() << QString("  GPU scene draw: %1 ms (%2, %3 shaders)")
+			.arg(gpuNsSinceStats_ / 1e6 / gpuSamplesSinceStats_, 0, 'f', 3)
+			.arg(rendererName())
+			.arg(Renderable::uberShader() ? "uber" : "specialized");
+	}
+	if (deferred_) {
+		qDebug().noquote() << QString("  Deferred lights: %1 full screen, %2 light volumes")
+			.arg(deferredRenderer_.fullScreenLights()).arg(deferredRenderer_.volumeLights());
+	}
+	else if (clustered_) {
+		qDebug().noquote() << QString("  Clustered lights: %1 lights, %2 cluster references, %3 ms assigning")
+			.arg(lightClusters_.lightCount()).arg(lightClusters_.lightReferences())
+			.arg(lightClusters_.assignMs(), 0, 'f', 3);
+	}
+	framesSinceStats_ = 0;
+	gpuNsSinceStats_ = 0;
+	gpuSamplesSinceStats_ = 0;
+	statsTimer_.restart();
+}
+
+QString BasicWidget::rendererName() const
+{
+	if (deferred_) {
+		return "deferred";
 	}
+	return clustered_ ? "clustered forward" : "forward";
+}
+
+void BasicWidget::startLightSweep()
+{
+	sweepRestoreLights_ = solarSystem_->swarmLightCount();
+	sweepRestoreDeferred_ = deferred_;
+	sweepStep_ = 0;
+	qDebug() << "Light sweep: GPU scene draw time, forward vs. deferred";
+	applyLightSweepStep();
+}
+
+void BasicWidget::applyLightSweepStep()
+{
+	// Even steps draw forward, odd steps deferred, at 0, 128, ... 1024 swarm lights
+	solarSystem_->setSwarmLightCount(sweepStep_ / 2 * 128);
+	deferred_ = sweepStep_ % 2 == 1;
+	sweepFrame_ = 0;
+	sweepGpuNs_ = 0;
+	sweepSamples_ = 0;
+}
+
+void BasicWidget::advanceLightSweep()
+{
+	if (++sweepFrame_ < SWEEP_FRAMES) {
+		return;
+	}
+	if (sweepSamples_ > 0) {
+		qDebug().noquote() << QString("  %1 lights, %2: %3 ms")
+			.arg(solarSystem_->planetLights()->size(), 5)
+			.arg(rendererName(), -17)
+			.arg(sweepGpuNs_ / 1e6 / sweepSamples_, 0, 'f', 3);
+	}
+	else {
+		qDebug() << "  No GPU timer results; timer queries are unavailable.";
+	}
+
+	if (++sweepStep_ < SWEEP_STEPS) {
+		applyLightSweepStep();
+		return;
+	}
+	sweepStep_ = -1;
+	solarSystem_->setSwarmLightCount(sweepRestoreLights_);
+	deferred_ = sweepRestoreDeferred_;
+	qDebug() << "Light sweep done.";
 }
 
 void BasicWidget::quit(QString message, int exitCode) {
@@ -114,6 +307,61 @@ void BasicWidget::keyReleaseEvent(QKeyEvent* keyEvent)
 			paused_ = !paused_;
 			qDebug() << "Rotation" << (paused_ ? "paused." : "unpaused.");
 			break;
+		case Qt::Key_U:
+			Renderable::setUberShader(!Renderable::uberShader());
+			qDebug() << (Renderable::uberShader() ? "Using the runtime-branching uber shader." : "Using specialized shader variants.");
+			break;
+		case Qt::Key_C:
+			culling_ = !culling_;
+			qDebug() << "Frustum culling" << (culling_ ? "enabled." : "disabled.");
+			break;
+		case Qt::Key_O:
+			occlusion_ = !occlusion_;
+			qDebug() << "Occlusion culling" << (occlusion_ ? "enabled." : "disabled.");
+			break;
+		case Qt::Key_A:
+		{
+			// Cycle through belts of 10000, 50000 and 100000 asteroids, then none
+			const int belts[] = { 0, 10000, 50000, 100000 };
+			int next = 0;
+			while (next < 4 && belts[next] <= solarSystem_->asteroidCount()) {
+				++next;
+			}
+			solarSystem_->setAsteroidCount(belts[next % 4]);
+			qDebug() << "Asteroids:" << solarSystem_->asteroidCount();
+			break;
+		}
+		case Qt::Key_I:
+			if (!solarSystem_->asteroids()->gpuSupported()) {
+				qDebug() << "GPU culling needs GL 4.3; asteroids are culled on the CPU.";
+				break;
+			}
+			solarSystem_->asteroids()->setGpuDriven(!solarSystem_->asteroids()->gpuDriven());
+			qDebug() << (solarSystem_->asteroids()->gpuDriven() ? "Culling asteroids on the GPU, drawn with one indirect multi-draw." : "Culling asteroids on the CPU, drawn with one draw per level of detail.");
+			break;
+		case Qt::Key_K:
+			clustered_ = !clustered_;
+			if (clustered_) {
+				qDebug() << "Clustered lighting enabled.";
+			}
+			else {
+				qDebug() << "Clustered lighting disabled, shading at most" << int(Renderable::MAX_POINT_LIGHTS) << "lights per object.";
+			}
+			break;
+		case Qt::Key_G:
+			deferred_ = !deferred_;
+			qDebug() << (deferred_ ? "Deferred shading enabled." : "Deferred shading disabled.");
+			break;
+		case Qt::Key_B:
+			if (sweepStep_ < 0) {
+				startLightSweep();
+			}
+			break;
+		case Qt::Key_J:
+			// Cycle through swarms of 128 to 1024 lights, then back to none
+			solarSystem_->setSwarmLightCount(solarSystem_->swarmLightCount() >= 1024 ? 0 : solarSystem_->swarmLightCount() + 128);
+			qDebug() << "Swarm lights:" << solarSystem_->swarmLightCount();
+			break;
 		case Qt::Key_R:
 			camera_.reset();
 			qDebug() << "Camera orientation reset.";
@@ -134,6 +382,7 @@ void BasicWidget::mousePressEvent(QMouseEvent* mouseEvent)
 		mouseAction_ = MouseControl::Zoom;
 	}
 	lastMouseLoc_ = mouseEvent->pos();
+	pressLoc_ = mouseEvent->pos();
 }
 
 void BasicWidget::mouseMoveEvent(QMouseEvent* mouseEvent)
@@ -157,9 +406,35 @@ void BasicWidget::mouseMoveEvent(QMouseEvent* mouseEvent)
 
 void BasicWidget::mouseReleaseEvent(QMouseEvent* mouseEvent)
 {
+	if (mouseEvent->button() == Qt::LeftButton && (mouseEvent->pos() - pressLoc_).manhattanLength() <= CLICK_PIXELS) {
+		pick(mouseEvent->pos());
+	}
 	mouseAction_ = MouseControl::NoAction;
 }
 
+void BasicWidget::pick(const QPoint& pixel)
+{
+	QElapsedTimer timer;
+	timer.start();
+	// Through the pixel's centre, against the transforms of the last frame drawn
+	QVector3D origin, direction;
+	camera_.rayThrough(2.0f * (pixel.x() + 0.5f) / width() - 1.0f, 1.0f - 2.0f * (pixel.y() + 0.5f) / height(), origin, direction);
+	RayHit hit;
+	const bool found = transforms_.intersect(origin, direction, hit);
+	const double us = timer.nsecsElapsed() / 1e3;
+
+	if (!found) {
+		qDebug().noquote() << QString("Picked nothing (%1 us)").arg(us, 0, 'f', 1);
+		return;
+	}
+	const QVector3D position = origin + direction * hit.t;
+	qDebug().noquote() << QString("Picked node %1, triangle %2, barycentrics (%3, %4, %5), at (%6, %7, %8) (%9 us)")
+		.arg(hit.node).arg(hit.face)
+		.arg(1.0f - hit.u - hit.v, 0, 'f', 3).arg(hit.u, 0, 'f', 3).arg(hit.v, 0, 'f', 3)
+		.arg(position.x(), 0, 'f', 3).arg(position.y(), 0, 'f', 3).arg(position.z(), 0, 'f', 3)
+		.arg(us, 0, 'f', 1);
+}
+
 void BasicWidget::initializeGL()
 {
   makeCurrent();
@@ -169,11 +444,24 @@ void BasicWidget::initializeGL()
   qDebug() << QDir::currentPath();
 	
 	// Load solar system
-	root = new SolarSystem();
+	QElapsedTimer startupTimer;
+	startupTimer.start();
+	solarSystem_ = new SolarSystem();
+	root = solarSystem_;
+	const ShaderCache& shaders = ShaderCache::instance();
+	qDebug().noquote() << QString("Scene startup: %1 ms, %2 shader programs (%3 compiled, %4 from saved binaries, %5 ms building programs)")
+		.arg(startupTimer.nsecsElapsed() / 1e6, 0, 'f', 1)
+		.arg(shaders.programCount()).arg(shaders.compiledCount()).arg(shaders.binaryLoadCount())
+		.arg(shaders.buildMs(), 0, 'f', 1);
+	if (TextureLoader::instance().pending() > 0) {
+		qDebug() << "Loading" << TextureLoader::instance().pending() << "textures in the background";
+		textureTimer_.start();
+	}
 
 	if (!root) {
 		quit("No objects loaded correctly", 1);
 	}
+	transforms_.build(root);
 
 	// Print instructions
 	qDebug() << "\n\nPass object files to the program like so: ./App \"path/to/object1.obj\" \"path/to/object2.obj\" ...";
@@ -183,21 +471,38 @@ void BasicWidget::initializeGL()
 		"  Camera Controls:\n" <<
 		"    Left click and drag to move the camera.\n" <<
 		"    Right click and drag to zoom the camera in/out.\n" <<
+		"    Left click without dragging to pick the body under the cursor.\n" <<
 		"    Press R to reset the camera to its original orientation.\n" <<
 		"  Model Controls:\n" <<
 		"    Press spacebar to toggle the model rotation.\n" <<
+		"    Press C to toggle frustum culling.\n" <<
+		"    Press O to toggle occlusion culling behind the sun and planets.\n" <<
+		"    Press A to grow the asteroid belt, up to 100000 asteroids, then empty it.\n" <<
+		"    Press I to switch between culling the asteroids on the GPU and on the CPU.\n" <<
+		"  Lighting:\n" <<
+		"    Press J to add 128 orbiting lights, up to 1024, then remove them all.\n" <<
+		"    Press K to toggle clustered lighting.\n" <<
+		"    Press G to toggle deferred shading.\n" <<
+		"    Press B to time forward and deferred rendering at rising light counts.\n" <<
 		"  Draw Modes:\n" <<
 		"    Press W to enter wireframe mode. Press again to return to default.\n" <<
 		"    Press T to enter texture debug mode. Press again to return to default.\n" <<
 		"    Press N to enter normal debug mode. Press again to return to default.\n" <<
 		"    Press L to enter lighting debug mode. Press again to return to default.\n" <<
 		"    Press D to return to default drawing mode.\n" <<
+		"    Press U to switch between specialized shader variants and the uber shader.\n" <<
 		"  Quitting:\n" <<
 		"    Press Q to quit.\n\n";
 	
+	// Timer queries are optional; without them we just don't report GPU time
+	for (QOpenGLTimerQuery& gpuTimer : gpuTimers_) {
+		gpuTimer.create();
+	}
+
 	// Prepare for render
 	glViewport(0, 0, width(), height());
 	frameTimer_.start();
+	statsTimer_.start();
 }
 
 void BasicWidget::resizeGL(int w, int h)
@@ -223,6 +528,18 @@ void BasicWidget::paintGL()
 {
   qint64 msSinceRestart = frameTimer_.restart();
 
+	// Bring in a few decoded textures each frame rather than stalling on all of them
+	TextureLoader& textures = TextureLoader::instance();
+	if (textures.pending() > 0) {
+		textures.upload(TEXTURE_UPLOAD_BUDGET_MS);
+		if (textures.pending() == 0) {
+			qDebug().noquote() << QString("Textures loaded %1 ms after startup: %2 textures (%3 from the mip cache), %4 MB, %5 ms uploading on the render thread")
+				.arg(textureTimer_.nsecsElapsed() / 1e6, 0, 'f', 1)
+				.arg(textures.uploadedCount()).arg(textures.cachedCount()).arg(textures.uploadedBytes() / (1024.0 * 1024.0), 0, 'f', 1)
+				.arg(textures.uploadMs(), 0, 'f', 1);
+		}
+	}
+
 	updateScene(msSinceRestart);
 	
 	renderScene();
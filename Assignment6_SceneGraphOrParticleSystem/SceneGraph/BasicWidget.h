@@ -7,6 +7,14 @@
 #include "Renderable.h"
 #include "Camera.h"
 #include "SceneNode.h"
+#include "RenderQueue.h"
+#include "Frustum.h"
+#include "OcclusionCuller.h"
+#include "LightClusters.h"
+#include "DeferredRenderer.h"
+#include "TextureLoader.h"
+
+class SolarSystem;
 
 /**
  * This is just a basic OpenGL widget that will allow a change of background color.
@@ -18,8 +26,46 @@ class BasicWidget : public QOpenGLWidget, protected QOpenGLFunctions
 private:
 	Camera camera_;
   SceneNode* root;
+  SolarSystem* solarSystem_;
+  TransformHierarchy transforms_;
+  TaskPool taskPool_;
+  RenderQueue renderQueue_;
+  FrustumCuller culler_;
+  QVector<int> visibleNodes_;
+  bool culling_;
+  OcclusionCuller occlusionCuller_;
+  bool occlusion_;
+  LightClusters lightClusters_;
+  bool clustered_;
+  DeferredRenderer deferredRenderer_;
+  bool deferred_;
   
   QElapsedTimer frameTimer_;
+  // Frame stats, logged once per second
+  QElapsedTimer statsTimer_;
+  int framesSinceStats_;
+  // GPU time of the scene draw. Each query is read GPU_TIMER_COUNT frames after it
+  // was issued, when the result is normally ready, so timing never stalls the pipeline.
+  static const int GPU_TIMER_COUNT = 4;
+  QOpenGLTimerQuery gpuTimers_[GPU_TIMER_COUNT];
+  int gpuTimerFrame_;
+  qint64 gpuNsSinceStats_;
+  int gpuSamplesSinceStats_;
+  // Sweep over swarm light counts, timing forward and deferred rendering at each.
+  // Every step runs SWEEP_FRAMES frames; sweepStep_ is -1 when not sweeping.
+  static const int SWEEP_FRAMES = 64;
+  static const int SWEEP_STEPS = 18;
+  int sweepStep_;
+  int sweepFrame_;
+  qint64 sweepGpuNs_;
+  int sweepSamples_;
+  int sweepRestoreLights_;
+  bool sweepRestoreDeferred_;
+
+  // Decoded textures are uploaded for at most this long each frame
+  static constexpr double TEXTURE_UPLOAD_BUDGET_MS = 2.0;
+  // Time from startup until the last background texture was uploaded
+  QElapsedTimer textureTimer_;
 
   QOpenGLDebugLogger logger_;
 	
@@ -30,9 +76,17 @@ private:
 	enum class MouseControl { NoAction = 0, Rotate, Zoom };
 	QPoint lastMouseLoc_;
 	MouseControl mouseAction_;
+	// A left press released within CLICK_PIXELS of where it went down picks instead
+	QPoint pressLoc_;
+	static const int CLICK_PIXELS = 3;
 
 protected:
-  void drawNode(SceneNode* node);
+  void gatherNodes();
+  void logFrameStats();
+  QString rendererName() const;
+  void startLightSweep();
+  void applyLightSweepStep();
+  void advanceLightSweep();
 	
   // Required interaction overrides
   void keyReleaseEvent(QKeyEvent* keyEvent) override;
@@ -47,6 +101,8 @@ protected:
 
 	void quit(QString message, int exitCode);
 	void setDrawMode(DrawMode drawMode);
+	// Find the node and triangle under a point in the widget and log them
+	void pick(const QPoint& pixel);
   
 public:
   BasicWidget(QWidget* parent=nullptr);
@@ -0,0 +1,715 @@
+#include "Benchmarks.h"
+#include "Frustum.h"
+#include "OcclusionCuller.h"
+#include "RotatingNode.h"
+#include "SceneBvh.h"
+#include "SolarSystem.h"
+#include "Sphere.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+SceneNode* generateGalaxy(int nodeCount, int spinEvery)
+{
+	const int planetsPerSystem = 8;
+	const int moonsPerPlanet = 4;
+
+	int created = 0;
+	// Every spinEvery-th node we create rotates
+	auto makeNode = [&](const QVector3D& translation) -> SceneNode*
+	{
+		const bool spins = spinEvery > 0 && created % spinEvery == 0;
+		SceneNode* node = spins ? new RotatingNode(nullptr, 0.05f) : new SceneNode();
+		node->setLocalTranslation(translation);
+		++created;
+		return node;
+	};
+
+	SceneNode* galaxy = makeNode(QVector3D(0, 0, 0));
+	int system = 0;
+	while (created < nodeCount) {
+		// Lay suns out on a spiral
+		const float angle = system * 0.35f;
+		const float radius = 50.0f + system * 2.0f;
+		SceneNode* sun = makeNode(QVector3D(radius * std::cos(angle), 0.0f, radius * std::sin(angle)));
+		galaxy->addChild(sun);
+
+		for (int p = 0; p < planetsPerSystem; ++p) {
+			SceneNode* planet = makeNode(QVector3D(2.0f + p * 1.5f, 0.0f, 0.0f));
+			sun->addChild(planet);
+			for (int m = 0; m < moonsPerPlanet; ++m) {
+				planet->addChild(makeNode(QVector3D(0.3f + m * 0.2f, 0.0f, 0.0f)));
+			}
+		}
+		++system;
+	}
+	return galaxy;
+}
+
+// The old SceneNode::update: recompute every world matrix recursively, changed or not
+static void recursiveUpdate(SceneNode* node, const QMatrix4x4& parentWorld, QVector<QMatrix4x4>& worlds)
+{
+	const QMatrix4x4 world = parentWorld * node->getLocalTransform();
+	worlds << world;
+	for (auto it = node->begin(); it != node->end(); ++it) {
+		recursiveUpdate(*it, world, worlds);
+	}
+}
+
+int runTransformBenchmark(int nodeCount)
+{
+	const int frames = 100;
+	const qint64 msPerFrame = 16;
+
+	qDebug().noquote() << QString("Transform benchmark: %1+ nodes, %2 frames per case").arg(nodeCount).arg(frames);
+
+	// spinEvery: 1 = every node animates, 100 = 1% animate, 0 = static scene
+	const int spinCases[] = { 1, 10, 100, 0 };
+	for (int spinEvery : spinCases) {
+		SceneNode* galaxy = generateGalaxy(nodeCount, spinEvery);
+		TransformHierarchy hierarchy;
+
+		QElapsedTimer timer;
+		timer.start();
+		hierarchy.build(galaxy);
+		hierarchy.update();
+		const double buildMs = timer.nsecsElapsed() / 1e6;
+
+		qint64 recomputed = 0;
+		timer.restart();
+		for (int frame = 0; frame < frames; ++frame) {
+			hierarchy.animate(msPerFrame);
+			hierarchy.update();
+			recomputed += hierarchy.lastUpdateCount();
+		}
+		const double flatMs = timer.nsecsElapsed() / 1e6 / frames;
+
+		// Compare against the recursive full traversal it replaces
+		QVector<QMatrix4x4> worlds;
+		worlds.reserve(hierarchy.size());
+		timer.restart();
+		for (int frame = 0; frame < frames; ++frame) {
+			worlds.resize(0);
+			recursiveUpdate(galaxy, QMatrix4x4(), worlds);
+		}
+		const double recursiveMs = timer.nsecsElapsed() / 1e6 / frames;
+
+		const QString animated = spinEvery == 0 ? QString("none") : QString("1/%1").arg(spinEvery);
+		qDebug().noquote() << QString("  %1 nodes, %2 animated: build %3 ms | flattened %4 ms/frame (%5 ns/node, %6 recomputed/frame) | recursive %7 ms/frame")
+			.arg(hierarchy.size()).arg(animated)
+			.arg(buildMs, 0, 'f', 2)
+			.arg(flatMs, 0, 'f', 3)
+			.arg(flatMs * 1e6 / hierarchy.size(), 0, 'f', 1)
+			.arg(recomputed / frames)
+			.arg(recursiveMs, 0, 'f', 3);
+
+		delete galaxy;
+	}
+	return 0;
+}
+
+// Animate and update a fresh galaxy for a number of frames, returning ms/frame.
+// worlds receives the final world matrices so runs can be compared.
+static double timeUpdates(int nodeCount, int frames, TaskPool* pool, QVector<QMatrix4x4>& worlds)
+{
+	SceneNode* galaxy = generateGalaxy(nodeCount, 1);
+	TransformHierarchy hierarchy;
+	hierarchy.build(galaxy);
+	hierarchy.update(pool);
+
+	QElapsedTimer timer;
+	timer.start();
+	for (int frame = 0; frame < frames; ++frame) {
+		hierarchy.animate(16);
+		hierarchy.update(pool);
+	}
+	const double ms = timer.nsecsElapsed() / 1e6 / frames;
+
+	worlds.resize(hierarchy.size());
+	for (int i = 0; i < hierarchy.size(); ++i) {
+		worlds[i] = hierarchy.world(i);
+	}
+	delete galaxy;
+	return ms;
+}
+
+namespace {
+	// Thread counts to time: the powers of two below maxThreads, then maxThreads itself
+	QVector<int> threadCounts(int maxThreads)
+	{
+		QVector<int> counts;
+		for (int threads = 1; threads < maxThreads; threads *= 2) {
+			counts << threads;
+		}
+		counts << maxThreads;
+		return counts;
+	}
+}
+
+int runParallelBenchmark(int nodeCount)
+{
+	const int frames = 100;
+	const int maxThreads = qMax(1, (int)std::thread::hardware_concurrency());
+
+	qDebug().noquote() << QString("Parallel transform benchmark: %1+ nodes, all animated, %2 frames, up to %3 threads")
+		.arg(nodeCount).arg(frames).arg(maxThreads);
+
+	QVector<QMatrix4x4> serialWorlds;
+	const double serialMs = timeUpdates(nodeCount, frames, nullptr, serialWorlds);
+	qDebug().noquote() << QString("  serial: %1 ms/frame").arg(serialMs, 0, 'f', 3);
+
+	bool allMatch = true;
+	for (int threads : threadCounts(maxThreads)) {
+		TaskPool pool(threads);
+		QVector<QMatrix4x4> worlds;
+		const double ms = timeUpdates(nodeCount, frames, &pool, worlds);
+
+		// Same math in the same order per node, so the results should be bit for bit equal
+		const bool match = worlds.size() == serialWorlds.size() &&
+			std::memcmp(worlds.constData(), serialWorlds.constData(), worlds.size() * sizeof(QMatrix4x4)) == 0;
+		allMatch = allMatch && match;
+
+		qDebug().noquote() << QString("  %1 threads: %2 ms/frame, %3x speedup, %4")
+			.arg(threads)
+			.arg(ms, 0, 'f', 3)
+			.arg(serialMs / ms, 0, 'f', 2)
+			.arg(match ? "matches serial" : "DIFFERS FROM SERIAL");
+	}
+	return allMatch ? 0 : 1;
+}
+
+// Cast a primary ray through the centre of every pixel of a size by size image, in blocks of
+// packetSize pixels: 1, 4 as 2x2 or 8 as 4x2. trace(packet, count, pixels) traces each block,
+// pixels holding the index of each ray's pixel. Returns how long it took in ms.
+template<typename Trace>
+static double castPrimary(const QVector3D& position, const QVector3D& lookAt, float fov, int size, int packetSize, Trace trace)
+{
+	const QVector3D forward = (lookAt - position).normalized();
+	const QVector3D right = QVector3D::crossProduct(forward, QVector3D(0.0f, 1.0f, 0.0f)).normalized();
+	const QVector3D up = QVector3D::crossProduct(right, forward);
+	const float tanHalfFov = std::tan(qDegreesToRadians(fov) * 0.5f);
+	const int blockWidth = qMax(packetSize / 2, 1);
+	const int blockHeight = packetSize > 1 ? 2 : 1;
+
+	QElapsedTimer timer;
+	timer.start();
+	Bvh::Packet packet;
+	int pixels[Bvh::MAX_PACKET];
+	for (int by = 0; by < size; by += blockHeight) {
+		for (int bx = 0; bx < size; bx += blockWidth) {
+			int count = 0;
+			for (int y = by; y < qMin(size, by + blockHeight); ++y) {
+				for (int x = bx; x < qMin(size, bx + blockWidth); ++x) {
+					const float sx = (2.0f * (x + 0.5f) / size - 1.0f) * tanHalfFov;
+					const float sy = (1.0f - 2.0f * (y + 0.5f) / size) * tanHalfFov;
+					const QVector3D direction = (forward + right * sx + up * sy).normalized();
+					for (int axis = 0; axis < 3; ++axis) {
+						packet.origin[axis][count] = position[axis];
+						packet.direction[axis][count] = direction[axis];
+					}
+					packet.tMax[count] = 1e30f;
+					pixels[count] = y * size + x;
+					++count;
+				}
+			}
+			trace(packet, count, pixels);
+		}
+	}
+	return timer.nsecsElapsed() / 1e6;
+}
+
+// Whether two traces of the same ray found the same thing. Of two equally near surfaces
+// either may win, so equal distances count as a match too.
+static bool sameHit(const SceneBvh::Hit& a, const SceneBvh::Hit& b, float tolerance)
+{
+	if (a.instance < 0 || b.instance < 0) {
+		return a.instance == b.instance;
+	}
+	return (a.instance == b.instance && a.face == b.face) || std::fabs(a.t - b.t) <= tolerance * a.t;
+}
+
+int runRaytraceBenchmark(int nodeCount)
+{
+	const int size = 512;
+	const float fov = 60.0f;
+
+	// Every body is the same sphere, sized by how deep it is: suns, planets, then moons
+	SceneNode* galaxy = generateGalaxy(nodeCount, 0);
+	TransformHierarchy hierarchy;
+	hierarchy.build(galaxy);
+	hierarchy.update();
+	QVector<int> depths(hierarchy.size(), 0);
+	for (int i = 1; i < hierarchy.size(); ++i) {
+		depths[i] = depths[hierarchy.parent(i)] + 1;
+	}
+	const float scales[] = { 0.0f, 0.8f, 0.2f, 0.05f };
+
+	const Sphere sphere;
+	const QVector<Vertex> sphereVertices = sphere.vertices();
+	const QVector<Face> sphereFaces = sphere.faces();
+	QElapsedTimer timer;
+	timer.start();
+	Bvh sphereBvh;
+	sphereBvh.build(sphereVertices, sphereFaces);
+	const double sphereMs = timer.nsecsElapsed() / 1e6;
+
+	SceneBvh scene;
+	for (int i = 1; i < hierarchy.size(); ++i) {
+		QMatrix4x4 toWorld = hierarchy.world(i);
+		toWorld.scale(scales[qMin(depths[i], 3)]);
+		scene.addInstance(&sphereBvh, toWorld, i);
+	}
+	timer.restart();
+	const Bvh::Stats topStats = scene.build();
+	const double topMs = timer.nsecsElapsed() / 1e6;
+
+	// The same bodies with their triangles copied into the world, in instance order
+	QVector<Vertex> worldVertices;
+	QVector<Face> worldFaces;
+	worldVertices.reserve(sphereVertices.size() * int(scene.instances().size()));
+	worldFaces.reserve(sphereFaces.size() * int(scene.instances().size()));
+	for (const SceneBvh::Instance& instance : scene.instances()) {
+		const unsigned int base = worldVertices.size();
+		for (Vertex vertex : sphereVertices) {
+			vertex.position = Vec3(instance.toWorld.map(QVector3D(vertex.position.x, vertex.position.y, vertex.position.z)));
+			worldVertices << vertex;
+		}
+		for (const Face& face : sphereFaces) {
+			worldFaces << Face(base + face.a, base + face.b, base + face.c);
+		}
+	}
+	timer.restart();
+	Bvh flat;
+	const Bvh::Stats flatStats = flat.build(worldVertices, worldFaces);
+	const double flatMs = timer.nsecsElapsed() / 1e6;
+
+	qDebug().noquote() << QString("Ray trace benchmark: %1 bodies instancing a %2 triangle sphere, %3x%3 primary rays on one thread")
+		.arg(scene.instances().size()).arg(sphereFaces.size()).arg(size);
+	qDebug().noquote() << QString("  two-level: %1 KB (sphere %2 KB shared), build %3 ms + %4 ms, %5 top nodes")
+		.arg((scene.bytes() + sphereBvh.bytes()) / 1024).arg(sphereBvh.bytes() / 1024)
+		.arg(sphereMs, 0, 'f', 2).arg(topMs, 0, 'f', 2).arg(topStats.nodes);
+	qDebug().noquote() << QString("  flattened: %1 KB for %2 triangles, build %3 ms, %4 nodes")
+		.arg(flat.bytes() / 1024).arg(worldFaces.size()).arg(flatMs, 0, 'f', 2).arg(flatStats.nodes);
+
+	// Look down the first solar system's row of planets from just above its sun, with the
+	// rest of the galaxy behind
+	const QVector3D sun = hierarchy.world(1).map(QVector3D(0.0f, 0.0f, 0.0f));
+	const QVector3D position = sun + QVector3D(0.0f, 3.0f, 6.0f);
+	const qint64 rays = qint64(size) * size;
+
+	int failures = 0;
+	std::vector<SceneBvh::Hit> singleHits;
+	double singleMs = 0.0;
+	for (int packetSize : { 1, 4, 8 }) {
+		std::vector<SceneBvh::Hit> hits(rays);
+		const double ms = castPrimary(position, sun, fov, size, packetSize, [&](const Bvh::Packet& packet, int count, const int* pixels) {
+			if (count == 1 && packetSize == 1) {
+				scene.intersect(Vec3(packet.origin[0][0], packet.origin[1][0], packet.origin[2][0]),
+					Vec3(packet.direction[0][0], packet.direction[1][0], packet.direction[2][0]), hits[pixels[0]]);
+				return;
+			}
+			SceneBvh::Hit packetHits[Bvh::MAX_PACKET];
+			scene.intersect(packet, count, packetHits);
+			for (int ii = 0; ii < count; ++ii) {
+				hits[pixels[ii]] = packetHits[ii];
+			}
+		});
+
+		int differ = 0;
+		qint64 hitCount = 0;
+		if (packetSize == 1) {
+			singleHits = hits;
+			singleMs = ms;
+		}
+		for (qint64 ii = 0; ii < rays; ++ii) {
+			differ += sameHit(hits[ii], singleHits[ii], 0.0f) ? 0 : 1;
+			hitCount += hits[ii].instance >= 0 ? 1 : 0;
+		}
+		failures += differ;
+		qDebug().noquote() << QString("  two-level, %1: %2 ms (%3 Mrays/s, x%4), %5 hits%6")
+			.arg(packetSize == 1 ? QString("single rays") : QString("packets of %1").arg(packetSize), -15)
+			.arg(ms, 0, 'f', 1).arg(rays / ms / 1000.0, 0, 'f', 2).arg(singleMs / ms, 0, 'f', 2)
+			.arg(hitCount).arg(differ == 0 ? QString() : QString(", %1 DIFFER").arg(differ));
+	}
+
+	// Copied triangles round differently from rays carried into the sphere's space, so the
+	// flattened tree may disagree where a ray grazes a triangle's edge
+	for (int packetSize : { 1, 8 }) {
+		std::vector<SceneBvh::Hit> hits(rays);
+		const int facesPerBody = sphereFaces.size();
+		const auto store = [&](const Bvh::Hit& hit, int pixel) {
+			SceneBvh::Hit& sceneHit = hits[pixel];
+			sceneHit.t = hit.t;
+			sceneHit.instance = hit.face < 0 ? -1 : hit.face / facesPerBody;
+			sceneHit.face = hit.face < 0 ? -1 : hit.face % facesPerBody;
+			sceneHit.u = hit.u;
+			sceneHit.v = hit.v;
+		};
+		const double ms = castPrimary(position, sun, fov, size, packetSize, [&](const Bvh::Packet& packet, int count, const int* pixels) {
+			if (count == 1 && packetSize == 1) {
+				Bvh::Hit hit;
+				if (!flat.intersect(Vec3(packet.origin[0][0], packet.origin[1][0], packet.origin[2][0]),
+					Vec3(packet.direction[0][0], packet.direction[1][0], packet.direction[2][0]), hit)) {
+					hit.face = -1;
+				}
+				store(hit, pixels[0]);
+				return;
+			}
+			Bvh::Hit packetHits[Bvh::MAX_PACKET];
+			flat.intersect(packet, count, packetHits);
+			for (int ii = 0; ii < count; ++ii) {
+				store(packetHits[ii], pixels[ii]);
+			}
+		});
+
+		int differ = 0;
+		for (qint64 ii = 0; ii < rays; ++ii) {
+			differ += sameHit(hits[ii], singleHits[ii], 1e-4f) ? 0 : 1;
+		}
+		// More than a sliver of pixels disagreeing means the trees don't hold the same scene
+		if (differ > rays / 1000) {
+			++failures;
+		}
+		qDebug().noquote() << QString("  flattened, %1: %2 ms (%3 Mrays/s, x%4 two-level single rays), %5 pixels differ")
+			.arg(packetSize == 1 ? QString("single rays") : QString("packets of %1").arg(packetSize), -15)
+			.arg(ms, 0, 'f', 1).arg(rays / ms / 1000.0, 0, 'f', 2).arg(singleMs / ms, 0, 'f', 2).arg(differ);
+	}
+
+	delete galaxy;
+	return failures == 0 ? 0 : 1;
+}
+
+// Whether a sphere at one of centres, of radius, lies across the segment from eye to point.
+// The sphere at skip is left out.
+static bool blockedBySpheres(const QVector3D& eye, const QVector3D& point, const QVector<QVector3D>& centres, float radius, int skip)
+{
+	const QVector3D toPoint = point - eye;
+	const float length = toPoint.length();
+	const QVector3D direction = toPoint / length;
+	for (int s = 0; s < centres.size(); ++s) {
+		if (s == skip) {
+			continue;
+		}
+		const QVector3D offset = eye - centres[s];
+		const float b = QVector3D::dotProduct(offset, direction);
+		const float c = QVector3D::dotProduct(offset, offset) - radius * radius;
+		const float discriminant = b * b - c;
+		if (discriminant < 0.0f) {
+			continue;
+		}
+		const float t = -b - std::sqrt(discriminant);
+		if (t > 0.0f && t < length) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int runOcclusionBenchmark(int nodeCount)
+{
+	const int frames = 100;
+	const int maxThreads = qMax(1, (int)std::thread::hardware_concurrency());
+
+	// Every body is a sphere sized by how deep it is, as in the ray trace benchmark
+	SceneNode* galaxy = generateGalaxy(nodeCount, 0);
+	TransformHierarchy hierarchy;
+	hierarchy.build(galaxy);
+	hierarchy.update();
+	QVector<int> depths(hierarchy.size(), 0);
+	for (int i = 1; i < hierarchy.size(); ++i) {
+		depths[i] = depths[hierarchy.parent(i)] + 1;
+	}
+	const float radii[] = { 0.0f, 1.5f, 0.2f, 0.05f };
+	QVector<QVector3D> centres(hierarchy.size());
+	QVector<BoundingBox> boxes(hierarchy.size());
+	QVector<int> suns;
+	QVector<QVector3D> sunCentres;
+	float extent = 0.0f;
+	for (int i = 1; i < hierarchy.size(); ++i) {
+		const float r = radii[qMin(depths[i], 3)];
+		centres[i] = hierarchy.world(i).map(QVector3D(0.0f, 0.0f, 0.0f));
+		boxes[i] = BoundingBox(centres[i] - QVector3D(r, r, r), centres[i] + QVector3D(r, r, r));
+		extent = qMax(extent, centres[i].length());
+		if (depths[i] == 1) {
+			suns << i;
+			sunCentres << centres[i];
+		}
+	}
+
+	// Look across the galaxy from just behind its innermost sun, which hides a wedge of it
+	const QVector3D firstSun = centres[suns.first()];
+	const QVector3D eye = firstSun + firstSun.normalized() * 6.0f + QVector3D(0.0f, 0.3f, 0.0f);
+	QMatrix4x4 projection;
+	projection.perspective(70.0f, 4.0f / 3.0f, 0.1f, 2.0f * extent + 100.0f);
+	QMatrix4x4 view;
+	view.lookAt(eye, QVector3D(0.0f, 0.0f, 0.0f), QVector3D(0.0f, 1.0f, 0.0f));
+	const QMatrix4x4 viewProjection = projection * view;
+
+	const Frustum frustum(viewProjection);
+	QVector<int> inView;
+	int sunsInView = 0;
+	for (int i = 1; i < hierarchy.size(); ++i) {
+		quint8 planeMask = Frustum::ALL_PLANES;
+		quint8 startPlane = 0;
+		if (frustum.test(boxes[i], planeMask, startPlane) != Frustum::Result::OUTSIDE) {
+			inView << i;
+			sunsInView += depths[i] == 1 ? 1 : 0;
+		}
+	}
+
+	// The suns in view, as coarse spheres inside the real ones
+	const Sphere coarse(0.99, 12, 8);
+	const OccluderMesh occluder(coarse.vertices(), coarse.faces());
+	auto drawOccluders = [&](OcclusionCuller& culler, TaskPool* pool) {
+		culler.begin(viewProjection);
+		for (int i : inView) {
+			if (depths[i] == 1) {
+				QMatrix4x4 toWorld = hierarchy.world(i);
+				toWorld.scale(radii[1]);
+				culler.addOccluder(&occluder, toWorld);
+			}
+		}
+		culler.rasterize(pool);
+	};
+
+	qDebug().noquote() << QString("Occlusion benchmark: %1 bodies, %2 in the frustum, %3 suns in view drawn as %4 triangle occluders into %5x%6 depth, %7 frames")
+		.arg(hierarchy.size() - 1).arg(inView.size()).arg(sunsInView).arg(occluder.faces.size())
+		.arg(OcclusionCuller::WIDTH).arg(OcclusionCuller::HEIGHT).arg(frames);
+
+	OcclusionCuller serial;
+	QElapsedTimer timer;
+	timer.start();
+	for (int frame = 0; frame < frames; ++frame) {
+		drawOccluders(serial, nullptr);
+	}
+	const double serialMs = timer.nsecsElapsed() / 1e6 / frames;
+	qDebug().noquote() << QString("  serial: %1 ms/frame rasterizing, %2 triangles drawn")
+		.arg(serialMs, 0, 'f', 3).arg(serial.trianglesDrawn());
+
+	int failures = 0;
+	for (int threads : threadCounts(maxThreads)) {
+		TaskPool pool(threads);
+		OcclusionCuller culler;
+		timer.restart();
+		for (int frame = 0; frame < frames; ++frame) {
+			drawOccluders(culler, &pool);
+		}
+		const double ms = timer.nsecsElapsed() / 1e6 / frames;
+
+		// Every band takes the nearest depth of the same spans, so threads can't change a bit
+		bool match = true;
+		for (int level = 0; level < OcclusionCuller::LEVELS; ++level) {
+			const int texels = (OcclusionCuller::WIDTH >> level) * (OcclusionCuller::HEIGHT >> level);
+			match = match && std::memcmp(culler.depth(level), serial.depth(level), texels * sizeof(float)) == 0;
+		}
+		failures += match ? 0 : 1;
+
+		qDebug().noquote() << QString("  %1 threads: %2 ms/frame, %3x speedup, %4")
+			.arg(threads)
+			.arg(ms, 0, 'f', 3)
+			.arg(serialMs / ms, 0, 'f', 2)
+			.arg(match ? "matches serial" : "DIFFERS FROM SERIAL");
+	}
+
+	QVector<int> occluded;
+	timer.restart();
+	for (int frame = 0; frame < frames; ++frame) {
+		occluded.resize(0);
+		for (int i : inView) {
+			if (serial.isOccluded(boxes[i])) {
+				occluded << i;
+			}
+		}
+	}
+	const double testMs = timer.nsecsElapsed() / 1e6 / frames;
+	qDebug().noquote() << QString("  hierarchical-Z tests: %1 of %2 bodies in view occluded (%3%), %4 ms/frame (%5 ns per box)")
+		.arg(occluded.size()).arg(inView.size())
+		.arg(100.0 * occluded.size() / qMax(1, inView.size()), 0, 'f', 1)
+		.arg(testMs, 0, 'f', 3).arg(testMs * 1e6 / qMax(1, inView.size()), 0, 'f', 1);
+
+	// The nearest point of each culled body and the four at its rim, as seen from the eye,
+	// should all be behind a sun. Suns are tested at their full radius, which takes in
+	// everything the drawn sphere covers.
+	int wronglyCulled = 0;
+	for (int i : occluded) {
+		const float r = radii[qMin(depths[i], 3)];
+		const QVector3D toEye = (eye - centres[i]).normalized();
+		const QVector3D side = QVector3D::crossProduct(toEye, QVector3D(0.0f, 1.0f, 0.0f)).normalized();
+		const QVector3D up = QVector3D::crossProduct(side, toEye);
+		const QVector3D points[] = { centres[i] + toEye * r, centres[i] + side * r, centres[i] - side * r, centres[i] + up * r, centres[i] - up * r };
+		const int self = depths[i] == 1 ? suns.indexOf(i) : -1;
+		for (const QVector3D& point : points) {
+			if (!blockedBySpheres(eye, point, sunCentres, radii[1], self)) {
+				++wronglyCulled;
+				break;
+			}
+		}
+	}
+	failures += wronglyCulled;
+	qDebug().noquote() << QString("  ray checks: %1 of the occluded bodies have a point in view")
+		.arg(wronglyCulled);
+
+	delete galaxy;
+	return failures == 0 ? 0 : 1;
+}
+
+namespace {
+	// The position of each copy, which both culling paths pass through untouched
+	bool byPosition(const InstanceData& a, const InstanceData& b)
+	{
+		return std::lexicographical_compare(a.modelMatrix + 12, a.modelMatrix + 15, b.modelMatrix + 12, b.modelMatrix + 15);
+	}
+}
+
+int runGpuCullingBenchmark(int instanceCount)
+{
+	const int frames = 50;
+	const QSize size(1280, 720);
+
+	QSurfaceFormat format;
+	format.setVersion(4, 3);
+	format.setProfile(QSurfaceFormat::CoreProfile);
+	format.setDepthBufferSize(24);
+	QOffscreenSurface surface;
+	surface.setFormat(format);
+	surface.create();
+	QOpenGLContext context;
+	context.setFormat(format);
+	if (!context.create() || !context.makeCurrent(&surface)) {
+		qDebug() << "GPU culling benchmark: could not create a GL context";
+		return 1;
+	}
+	QOpenGLExtraFunctions* gl = context.extraFunctions();
+	qDebug().noquote() << QString("GPU culling benchmark: %1 asteroids, %2x%3, %4 frames per view and path, on %5 (%6)")
+		.arg(instanceCount).arg(size.width()).arg(size.height()).arg(frames)
+		.arg(reinterpret_cast<const char*>(gl->glGetString(GL_RENDERER)))
+		.arg(reinterpret_cast<const char*>(gl->glGetString(GL_VERSION)));
+
+	int failures = 0;
+	{
+		QVector<Vertex> vertices;
+		QVector<Face> faces;
+		QVector<GpuCuller::Lod> lods;
+		SolarSystem::asteroidMesh(vertices, faces, lods);
+		Renderable rock;
+		rock.init(vertices, faces);
+		GpuCuller belt;
+		belt.create(&rock, lods, 1.0f);
+		belt.setInstances(SolarSystem::generateAsteroids(instanceCount));
+		if (!belt.gpuSupported()) {
+			qDebug() << "  No GPU path on this context; timing the CPU path alone";
+		}
+
+		QOpenGLFramebufferObject target(size, QOpenGLFramebufferObject::Depth);
+		target.bind();
+		gl->glViewport(0, 0, size.width(), size.height());
+		gl->glEnable(GL_DEPTH_TEST);
+		QMatrix4x4 projection;
+		projection.perspective(70.0f, float(size.width()) / size.height(), 0.001f, 1000.0f);
+
+		// The viewer's starting view, inside the belt looking along it, and straight down on it
+		const QVector3D eyes[] = { QVector3D(0, 5, 35), QVector3D(16.5f, 0.2f, 0), QVector3D(0, 40, 0.1f) };
+		const QVector3D targets[] = { QVector3D(0, 0, 0), QVector3D(0, 0, 16.5f), QVector3D(0, 0, 0) };
+		const char* names[] = { "starting view", "inside the belt", "from above" };
+		for (int view = 0; view < 3; ++view) {
+			QMatrix4x4 viewMatrix;
+			viewMatrix.lookAt(eyes[view], targets[view], QVector3D(0, 1, 0));
+			const QMatrix4x4 viewProjection = projection * viewMatrix;
+
+			QImage images[2];
+			QVector<InstanceData> kept[2][GpuCuller::MAX_LODS];
+			double issueMs[2] = {};
+			double frameMs[2] = {};
+			const int paths = belt.gpuSupported() ? 2 : 1;
+			for (int path = 0; path < paths; ++path) {
+				belt.setGpuDriven(path == 1);
+				auto frame = [&]() {
+					gl->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+					belt.cull(viewProjection, eyes[view]);
+					belt.draw(eyes[view], viewMatrix, projection, DrawMode::NORM_DEBUG);
+				};
+				frame();
+				images[path] = target.toImage();
+				for (int lod = 0; lod < belt.lodCount(); ++lod) {
+					kept[path][lod] = belt.visibleInstances(lod);
+					std::sort(kept[path][lod].begin(), kept[path][lod].end(), byPosition);
+				}
+
+				// Time spent issuing each frame, then until the GPU has finished them all
+				gl->glFinish();
+				QElapsedTimer timer;
+				timer.start();
+				qint64 issueNs = 0;
+				for (int ii = 0; ii < frames; ++ii) {
+					QElapsedTimer issue;
+					issue.start();
+					frame();
+					issueNs += issue.nsecsElapsed();
+				}
+				gl->glFinish();
+				frameMs[path] = timer.nsecsElapsed() / 1e6 / frames;
+				issueMs[path] = issueNs / 1e6 / frames;
+			}
+
+			QStringList levels;
+			for (int lod = 0; lod < belt.lodCount(); ++lod) {
+				levels << QString::number(kept[0][lod].size());
+			}
+			qDebug().noquote() << QString("  %1: %2 by level of detail").arg(names[view]).arg(levels.join(" / "));
+			qDebug().noquote() << QString("    CPU cull, %1 draws:  %2 ms/frame issuing, %3 ms/frame until drawn")
+				.arg(belt.lodCount()).arg(issueMs[0], 0, 'f', 3).arg(frameMs[0], 0, 'f', 3);
+			if (paths < 2) {
+				continue;
+			}
+			qDebug().noquote() << QString("    GPU cull, 1 multi-draw: %1 ms/frame issuing, %2 ms/frame until drawn")
+				.arg(issueMs[1], 0, 'f', 3).arg(frameMs[1], 0, 'f', 3);
+
+			// Both paths should keep the same rocks at the same levels, with the same attributes
+			// up to rounding, and so draw the same picture
+			int wrongLevels = 0;
+			float attributeError = 0.0f;
+			for (int lod = 0; lod < belt.lodCount(); ++lod) {
+				const QVector<InstanceData>& cpu = kept[0][lod];
+				const QVector<InstanceData>& gpu = kept[1][lod];
+				if (cpu.size() != gpu.size()) {
+					++wrongLevels;
+					continue;
+				}
+				for (int ii = 0; ii < cpu.size(); ++ii) {
+					const float* a = cpu[ii].modelMatrix;
+					const float* b = gpu[ii].modelMatrix;
+					for (int jj = 0; jj < int(sizeof(InstanceData) / sizeof(float)); ++jj) {
+						attributeError = qMax(attributeError, std::fabs(a[jj] - b[jj]));
+					}
+				}
+			}
+			int pixelsDiffering = 0;
+			for (int y = 0; y < size.height(); ++y) {
+				const QRgb* a = reinterpret_cast<const QRgb*>(images[0].constScanLine(y));
+				const QRgb* b = reinterpret_cast<const QRgb*>(images[1].constScanLine(y));
+				for (int x = 0; x < size.width(); ++x) {
+					if (qAbs(qRed(a[x]) - qRed(b[x])) > 1 || qAbs(qGreen(a[x]) - qGreen(b[x])) > 1 || qAbs(qBlue(a[x]) - qBlue(b[x])) > 1) {
+						++pixelsDiffering;
+					}
+				}
+			}
+			// The shader rounds the matrices a little differently from the CPU, which can move a
+			// silhouette edge across a pixel center, so a handful of pixels in ten thousand may
+			// differ. A missing or misplaced rock changes far more than that.
+			const int pixelTolerance = size.width() * size.height() / 10000;
+			const bool matches = wrongLevels == 0 && attributeError < 1e-4f && pixelsDiffering <= pixelTolerance;
+			failures += matches ? 0 : 1;
+			qDebug().noquote() << QString("    %1 levels differ, largest attribute difference %2, %3 pixels differ (up to %4 allowed), %5")
+				.arg(wrongLevels).arg(attributeError, 0, 'g', 3).arg(pixelsDiffering).arg(pixelTolerance)
+				.arg(matches ? "matches CPU" : "DIFFERS FROM CPU");
+		}
+		target.release();
+		belt.destroy();
+		ShaderCache::instance().clear();
+	}
+	context.doneCurrent();
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <QtCore>
+#include "SceneNode.h"
+
+// Headless benchmarks, run from the command line instead of opening a window.
+// See main.cpp for the flags that select them.
+
+// Build a galaxy of solar systems (suns with planets with moons) of at least nodeCount nodes.
+// Every spinEvery-th node rotates; 0 means nothing rotates.
+SceneNode* generateGalaxy(int nodeCount, int spinEvery);
+
+// Time flattened, dirty-flag transform updates on a generated galaxy
+int runTransformBenchmark(int nodeCount);
+
+// Time transform updates across thread counts, checking the results match the serial update
+int runParallelBenchmark(int nodeCount);
+
+// Trace primary rays through a generated galaxy whose every body instances one sphere, with a
+// two-level SceneBvh and with one Bvh over every body's triangles copied into the world.
+// Compares their memory and build times, and single rays against packets of 4 and 8.
+int runRaytraceBenchmark(int nodeCount);
+
+// Occlusion cull a generated galaxy seen from behind one of its suns, with every sun in view
+// drawn as an occluder. Times rasterizing across thread counts, checking the depth matches the
+// serial result, and times the hierarchical-Z tests. Every body culled is checked by casting
+// rays to points on it, which should all be blocked by a sun.
+int runOcclusionBenchmark(int nodeCount);
+
+// Cull and draw an asteroid belt of instanceCount rocks from a few views, on the GPU with
+// one indirect multi-draw and on the CPU with one draw per level of detail. Checks both
+// keep the same rocks at the same levels and draw the same image, to within a few edge
+// pixels, and times them. Needs a QGuiApplication; the GPU path needs GL 4.3.
+int runGpuCullingBenchmark(int instanceCount);
@@ -0,0 +1,54 @@
+#include "Bounds.h"
+
+#include <cmath>
+#include <limits>
+
+// ~~~~~~~~~~ BOUNDINGBOX ~~~~~~~~~~
+BoundingBox::BoundingBox() :
+	min(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()),
+	max(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max())
+{}
+
+BoundingBox::BoundingBox(const QVector3D& min, const QVector3D& max) : min(min), max(max) {}
+
+void BoundingBox::expand(const QVector3D& point)
+{
+	min = QVector3D(qMin(min.x(), point.x()), qMin(min.y(), point.y()), qMin(min.z(), point.z()));
+	max = QVector3D(qMax(max.x(), point.x()), qMax(max.y(), point.y()), qMax(max.z(), point.z()));
+}
+
+void BoundingBox::merge(const BoundingBox& other)
+{
+	if (other.isEmpty()) {
+		return;
+	}
+	expand(other.min);
+	expand(other.max);
+}
+
+BoundingBox BoundingBox::transformed(const QMatrix4x4& matrix) const
+{
+	if (isEmpty()) {
+		return *this;
+	}
+	// Transform the center, then project the extents onto each world axis (Arvo)
+	const QVector3D c = matrix.map(center());
+	const QVector3D e = extents();
+	float worldExtents[3];
+	for (int row = 0; row < 3; ++row) {
+		worldExtents[row] = std::fabs(matrix(row, 0)) * e.x() + std::fabs(matrix(row, 1)) * e.y() + std::fabs(matrix(row, 2)) * e.z();
+	}
+	const QVector3D we(worldExtents[0], worldExtents[1], worldExtents[2]);
+	return BoundingBox(c - we, c + we);
+}
+
+BoundingBox BoundingBox::scaled(const QVector3D& scale) const
+{
+	if (isEmpty()) {
+		return *this;
+	}
+	BoundingBox result;
+	result.expand(min * scale);
+	result.expand(max * scale);
+	return result;
+}
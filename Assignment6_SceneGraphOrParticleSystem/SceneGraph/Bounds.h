@@ -0,0 +1,24 @@
+#pragma once
+
+#include <QtGui/QMatrix4x4>
+#include <QtGui/QVector3D>
+
+// Axis-aligned bounding box. A default-constructed box is empty and merging
+// anything into it just takes the other bounds.
+struct BoundingBox {
+	QVector3D min;
+	QVector3D max;
+
+	BoundingBox();
+	BoundingBox(const QVector3D& min, const QVector3D& max);
+
+	inline bool isEmpty() const { return min.x() > max.x(); }
+	inline QVector3D center() const { return (min + max) * 0.5f; }
+	inline QVector3D extents() const { return (max - min) * 0.5f; }
+
+	void expand(const QVector3D& point);
+	void merge(const BoundingBox& other);
+	// Smallest axis-aligned box around this box once transformed by matrix
+	BoundingBox transformed(const QMatrix4x4& matrix) const;
+	BoundingBox scaled(const QVector3D& scale) const;
+};
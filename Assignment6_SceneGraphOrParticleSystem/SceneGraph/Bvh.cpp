@@ -0,0 +1,790 @@
+#include "Bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BVH_SSE
+#endif
+
+// Candidate split planes per axis are the boundaries between this many bins
+static const int BINS = 16;
+// Leaves hold at most this many triangles, unless MAX_DEPTH cuts the tree short
+static const int MAX_LEAF_TRIANGLES = 8;
+// Cost of visiting a node, relative to testing one triangle
+static const float TRAVERSAL_COST = 1.0f;
+// Nodes with at most this many triangles are built as one subtree on one thread
+static const int SUBTREE_TRIANGLES = 1024;
+// Below this many triangles, starting threads costs more than it saves
+static const int PARALLEL_TRIANGLES = 16384;
+
+namespace {
+	struct Bounds {
+		float lower[3];
+		float upper[3];
+
+		void clear() {
+			for (int axis = 0; axis < 3; ++axis) {
+				lower[axis] = INFINITY;
+				upper[axis] = -INFINITY;
+			}
+		}
+		void grow(const Vec3& point) {
+			for (int axis = 0; axis < 3; ++axis) {
+				lower[axis] = std::min(lower[axis], point[axis]);
+				upper[axis] = std::max(upper[axis], point[axis]);
+			}
+		}
+		void grow(const Bounds& other) {
+			for (int axis = 0; axis < 3; ++axis) {
+				lower[axis] = std::min(lower[axis], other.lower[axis]);
+				upper[axis] = std::max(upper[axis], other.upper[axis]);
+			}
+		}
+		// Half the surface area, which is all the SAH's ratios need
+		float area() const {
+			const float x = upper[0] - lower[0];
+			const float y = upper[1] - lower[1];
+			const float z = upper[2] - lower[2];
+			return x < 0.0f ? 0.0f : x * y + y * z + z * x;
+		}
+	};
+
+	struct Bin {
+		Bounds bounds;
+		int count;
+	};
+
+	// A triangle's bounds and face. The build partitions these themselves rather than indices
+	// to them, so binning a node reads its triangles in order.
+	struct Reference {
+		Bounds bounds;
+		int face;
+
+		float centroid(int axis) const {
+			return (bounds.lower[axis] + bounds.upper[axis]) * 0.5f;
+		}
+	};
+
+	// A node still to be split: its triangles are references[begin, end)
+	struct Range {
+		int node;
+		int begin, end;
+		int depth;
+		Bounds centroids;
+	};
+
+	struct Split {
+		int axis;
+		int bin;			// The first bin on the right
+		float binLower;		// Where the axis' bins start
+		float binScale;		// Bins per unit along the axis
+		int leftCount;
+		float cost;
+		Bounds left, right;
+	};
+}
+
+static inline Vec3 cross(const Vec3& a, const Vec3& b) {
+	return Vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+static inline float dot(const Vec3& a, const Vec3& b) {
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+// Split [0, count) into one contiguous range per thread, each a multiple of grain long, and
+// run function(chunk, begin, end) on each, with the calling thread taking the first
+template<typename Function>
+static void parallelFor(int count, int threadCount, int grain, Function function) {
+	const int chunkSize = ((count + threadCount - 1) / threadCount + grain - 1) / grain * grain;
+	std::vector<std::thread> threads;
+	for (int chunk = 1; chunk < threadCount; ++chunk) {
+		const int begin = chunk * chunkSize;
+		const int end = std::min(count, begin + chunkSize);
+		if (begin < end) {
+			threads.emplace_back(function, chunk, begin, end);
+		}
+	}
+	function(0, 0, std::min(count, chunkSize));
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
+
+static inline int binOf(float centroid, float binLower, float binScale) {
+	return std::min(BINS - 1, int((centroid - binLower) * binScale));
+}
+
+static inline Bounds boundsOf(const Bvh::Node& node) {
+	Bounds bounds;
+	for (int axis = 0; axis < 3; ++axis) {
+		bounds.lower[axis] = node.lower[axis];
+		bounds.upper[axis] = node.upper[axis];
+	}
+	return bounds;
+}
+
+static inline Bvh::Node nodeOf(const Bounds& bounds) {
+	Bvh::Node node;
+	for (int axis = 0; axis < 3; ++axis) {
+		node.lower[axis] = bounds.lower[axis];
+		node.upper[axis] = bounds.upper[axis];
+	}
+	node.first = 0;
+	node.count = 0;
+	return node;
+}
+
+// Find the cheapest split of range between bins, trying every axis the centroids spread
+// along. Large ranges are binned across threads; min, max and counts merge the same
+// whichever thread binned what, so the result doesn't depend on threadCount.
+static bool findSplit(const std::vector<Reference>& references, const Range& range, const Bounds& bounds, int threadCount, Split& split) {
+	const int count = range.end - range.begin;
+	float binScale[3];
+	for (int axis = 0; axis < 3; ++axis) {
+		const float extent = range.centroids.upper[axis] - range.centroids.lower[axis];
+		binScale[axis] = extent > 0.0f ? BINS / extent : 0.0f;
+	}
+
+	// Small nodes, which are most of them, bin into an array on the stack
+	const int chunks = count >= PARALLEL_TRIANGLES ? threadCount : 1;
+	Bin local[3 * BINS];
+	std::vector<Bin> shared(chunks > 1 ? size_t(chunks) * 3 * BINS : 0);
+	Bin* bins = chunks > 1 ? shared.data() : local;
+	for (Bin* bin = bins; bin < bins + size_t(chunks) * 3 * BINS; ++bin) {
+		bin->bounds.clear();
+		bin->count = 0;
+	}
+	parallelFor(count, chunks, 1, [&](int chunk, int begin, int end) {
+		Bin* own = bins + size_t(chunk) * 3 * BINS;
+		for (int ii = range.begin + begin; ii < range.begin + end; ++ii) {
+			const Reference& reference = references[ii];
+			for (int axis = 0; axis < 3; ++axis) {
+				if (binScale[axis] > 0.0f) {
+					Bin& bin = own[axis * BINS + binOf(reference.centroid(axis), range.centroids.lower[axis], binScale[axis])];
+					bin.bounds.grow(reference.bounds);
+					++bin.count;
+				}
+			}
+		}
+	});
+	for (int chunk = 1; chunk < chunks; ++chunk) {
+		for (int ii = 0; ii < 3 * BINS; ++ii) {
+			const Bin& other = bins[size_t(chunk) * 3 * BINS + ii];
+			bins[ii].bounds.grow(other.bounds);
+			bins[ii].count += other.count;
+		}
+	}
+
+	// Sweep from the right to total every suffix of bins, then from the left to cost each plane
+	float best = INFINITY;
+	for (int axis = 0; axis < 3; ++axis) {
+		if (binScale[axis] <= 0.0f) {
+			continue;
+		}
+		const Bin* axisBins = bins + axis * BINS;
+		Bin right[BINS];
+		Bin accumulated = axisBins[BINS - 1];
+		for (int bin = BINS - 1; bin > 0; --bin) {
+			if (bin < BINS - 1) {
+				accumulated.bounds.grow(axisBins[bin].bounds);
+				accumulated.count += axisBins[bin].count;
+			}
+			right[bin] = accumulated;
+		}
+		Bin left;
+		left.bounds.clear();
+		left.count = 0;
+		for (int bin = 1; bin < BINS; ++bin) {
+			left.bounds.grow(axisBins[bin - 1].bounds);
+			left.count += axisBins[bin - 1].count;
+			if (left.count == 0 || right[bin].count == 0) {
+				continue;
+			}
+			const float cost = left.bounds.area() * left.count + right[bin].bounds.area() * right[bin].count;
+			if (cost < best) {
+				best = cost;
+				split.axis = axis;
+				split.bin = bin;
+				split.binLower = range.centroids.lower[axis];
+				split.binScale = binScale[axis];
+				split.leftCount = left.count;
+				split.left = left.bounds;
+				split.right = right[bin].bounds;
+			}
+		}
+	}
+	if (best == INFINITY) {
+		return false;
+	}
+	split.cost = TRAVERSAL_COST + best / std::max(bounds.area(), 1e-30f);
+	return true;
+}
+
+// Split range in two, or return false to make it a leaf
+static bool splitRange(std::vector<Reference>& references, const Range& range, const Bounds& bounds, int threadCount, Range& left, Range& right, Bounds& leftBounds, Bounds& rightBounds) {
+	const int count = range.end - range.begin;
+	if (count <= 1 || range.depth >= Bvh::MAX_DEPTH) {
+		return false;
+	}
+
+	left.begin = range.begin;
+	right.end = range.end;
+	left.depth = right.depth = range.depth + 1;
+	Reference* first = references.data();
+	Split split;
+	if (findSplit(references, range, bounds, threadCount, split)) {
+		if (count <= MAX_LEAF_TRIANGLES && split.cost >= count) {
+			return false;
+		}
+		std::partition(first + range.begin, first + range.end, [&](const Reference& reference) {
+			return binOf(reference.centroid(split.axis), split.binLower, split.binScale) < split.bin;
+		});
+		left.end = right.begin = range.begin + split.leftCount;
+		leftBounds = split.left;
+		rightBounds = split.right;
+		// The children's centroids, which is all their binning needs, in one pass rather than
+		// tracking them in every bin
+		left.centroids.clear();
+		right.centroids.clear();
+		for (int ii = range.begin; ii < range.end; ++ii) {
+			const Reference& reference = first[ii];
+			(ii < left.end ? left.centroids : right.centroids).grow(Vec3(reference.centroid(0), reference.centroid(1), reference.centroid(2)));
+		}
+		return true;
+	}
+	if (count <= MAX_LEAF_TRIANGLES) {
+		return false;
+	}
+
+	// Every centroid is in the same place, so no plane separates them; halve the list
+	left.end = right.begin = range.begin + count / 2;
+	leftBounds.clear();
+	rightBounds.clear();
+	for (int ii = range.begin; ii < range.end; ++ii) {
+		(ii < left.end ? leftBounds : rightBounds).grow(first[ii].bounds);
+	}
+	left.centroids = right.centroids = range.centroids;
+	return true;
+}
+
+// Split ranges depth first until they become leaves, or, given stopped, until they have at
+// most stopAt triangles. Those are left for later with their nodes unfinished.
+static void splitRanges(std::vector<Reference>& references, std::vector<Bvh::Node>& nodes, std::vector<Range> open, int threadCount, int stopAt, std::vector<Range>* stopped) {
+	while (!open.empty()) {
+		const Range range = open.back();
+		open.pop_back();
+		if (stopped && range.end - range.begin <= stopAt) {
+			stopped->push_back(range);
+			continue;
+		}
+
+		Range left, right;
+		Bounds leftBounds, rightBounds;
+		if (!splitRange(references, range, boundsOf(nodes[range.node]), threadCount, left, right, leftBounds, rightBounds)) {
+			nodes[range.node].first = range.begin;
+			nodes[range.node].count = range.end - range.begin;
+			continue;
+		}
+		left.node = int(nodes.size());
+		right.node = left.node + 1;
+		nodes[range.node].first = left.node;
+		nodes[range.node].count = 0;
+		nodes.push_back(nodeOf(leftBounds));
+		nodes.push_back(nodeOf(rightBounds));
+		open.push_back(right);
+		open.push_back(left);
+	}
+}
+
+static inline bool intersectTriangle(const Vec3& v0, const Vec3& e1, const Vec3& e2, const Vec3& origin, const Vec3& direction, float tMax, float& t, float& u, float& v) {
+	// Moller and Trumbore, "Fast, Minimum Storage Ray/Triangle Intersection", 1997
+	const Vec3 p = cross(direction, e2);
+	const float determinant = dot(e1, p);
+	if (determinant == 0.0f) {
+		return false;
+	}
+	const float inverse = 1.0f / determinant;
+	const Vec3 s = origin - v0;
+	u = dot(s, p) * inverse;
+	if (u < 0.0f || u > 1.0f) {
+		return false;
+	}
+	const Vec3 q = cross(s, e1);
+	v = dot(direction, q) * inverse;
+	if (v < 0.0f || u + v > 1.0f) {
+		return false;
+	}
+	t = dot(e2, q) * inverse;
+	return t > 0.0f && t <= tMax;
+}
+
+// Distance along the ray to where it enters node's box, or INFINITY if it misses it before tMax
+static inline float enter(const Bvh::Node& node, const Vec3& origin, const Vec3& inverseDirection, float tMax) {
+	float tEnter = 0.0f;
+	float tExit = tMax;
+	for (int axis = 0; axis < 3; ++axis) {
+		float tNear = (node.lower[axis] - origin[axis]) * inverseDirection[axis];
+		float tFar = (node.upper[axis] - origin[axis]) * inverseDirection[axis];
+		if (tNear > tFar) {
+			std::swap(tNear, tFar);
+		}
+		tEnter = std::max(tEnter, tNear);
+		tExit = std::min(tExit, tFar);
+	}
+	return tEnter <= tExit ? tEnter : INFINITY;
+}
+
+Bvh::Bvh()
+{}
+
+// Build nodes over references, which end up in leaf order. Returns the number of subtrees
+// built in parallel.
+static int buildTree(std::vector<Reference>& references, int threadCount, std::vector<Bvh::Node>& nodes) {
+	const int count = int(references.size());
+	Range root = { 0, 0, count, 0, Bounds() };
+	Bounds rootBounds;
+	rootBounds.clear();
+	root.centroids.clear();
+	for (const Reference& reference : references) {
+		rootBounds.grow(reference.bounds);
+		root.centroids.grow(Vec3(reference.centroid(0), reference.centroid(1), reference.centroid(2)));
+	}
+	nodes.push_back(nodeOf(rootBounds));
+
+	// The top of the tree, one node at a time
+	std::vector<Range> subtrees;
+	splitRanges(references, nodes, std::vector<Range>(1, root), threadCount, SUBTREE_TRIANGLES, &subtrees);
+
+	// The rest, a subtree at a time on whichever thread is free. Each is built into a list of
+	// its own, with its root first, and never touches the others' triangles.
+	std::vector<std::vector<Bvh::Node>> subtreeNodes(subtrees.size());
+	std::atomic<int> nextSubtree(0);
+	const int subtreeThreads = std::max(1, std::min(threadCount, int(subtrees.size())));
+	parallelFor(subtreeThreads, subtreeThreads, 1, [&](int, int, int) {
+		for (int ii = nextSubtree++; ii < int(subtrees.size()); ii = nextSubtree++) {
+			Range range = subtrees[ii];
+			std::vector<Bvh::Node>& own = subtreeNodes[ii];
+			own.push_back(nodes[range.node]);
+			range.node = 0;
+			splitRanges(references, own, std::vector<Range>(1, range), 1, 0, nullptr);
+		}
+	});
+
+	// Append the subtrees in order, their roots taking the places left for them
+	for (size_t ii = 0; ii < subtrees.size(); ++ii) {
+		const std::vector<Bvh::Node>& own = subtreeNodes[ii];
+		const int offset = int(nodes.size()) - 1;
+		for (size_t jj = 0; jj < own.size(); ++jj) {
+			Bvh::Node node = own[jj];
+			if (node.count == 0) {
+				node.first += offset;
+			}
+			if (jj == 0) {
+				nodes[subtrees[ii].node] = node;
+			} else {
+				nodes.push_back(node);
+			}
+		}
+	}
+	return int(subtrees.size());
+}
+
+static Bvh::Stats treeStats(const std::vector<Bvh::Node>& nodes, int subtrees) {
+	Bvh::Stats stats = { int(nodes.size()), 0, 0, subtrees, 0.0f };
+	// Children always come after their parents, so depths fill in from the front
+	std::vector<int> depths(nodes.size(), 0);
+	const float rootArea = std::max(boundsOf(nodes[0]).area(), 1e-30f);
+	for (size_t ii = 0; ii < nodes.size(); ++ii) {
+		const Bvh::Node& node = nodes[ii];
+		const float area = boundsOf(node).area() / rootArea;
+		stats.depth = std::max(stats.depth, depths[ii]);
+		if (node.count > 0) {
+			++stats.leaves;
+			stats.sahCost += area * node.count;
+		} else {
+			depths[node.first] = depths[node.first + 1] = depths[ii] + 1;
+			stats.sahCost += area * TRAVERSAL_COST;
+		}
+	}
+	return stats;
+}
+
+Bvh::Stats Bvh::build(const QVector<Vertex>& vertices, const QVector<Face>& faces, int threadCount) {
+	nodes_.clear();
+	triangles_.clear();
+	faceOrder_.clear();
+	const int count = faces.size();
+	if (count == 0) {
+		return Stats{ 0, 0, 0, 0, 0.0f };
+	}
+	if (threadCount <= 0) {
+		threadCount = count < PARALLEL_TRIANGLES ? 1 : int(std::max(std::thread::hardware_concurrency(), 1u));
+	}
+
+	std::vector<Reference> references(count);
+	parallelFor(count, count < PARALLEL_TRIANGLES ? 1 : threadCount, 1, [&](int, int begin, int end) {
+		for (int ii = begin; ii < end; ++ii) {
+			Reference& reference = references[ii];
+			reference.bounds.clear();
+			for (int corner = 0; corner < 3; ++corner) {
+				reference.bounds.grow(vertices[faces[ii][corner]].position);
+			}
+			reference.face = ii;
+		}
+	});
+	const int subtrees = buildTree(references, threadCount, nodes_);
+
+	// Triangles in leaf order, so a leaf's are next to each other
+	faceOrder_.resize(count);
+	triangles_.resize(count);
+	for (int ii = 0; ii < count; ++ii) {
+		faceOrder_[ii] = references[ii].face;
+		const Face& face = faces[faceOrder_[ii]];
+		Triangle& triangle = triangles_[ii];
+		triangle.v0 = vertices[face.a].position;
+		triangle.e1 = vertices[face.b].position - triangle.v0;
+		triangle.e2 = vertices[face.c].position - triangle.v0;
+	}
+	return treeStats(nodes_, subtrees);
+}
+
+Bvh::Stats Bvh::build(const std::vector<Vec3>& lowers, const std::vector<Vec3>& uppers, int threadCount) {
+	nodes_.clear();
+	triangles_.clear();
+	faceOrder_.clear();
+	const int count = int(lowers.size());
+	if (count == 0) {
+		return Stats{ 0, 0, 0, 0, 0.0f };
+	}
+	if (threadCount <= 0) {
+		threadCount = count < PARALLEL_TRIANGLES ? 1 : int(std::max(std::thread::hardware_concurrency(), 1u));
+	}
+
+	std::vector<Reference> references(count);
+	for (int ii = 0; ii < count; ++ii) {
+		references[ii].bounds.clear();
+		references[ii].bounds.grow(lowers[ii]);
+		references[ii].bounds.grow(uppers[ii]);
+		references[ii].face = ii;
+	}
+	const int subtrees = buildTree(references, threadCount, nodes_);
+	faceOrder_.resize(count);
+	for (int ii = 0; ii < count; ++ii) {
+		faceOrder_[ii] = references[ii].face;
+	}
+	return treeStats(nodes_, subtrees);
+}
+
+bool Bvh::intersect(const Vec3& origin, const Vec3& direction, Hit& hit, float tMax) const {
+	hit.t = tMax;
+	hit.face = -1;
+	hit.u = hit.v = 0.0f;
+	const Vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	if (nodes_.empty() || enter(nodes_[0], origin, inverseDirection, tMax) == INFINITY) {
+		return false;
+	}
+
+	// Nearer child first; the farther waits on the stack with the distance it starts at, and
+	// is skipped if a hit turns up before that. Boxes touching the closest hit so far are still
+	// visited, for the sake of ties.
+	int stack[MAX_DEPTH];
+	float stackEnter[MAX_DEPTH];
+	int size = 0;
+	int triangle = -1;
+	int current = 0;
+	for (;;) {
+		const Node& node = nodes_[current];
+		if (node.count > 0) {
+			for (int ii = node.first; ii < node.first + node.count; ++ii) {
+				const Triangle& candidate = triangles_[ii];
+				float t, u, v;
+				// Ties go to the triangle first in leaf order, whichever leaf is visited first
+				if (intersectTriangle(candidate.v0, candidate.e1, candidate.e2, origin, direction, hit.t, t, u, v) && (t < hit.t || ii < triangle)) {
+					hit.t = t;
+					hit.u = u;
+					hit.v = v;
+					triangle = ii;
+				}
+			}
+		} else {
+			int nearChild = node.first;
+			int farChild = node.first + 1;
+			float nearEnter = enter(nodes_[nearChild], origin, inverseDirection, hit.t);
+			float farEnter = enter(nodes_[farChild], origin, inverseDirection, hit.t);
+			if (farEnter < nearEnter) {
+				std::swap(nearChild, farChild);
+				std::swap(nearEnter, farEnter);
+			}
+			if (nearEnter != INFINITY) {
+				if (farEnter != INFINITY) {
+					stack[size] = farChild;
+					stackEnter[size] = farEnter;
+					++size;
+				}
+				current = nearChild;
+				continue;
+			}
+		}
+
+		current = -1;
+		while (size > 0) {
+			--size;
+			if (stackEnter[size] <= hit.t) {
+				current = stack[size];
+				break;
+			}
+		}
+		if (current < 0) {
+			break;
+		}
+	}
+
+	if (triangle < 0) {
+		return false;
+	}
+	hit.face = faceOrder_[triangle];
+	return true;
+}
+
+bool Bvh::occluded(const Vec3& origin, const Vec3& direction, float tMax) const {
+	const Vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	if (nodes_.empty() || enter(nodes_[0], origin, inverseDirection, tMax) == INFINITY) {
+		return false;
+	}
+
+	// Any hit will do, so there's no point ordering the children
+	int stack[MAX_DEPTH];
+	int size = 0;
+	int current = 0;
+	for (;;) {
+		const Node& node = nodes_[current];
+		if (node.count > 0) {
+			for (int ii = node.first; ii < node.first + node.count; ++ii) {
+				const Triangle& candidate = triangles_[ii];
+				float t, u, v;
+				if (intersectTriangle(candidate.v0, candidate.e1, candidate.e2, origin, direction, tMax, t, u, v)) {
+					return true;
+				}
+			}
+		} else {
+			const bool first = enter(nodes_[node.first], origin, inverseDirection, tMax) != INFINITY;
+			const bool second = enter(nodes_[node.first + 1], origin, inverseDirection, tMax) != INFINITY;
+			if (first || second) {
+				if (first && second) {
+					stack[size++] = node.first + 1;
+				}
+				current = first ? node.first : node.first + 1;
+				continue;
+			}
+		}
+		if (size == 0) {
+			return false;
+		}
+		current = stack[--size];
+	}
+}
+
+void Bvh::intersect(const Packet& packet, int count, Hit* hits) const {
+#ifdef BVH_SSE
+	if (count > 4) {
+		intersectGroups<2>(packet, count, hits);
+	} else {
+		intersectGroups<1>(packet, count, hits);
+	}
+#else
+	for (int ii = 0; ii < count; ++ii) {
+		const Vec3 origin(packet.origin[0][ii], packet.origin[1][ii], packet.origin[2][ii]);
+		const Vec3 direction(packet.direction[0][ii], packet.direction[1][ii], packet.direction[2][ii]);
+		intersect(origin, direction, hits[ii], packet.tMax[ii]);
+	}
+#endif
+}
+
+#ifdef BVH_SSE
+// Smallest of the four lanes
+static inline float minLane(__m128 value) {
+	value = _mm_min_ps(value, _mm_shuffle_ps(value, value, _MM_SHUFFLE(1, 0, 3, 2)));
+	value = _mm_min_ps(value, _mm_shuffle_ps(value, value, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtss_f32(value);
+}
+
+// Largest of the four lanes
+static inline float maxLane(__m128 value) {
+	value = _mm_max_ps(value, _mm_shuffle_ps(value, value, _MM_SHUFFLE(1, 0, 3, 2)));
+	value = _mm_max_ps(value, _mm_shuffle_ps(value, value, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtss_f32(value);
+}
+
+// a where mask is set, b elsewhere
+static inline __m128 blend(__m128 mask, __m128 a, __m128 b) {
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// enter() for four rays: where each enters the box, or INFINITY where it misses before tMax
+static inline __m128 enter4(const Bvh::Node& node, const __m128* origin, const __m128* inverseDirection, __m128 tMax) {
+	__m128 tEnter = _mm_setzero_ps();
+	__m128 tExit = tMax;
+	for (int axis = 0; axis < 3; ++axis) {
+		const __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.lower[axis]), origin[axis]), inverseDirection[axis]);
+		const __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.upper[axis]), origin[axis]), inverseDirection[axis]);
+		tEnter = _mm_max_ps(tEnter, _mm_min_ps(t0, t1));
+		tExit = _mm_min_ps(tExit, _mm_max_ps(t0, t1));
+	}
+	return blend(_mm_cmple_ps(tEnter, tExit), tEnter, _mm_set1_ps(INFINITY));
+}
+
+template<int GROUPS>
+void Bvh::intersectGroups(const Packet& packet, int count, Hit* hits) const {
+	// Per group of four rays: origins, directions and their inverses, and the closest hit so
+	// far. Rays past count get a tMax below zero, so they never hit anything.
+	__m128 origin[GROUPS][3], direction[GROUPS][3], inverseDirection[GROUPS][3];
+	__m128 bestT[GROUPS], bestU[GROUPS], bestV[GROUPS];
+	__m128i bestTriangle[GROUPS];
+	for (int group = 0; group < GROUPS; ++group) {
+		for (int axis = 0; axis < 3; ++axis) {
+			origin[group][axis] = _mm_loadu_ps(packet.origin[axis] + group * 4);
+			direction[group][axis] = _mm_loadu_ps(packet.direction[axis] + group * 4);
+			inverseDirection[group][axis] = _mm_div_ps(_mm_set1_ps(1.0f), direction[group][axis]);
+		}
+		float tMax[4];
+		for (int lane = 0; lane < 4; ++lane) {
+			tMax[lane] = group * 4 + lane < count ? packet.tMax[group * 4 + lane] : -1.0f;
+		}
+		bestT[group] = _mm_loadu_ps(tMax);
+		bestU[group] = bestV[group] = _mm_setzero_ps();
+		bestTriangle[group] = _mm_set1_epi32(-1);
+	}
+
+	// The farthest any ray still looks, to skip boxes no ray can reach first
+	const auto farthest = [&]() {
+		__m128 value = bestT[0];
+		for (int group = 1; group < GROUPS; ++group) {
+			value = _mm_max_ps(value, bestT[group]);
+		}
+		return maxLane(value);
+	};
+	// Where the first ray to reach node enters it, or INFINITY if none do
+	const auto enterAny = [&](const Node& node) {
+		__m128 value = enter4(node, origin[0], inverseDirection[0], bestT[0]);
+		for (int group = 1; group < GROUPS; ++group) {
+			value = _mm_min_ps(value, enter4(node, origin[group], inverseDirection[group], bestT[group]));
+		}
+		return minLane(value);
+	};
+
+	if (nodes_.empty() || enterAny(nodes_[0]) == INFINITY) {
+		for (int ii = 0; ii < count; ++ii) {
+			hits[ii].t = packet.tMax[ii];
+			hits[ii].face = -1;
+			hits[ii].u = hits[ii].v = 0.0f;
+		}
+		return;
+	}
+
+	// The same walk as intersect(), ordering children by the first ray to reach them
+	int stack[MAX_DEPTH];
+	float stackEnter[MAX_DEPTH];
+	int size = 0;
+	int current = 0;
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	for (;;) {
+		const Node& node = nodes_[current];
+		if (node.count > 0) {
+			for (int ii = node.first; ii < node.first + node.count; ++ii) {
+				// intersectTriangle(), four rays at a time, with the same operations in the same
+				// order so every ray gets exactly the scalar result
+				const Triangle& candidate = triangles_[ii];
+				const __m128 e1[3] = { _mm_set1_ps(candidate.e1.x), _mm_set1_ps(candidate.e1.y), _mm_set1_ps(candidate.e1.z) };
+				const __m128 e2[3] = { _mm_set1_ps(candidate.e2.x), _mm_set1_ps(candidate.e2.y), _mm_set1_ps(candidate.e2.z) };
+				const __m128 v0[3] = { _mm_set1_ps(candidate.v0.x), _mm_set1_ps(candidate.v0.y), _mm_set1_ps(candidate.v0.z) };
+				const __m128i index = _mm_set1_epi32(ii);
+				for (int group = 0; group < GROUPS; ++group) {
+					const __m128* d = direction[group];
+					const __m128 p[3] = {
+						_mm_sub_ps(_mm_mul_ps(d[1], e2[2]), _mm_mul_ps(d[2], e2[1])),
+						_mm_sub_ps(_mm_mul_ps(d[2], e2[0]), _mm_mul_ps(d[0], e2[2])),
+						_mm_sub_ps(_mm_mul_ps(d[0], e2[1]), _mm_mul_ps(d[1], e2[0]))
+					};
+					const __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1[0], p[0]), _mm_mul_ps(e1[1], p[1])), _mm_mul_ps(e1[2], p[2]));
+					const __m128 inverse = _mm_div_ps(one, determinant);
+					const __m128 s[3] = { _mm_sub_ps(origin[group][0], v0[0]), _mm_sub_ps(origin[group][1], v0[1]), _mm_sub_ps(origin[group][2], v0[2]) };
+					const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(s[0], p[0]), _mm_mul_ps(s[1], p[1])), _mm_mul_ps(s[2], p[2])), inverse);
+					const __m128 q[3] = {
+						_mm_sub_ps(_mm_mul_ps(s[1], e1[2]), _mm_mul_ps(s[2], e1[1])),
+						_mm_sub_ps(_mm_mul_ps(s[2], e1[0]), _mm_mul_ps(s[0], e1[2])),
+						_mm_sub_ps(_mm_mul_ps(s[0], e1[1]), _mm_mul_ps(s[1], e1[0]))
+					};
+					const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], q[0]), _mm_mul_ps(d[1], q[1])), _mm_mul_ps(d[2], q[2])), inverse);
+					const __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2[0], q[0]), _mm_mul_ps(e2[1], q[1])), _mm_mul_ps(e2[2], q[2])), inverse);
+
+					__m128 mask = _mm_and_ps(_mm_cmpneq_ps(determinant, zero), _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+					mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+					mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmple_ps(t, bestT[group])));
+					// Nearer, or as near and first in leaf order
+					const __m128 earlier = _mm_castsi128_ps(_mm_cmplt_epi32(index, bestTriangle[group]));
+					mask = _mm_and_ps(mask, _mm_or_ps(_mm_cmplt_ps(t, bestT[group]), earlier));
+					if (_mm_movemask_ps(mask)) {
+						bestT[group] = blend(mask, t, bestT[group]);
+						bestU[group] = blend(mask, u, bestU[group]);
+						bestV[group] = blend(mask, v, bestV[group]);
+						bestTriangle[group] = _mm_castps_si128(blend(mask, _mm_castsi128_ps(index), _mm_castsi128_ps(bestTriangle[group])));
+					}
+				}
+			}
+		} else {
+			int nearChild = node.first;
+			int farChild = node.first + 1;
+			float nearEnter = enterAny(nodes_[nearChild]);
+			float farEnter = enterAny(nodes_[farChild]);
+			if (farEnter < nearEnter) {
+				std::swap(nearChild, farChild);
+				std::swap(nearEnter, farEnter);
+			}
+			if (nearEnter != INFINITY) {
+				if (farEnter != INFINITY) {
+					stack[size] = farChild;
+					stackEnter[size] = farEnter;
+					++size;
+				}
+				current = nearChild;
+				continue;
+			}
+		}
+
+		current = -1;
+		const float limit = farthest();
+		while (size > 0) {
+			--size;
+			if (stackEnter[size] <= limit) {
+				current = stack[size];
+				break;
+			}
+		}
+		if (current < 0) {
+			break;
+		}
+	}
+
+	for (int group = 0; group < GROUPS; ++group) {
+		float t[4], u[4], v[4];
+		int triangle[4];
+		_mm_storeu_ps(t, bestT[group]);
+		_mm_storeu_ps(u, bestU[group]);
+		_mm_storeu_ps(v, bestV[group]);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(triangle), bestTriangle[group]);
+		for (int lane = 0; lane < 4 && group * 4 + lane < count; ++lane) {
+			Hit& hit = hits[group * 4 + lane];
+			hit.t = t[lane];
+			hit.face = triangle[lane] >= 0 ? faceOrder_[triangle[lane]] : -1;
+			hit.u = triangle[lane] >= 0 ? u[lane] : 0.0f;
+			hit.v = triangle[lane] >= 0 ? v[lane] : 0.0f;
+		}
+	}
+}
+#endif
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "Structs.h"
+
+#include <vector>
+
+// Bounding volume hierarchy over a mesh's triangles, for tracing rays on the CPU.
+// Built top down with the surface area heuristic, evaluated at 16 bins per axis (Wald,
+// "On fast Construction of SAH-based Bounding Volume Hierarchies", 2007).
+//
+// Large nodes are split one at a time, binning their triangles across threads. Once every
+// open node is small enough, those subtrees are built in parallel and appended in a fixed
+// order, so the tree is the same whatever the number of threads.
+//
+// Rays are traced one at a time or as packets of up to eight. A packet walks the tree once
+// for all its rays, testing boxes and triangles four rays at a time with SSE, which pays off
+// when the rays are coherent, like those through neighbouring pixels. Either way a ray finds
+// the same hit: of equally near triangles, the one first in leaf order wins.
+class Bvh {
+public:
+	// 32 bytes, two to a cache line. Children are always stored next to each other.
+	struct Node {
+		float lower[3];
+		int first;		// Interior: the first of its two children. Leaf: its first triangle.
+		float upper[3];
+		int count;		// Triangles in a leaf; 0 for interior nodes
+	};
+
+	struct Hit {
+		float t;
+		int face;		// Index into the faces built from, -1 for a miss
+		float u, v;		// Barycentrics of the face's second and third corners
+	};
+
+	static const int MAX_PACKET = 8;
+	// Rays traced together, one array per component
+	struct Packet {
+		float origin[3][MAX_PACKET];
+		float direction[3][MAX_PACKET];
+		float tMax[MAX_PACKET];
+	};
+
+	struct Stats {
+		int nodes;
+		int leaves;
+		int depth;
+		int subtrees;	// Built in parallel
+		float sahCost;	// Expected cost of a ray, in triangle tests
+	};
+
+	Bvh();
+
+	// Build over faces. threadCount 0 picks one from the mesh's size.
+	Stats build(const QVector<Vertex>& vertices, const QVector<Face>& faces, int threadCount = 0);
+	// Build over boxes instead, for a level above other trees. Leaves index the boxes through
+	// faceOrder(), and there are no triangles to intersect.
+	Stats build(const std::vector<Vec3>& lowers, const std::vector<Vec3>& uppers, int threadCount = 0);
+
+	// Closest triangle along origin + t * direction with t in (0, tMax]
+	bool intersect(const Vec3& origin, const Vec3& direction, Hit& hit, float tMax = 1e30f) const;
+	// Closest triangles along the first count rays of packet, each within its tMax
+	void intersect(const Packet& packet, int count, Hit* hits) const;
+	// Whether any triangle is in the way, for shadow rays
+	bool occluded(const Vec3& origin, const Vec3& direction, float tMax) const;
+
+	inline bool isEmpty() const { return nodes_.empty(); }
+	inline const std::vector<Node>& nodes() const { return nodes_; }
+	// Face (or box) of each triangle, in leaf order
+	inline const std::vector<int>& faceOrder() const { return faceOrder_; }
+	inline size_t bytes() const { return nodes_.size() * sizeof(Node) + triangles_.size() * sizeof(Triangle) + faceOrder_.size() * sizeof(int); }
+
+	// Deepest a tree gets; nodes this deep become leaves however many triangles they hold
+	static const int MAX_DEPTH = 64;
+
+private:
+	// A triangle in leaf order, as its first corner and the two edges from it
+	struct Triangle {
+		Vec3 v0, e1, e2;
+	};
+
+	// Packets of up to four rays per group
+	template<int GROUPS>
+	void intersectGroups(const Packet& packet, int count, Hit* hits) const;
+
+	std::vector<Node> nodes_;
+	std::vector<Triangle> triangles_;
+	std::vector<int> faceOrder_;
+};
@@ -40,6 +40,10 @@ public:
 	QMatrix4x4 getViewMatrix() const;
 	QMatrix4x4 getProjectionMatrix() const;
 
+	// World-space ray from the eye through a point on screen, given in normalized device
+	// coordinates: x and y in [-1, 1], y up
+	void rayThrough(float x, float y, QVector3D& origin, QVector3D& direction) const;
+
 	// Reset camera to inital orientation
 	void reset();
 
@@ -0,0 +1,77 @@
+#version 330
+
+// ~~~~~~~~~~ STRUCTS ~~~~~~~~~~
+struct PointLight {
+    vec3 position;
+    vec3 color;
+    float ambientIntensity;
+    float specularIntensity;
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+// ~~~~~~~~~~ INPUTS ~~~~~~~~~~
+flat in vec4 positionRange;
+flat in vec4 colorAmbient;
+flat in vec4 specularAttenuation;
+
+// ~~~~~~~~~~ OUTPUTS ~~~~~~~~~~
+out vec4 fragColor;
+
+// ~~~~~~~~~~ UNIFORMS ~~~~~~~~~~
+// G-buffer written by frag.glsl's G_BUFFER variant
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;		// view space depth, 0 where nothing was drawn
+uniform vec3 viewPosition;
+uniform mat4 inverseViewMatrix;
+uniform vec2 projectionScale;	// projection matrix (0, 0) and (1, 1)
+uniform vec2 viewportSize;
+uniform bool lightingOnly;
+
+vec3 calcPointLight(PointLight light, vec3 fragPos, vec3 normal, vec3 viewDir);
+
+void main() {
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	float depth = texelFetch(gDepth, pixel, 0).r;
+	if (depth <= 0.0) {
+		discard;
+	}
+
+	// Rebuild the world space position from the pixel's view ray and depth
+	vec2 ndc = gl_FragCoord.xy / viewportSize * 2.0 - 1.0;
+	vec3 viewSpace = vec3(ndc / projectionScale * depth, -depth);
+	vec3 fragPos = vec3(inverseViewMatrix * vec4(viewSpace, 1.0));
+
+	vec3 normal = texelFetch(gNormal, pixel, 0).xyz;
+	vec3 viewDir = normalize(viewPosition - fragPos);
+	vec3 diffuseColor = lightingOnly ? vec3(1.0) : texelFetch(gAlbedo, pixel, 0).rgb;
+
+	PointLight light = PointLight(positionRange.xyz, colorAmbient.rgb, colorAmbient.a,
+		specularAttenuation.x, specularAttenuation.y, specularAttenuation.z, specularAttenuation.w);
+
+	// Fade to exactly zero at the light's range, matching clustered shading
+	float ratio = length(light.position - fragPos) / positionRange.w;
+	float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+	fragColor = vec4(diffuseColor * calcPointLight(light, fragPos, normal, viewDir) * (window * window), 1.0);
+}
+
+vec3 calcPointLight(PointLight light, vec3 fragPos, vec3 normal, vec3 viewDir)
+{
+	// Same model as frag.glsl
+	vec3 ambient = light.ambientIntensity * light.color;
+
+	vec3 lightDir = normalize(light.position - fragPos);
+	float diffImpact = (max(dot(normal, lightDir), 0.0));
+	vec3 diffuse = diffImpact * light.color;
+
+	vec3 reflectDir = reflect(-lightDir, normal);
+	float spec = pow(max(dot(viewDir, reflectDir), 0.0), 100);
+	vec3 specular = light.specularIntensity * spec * light.color;
+
+	float lightDistance = length(light.position - fragPos);
+	float attenuation = 1.0 / (light.constant + light.linear * lightDistance + light.quadratic * (lightDistance * lightDistance));
+
+	return (ambient + diffuse + specular) * attenuation;
+}
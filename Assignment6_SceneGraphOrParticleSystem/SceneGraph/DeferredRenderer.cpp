@@ -0,0 +1,262 @@
+#include "DeferredRenderer.h"
+#include "LightClusters.h"
+#include "Sphere.h"
+
+#include <cfloat>
+
+// Light volumes are built from a tessellated sphere whose faces cut slightly inside
+// the true sphere, so grow them a little to never clip a light's range
+static const float VOLUME_MARGIN = 1.02f;
+
+static void appendLight(QVector<float>& data, const PointLight& light, float radius)
+{
+	data << light.position.x() << light.position.y() << light.position.z() << radius
+		<< light.color.x() << light.color.y() << light.color.z() << light.ambientIntensity
+		<< light.specularIntensity << light.constant << light.linear << light.quadratic;
+}
+
+DeferredRenderer::DeferredRenderer() : initialized_(false), fbo_(0), depthBuffer_(0), fullScreenShader_(nullptr), volumeShader_(nullptr),
+	fullScreenInstances_(QOpenGLBuffer::VertexBuffer), volumeVbo_(QOpenGLBuffer::VertexBuffer), volumeIbo_(QOpenGLBuffer::IndexBuffer),
+	volumeInstances_(QOpenGLBuffer::VertexBuffer), volumeIndexCount_(0), fullScreenLights_(0), volumeLights_(0)
+{
+	for (int t = 0; t < TARGET_COUNT; ++t) {
+		targets_[t] = 0;
+	}
+}
+
+DeferredRenderer::~DeferredRenderer()
+{
+	if (!initialized_) {
+		return;
+	}
+	destroyTargets();
+	fullScreenInstances_.destroy();
+	volumeVbo_.destroy();
+	volumeIbo_.destroy();
+	volumeInstances_.destroy();
+	fullScreenVao_.destroy();
+	volumeVao_.destroy();
+}
+
+void DeferredRenderer::init()
+{
+	initializeOpenGLFunctions();
+	fullScreenShader_ = ShaderCache::instance().program("../../DeferredVert.glsl", "../../DeferredFrag.glsl");
+	volumeShader_ = ShaderCache::instance().program("../../DeferredVert.glsl", "../../DeferredFrag.glsl", QStringList() << "LIGHT_VOLUMES");
+
+	fullScreenVao_.create();
+	fullScreenVao_.bind();
+	fullScreenInstances_.create();
+	fullScreenInstances_.setUsagePattern(QOpenGLBuffer::StreamDraw);
+	fullScreenInstances_.bind();
+	setLightAttributes(fullScreenShader_);
+	fullScreenVao_.release();
+	fullScreenInstances_.release();
+
+	const Sphere sphere;
+	const QVector<Vertex> vertices = sphere.vertices();
+	const QVector<Face> faces = sphere.faces();
+	volumeIndexCount_ = faces.size() * 3;
+
+	volumeVao_.create();
+	volumeVao_.bind();
+	volumeVbo_.create();
+	volumeVbo_.setUsagePattern(QOpenGLBuffer::StaticDraw);
+	volumeVbo_.bind();
+	volumeVbo_.allocate(vertices.constData(), vertices.size() * sizeof(Vertex));
+	volumeShader_->enableAttributeArray(0);
+	volumeShader_->setAttributeBuffer(0, GL_FLOAT, 0, 3, sizeof(Vertex));
+	volumeIbo_.create();
+	volumeIbo_.setUsagePattern(QOpenGLBuffer::StaticDraw);
+	volumeIbo_.bind();
+	volumeIbo_.allocate(faces.constData(), faces.size() * sizeof(Face));
+	volumeInstances_.create();
+	volumeInstances_.setUsagePattern(QOpenGLBuffer::StreamDraw);
+	volumeInstances_.bind();
+	setLightAttributes(volumeShader_);
+	volumeVao_.release();
+	volumeVbo_.release();
+	volumeIbo_.release();
+	volumeInstances_.release();
+
+	initialized_ = true;
+}
+
+void DeferredRenderer::setLightAttributes(QOpenGLShaderProgram* shader)
+{
+	// Three vec4s per light instance, at locations 1-3
+	const int stride = 12 * sizeof(float);
+	for (int ii = 0; ii < 3; ++ii) {
+		shader->enableAttributeArray(1 + ii);
+		shader->setAttributeBuffer(1 + ii, GL_FLOAT, ii * 4 * sizeof(float), 4, stride);
+		glVertexAttribDivisor(1 + ii, 1);
+	}
+}
+
+void DeferredRenderer::destroyTargets()
+{
+	if (!fbo_) {
+		return;
+	}
+	glDeleteFramebuffers(1, &fbo_);
+	glDeleteTextures(TARGET_COUNT, targets_);
+	glDeleteRenderbuffers(1, &depthBuffer_);
+	fbo_ = 0;
+}
+
+void DeferredRenderer::resize(const QSize& size)
+{
+	destroyTargets();
+	size_ = size;
+
+	glGenFramebuffers(1, &fbo_);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+
+	// Albedo only needs 8 bits; normals and depth keep full float range for lighting
+	const GLenum internalFormats[TARGET_COUNT] = { GL_RGBA8, GL_RGBA16F, GL_R32F };
+	const GLenum formats[TARGET_COUNT] = { GL_RGBA, GL_RGBA, GL_RED };
+	const GLenum types[TARGET_COUNT] = { GL_UNSIGNED_BYTE, GL_HALF_FLOAT, GL_FLOAT };
+	glGenTextures(TARGET_COUNT, targets_);
+	for (int t = 0; t < TARGET_COUNT; ++t) {
+		glBindTexture(GL_TEXTURE_2D, targets_[t]);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[t], size.width(), size.height(), 0, formats[t], types[t], nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + t, GL_TEXTURE_2D, targets_[t], 0);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// Same format as the window's depth buffer, so it can be blitted there
+	glGenRenderbuffers(1, &depthBuffer_);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer_);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, size.width(), size.height());
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer_);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		qDebug() << "G-buffer is incomplete at" << size;
+	}
+}
+
+void DeferredRenderer::beginGeometryPass(const QSize& viewportPixels)
+{
+	if (!initialized_) {
+		init();
+	}
+	if (viewportPixels != size_ || !fbo_) {
+		resize(viewportPixels);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+	const GLenum drawBuffers[TARGET_COUNT] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+	glDrawBuffers(TARGET_COUNT, drawBuffers);
+	glViewport(0, 0, size_.width(), size_.height());
+
+	// Zero depth marks pixels no geometry was drawn to
+	const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int t = 0; t < TARGET_COUNT; ++t) {
+		glClearBufferfv(GL_COLOR, t, zero);
+	}
+	glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+}
+
+void DeferredRenderer::lightingPass(GLuint targetFramebuffer, const QVector<PointLight>* lights, const QVector3D& viewPosition,
+	const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix, bool lightingOnly)
+{
+	// Give the target the scene's depth, so light volumes and later forward draws are depth tested
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo_);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targetFramebuffer);
+	glBlitFramebuffer(0, 0, size_.width(), size_.height(), 0, 0, size_.width(), size_.height(), GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+
+	// Split lights by whether they have a finite range
+	fullScreenData_.resize(0);
+	volumeData_.resize(0);
+	if (lights) {
+		for (const PointLight& light : *lights) {
+			const float radius = LightClusters::lightRadius(light);
+			if (radius <= 0.0f) {
+				continue;
+			}
+			if (radius < FLT_MAX) {
+				appendLight(volumeData_, light, radius);
+			}
+			else {
+				appendLight(fullScreenData_, light, 1e30f);
+			}
+		}
+	}
+	fullScreenLights_ = fullScreenData_.size() / 12;
+	volumeLights_ = volumeData_.size() / 12;
+
+	// Every light adds its contribution to the pixel
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glDepthMask(GL_FALSE);
+
+	for (int t = 0; t < TARGET_COUNT; ++t) {
+		glActiveTexture(GL_TEXTURE0 + t);
+		glBindTexture(GL_TEXTURE_2D, targets_[t]);
+	}
+	QMatrix4x4 inverseView = viewMatrix.inverted();
+	auto setUniforms = [&](QOpenGLShaderProgram* shader)
+	{
+		shader->bind();
+		shader->setUniformValue("gAlbedo", 0);
+		shader->setUniformValue("gNormal", 1);
+		shader->setUniformValue("gDepth", 2);
+		shader->setUniformValue("viewPosition", viewPosition);
+		shader->setUniformValue("viewMatrix", viewMatrix);
+		shader->setUniformValue("inverseViewMatrix", inverseView);
+		shader->setUniformValue("projectionMatrix", projectionMatrix);
+		shader->setUniformValue("projectionScale", QVector2D(projectionMatrix(0, 0), projectionMatrix(1, 1)));
+		shader->setUniformValue("viewportSize", QVector2D(size_.width(), size_.height()));
+		shader->setUniformValue("volumeScale", VOLUME_MARGIN);
+		shader->setUniformValue("lightingOnly", lightingOnly);
+	};
+
+	if (fullScreenLights_ > 0) {
+		glDisable(GL_DEPTH_TEST);
+		setUniforms(fullScreenShader_);
+		fullScreenVao_.bind();
+		fullScreenInstances_.bind();
+		fullScreenInstances_.allocate(fullScreenData_.constData(), fullScreenData_.size() * sizeof(float));
+		fullScreenInstances_.release();
+		glDrawArraysInstanced(GL_TRIANGLES, 0, 3, fullScreenLights_);
+		fullScreenVao_.release();
+		fullScreenShader_->release();
+	}
+
+	if (volumeLights_ > 0) {
+		// Draw each sphere's far side where it lies behind the scene, which covers
+		// exactly the pixels inside its range, even with the camera inside it.
+		// Sphere winds its faces clockwise seen from outside.
+		glEnable(GL_DEPTH_TEST);
+		glDepthFunc(GL_GEQUAL);
+		glEnable(GL_CULL_FACE);
+		glFrontFace(GL_CW);
+		glCullFace(GL_FRONT);
+		setUniforms(volumeShader_);
+		volumeVao_.bind();
+		volumeInstances_.bind();
+		volumeInstances_.allocate(volumeData_.constData(), volumeData_.size() * sizeof(float));
+		volumeInstances_.release();
+		glDrawElementsInstanced(GL_TRIANGLES, volumeIndexCount_, GL_UNSIGNED_INT, 0, volumeLights_);
+		volumeVao_.release();
+		volumeShader_->release();
+		glFrontFace(GL_CCW);
+		glCullFace(GL_BACK);
+		glDisable(GL_CULL_FACE);
+		glDepthFunc(GL_LESS);
+	}
+
+	for (int t = TARGET_COUNT - 1; t >= 0; --t) {
+		glActiveTexture(GL_TEXTURE0 + t);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	glEnable(GL_DEPTH_TEST);
+	glDepthMask(GL_TRUE);
+	glDisable(GL_BLEND);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <QtCore>
+#include <QtGui>
+#include <QtOpenGL>
+#include "ShaderCache.h"
+#include "Structs.h"
+
+// Deferred shading. The geometry pass writes albedo, normal and linear depth for
+// every pixel into a G-buffer through multiple render targets; the lighting pass
+// then shades each visible pixel once per light that reaches it. Lights with a
+// finite range are drawn as spheres around that range, so they only touch the
+// pixels they can light; lights without falloff are drawn full screen.
+class DeferredRenderer : protected QOpenGLExtraFunctions
+{
+public:
+	DeferredRenderer();
+	~DeferredRenderer();
+
+	// Bind the G-buffer, sized to the viewport, and clear it. Draw the scene in
+	// DrawMode::GBUFFER afterwards. Needs a current context.
+	void beginGeometryPass(const QSize& viewportPixels);
+	// Shade the G-buffer with these lights into targetFramebuffer, which is left bound
+	// with the scene's depth so forward geometry can be drawn on top
+	void lightingPass(GLuint targetFramebuffer, const QVector<PointLight>* lights, const QVector3D& viewPosition,
+		const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix, bool lightingOnly);
+
+	// Stats from the last lighting pass
+	inline int fullScreenLights() const { return fullScreenLights_; }
+	inline int volumeLights() const { return volumeLights_; }
+
+private:
+	void init();
+	void resize(const QSize& size);
+	void destroyTargets();
+	void setLightAttributes(QOpenGLShaderProgram* shader);
+
+	bool initialized_;
+	QSize size_;
+
+	// G-buffer: albedo, world space normal, view space depth, plus a depth buffer for testing
+	static const int TARGET_COUNT = 3;
+	GLuint fbo_;
+	GLuint targets_[TARGET_COUNT];
+	GLuint depthBuffer_;
+
+	QOpenGLShaderProgram* fullScreenShader_;
+	QOpenGLShaderProgram* volumeShader_;
+	// A full screen triangle is generated from gl_VertexID, so it only needs light instances
+	QOpenGLVertexArrayObject fullScreenVao_;
+	QOpenGLBuffer fullScreenInstances_;
+	// Unit sphere, scaled to each light's range
+	QOpenGLVertexArrayObject volumeVao_;
+	QOpenGLBuffer volumeVbo_;
+	QOpenGLBuffer volumeIbo_;
+	QOpenGLBuffer volumeInstances_;
+	int volumeIndexCount_;
+
+	// 12 floats per light: position, range, color, ambient, specular, attenuation
+	QVector<float> fullScreenData_;
+	QVector<float> volumeData_;
+	int fullScreenLights_;
+	int volumeLights_;
+};
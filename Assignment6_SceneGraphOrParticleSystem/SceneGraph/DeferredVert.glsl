@@ -0,0 +1,40 @@
+#version 330
+
+// Deferred lighting pass. Each instance is one light:
+//   LIGHT_VOLUMES  a sphere around the light's range, drawn where it covers the scene
+//   otherwise      a triangle covering the whole screen
+// ~~~~~~~~~~ INPUTS ~~~~~~~~~~
+#ifdef LIGHT_VOLUMES
+layout(location = 0) in vec3 position;
+#endif
+
+// ~~~~~~~~~~ PER-INSTANCE INPUTS ~~~~~~~~~~
+layout(location = 1) in vec4 lightPositionRange;
+layout(location = 2) in vec4 lightColorAmbient;
+layout(location = 3) in vec4 lightSpecularAttenuation;	// specular, constant, linear, quadratic
+
+// ~~~~~~~~~~ OUTPUTS ~~~~~~~~~~
+flat out vec4 positionRange;
+flat out vec4 colorAmbient;
+flat out vec4 specularAttenuation;
+
+// ~~~~~~~~~~ UNIFORMS ~~~~~~~~~~
+uniform mat4 viewMatrix;
+uniform mat4 projectionMatrix;
+uniform float volumeScale;
+
+void main()
+{
+	positionRange = lightPositionRange;
+	colorAmbient = lightColorAmbient;
+	specularAttenuation = lightSpecularAttenuation;
+
+#ifdef LIGHT_VOLUMES
+	vec3 worldPosition = lightPositionRange.xyz + position * lightPositionRange.w * volumeScale;
+	gl_Position = projectionMatrix * viewMatrix * vec4(worldPosition, 1.0);
+#else
+	// Vertices (-1, -1), (3, -1), (-1, 3) cover the screen with one triangle
+	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+#endif
+}
@@ -0,0 +1,129 @@
+#include "Frustum.h"
+#include "SceneNode.h"
+
+#include <cmath>
+
+// ~~~~~~~~~~ FRUSTUM ~~~~~~~~~~
+Frustum::Frustum()
+{
+	for (int i = 0; i < PLANE_COUNT; ++i) {
+		planes_[i] = QVector4D(0, 0, 0, 1);
+	}
+}
+
+Frustum::Frustum(const QMatrix4x4& viewProjection)
+{
+	// Gribb/Hartmann: clip-space planes are sums and differences of the matrix rows
+	const QVector4D r0 = viewProjection.row(0);
+	const QVector4D r1 = viewProjection.row(1);
+	const QVector4D r2 = viewProjection.row(2);
+	const QVector4D r3 = viewProjection.row(3);
+	planes_[LEFT] = r3 + r0;
+	planes_[RIGHT] = r3 - r0;
+	planes_[BOTTOM] = r3 + r1;
+	planes_[TOP] = r3 - r1;
+	planes_[NEAR_PLANE] = r3 + r2;
+	planes_[FAR_PLANE] = r3 - r2;
+
+	for (int i = 0; i < PLANE_COUNT; ++i) {
+		const float length = planes_[i].toVector3D().length();
+		if (length > 0.0f) {
+			planes_[i] /= length;
+		}
+	}
+}
+
+Frustum::Result Frustum::test(const BoundingBox& box, quint8& planeMask, quint8& startPlane) const
+{
+	if (box.isEmpty()) {
+		return Result::OUTSIDE;
+	}
+
+	const QVector3D center = box.center();
+	const QVector3D extents = box.extents();
+	const float sphereRadius = extents.length();
+
+	for (int n = 0; n < PLANE_COUNT; ++n) {
+		// Start with the plane that rejected these bounds last time
+		const int i = (startPlane + n) % PLANE_COUNT;
+		const quint8 bit = quint8(1 << i);
+		if (!(planeMask & bit)) {
+			continue;
+		}
+
+		const QVector4D& plane = planes_[i];
+		const float distance = plane.x() * center.x() + plane.y() * center.y() + plane.z() * center.z() + plane.w();
+
+		// The enclosing sphere settles most cases before we need the box
+		if (distance > sphereRadius) {
+			planeMask &= ~bit;
+			continue;
+		}
+		const float boxRadius = std::fabs(plane.x()) * extents.x() + std::fabs(plane.y()) * extents.y() + std::fabs(plane.z()) * extents.z();
+		if (distance < -boxRadius) {
+			startPlane = quint8(i);
+			return Result::OUTSIDE;
+		}
+		if (distance > boxRadius) {
+			planeMask &= ~bit;
+		}
+	}
+	return planeMask == 0 ? Result::INSIDE : Result::INTERSECTS;
+}
+
+// ~~~~~~~~~~ FRUSTUMCULLER ~~~~~~~~~~
+FrustumCuller::FrustumCuller() : visibleCount_(0), culledCount_(0) {}
+
+void FrustumCuller::cull(const TransformHierarchy& hierarchy, const Frustum& frustum, QVector<int>& visible)
+{
+	const int count = hierarchy.size();
+	if (lastRejectingPlane_.size() != count) {
+		lastRejectingPlane_.fill(0, count);
+	}
+	planeMasks_.resize(count);
+
+	visible.resize(0);
+	visibleCount_ = 0;
+	culledCount_ = 0;
+
+	int i = 0;
+	while (i < count) {
+		const int p = hierarchy.parent(i);
+		quint8 mask = p >= 0 ? planeMasks_[p] : Frustum::ALL_PLANES;
+
+		// Test the whole subtree's bounds first
+		const Frustum::Result subtree = mask ? frustum.test(hierarchy.subtreeBounds(i), mask, lastRejectingPlane_[i]) : Frustum::Result::INSIDE;
+		if (subtree == Frustum::Result::OUTSIDE) {
+			culledCount_ += hierarchy.subtreeRenderables(i);
+			i = hierarchy.subtreeEnd(i);
+			continue;
+		}
+
+		if (subtree == Frustum::Result::INSIDE) {
+			// Everything below is visible without further tests
+			const int end = hierarchy.subtreeEnd(i);
+			for (; i < end; ++i) {
+				if (hierarchy.node(i)->getRenderable()) {
+					visible << i;
+				}
+			}
+			continue;
+		}
+
+		// Partially inside: the node's own bounds decide whether it draws, and
+		// its children carry on with the planes still left to test
+		planeMasks_[i] = mask;
+		if (hierarchy.node(i)->getRenderable()) {
+			quint8 ownMask = mask;
+			quint8 startPlane = lastRejectingPlane_[i];
+			if (frustum.test(hierarchy.ownBounds(i), ownMask, startPlane) != Frustum::Result::OUTSIDE) {
+				visible << i;
+			}
+			else {
+				++culledCount_;
+			}
+		}
+		++i;
+	}
+	visibleCount_ = visible.size();
+}
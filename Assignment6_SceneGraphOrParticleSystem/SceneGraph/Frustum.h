@@ -0,0 +1,54 @@
+#pragma once
+
+#include <QtCore>
+#include <QtGui>
+#include "Bounds.h"
+#include "TransformHierarchy.h"
+
+// The six planes of a view-projection matrix, normals pointing inwards
+class Frustum
+{
+public:
+	enum Plane { LEFT = 0, RIGHT, BOTTOM, TOP, NEAR_PLANE, FAR_PLANE, PLANE_COUNT };
+	// Bit i of a plane mask is set while bounds still need testing against plane i
+	static const quint8 ALL_PLANES = (1 << PLANE_COUNT) - 1;
+
+	enum class Result { OUTSIDE, INTERSECTS, INSIDE };
+
+	Frustum();
+	explicit Frustum(const QMatrix4x4& viewProjection);
+
+	// Test against the planes left in planeMask, starting with startPlane. Planes the
+	// bounds are fully inside are cleared from planeMask, so children can skip them.
+	// On OUTSIDE, startPlane is set to the plane that rejected the bounds.
+	Result test(const BoundingBox& box, quint8& planeMask, quint8& startPlane) const;
+
+	// Normalized, so a point's distance inside it is dot(xyz, point) + w
+	inline const QVector4D& plane(int i) const { return planes_[i]; }
+
+private:
+	QVector4D planes_[PLANE_COUNT];
+};
+
+// Hierarchical frustum culling over a TransformHierarchy's bounds. Whole subtrees
+// are skipped once their bounds are outside, and planes a parent is entirely inside
+// are never tested again below it. Each node remembers the plane that last rejected
+// it, which is usually the one to reject it again next frame.
+class FrustumCuller
+{
+public:
+	FrustumCuller();
+
+	// Fill visible with the preorder indices of renderable nodes inside the frustum
+	void cull(const TransformHierarchy& hierarchy, const Frustum& frustum, QVector<int>& visible);
+
+	// Counts of renderable nodes from the last cull()
+	inline int visibleCount() const { return visibleCount_; }
+	inline int culledCount() const { return culledCount_; }
+
+private:
+	QVector<quint8> lastRejectingPlane_;
+	QVector<quint8> planeMasks_;
+	int visibleCount_;
+	int culledCount_;
+};
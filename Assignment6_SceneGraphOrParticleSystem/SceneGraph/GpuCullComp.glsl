@@ -0,0 +1,95 @@
+#version 430
+
+// Frustum culling for GpuCuller, one instance per invocation. An instance in view picks its
+// level of detail by distance and takes the next slot of that level's range in the instance
+// buffer, counted by the instanceCount of the level's draw command. There it's written out
+// in full, as the per-instance attributes vert.glsl reads, so the commands can be drawn
+// without the CPU ever learning how many instances each one has.
+
+layout(local_size_x = 64) in;
+
+// ~~~~~~~~~~ BUFFERS ~~~~~~~~~~
+// Two vec4s per instance: position and scale, then its rotation as a unit quaternion
+layout(std430, binding = 0) readonly buffer Instances {
+	vec4 instances[];
+};
+// One DrawElementsIndirectCommand per level, five uints each:
+// (count, instanceCount, firstIndex, baseVertex, baseInstance)
+layout(std430, binding = 1) buffer Commands {
+	uint commands[];
+};
+// 36 floats per instance, laid out as InstanceData in Structs.h
+layout(std430, binding = 2) writeonly buffer Visible {
+	float visible[];
+};
+
+// ~~~~~~~~~~ UNIFORMS ~~~~~~~~~~
+uniform uint instanceCount;
+uniform vec4 planes[6];			// Frustum planes, normals pointing inwards
+uniform vec3 viewPosition;
+uniform float radius;			// Bounding sphere of the mesh at scale 1
+uniform int lodCount;
+uniform float lodDistances[4];	// Instances nearer than lodDistances[i] draw level i
+uniform vec3 textureLayers;		// (diffuse layer, normal layer, opacity)
+uniform vec4 diffuseRegion;
+uniform vec4 normalRegion;
+
+void main()
+{
+	const uint index = gl_GlobalInvocationID.x;
+	if (index >= instanceCount) {
+		return;
+	}
+	const vec4 centerScale = instances[2 * index];
+	const vec4 q = instances[2 * index + 1];
+	const vec3 center = centerScale.xyz;
+	const float scale = centerScale.w;
+
+	for (int ii = 0; ii < 6; ++ii) {
+		if (dot(planes[ii].xyz, center) + planes[ii].w < -radius * scale) {
+			return;
+		}
+	}
+
+	const float dist = distance(center, viewPosition);
+	int lod = 0;
+	while (lod < lodCount - 1 && dist >= lodDistances[lod]) {
+		++lod;
+	}
+	const uint slot = atomicAdd(commands[5 * lod + 1], 1u);
+	const uint base = 36u * (commands[5 * lod + 4] + slot);
+
+	// Rotation columns, from the quaternion
+	const vec3 r0 = vec3(1.0 - 2.0 * (q.y * q.y + q.z * q.z), 2.0 * (q.x * q.y + q.w * q.z), 2.0 * (q.x * q.z - q.w * q.y));
+	const vec3 r1 = vec3(2.0 * (q.x * q.y - q.w * q.z), 1.0 - 2.0 * (q.x * q.x + q.z * q.z), 2.0 * (q.y * q.z + q.w * q.x));
+	const vec3 r2 = vec3(2.0 * (q.x * q.z + q.w * q.y), 2.0 * (q.y * q.z - q.w * q.x), 1.0 - 2.0 * (q.x * q.x + q.y * q.y));
+
+	// Model matrix, translate * rotate * scale, column major
+	const vec3 columns[3] = vec3[3](r0 * scale, r1 * scale, r2 * scale);
+	for (int col = 0; col < 3; ++col) {
+		visible[base + 4 * col] = columns[col].x;
+		visible[base + 4 * col + 1] = columns[col].y;
+		visible[base + 4 * col + 2] = columns[col].z;
+		visible[base + 4 * col + 3] = 0.0;
+	}
+	visible[base + 12] = center.x;
+	visible[base + 13] = center.y;
+	visible[base + 14] = center.z;
+	visible[base + 15] = 1.0;
+
+	// Normal matrix, the inverse transpose of the model's upper 3x3
+	const vec3 normals[3] = vec3[3](r0 / scale, r1 / scale, r2 / scale);
+	for (int col = 0; col < 3; ++col) {
+		visible[base + 16 + 3 * col] = normals[col].x;
+		visible[base + 17 + 3 * col] = normals[col].y;
+		visible[base + 18 + 3 * col] = normals[col].z;
+	}
+
+	visible[base + 25] = textureLayers.x;
+	visible[base + 26] = textureLayers.y;
+	visible[base + 27] = textureLayers.z;
+	for (int ii = 0; ii < 4; ++ii) {
+		visible[base + 28 + ii] = diffuseRegion[ii];
+		visible[base + 32 + ii] = normalRegion[ii];
+	}
+}
@@ -0,0 +1,266 @@
+#include "GpuCuller.h"
+
+#include <cmath>
+#include <cstring>
+
+GpuCuller::GpuCuller() : renderable_(nullptr), radius_(1.0f), diffuseMaps_(nullptr), diffuseTexture_(-1), lights_(nullptr),
+	gpuSupported_(false), gpuDriven_(true), instanceBuffer_(0), commandBuffer_(0), visibleBytes_(0), culledOnGpu_(false), cullMs_(0.0)
+{}
+
+GpuCuller::~GpuCuller()
+{
+	// GL objects have to go in destroy(), with the context current
+}
+
+void GpuCuller::create(Renderable* renderable, const QVector<Lod>& lods, float radius)
+{
+	initializeOpenGLFunctions();
+	renderable_ = renderable;
+	lods_ = lods.mid(0, MAX_LODS);
+	radius_ = radius;
+
+	QOpenGLContext* context = QOpenGLContext::currentContext();
+	if (context->isOpenGLES() || context->format().version() < qMakePair(4, 3)) {
+		qDebug() << "GpuCuller: compute shaders need GL 4.3, culling on the CPU";
+		return;
+	}
+	if (!cull_.addShaderFromSourceFile(QOpenGLShader::Compute, "../../GpuCullComp.glsl") || !cull_.link()) {
+		qDebug() << "GpuCuller: could not build the culling shader, culling on the CPU:" << cull_.log();
+		return;
+	}
+	glGenBuffers(1, &instanceBuffer_);
+	glGenBuffers(1, &commandBuffer_);
+	gpuSupported_ = true;
+	setInstances(instances_);
+}
+
+void GpuCuller::destroy()
+{
+	if (instanceBuffer_) {
+		glDeleteBuffers(1, &instanceBuffer_);
+		glDeleteBuffers(1, &commandBuffer_);
+		instanceBuffer_ = commandBuffer_ = 0;
+	}
+	cull_.removeAllShaders();
+	gpuSupported_ = false;
+}
+
+void GpuCuller::setInstances(const QVector<Instance>& instances)
+{
+	instances_ = instances;
+	if (!gpuSupported_) {
+		return;
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer_);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, qint64(instances_.size()) * sizeof(Instance), instances_.constData(), GL_STATIC_DRAW);
+
+	// Level i fills slots [i * capacity, (i + 1) * capacity) of the instance buffer
+	commands_.resize(lods_.size());
+	for (int lod = 0; lod < lods_.size(); ++lod) {
+		Command& command = commands_[lod];
+		command.count = lods_[lod].faceCount * 3;
+		command.instanceCount = 0;
+		command.firstIndex = lods_[lod].firstFace * 3;
+		command.baseVertex = 0;
+		command.baseInstance = lod * instances_.size();
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer_);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, commands_.size() * sizeof(Command), commands_.constData(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+TextureArray::Region GpuCuller::diffuseRegion() const
+{
+	return diffuseMaps_ && diffuseMaps_->isCreated() ? diffuseMaps_->region(diffuseTexture_) : TextureArray::Region();
+}
+
+void GpuCuller::cull(const QMatrix4x4& viewProjection, const QVector3D& viewPosition)
+{
+	QElapsedTimer timer;
+	timer.start();
+	const Frustum frustum(viewProjection);
+	culledOnGpu_ = gpuDriven();
+	if (!culledOnGpu_) {
+		cullOnCpu(frustum, viewPosition);
+		cullMs_ = timer.nsecsElapsed() / 1e6;
+		return;
+	}
+
+	// Every level starts empty
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer_);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, commands_.size() * sizeof(Command), commands_.constData());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	QOpenGLBuffer& visible = renderable_->instanceBuffer();
+	const qint64 visibleBytes = qint64(lods_.size()) * instances_.size() * sizeof(InstanceData);
+	if (visibleBytes_ != visibleBytes) {
+		visible.bind();
+		visible.allocate(int(visibleBytes));
+		visible.release();
+		visibleBytes_ = visibleBytes;
+	}
+	if (instances_.isEmpty()) {
+		cullMs_ = timer.nsecsElapsed() / 1e6;
+		return;
+	}
+
+	QVector4D planes[Frustum::PLANE_COUNT];
+	for (int ii = 0; ii < Frustum::PLANE_COUNT; ++ii) {
+		planes[ii] = frustum.plane(ii);
+	}
+	GLfloat distances[MAX_LODS] = {};
+	for (int lod = 0; lod < lods_.size(); ++lod) {
+		distances[lod] = lods_[lod].maxDistance;
+	}
+	const TextureArray::Region diffuse = diffuseRegion();
+
+	cull_.bind();
+	cull_.setUniformValue("instanceCount", GLuint(instances_.size()));
+	cull_.setUniformValueArray("planes", planes, Frustum::PLANE_COUNT);
+	cull_.setUniformValue("viewPosition", viewPosition);
+	cull_.setUniformValue("radius", radius_);
+	cull_.setUniformValue("lodCount", lods_.size());
+	cull_.setUniformValueArray("lodDistances", distances, MAX_LODS, 1);
+	cull_.setUniformValue("textureLayers", QVector3D(diffuse.layer, -1, 1));
+	cull_.setUniformValue("diffuseRegion", diffuse.rect);
+	cull_.setUniformValue("normalRegion", QVector4D(0, 0, 1, 1));
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instanceBuffer_);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandBuffer_);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, visible.bufferId());
+	glDispatchCompute((instances_.size() + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+	// The draw reads the counts as commands and the copies as attributes; resetting the
+	// counts next frame, and reading them back, go through buffer updates
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	for (int binding = 0; binding < 3; ++binding) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+	}
+	cull_.release();
+	cullMs_ = timer.nsecsElapsed() / 1e6;
+}
+
+void GpuCuller::cullOnCpu(const Frustum& frustum, const QVector3D& viewPosition)
+{
+	for (int lod = 0; lod < lods_.size(); ++lod) {
+		lodInstances_[lod].resize(0);
+	}
+	const TextureArray::Region diffuse = diffuseRegion();
+	QVector4D planes[Frustum::PLANE_COUNT];
+	for (int ii = 0; ii < Frustum::PLANE_COUNT; ++ii) {
+		planes[ii] = frustum.plane(ii);
+	}
+
+	for (const Instance& instance : instances_) {
+		const QVector3D center(instance.centerScale[0], instance.centerScale[1], instance.centerScale[2]);
+		const float radius = radius_ * instance.centerScale[3];
+		bool outside = false;
+		for (int ii = 0; ii < Frustum::PLANE_COUNT && !outside; ++ii) {
+			outside = QVector3D::dotProduct(planes[ii].toVector3D(), center) + planes[ii].w() < -radius;
+		}
+		if (outside) {
+			continue;
+		}
+
+		const float distance = (center - viewPosition).length();
+		int lod = 0;
+		while (lod < lods_.size() - 1 && distance >= lods_[lod].maxDistance) {
+			++lod;
+		}
+		QVector<InstanceData>& survivors = lodInstances_[lod];
+		survivors.resize(survivors.size() + 1);
+		expand(instance, diffuse, survivors.last());
+	}
+}
+
+void GpuCuller::expand(const Instance& instance, const TextureArray::Region& diffuse, InstanceData& data)
+{
+	const float* q = instance.rotation;
+	const float scale = instance.centerScale[3];
+	// Rotation columns, from the quaternion
+	const float rotation[3][3] = {
+		{ 1.0f - 2.0f * (q[1] * q[1] + q[2] * q[2]), 2.0f * (q[0] * q[1] + q[3] * q[2]), 2.0f * (q[0] * q[2] - q[3] * q[1]) },
+		{ 2.0f * (q[0] * q[1] - q[3] * q[2]), 1.0f - 2.0f * (q[0] * q[0] + q[2] * q[2]), 2.0f * (q[1] * q[2] + q[3] * q[0]) },
+		{ 2.0f * (q[0] * q[2] + q[3] * q[1]), 2.0f * (q[1] * q[2] - q[3] * q[0]), 1.0f - 2.0f * (q[0] * q[0] + q[1] * q[1]) }
+	};
+	// Translate * rotate * scale, and its inverse transpose for the normals, column major
+	for (int col = 0; col < 3; ++col) {
+		for (int row = 0; row < 3; ++row) {
+			data.modelMatrix[4 * col + row] = rotation[col][row] * scale;
+			data.normalMatrix[3 * col + row] = rotation[col][row] / scale;
+		}
+		data.modelMatrix[4 * col + 3] = 0.0f;
+	}
+	data.modelMatrix[12] = instance.centerScale[0];
+	data.modelMatrix[13] = instance.centerScale[1];
+	data.modelMatrix[14] = instance.centerScale[2];
+	data.modelMatrix[15] = 1.0f;
+	data.diffuseLayer = diffuse.layer;
+	data.normalLayer = -1;
+	data.opacity = 1.0f;
+	for (int ii = 0; ii < 4; ++ii) {
+		data.diffuseRegion[ii] = diffuse.rect[ii];
+		data.normalRegion[ii] = ii < 2 ? 0.0f : 1.0f;
+	}
+}
+
+void GpuCuller::draw(const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix, const DrawMode drawMode, LightClusters* clusters)
+{
+	if (!renderable_ || instances_.isEmpty()) {
+		return;
+	}
+	QOpenGLTexture* diffuseMaps = diffuseMaps_ && diffuseMaps_->isCreated() ? diffuseMaps_->texture() : nullptr;
+	if (diffuseMaps) {
+		diffuseMaps->bind(0);
+	}
+
+	if (culledOnGpu_) {
+		renderable_->drawIndirect(commandBuffer_, commands_.size(), viewPosition, viewMatrix, projectionMatrix, drawMode, diffuseMaps, nullptr, lights_, clusters);
+	}
+	else {
+		for (int lod = 0; lod < lods_.size(); ++lod) {
+			renderable_->drawFaces(lodInstances_[lod], lods_[lod].firstFace, lods_[lod].faceCount, viewPosition, viewMatrix, projectionMatrix,
+				drawMode, diffuseMaps, nullptr, lights_, clusters);
+		}
+		// Those uploads replaced the GPU path's storage
+		visibleBytes_ = 0;
+	}
+
+	if (diffuseMaps) {
+		diffuseMaps->release(0);
+	}
+}
+
+int GpuCuller::visibleCount(int lod)
+{
+	if (!culledOnGpu_) {
+		return lodInstances_[lod].size();
+	}
+	GLuint count = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer_);
+	const Command* commands = static_cast<const Command*>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, commands_.size() * sizeof(Command), GL_MAP_READ_BIT));
+	if (commands) {
+		count = commands[lod].instanceCount;
+		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	return int(count);
+}
+
+QVector<InstanceData> GpuCuller::visibleInstances(int lod)
+{
+	if (!culledOnGpu_) {
+		return lodInstances_[lod];
+	}
+	QVector<InstanceData> survivors(visibleCount(lod));
+	if (survivors.isEmpty()) {
+		return survivors;
+	}
+	QOpenGLBuffer& visible = renderable_->instanceBuffer();
+	visible.bind();
+	const void* data = glMapBufferRange(GL_ARRAY_BUFFER, qint64(commands_[lod].baseInstance) * sizeof(InstanceData), qint64(survivors.size()) * sizeof(InstanceData), GL_MAP_READ_BIT);
+	if (data) {
+		memcpy(survivors.data(), data, survivors.size() * sizeof(InstanceData));
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	}
+	visible.release();
+	return survivors;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <QtCore>
+#include <QtGui>
+#include <QtOpenGL>
+#include "Frustum.h"
+#include "Renderable.h"
+#include "TextureArray.h"
+
+// Culls and draws tens of thousands of copies of one Renderable without the CPU touching
+// them each frame. The copies' placements live in a buffer on the GPU, and every frame a
+// compute shader (GpuCullComp.glsl) tests each one's bounding sphere against the frustum,
+// picks a level of detail by distance and writes the survivors into the renderable's
+// instance buffer, counting them into one DrawElementsIndirectCommand per level. A single
+// glMultiDrawElementsIndirect then draws every level; only uniforms go up.
+//
+// Each level has a range of capacity slots in the instance buffer, so it holds every copy
+// once per level. Compute shaders and multi-draw indirect need GL 4.3. On older contexts,
+// or with the GPU path turned off, the same test runs on the CPU, which uploads the
+// survivors and draws each level with its own instanced draw.
+class GpuCuller : protected QOpenGLExtraFunctions
+{
+public:
+	// Levels the shader has room for
+	static const int MAX_LODS = 4;
+	// Instances each compute work group tests; matches local_size_x in the shader
+	static const int GROUP_SIZE = 64;
+
+	// One copy, as stored in the buffer the shader reads
+	struct Instance {
+		float centerScale[4];	// Position, then uniform scale
+		float rotation[4];		// Unit quaternion: x, y, z, then w
+	};
+
+	// A level of detail: faces [firstFace, firstFace + faceCount) of the renderable, drawn
+	// for copies nearer than maxDistance. The last level takes everything farther.
+	struct Lod {
+		int firstFace;
+		int faceCount;
+		float maxDistance;
+	};
+
+	GpuCuller();
+	~GpuCuller();
+
+	// renderable holds every level in its faces, each within radius of the origin. It must
+	// outlive the culler and be drawn by nothing else, since its instance buffer is reused
+	// for the culled copies. Must be called with a current GL context.
+	void create(Renderable* renderable, const QVector<Lod>& lods, float radius);
+	// Free every GL object; the owning context must be current
+	void destroy();
+
+	// Replace every copy, uploading them once
+	void setInstances(const QVector<Instance>& instances);
+	inline int instanceCount() const { return instances_.size(); }
+
+	// Every copy samples one texture of maps, lit by lights
+	inline void setDiffuseTexture(TextureArray* maps, int texture) { diffuseMaps_ = maps; diffuseTexture_ = texture; }
+	inline void setLights(QVector<PointLight>* lights) { lights_ = lights; }
+	inline QVector<PointLight>* lights() const { return lights_; }
+
+	// Whether the context can cull on the GPU, and whether it's being used
+	inline bool gpuSupported() const { return gpuSupported_; }
+	inline bool gpuDriven() const { return gpuSupported_ && gpuDriven_; }
+	inline void setGpuDriven(bool enabled) { gpuDriven_ = enabled; }
+
+	// Cull against viewProjection's frustum and choose each survivor's level by its distance
+	// from viewPosition
+	void cull(const QMatrix4x4& viewProjection, const QVector3D& viewPosition);
+	// Draw what the last cull() kept: one multi-draw on the GPU path, one draw per level otherwise.
+	// The diffuse maps are bound to unit 0 for the draw.
+	void draw(const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix, const DrawMode drawMode, LightClusters* clusters = nullptr);
+
+	inline int lodCount() const { return lods_.size(); }
+	// Copies the last cull() kept at level lod, and what they were drawn with. On the GPU
+	// path these read the buffers back, stalling until the GPU catches up, so they're for
+	// stats and benchmarks only.
+	int visibleCount(int lod);
+	QVector<InstanceData> visibleInstances(int lod);
+	// CPU time the last cull() took: testing and writing the copies on the CPU path,
+	// issuing the compute pass on the GPU path
+	inline double cullMs() const { return cullMs_; }
+
+private:
+	// Same layout as the GL's DrawElementsIndirectCommand
+	struct Command {
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+	// Test every copy on the CPU into lodInstances_
+	void cullOnCpu(const Frustum& frustum, const QVector3D& viewPosition);
+	// The attributes the shader writes for instance, so both paths draw the same
+	static void expand(const Instance& instance, const TextureArray::Region& diffuse, InstanceData& data);
+	TextureArray::Region diffuseRegion() const;
+
+	Renderable* renderable_;
+	QVector<Lod> lods_;
+	float radius_;
+	QVector<Instance> instances_;
+	TextureArray* diffuseMaps_;
+	int diffuseTexture_;
+	QVector<PointLight>* lights_;
+
+	bool gpuSupported_;
+	bool gpuDriven_;
+	QOpenGLShaderProgram cull_;
+	GLuint instanceBuffer_;
+	GLuint commandBuffer_;
+	// Commands with every level empty, to reset the counts from each frame
+	QVector<Command> commands_;
+	// Size of the renderable's instance buffer as last allocated for the GPU path; the
+	// CPU path reallocates it, so it's 0 after a CPU draw
+	qint64 visibleBytes_;
+	// Whether the last cull() ran on the GPU
+	bool culledOnGpu_;
+
+	QVector<InstanceData> lodInstances_[MAX_LODS];
+	double cullMs_;
+};
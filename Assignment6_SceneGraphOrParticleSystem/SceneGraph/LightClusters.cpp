@@ -0,0 +1,315 @@
+#include "LightClusters.h"
+
+#include <cfloat>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LIGHT_CLUSTERS_SSE
+#endif
+
+// A light stops being assigned where it would add less than this to a color channel
+static const float LIGHT_CUTOFF = 1.0f / 256.0f;
+// Depth slices are exponential from here; everything closer goes in the first slice
+static const float MIN_SLICE_DEPTH = 0.1f;
+
+LightClusters::LightClusters() : lights_(nullptr), near_(0.0f), far_(0.0f), depthScale_(0.0f), depthBias_(0.0f),
+	created_(false), assignMs_(0.0)
+{
+	for (int t = 0; t < TEXTURE_UNITS; ++t) {
+		buffers_[t] = 0;
+		textures_[t] = 0;
+	}
+}
+
+LightClusters::~LightClusters()
+{
+	destroy();
+}
+
+void LightClusters::destroy()
+{
+	if (!created_) {
+		return;
+	}
+	glDeleteTextures(TEXTURE_UNITS, textures_);
+	glDeleteBuffers(TEXTURE_UNITS, buffers_);
+	created_ = false;
+}
+
+float LightClusters::lightRadius(const PointLight& light)
+{
+	// Brightest this light can make a surface before attenuation
+	const float maxColor = qMax(light.color.x(), qMax(light.color.y(), light.color.z()));
+	const float intensity = maxColor * (light.ambientIntensity + 1.0f + light.specularIntensity);
+	// Solve constant + linear * d + quadratic * d^2 = intensity / cutoff for d
+	const float k = intensity / LIGHT_CUTOFF;
+	if (light.constant >= k) {
+		return 0.0f;
+	}
+	if (light.quadratic > 0.0f) {
+		const float discriminant = light.linear * light.linear - 4.0f * light.quadratic * (light.constant - k);
+		return (-light.linear + std::sqrt(discriminant)) / (2.0f * light.quadratic);
+	}
+	if (light.linear > 0.0f) {
+		return (k - light.constant) / light.linear;
+	}
+	// No falloff, so it reaches everything
+	return FLT_MAX;
+}
+
+void LightClusters::buildClusterBounds(const QMatrix4x4& projectionMatrix)
+{
+	projection_ = projectionMatrix;
+	const float p00 = projectionMatrix(0, 0);
+	const float p11 = projectionMatrix(1, 1);
+	const float p22 = projectionMatrix(2, 2);
+	const float p23 = projectionMatrix(2, 3);
+	near_ = p23 / (p22 - 1.0f);
+	far_ = p23 / (p22 + 1.0f);
+
+	const float sliceNear = qMin(qMax(near_, MIN_SLICE_DEPTH), far_ * 0.5f);
+	const float logRange = std::log(far_ / sliceNear);
+	depthScale_ = SLICES / logRange;
+	depthBias_ = -SLICES * std::log(sliceNear) / logRange;
+
+	minX_.resize(CLUSTER_COUNT);
+	maxX_.resize(CLUSTER_COUNT);
+	minY_.resize(CLUSTER_COUNT);
+	maxY_.resize(CLUSTER_COUNT);
+	minZ_.resize(CLUSTER_COUNT);
+	maxZ_.resize(CLUSTER_COUNT);
+
+	for (int k = 0; k < SLICES; ++k) {
+		const float depthNear = k == 0 ? near_ : std::exp((k - depthBias_) / depthScale_);
+		const float depthFar = k == SLICES - 1 ? far_ : std::exp((k + 1 - depthBias_) / depthScale_);
+		for (int j = 0; j < TILES_Y; ++j) {
+			const float y0 = -1.0f + 2.0f * j / TILES_Y;
+			const float y1 = -1.0f + 2.0f * (j + 1) / TILES_Y;
+			for (int i = 0; i < TILES_X; ++i) {
+				const float x0 = -1.0f + 2.0f * i / TILES_X;
+				const float x1 = -1.0f + 2.0f * (i + 1) / TILES_X;
+				// The tile's side planes pass through the eye, so its view space extent
+				// at either end of the slice bounds the whole cluster
+				const int c = i + TILES_X * (j + TILES_Y * k);
+				minX_[c] = qMin(x0 * depthNear, x0 * depthFar) / p00;
+				maxX_[c] = qMax(x1 * depthNear, x1 * depthFar) / p00;
+				minY_[c] = qMin(y0 * depthNear, y0 * depthFar) / p11;
+				maxY_[c] = qMax(y1 * depthNear, y1 * depthFar) / p11;
+				minZ_[c] = -depthFar;
+				maxZ_[c] = -depthNear;
+			}
+		}
+	}
+}
+
+void LightClusters::assignLights(const QMatrix4x4& viewMatrix)
+{
+	pairClusters_.resize(0);
+	pairLights_.resize(0);
+
+	const float p00 = projection_(0, 0);
+	const float p11 = projection_(1, 1);
+	auto sliceFor = [&](float depth) -> int
+	{
+		return qBound(0, int(std::floor(std::log(depth) * depthScale_ + depthBias_)), SLICES - 1);
+	};
+	auto tileFor = [](float ndc, int tiles) -> int
+	{
+		// Clamp as a float first, since unbounded lights give infinite coordinates
+		return int(qBound(0.0f, (ndc + 1.0f) * 0.5f * tiles, float(tiles - 1)));
+	};
+
+	const int lightCount = lights_->size();
+	for (int li = 0; li < lightCount; ++li) {
+		const PointLight& light = (*lights_)[li];
+		const float r = lightRadius(light);
+		const QVector3D c = viewMatrix.map(light.position);
+		const float depth = -c.z();
+		if (r <= 0.0f || depth + r < near_ || depth - r > far_) {
+			continue;
+		}
+
+		// Depth slices the sphere spans
+		const float depthMin = qMax(depth - r, near_);
+		const float depthMax = qMin(depth + r, far_);
+		const int k0 = sliceFor(depthMin);
+		const int k1 = sliceFor(depthMax);
+
+		// Screen tiles it covers. x / depth is extreme at the nearest or farthest depth.
+		const int i0 = tileFor(p00 * qMin((c.x() - r) / depthMin, (c.x() - r) / depthMax), TILES_X);
+		const int i1 = tileFor(p00 * qMax((c.x() + r) / depthMin, (c.x() + r) / depthMax), TILES_X);
+		const int j0 = tileFor(p11 * qMin((c.y() - r) / depthMin, (c.y() - r) / depthMax), TILES_Y);
+		const int j1 = tileFor(p11 * qMax((c.y() + r) / depthMin, (c.y() + r) / depthMax), TILES_Y);
+
+		// Then an exact sphere vs. cluster box test for the candidates
+		const float r2 = r < FLT_MAX ? r * r : FLT_MAX;
+#ifdef LIGHT_CLUSTERS_SSE
+		const __m128 cx = _mm_set1_ps(c.x());
+		const __m128 cy = _mm_set1_ps(c.y());
+		const __m128 cz = _mm_set1_ps(c.z());
+		const __m128 radius2 = _mm_set1_ps(r2);
+		const __m128 zero = _mm_setzero_ps();
+#endif
+		for (int k = k0; k <= k1; ++k) {
+			for (int j = j0; j <= j1; ++j) {
+				const int row = TILES_X * (j + TILES_Y * k);
+#ifdef LIGHT_CLUSTERS_SSE
+				// Four neighbouring clusters per test. TILES_X is a multiple of 4, so
+				// aligning i down never leaves the row; lanes outside [i0, i1] are masked.
+				for (int i = i0 & ~3; i <= i1; i += 4) {
+					const int base = row + i;
+					__m128 dx = _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minX_[base]), cx), _mm_sub_ps(cx, _mm_loadu_ps(&maxX_[base])));
+					__m128 dy = _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minY_[base]), cy), _mm_sub_ps(cy, _mm_loadu_ps(&maxY_[base])));
+					__m128 dz = _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minZ_[base]), cz), _mm_sub_ps(cz, _mm_loadu_ps(&maxZ_[base])));
+					dx = _mm_max_ps(dx, zero);
+					dy = _mm_max_ps(dy, zero);
+					dz = _mm_max_ps(dz, zero);
+					const __m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+					const int hits = _mm_movemask_ps(_mm_cmple_ps(distance2, radius2));
+					for (int lane = 0; lane < 4; ++lane) {
+						const int ii = i + lane;
+						if ((hits & (1 << lane)) && ii >= i0 && ii <= i1) {
+							pairClusters_ << quint32(row + ii);
+							pairLights_ << quint32(li);
+						}
+					}
+				}
+#else
+				for (int i = i0; i <= i1; ++i) {
+					const int cluster = row + i;
+					const float dx = qMax(0.0f, qMax(minX_[cluster] - c.x(), c.x() - maxX_[cluster]));
+					const float dy = qMax(0.0f, qMax(minY_[cluster] - c.y(), c.y() - maxY_[cluster]));
+					const float dz = qMax(0.0f, qMax(minZ_[cluster] - c.z(), c.z() - maxZ_[cluster]));
+					if (dx * dx + dy * dy + dz * dz <= r2) {
+						pairClusters_ << quint32(cluster);
+						pairLights_ << quint32(li);
+					}
+				}
+#endif
+			}
+		}
+	}
+
+	// Counting sort the pairs into one contiguous light list per cluster
+	clusterRanges_.fill(0, CLUSTER_COUNT * 2);
+	for (quint32 cluster : pairClusters_) {
+		++clusterRanges_[cluster * 2 + 1];
+	}
+	clusterCursors_.resize(CLUSTER_COUNT);
+	quint32 offset = 0;
+	for (int cluster = 0; cluster < CLUSTER_COUNT; ++cluster) {
+		clusterRanges_[cluster * 2] = offset;
+		clusterCursors_[cluster] = offset;
+		offset += clusterRanges_[cluster * 2 + 1];
+	}
+	lightIndices_.resize(pairClusters_.size());
+	for (int p = 0; p < pairClusters_.size(); ++p) {
+		lightIndices_[clusterCursors_[pairClusters_[p]]++] = pairLights_[p];
+	}
+
+	// Light parameters, 3 texels each
+	lightData_.resize(lightCount * 12);
+	float* data = lightData_.data();
+	for (int li = 0; li < lightCount; ++li, data += 12) {
+		const PointLight& light = (*lights_)[li];
+		const float r = lightRadius(light);
+		data[0] = light.position.x();
+		data[1] = light.position.y();
+		data[2] = light.position.z();
+		data[3] = r < FLT_MAX ? r : 1e30f;
+		data[4] = light.color.x();
+		data[5] = light.color.y();
+		data[6] = light.color.z();
+		data[7] = light.ambientIntensity;
+		data[8] = light.specularIntensity;
+		data[9] = light.constant;
+		data[10] = light.linear;
+		data[11] = light.quadratic;
+	}
+}
+
+void LightClusters::upload()
+{
+	if (!created_) {
+		initializeOpenGLFunctions();
+		glGenBuffers(TEXTURE_UNITS, buffers_);
+		glGenTextures(TEXTURE_UNITS, textures_);
+		const GLenum formats[TEXTURE_UNITS] = { GL_RG32UI, GL_R32UI, GL_RGBA32F };
+		for (int t = 0; t < TEXTURE_UNITS; ++t) {
+			glBindBuffer(GL_TEXTURE_BUFFER, buffers_[t]);
+			glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+			glBindTexture(GL_TEXTURE_BUFFER, textures_[t]);
+			glTexBuffer(GL_TEXTURE_BUFFER, formats[t], buffers_[t]);
+		}
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+		created_ = true;
+	}
+
+	// Re-specifying the store orphans last frame's, so we never wait on the GPU
+	const void* data[TEXTURE_UNITS] = { clusterRanges_.constData(), lightIndices_.constData(), lightData_.constData() };
+	const int sizes[TEXTURE_UNITS] = {
+		int(clusterRanges_.size() * sizeof(quint32)),
+		int(lightIndices_.size() * sizeof(quint32)),
+		int(lightData_.size() * sizeof(float))
+	};
+	for (int t = 0; t < TEXTURE_UNITS; ++t) {
+		glBindBuffer(GL_TEXTURE_BUFFER, buffers_[t]);
+		if (sizes[t] > 0) {
+			glBufferData(GL_TEXTURE_BUFFER, sizes[t], data[t], GL_STREAM_DRAW);
+		}
+		else {
+			// Keep a valid store; nothing will index into it
+			glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+		}
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightClusters::update(const QVector<PointLight>* lights, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix, const QSize& viewportPixels)
+{
+	QElapsedTimer timer;
+	timer.start();
+
+	lights_ = lights;
+	viewport_ = viewportPixels;
+	if (projectionMatrix != projection_ || minX_.isEmpty()) {
+		buildClusterBounds(projectionMatrix);
+	}
+
+	if (lights_) {
+		assignLights(viewMatrix);
+	}
+	else {
+		clusterRanges_.fill(0, CLUSTER_COUNT * 2);
+		lightIndices_.resize(0);
+		lightData_.resize(0);
+	}
+	assignMs_ = timer.nsecsElapsed() / 1e6;
+
+	upload();
+}
+
+void LightClusters::bind(QOpenGLShaderProgram* shader, int firstUnit)
+{
+	for (int t = 0; t < TEXTURE_UNITS; ++t) {
+		glActiveTexture(GL_TEXTURE0 + firstUnit + t);
+		glBindTexture(GL_TEXTURE_BUFFER, textures_[t]);
+	}
+	glActiveTexture(GL_TEXTURE0);
+
+	shader->setUniformValue("clusterRanges", firstUnit);
+	shader->setUniformValue("clusterLightIndices", firstUnit + 1);
+	shader->setUniformValue("clusterLights", firstUnit + 2);
+	shader->setUniformValue("clusterTileScale", QVector2D(float(TILES_X) / qMax(viewport_.width(), 1), float(TILES_Y) / qMax(viewport_.height(), 1)));
+	shader->setUniformValue("clusterDepthScaleBias", QVector2D(depthScale_, depthBias_));
+}
+
+void LightClusters::release(int firstUnit)
+{
+	for (int t = 0; t < TEXTURE_UNITS; ++t) {
+		glActiveTexture(GL_TEXTURE0 + firstUnit + t);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
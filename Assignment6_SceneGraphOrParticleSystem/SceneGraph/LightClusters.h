@@ -0,0 +1,81 @@
+#pragma once
+
+#include <QtCore>
+#include <QtGui>
+#include <QtOpenGL>
+#include <QOpenGLFunctions_3_3_Core>
+#include "Structs.h"
+
+// Clustered forward lighting. The view frustum is split into a grid of clusters
+// (screen tiles by exponential depth slices), every light is assigned to the
+// clusters its sphere of influence touches, and the per-cluster light lists are
+// uploaded as buffer textures. Each fragment then only shades the lights of its
+// own cluster, so cost follows local light density rather than total light count.
+class LightClusters : protected QOpenGLFunctions_3_3_Core
+{
+public:
+	static const int TILES_X = 16;
+	static const int TILES_Y = 9;
+	static const int SLICES = 24;
+	static const int CLUSTER_COUNT = TILES_X * TILES_Y * SLICES;
+	// Texture units used by bind(), starting at firstUnit
+	static const int TEXTURE_UNITS = 3;
+
+	LightClusters();
+	~LightClusters();
+
+	// Assign lights to clusters for this camera and upload the lists. The projection
+	// must be a symmetric perspective. Needs a current context.
+	void update(const QVector<PointLight>* lights, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix, const QSize& viewportPixels);
+
+	// True if these clusters were built from this light list
+	inline bool covers(const QVector<PointLight>* lights) const { return lights && lights == lights_; }
+
+	// Bind the cluster textures to firstUnit onwards and set the shader's cluster uniforms
+	void bind(QOpenGLShaderProgram* shader, int firstUnit);
+	void release(int firstUnit);
+
+	// Stats from the last update()
+	inline int lightCount() const { return lights_ ? lights_->size() : 0; }
+	inline int lightReferences() const { return lightIndices_.size(); }
+	inline double assignMs() const { return assignMs_; }
+
+	// Distance at which a light's contribution falls below visibility
+	static float lightRadius(const PointLight& light);
+
+private:
+	void buildClusterBounds(const QMatrix4x4& projectionMatrix);
+	void assignLights(const QMatrix4x4& viewMatrix);
+	void upload();
+	void destroy();
+
+	const QVector<PointLight>* lights_;
+
+	// Projection the cluster bounds were built for
+	QMatrix4x4 projection_;
+	float near_;
+	float far_;
+	// Slice k starts at depth exp((k - depthBias_) / depthScale_)
+	float depthScale_;
+	float depthBias_;
+	QSize viewport_;
+
+	// View space bounds of every cluster, as separate arrays so four neighbouring
+	// clusters can be tested against a light at once. x runs fastest, then y, then slice.
+	QVector<float> minX_, maxX_, minY_, maxY_, minZ_, maxZ_;
+
+	// (cluster, light) pairs found this frame, then counting-sorted into per-cluster lists
+	QVector<quint32> pairClusters_;
+	QVector<quint32> pairLights_;
+	QVector<quint32> clusterRanges_;	// (offset, count) per cluster
+	QVector<quint32> clusterCursors_;
+	QVector<quint32> lightIndices_;
+	QVector<float> lightData_;			// 3 RGBA texels per light
+
+	// GL buffer textures: cluster ranges, light indices, light data
+	GLuint buffers_[TEXTURE_UNITS];
+	GLuint textures_[TEXTURE_UNITS];
+	bool created_;
+
+	double assignMs_;
+};
@@ -0,0 +1,377 @@
+#include "OcclusionCuller.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUSION_CULLER_SSE
+#endif
+
+#ifdef OCCLUSION_CULLER_SSE
+static inline float horizontalMin(__m128 v)
+{
+	v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtss_f32(v);
+}
+
+static inline float horizontalMax(__m128 v)
+{
+	v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtss_f32(v);
+}
+#endif
+
+OccluderMesh::OccluderMesh() {}
+
+OccluderMesh::OccluderMesh(const QVector<Vertex>& vertices, const QVector<Face>& faces) : faces(faces)
+{
+	positions.reserve(vertices.size());
+	for (const Vertex& vertex : vertices) {
+		positions << QVector3D(vertex.position.x, vertex.position.y, vertex.position.z);
+	}
+}
+
+OcclusionCuller::OcclusionCuller() : trianglesDrawn_(0), rasterMs_(0.0), testedCount_(0), occludedCount_(0), testMs_(0.0)
+{
+	for (int level = 0; level < LEVELS; ++level) {
+		levels_[level].assign((WIDTH >> level) * (HEIGHT >> level), 1.0f);
+	}
+}
+
+void OcclusionCuller::begin(const QMatrix4x4& viewProjection)
+{
+	viewProjection_ = viewProjection;
+	occluders_.resize(0);
+	std::fill(levels_[0].begin(), levels_[0].end(), 1.0f);
+}
+
+void OcclusionCuller::addOccluder(const OccluderMesh* mesh, const QMatrix4x4& toWorld)
+{
+	Occluder occluder;
+	occluder.mesh = mesh;
+	occluder.toClip = viewProjection_ * toWorld;
+	occluder.firstTriangle = 0;
+	occluders_ << occluder;
+}
+
+void OcclusionCuller::rasterize(TaskPool* pool)
+{
+	QElapsedTimer timer;
+	timer.start();
+
+	int triangleCount = 0;
+	for (Occluder& occluder : occluders_) {
+		occluder.firstTriangle = triangleCount;
+		triangleCount += occluder.mesh->faces.size();
+	}
+	triangles_.resize(triangleCount);
+
+	if (pool && pool->threadCount() > 1) {
+		// Every occluder writes its own range of triangles, then every band its own rows
+		TaskGroup setupGroup;
+		const int chunk = qMax(1, occluders_.size() / (4 * pool->threadCount()));
+		for (int begin = 0; begin < occluders_.size(); begin += chunk) {
+			const int end = qMin(begin + chunk, occluders_.size());
+			pool->run(setupGroup, [this, begin, end]() {
+				for (int i = begin; i < end; ++i) {
+					setup(occluders_.at(i));
+				}
+			});
+		}
+		pool->wait(setupGroup);
+
+		TaskGroup bandGroup;
+		for (int row = 0; row < HEIGHT; row += BAND_ROWS) {
+			pool->run(bandGroup, [this, row]() { rasterizeRows(row, row + BAND_ROWS); });
+		}
+		pool->wait(bandGroup);
+	}
+	else {
+		for (const Occluder& occluder : occluders_) {
+			setup(occluder);
+		}
+		rasterizeRows(0, HEIGHT);
+	}
+
+	trianglesDrawn_ = 0;
+	for (const ScreenTriangle& triangle : triangles_) {
+		trianglesDrawn_ += triangle.rowBegin < triangle.rowEnd ? 1 : 0;
+	}
+	buildPyramid();
+	rasterMs_ = timer.nsecsElapsed() / 1e6;
+}
+
+void OcclusionCuller::setup(const Occluder& occluder)
+{
+	const OccluderMesh& mesh = *occluder.mesh;
+	const QMatrix4x4& m = occluder.toClip;
+
+	// Clip-space corners, four floats each
+	std::vector<float> clip(mesh.positions.size() * 4);
+#ifdef OCCLUSION_CULLER_SSE
+	const __m128 column0 = _mm_setr_ps(m(0, 0), m(1, 0), m(2, 0), m(3, 0));
+	const __m128 column1 = _mm_setr_ps(m(0, 1), m(1, 1), m(2, 1), m(3, 1));
+	const __m128 column2 = _mm_setr_ps(m(0, 2), m(1, 2), m(2, 2), m(3, 2));
+	const __m128 column3 = _mm_setr_ps(m(0, 3), m(1, 3), m(2, 3), m(3, 3));
+	for (int ii = 0; ii < mesh.positions.size(); ++ii) {
+		const QVector3D& p = mesh.positions[ii];
+		const __m128 position = _mm_add_ps(_mm_add_ps(_mm_mul_ps(column0, _mm_set1_ps(p.x())), _mm_mul_ps(column1, _mm_set1_ps(p.y()))),
+			_mm_add_ps(_mm_mul_ps(column2, _mm_set1_ps(p.z())), column3));
+		_mm_storeu_ps(&clip[ii * 4], position);
+	}
+#else
+	for (int ii = 0; ii < mesh.positions.size(); ++ii) {
+		const QVector3D& p = mesh.positions[ii];
+		for (int row = 0; row < 4; ++row) {
+			clip[ii * 4 + row] = m(row, 0) * p.x() + m(row, 1) * p.y() + m(row, 2) * p.z() + m(row, 3);
+		}
+	}
+#endif
+
+	for (int f = 0; f < mesh.faces.size(); ++f) {
+		ScreenTriangle& triangle = triangles_[occluder.firstTriangle + f];
+		triangle.rowBegin = triangle.rowEnd = 0;
+
+		float x[3], y[3], z[3];
+		bool drawn = true;
+		for (int k = 0; k < 3; ++k) {
+			const float* p = &clip[mesh.faces[f][k] * 4];
+			// Triangles reaching in front of the near plane are left out rather than
+			// clipped; drawing less can only cull less
+			if (p[2] < -p[3]) {
+				drawn = false;
+				break;
+			}
+			const float inverseW = 1.0f / p[3];
+			x[k] = (p[0] * inverseW * 0.5f + 0.5f) * WIDTH;
+			y[k] = (0.5f - p[1] * inverseW * 0.5f) * HEIGHT;
+			z[k] = p[2] * inverseW;
+		}
+		if (!drawn) {
+			continue;
+		}
+
+		// Sort the corners top to bottom
+		int order[3] = { 0, 1, 2 };
+		if (y[order[1]] < y[order[0]]) std::swap(order[0], order[1]);
+		if (y[order[2]] < y[order[1]]) std::swap(order[1], order[2]);
+		if (y[order[1]] < y[order[0]]) std::swap(order[0], order[1]);
+		for (int k = 0; k < 3; ++k) {
+			triangle.x[k] = x[order[k]];
+			triangle.y[k] = y[order[k]];
+		}
+		const float* tx = triangle.x;
+		const float* ty = triangle.y;
+
+		if (qMax(tx[0], qMax(tx[1], tx[2])) < 0.0f || qMin(tx[0], qMin(tx[1], tx[2])) > WIDTH || qMin(z[0], qMin(z[1], z[2])) > 1.0f) {
+			continue;
+		}
+		const float e1x = x[1] - x[0], e1y = y[1] - y[0], e1z = z[1] - z[0];
+		const float e2x = x[2] - x[0], e2y = y[2] - y[0], e2z = z[2] - z[0];
+		const float area = e1x * e2y - e1y * e2x;
+		if (area == 0.0f) {
+			continue;
+		}
+		triangle.dzdx = (e1z * e2y - e2z * e1y) / area;
+		triangle.dzdy = (e1x * e2z - e2x * e1z) / area;
+		triangle.z0 = z[0] - triangle.dzdx * x[0] - triangle.dzdy * y[0];
+
+		const float dy02 = ty[2] - ty[0], dy01 = ty[1] - ty[0], dy12 = ty[2] - ty[1];
+		triangle.dxdy[0] = dy02 > 0.0f ? (tx[2] - tx[0]) / dy02 : 0.0f;
+		triangle.dxdy[1] = dy01 > 0.0f ? (tx[1] - tx[0]) / dy01 : 0.0f;
+		triangle.dxdy[2] = dy12 > 0.0f ? (tx[2] - tx[1]) / dy12 : 0.0f;
+
+		// Rows whose centre lies in [top, bottom)
+		triangle.rowBegin = int(std::ceil(qBound(0.0f, ty[0] - 0.5f, float(HEIGHT))));
+		triangle.rowEnd = int(std::ceil(qBound(0.0f, ty[2] - 0.5f, float(HEIGHT))));
+	}
+}
+
+void OcclusionCuller::rasterizeRows(int rowBegin, int rowEnd)
+{
+	float* depth = levels_[0].data();
+#ifdef OCCLUSION_CULLER_SSE
+	const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	const __m128 empty = _mm_set1_ps(INFINITY);
+#endif
+	for (const ScreenTriangle& triangle : triangles_) {
+		const int first = qMax(triangle.rowBegin, rowBegin);
+		const int last = qMin(triangle.rowEnd, rowEnd);
+		for (int row = first; row < last; ++row) {
+			// Scan convert: where the row's centre crosses the long edge and the short one
+			const float yc = row + 0.5f;
+			const float xLong = triangle.x[0] + (yc - triangle.y[0]) * triangle.dxdy[0];
+			const float xShort = yc < triangle.y[1] ? triangle.x[0] + (yc - triangle.y[0]) * triangle.dxdy[1] :
+				triangle.x[1] + (yc - triangle.y[1]) * triangle.dxdy[2];
+			// Columns whose centre lies in [left, right)
+			const int colBegin = int(std::ceil(qBound(0.0f, qMin(xLong, xShort) - 0.5f, float(WIDTH))));
+			const int colEnd = int(std::ceil(qBound(0.0f, qMax(xLong, xShort) - 0.5f, float(WIDTH))));
+			if (colBegin >= colEnd) {
+				continue;
+			}
+
+			float* line = depth + row * WIDTH;
+			// Depth at the centre of column 0, going up by dzdx per column
+			const float rowStart = triangle.z0 + triangle.dzdy * yc + triangle.dzdx * 0.5f;
+#ifdef OCCLUSION_CULLER_SSE
+			// Four columns at a time. WIDTH is a multiple of 4, so aligning colBegin down never
+			// leaves the row; columns outside the span keep their depth.
+			const __m128 start = _mm_set1_ps(rowStart);
+			const __m128 step = _mm_set1_ps(triangle.dzdx);
+			const __m128 spanBegin = _mm_set1_ps(float(colBegin));
+			const __m128 spanEnd = _mm_set1_ps(float(colEnd));
+			for (int col = colBegin & ~3; col < colEnd; col += 4) {
+				const __m128 cols = _mm_add_ps(_mm_set1_ps(float(col)), lanes);
+				const __m128 inside = _mm_and_ps(_mm_cmpge_ps(cols, spanBegin), _mm_cmplt_ps(cols, spanEnd));
+				__m128 z = _mm_add_ps(start, _mm_mul_ps(step, cols));
+				z = _mm_or_ps(_mm_and_ps(inside, z), _mm_andnot_ps(inside, empty));
+				_mm_storeu_ps(line + col, _mm_min_ps(_mm_loadu_ps(line + col), z));
+			}
+#else
+			for (int col = colBegin; col < colEnd; ++col) {
+				line[col] = qMin(line[col], rowStart + triangle.dzdx * float(col));
+			}
+#endif
+		}
+	}
+}
+
+void OcclusionCuller::buildPyramid()
+{
+	for (int level = 1; level < LEVELS; ++level) {
+		const float* source = levels_[level - 1].data();
+		float* target = levels_[level].data();
+		const int width = WIDTH >> level;
+		const int height = HEIGHT >> level;
+		const int sourceWidth = width * 2;
+		for (int y = 0; y < height; ++y) {
+			const float* above = source + 2 * y * sourceWidth;
+			const float* below = above + sourceWidth;
+			float* out = target + y * width;
+			int x = 0;
+#ifdef OCCLUSION_CULLER_SSE
+			// Four texels from eight columns of two rows
+			for (; x + 4 <= width; x += 4) {
+				const __m128 left = _mm_max_ps(_mm_loadu_ps(above + 2 * x), _mm_loadu_ps(below + 2 * x));
+				const __m128 right = _mm_max_ps(_mm_loadu_ps(above + 2 * x + 4), _mm_loadu_ps(below + 2 * x + 4));
+				_mm_storeu_ps(out + x, _mm_max_ps(_mm_shuffle_ps(left, right, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(left, right, _MM_SHUFFLE(3, 1, 3, 1))));
+			}
+#endif
+			for (; x < width; ++x) {
+				out[x] = qMax(qMax(above[2 * x], above[2 * x + 1]), qMax(below[2 * x], below[2 * x + 1]));
+			}
+		}
+	}
+}
+
+bool OcclusionCuller::isOccluded(const BoundingBox& box) const
+{
+	if (box.isEmpty()) {
+		return false;
+	}
+	const QMatrix4x4& m = viewProjection_;
+
+	// The box's corners on screen: their extent, and the nearest depth of any
+	float minX, maxX, minY, maxY, minZ;
+#ifdef OCCLUSION_CULLER_SSE
+	// Four corners per pass, one face of the box at a time
+	const __m128 xs = _mm_setr_ps(box.min.x(), box.max.x(), box.min.x(), box.max.x());
+	const __m128 ys = _mm_setr_ps(box.min.y(), box.min.y(), box.max.y(), box.max.y());
+	__m128 lowX = _mm_set1_ps(INFINITY), lowY = lowX, lowZ = lowX;
+	__m128 highX = _mm_set1_ps(-INFINITY), highY = highX;
+	for (int face = 0; face < 2; ++face) {
+		const __m128 zs = _mm_set1_ps(face ? box.max.z() : box.min.z());
+		__m128 clip[4];
+		for (int row = 0; row < 4; ++row) {
+			clip[row] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m(row, 0)), xs), _mm_mul_ps(_mm_set1_ps(m(row, 1)), ys)),
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m(row, 2)), zs), _mm_set1_ps(m(row, 3))));
+		}
+		// A corner in front of the near plane means the camera may be inside the box
+		if (_mm_movemask_ps(_mm_cmplt_ps(clip[2], _mm_sub_ps(_mm_setzero_ps(), clip[3])))) {
+			return false;
+		}
+		const __m128 inverseW = _mm_div_ps(_mm_set1_ps(1.0f), clip[3]);
+		const __m128 x = _mm_mul_ps(clip[0], inverseW);
+		const __m128 y = _mm_mul_ps(clip[1], inverseW);
+		lowX = _mm_min_ps(lowX, x);
+		highX = _mm_max_ps(highX, x);
+		lowY = _mm_min_ps(lowY, y);
+		highY = _mm_max_ps(highY, y);
+		lowZ = _mm_min_ps(lowZ, _mm_mul_ps(clip[2], inverseW));
+	}
+	minX = horizontalMin(lowX);
+	maxX = horizontalMax(highX);
+	minY = horizontalMin(lowY);
+	maxY = horizontalMax(highY);
+	minZ = horizontalMin(lowZ);
+#else
+	minX = minY = minZ = INFINITY;
+	maxX = maxY = -INFINITY;
+	for (int corner = 0; corner < 8; ++corner) {
+		const QVector3D p((corner & 1) ? box.max.x() : box.min.x(), (corner & 2) ? box.max.y() : box.min.y(), (corner & 4) ? box.max.z() : box.min.z());
+		float clip[4];
+		for (int row = 0; row < 4; ++row) {
+			clip[row] = m(row, 0) * p.x() + m(row, 1) * p.y() + m(row, 2) * p.z() + m(row, 3);
+		}
+		if (clip[2] < -clip[3]) {
+			return false;
+		}
+		const float inverseW = 1.0f / clip[3];
+		minX = qMin(minX, clip[0] * inverseW);
+		maxX = qMax(maxX, clip[0] * inverseW);
+		minY = qMin(minY, clip[1] * inverseW);
+		maxY = qMax(maxY, clip[1] * inverseW);
+		minZ = qMin(minZ, clip[2] * inverseW);
+	}
+#endif
+	// Off screen is the frustum culler's business
+	if (maxX < -1.0f || minX > 1.0f || maxY < -1.0f || minY > 1.0f || minZ > 1.0f) {
+		return false;
+	}
+
+	// Pixels the box touches and one more all round, since an occluder's edge can leave part
+	// of a pixel open whose centre it covers. Then the finest level where they fit in 2x2 texels.
+	const int x0 = qMax(int((qMax(minX, -1.0f) * 0.5f + 0.5f) * WIDTH) - 1, 0);
+	const int x1 = qMin(int((qMin(maxX, 1.0f) * 0.5f + 0.5f) * WIDTH) + 1, WIDTH - 1);
+	const int y0 = qMax(int((0.5f - qMin(maxY, 1.0f) * 0.5f) * HEIGHT) - 1, 0);
+	const int y1 = qMin(int((0.5f - qMax(minY, -1.0f) * 0.5f) * HEIGHT) + 1, HEIGHT - 1);
+	int level = 0;
+	while (level < LEVELS - 1 && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1)) {
+		++level;
+	}
+
+	const float* texels = levels_[level].data();
+	const int width = WIDTH >> level;
+	for (int y = y0 >> level; y <= y1 >> level; ++y) {
+		for (int x = x0 >> level; x <= x1 >> level; ++x) {
+			if (texels[y * width + x] >= minZ) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void OcclusionCuller::cull(const TransformHierarchy& hierarchy, QVector<int>& visible)
+{
+	QElapsedTimer timer;
+	timer.start();
+	testedCount_ = visible.size();
+	int kept = 0;
+	if (trianglesDrawn_ == 0) {
+		kept = visible.size();
+	}
+	else {
+		for (int ii = 0; ii < visible.size(); ++ii) {
+			if (!isOccluded(hierarchy.ownBounds(visible[ii]))) {
+				visible[kept++] = visible[ii];
+			}
+		}
+	}
+	occludedCount_ = testedCount_ - kept;
+	visible.resize(kept);
+	testMs_ = timer.nsecsElapsed() / 1e6;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <QtCore>
+#include <QtGui>
+#include <vector>
+#include "Bounds.h"
+#include "Structs.h"
+#include "TaskPool.h"
+#include "TransformHierarchy.h"
+
+// Simplified stand-in for a mesh, drawn only into the occlusion depth buffer. It has to
+// lie inside the mesh it stands in for, or it could hide things that are really visible.
+struct OccluderMesh {
+	QVector<QVector3D> positions;
+	QVector<Face> faces;
+
+	OccluderMesh();
+	// Just the positions of a mesh's vertices, with its faces as they are
+	OccluderMesh(const QVector<Vertex>& vertices, const QVector<Face>& faces);
+};
+
+// Occlusion culling against a small depth buffer drawn on the CPU. Every frame the
+// occluders are rasterized, depth only, at low resolution: like Lab 4's ScanBuffer each
+// triangle is scan converted into one span per row, and spans are filled four pixels at
+// a time. The rows are split into bands that threads fill independently. The depth buffer
+// is then reduced into a pyramid holding the farthest depth under each texel, and an
+// object is culled when every texel under its screen rectangle is nearer than the nearest
+// corner of its bounding box.
+//
+// Depth is only sampled at pixel centres, so an occluder covering a centre hides the
+// whole low-resolution pixel; occluders being smaller than what they stand for keeps
+// that from showing.
+class OcclusionCuller
+{
+public:
+	// Depth buffer size. The whole viewport is squeezed into it whatever its aspect ratio.
+	static const int WIDTH = 256;
+	static const int HEIGHT = 128;
+	// Levels of the pyramid, down to 2x1
+	static const int LEVELS = 8;
+	// Rows each rasterizing task fills
+	static const int BAND_ROWS = 8;
+
+	OcclusionCuller();
+
+	// Clear the depth buffer and forget last frame's occluders
+	void begin(const QMatrix4x4& viewProjection);
+	// Draw mesh, placed in the world by toWorld, this frame. It must outlive rasterize().
+	void addOccluder(const OccluderMesh* mesh, const QMatrix4x4& toWorld);
+	// Rasterize the occluders and build the pyramid, on pool's threads when given one.
+	// The depth buffer comes out the same either way.
+	void rasterize(TaskPool* pool = nullptr);
+
+	// True if everything in box is behind the occluders drawn
+	bool isOccluded(const BoundingBox& box) const;
+	// Remove the nodes whose own bounds are occluded from visible
+	void cull(const TransformHierarchy& hierarchy, QVector<int>& visible);
+
+	// Farthest depth under each texel of a pyramid level, WIDTH >> level by HEIGHT >> level
+	// with the top row first. Level 0 is the depth buffer. Depths are NDC z, 1 where empty.
+	inline const float* depth(int level = 0) const { return levels_[level].data(); }
+
+	// Stats from the last rasterize() and cull()
+	inline int occluderCount() const { return occluders_.size(); }
+	inline int trianglesDrawn() const { return trianglesDrawn_; }
+	inline double rasterMs() const { return rasterMs_; }
+	inline int testedCount() const { return testedCount_; }
+	inline int occludedCount() const { return occludedCount_; }
+	inline double testMs() const { return testMs_; }
+
+private:
+	struct Occluder {
+		const OccluderMesh* mesh;
+		QMatrix4x4 toClip;
+		int firstTriangle;
+	};
+
+	// A triangle in pixels, corners sorted top to bottom, ready to scan convert. Depth is
+	// the plane z = z0 + dzdx * x + dzdy * y, since NDC z is linear across the screen.
+	struct ScreenTriangle {
+		float x[3], y[3];
+		// Change in x per row down each edge: 0 to 2, 0 to 1 and 1 to 2
+		float dxdy[3];
+		float z0, dzdx, dzdy;
+		// Rows whose centres it covers; empty for triangles that aren't drawn
+		int rowBegin, rowEnd;
+	};
+
+	// Project one occluder's triangles into triangles_
+	void setup(const Occluder& occluder);
+	// Fill rows [rowBegin, rowEnd) of the depth buffer from every triangle
+	void rasterizeRows(int rowBegin, int rowEnd);
+	void buildPyramid();
+
+	QMatrix4x4 viewProjection_;
+	QVector<Occluder> occluders_;
+	std::vector<ScreenTriangle> triangles_;
+	std::vector<float> levels_[LEVELS];
+
+	int trianglesDrawn_;
+	double rasterMs_;
+	int testedCount_;
+	int occludedCount_;
+	double testMs_;
+};
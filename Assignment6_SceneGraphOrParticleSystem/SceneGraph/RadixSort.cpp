@@ -0,0 +1,221 @@
+#include "RadixSort.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+namespace {
+	// Keys sorted per chunk; fewer than this and the sort runs on the calling thread
+	const int TASK_KEYS = 16384;
+	const int DIGITS = 256;
+	const int PASSES = 4;
+	// Repair the last order only while no more than one item in this many is out of place
+	const int REPAIR_FRACTION = 16;
+	// After the last order turns out no help, sort from scratch for this many frames before
+	// trying it again
+	const int RETRY_FRAMES = 8;
+
+	// Run body(index) for every index below count, across pool's threads when given
+	template <typename Body>
+	void runTasks(TaskPool* pool, int count, Body body)
+	{
+		if (!pool || count == 1) {
+			for (int ii = 0; ii < count; ++ii) {
+				body(ii);
+			}
+			return;
+		}
+		TaskGroup group;
+		for (int ii = 0; ii < count; ++ii) {
+			pool->run(group, [&body, ii]() { body(ii); });
+		}
+		pool->wait(group);
+	}
+
+	// Flip a float's bits so that comparing them as unsigned integers orders the floats:
+	// negatives get every bit flipped, positives just the sign bit
+	inline quint32 sortable(float value)
+	{
+		quint32 bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		return bits ^ (bits & 0x80000000u ? 0xFFFFFFFFu : 0x80000000u);
+	}
+
+	// Items carry their key in the high half and their index in the low half
+	inline quint32 key(quint64 item)
+	{
+		return quint32(item >> 32);
+	}
+}
+
+RadixSort::RadixSort() : coherent_(true), path_(Path::Empty), repaired_(0), passesSkipped_(0), framesToRetry_(0)
+{}
+
+void RadixSort::reset()
+{
+	order_.clear();
+	framesToRetry_ = 0;
+}
+
+void RadixSort::sort(const float* keys, int count, TaskPool* pool)
+{
+	repaired_ = 0;
+	passesSkipped_ = 0;
+	if (count <= 0) {
+		order_.clear();
+		path_ = Path::Empty;
+		return;
+	}
+
+	// Start from the last order: indices past the end drop out and new ones go last
+	const bool tryLast = coherent_ && framesToRetry_ == 0;
+	framesToRetry_ = qMax(framesToRetry_ - 1, 0);
+	const int previous = tryLast ? int(order_.size()) : 0;
+	if (previous > count) {
+		order_.erase(std::remove_if(order_.begin(), order_.end(), [count](quint32 index) { return index >= quint32(count); }), order_.end());
+	}
+	order_.resize(count);
+	std::iota(order_.begin() + qMin(previous, count), order_.end(), quint32(qMin(previous, count)));
+	items_.resize(count);
+	scratch_.resize(count);
+
+	const int threads = pool ? pool->threadCount() : 1;
+	const int chunks = qMax(1, qMin(threads, count / TASK_KEYS));
+	const int chunkKeys = (count + chunks - 1) / chunks;
+	TaskPool* tasks = chunks > 1 ? pool : nullptr;
+
+	// Gather the keys in that order, counting where they go down
+	std::vector<int> descents(chunks, 0);
+	runTasks(tasks, chunks, [&](int chunk) {
+		const int begin = chunk * chunkKeys;
+		const int end = qMin(count, begin + chunkKeys);
+		int found = 0;
+		for (int ii = begin; ii < end; ++ii) {
+			const quint32 index = order_[ii];
+			items_[ii] = quint64(sortable(keys[index])) << 32 | index;
+			if (ii > begin && key(items_[ii]) < key(items_[ii - 1])) {
+				++found;
+			}
+		}
+		descents[chunk] = found;
+	});
+	int total = 0;
+	for (int chunk = 0; chunk < chunks; ++chunk) {
+		total += descents[chunk];
+		const int begin = chunk * chunkKeys;
+		if (chunk > 0 && begin < count && key(items_[begin]) < key(items_[begin - 1])) {
+			++total;
+		}
+	}
+
+	if (tryLast && total == 0) {
+		path_ = Path::Coherent;
+		return;
+	}
+	if (tryLast && total <= count / REPAIR_FRACTION && repair(count)) {
+		path_ = Path::Repaired;
+	} else {
+		if (tryLast && previous > 0) {
+			framesToRetry_ = RETRY_FRAMES;
+		}
+		radixSort(count, pool);
+		path_ = Path::Radix;
+	}
+
+	runTasks(tasks, chunks, [&](int chunk) {
+		const int end = qMin(count, (chunk + 1) * chunkKeys);
+		for (int ii = chunk * chunkKeys; ii < end; ++ii) {
+			order_[ii] = quint32(items_[ii]);
+		}
+	});
+}
+
+bool RadixSort::repair(int count)
+{
+	// Keep a sorted run of the items, pulling out each item that goes down along with the
+	// kept item before it. One of the two is out of place, so at most twice as many items are
+	// pulled as really need to move.
+	const size_t maxMoved = size_t(count / REPAIR_FRACTION);
+	moved_.clear();
+	int kept = 0;
+	for (int ii = 0; ii < count; ++ii) {
+		const quint64 item = items_[ii];
+		if (kept == 0 || key(item) >= key(scratch_[kept - 1])) {
+			scratch_[kept++] = item;
+		} else {
+			moved_.push_back(scratch_[--kept]);
+			moved_.push_back(item);
+			if (moved_.size() > maxMoved) {
+				return false;
+			}
+		}
+	}
+	repaired_ = int(moved_.size());
+
+	// Sort what was pulled out, ties by index, and merge it back in
+	std::sort(moved_.begin(), moved_.end());
+	int from = 0;
+	size_t next = 0;
+	for (int ii = 0; ii < count; ++ii) {
+		if (next < moved_.size() && (from == kept || key(moved_[next]) < key(scratch_[from]))) {
+			items_[ii] = moved_[next++];
+		} else {
+			items_[ii] = scratch_[from++];
+		}
+	}
+	return true;
+}
+
+void RadixSort::radixSort(int count, TaskPool* pool)
+{
+	// Each chunk scatters its items into its own part of every digit's run, so the chunking
+	// doesn't change the result
+	const int threads = pool ? pool->threadCount() : 1;
+	const int chunks = qMax(1, qMin(threads, count / TASK_KEYS));
+	const int chunkKeys = (count + chunks - 1) / chunks;
+	histograms_.resize(size_t(chunks) * DIGITS);
+	TaskPool* tasks = chunks > 1 ? pool : nullptr;
+
+	for (int pass = 0; pass < PASSES; ++pass) {
+		// The key is the item's high half
+		const int shift = 32 + pass * 8;
+		runTasks(tasks, chunks, [&](int chunk) {
+			int* histogram = histograms_.data() + size_t(chunk) * DIGITS;
+			std::memset(histogram, 0, DIGITS * sizeof(int));
+			const int end = qMin(count, (chunk + 1) * chunkKeys);
+			for (int ii = chunk * chunkKeys; ii < end; ++ii) {
+				++histogram[(items_[ii] >> shift) & 0xFF];
+			}
+		});
+
+		// Within a digit, earlier chunks' items go first. A pass where every key has the same
+		// digit would move nothing.
+		int offset = 0;
+		bool single = false;
+		for (int digit = 0; digit < DIGITS; ++digit) {
+			const int start = offset;
+			for (int chunk = 0; chunk < chunks; ++chunk) {
+				int& slot = histograms_[size_t(chunk) * DIGITS + digit];
+				const int items = slot;
+				slot = offset;
+				offset += items;
+			}
+			single = single || offset - start == count;
+		}
+		if (single) {
+			++passesSkipped_;
+			continue;
+		}
+
+		runTasks(tasks, chunks, [&](int chunk) {
+			int* offsets = histograms_.data() + size_t(chunk) * DIGITS;
+			const int end = qMin(count, (chunk + 1) * chunkKeys);
+			for (int ii = chunk * chunkKeys; ii < end; ++ii) {
+				const quint64 item = items_[ii];
+				scratch_[offsets[(item >> shift) & 0xFF]++] = item;
+			}
+		});
+		items_.swap(scratch_);
+	}
+}
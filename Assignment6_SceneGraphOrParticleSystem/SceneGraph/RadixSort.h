@@ -0,0 +1,68 @@
+#pragma once
+
+#include <QtCore>
+
+#include <vector>
+
+class TaskPool;
+
+// Sorts float keys, producing the order of their indices: a least significant digit radix
+// sort of the keys as 32-bit integers, one byte per pass, split across threads. Passes where
+// every key has the same byte are skipped.
+//
+// Keys like depths change little from one frame to the next, so by default each sort starts
+// from the last order. If that is still sorted, checking it is all the work there is. If
+// only a few items have moved, they are pulled out, sorted on their own and merged back in.
+// Only when too many have moved does the full radix sort run, and then the next few frames
+// skip straight to it, since checking the last order costs a pass over randomly placed keys.
+//
+// Every path gives keys in ascending order, and the result depends on the keys and the last
+// order only, never on the number of threads.
+class RadixSort
+{
+public:
+	enum class Path { Empty, Coherent, Repaired, Radix };
+
+	RadixSort();
+
+	// Sort count keys ascending. Work is split across pool's threads when given.
+	void sort(const float* keys, int count, TaskPool* pool = nullptr);
+	// Forget the last order, for when the keys no longer describe the same items
+	void reset();
+
+	// Indices of the keys, in ascending order of key
+	inline const quint32* order() const { return order_.data(); }
+	inline int size() const { return int(order_.size()); }
+
+	// Start from the last order; on by default
+	inline bool coherent() const { return coherent_; }
+	inline void setCoherent(bool coherent) { coherent_ = coherent; }
+
+	// How the last sort went
+	inline Path lastPath() const { return path_; }
+	// Items out of place in the last order, when it was repaired
+	inline int repairedCount() const { return repaired_; }
+	inline int passesSkipped() const { return passesSkipped_; }
+
+private:
+	// Try to finish from the gathered last order; false if too much has moved
+	bool repair(int count);
+	void radixSort(int count, TaskPool* pool);
+
+	bool coherent_;
+	Path path_;
+	int repaired_;
+	int passesSkipped_;
+	// Frames left to sort from scratch before trying the last order again
+	int framesToRetry_;
+
+	std::vector<quint32> order_;
+	// Keys as order-preserving integers with their indices, key in the high half, in the
+	// current order
+	std::vector<quint64> items_;
+	std::vector<quint64> scratch_;
+	// Per chunk, its count of each digit, then where it writes each digit
+	std::vector<int> histograms_;
+	// Items pulled out of the last order
+	std::vector<quint64> moved_;
+};
@@ -0,0 +1,155 @@
+#include "RenderQueue.h"
+
+RenderQueue::RenderQueue() : drawCalls_(0), instancesDrawn_(0), textureBinds_(0), translucentDrawn_(0), boundTextures_()
+{}
+
+void RenderQueue::clear()
+{
+	drawCalls_ = 0;
+	instancesDrawn_ = 0;
+	textureBinds_ = 0;
+	translucentDrawn_ = 0;
+	// resize(0) keeps each vector's capacity, so steady-state frames don't allocate
+	for (RenderBatch& batch : batches_) {
+		batch.instances.resize(0);
+	}
+	translucent_.resize(0);
+	translucentBatches_.resize(0);
+}
+
+void RenderQueue::submit(const SceneNode* node, const QMatrix4x4& worldSpaceModelMatrix)
+{
+	Renderable* renderable = node->getRenderable();
+	if (!renderable) {
+		return;
+	}
+
+	// Scenes only have a handful of batches, so a linear search beats hashing
+	RenderBatch* target = nullptr;
+	for (RenderBatch& batch : batches_) {
+		if (batch.renderable == renderable && batch.lights == node->getLights() &&
+			batch.diffuseMaps == node->getDiffuseMaps() && batch.normalMaps == node->getNormalMaps()) {
+			target = &batch;
+			break;
+		}
+	}
+	if (!target) {
+		RenderBatch batch;
+		batch.renderable = renderable;
+		batch.lights = node->getLights();
+		batch.diffuseMaps = node->getDiffuseMaps();
+		batch.normalMaps = node->getNormalMaps();
+		batches_ << batch;
+		target = &batches_.last();
+	}
+
+	// Nodes name a texture of each array; the array knows its layer and atlas region
+	const TextureArray::Region diffuse = node->getDiffuseMaps() ? node->getDiffuseMaps()->region(node->getDiffuseTexture()) : TextureArray::Region();
+	const TextureArray::Region normal = node->getNormalMaps() ? node->getNormalMaps()->region(node->getNormalTexture()) : TextureArray::Region();
+	const InstanceData instance(worldSpaceModelMatrix, diffuse.layer, normal.layer, diffuse.rect, normal.rect, node->getOpacity());
+	if (node->getOpacity() < 1.0f) {
+		translucent_ << instance;
+		translucentBatches_ << int(target - batches_.data());
+	}
+	else {
+		target->instances << instance;
+	}
+}
+
+void RenderQueue::bindTexture(int unit, TextureArray* maps)
+{
+	QOpenGLTexture* texture = maps && maps->isCreated() ? maps->texture() : nullptr;
+	if (texture && texture != boundTextures_[unit]) {
+		texture->bind(unit);
+		boundTextures_[unit] = texture;
+		++textureBinds_;
+	}
+}
+
+void RenderQueue::releaseTextures()
+{
+	for (int unit = 0; unit < TEXTURE_UNITS; ++unit) {
+		if (boundTextures_[unit]) {
+			boundTextures_[unit]->release(unit);
+			boundTextures_[unit] = nullptr;
+		}
+	}
+}
+
+void RenderQueue::drawBatch(RenderBatch& batch, const QVector<InstanceData>& instances, const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix,
+	const DrawMode drawMode, LightClusters* clusters)
+{
+	bindTexture(0, batch.diffuseMaps);
+	bindTexture(1, batch.normalMaps);
+	QOpenGLTexture* diffuseMaps = batch.diffuseMaps ? batch.diffuseMaps->texture() : nullptr;
+	QOpenGLTexture* normalMaps = batch.normalMaps ? batch.normalMaps->texture() : nullptr;
+	batch.renderable->draw(instances, viewPosition, viewMatrix, projectionMatrix, drawMode, diffuseMaps, normalMaps, batch.lights, clusters);
+
+	++drawCalls_;
+	instancesDrawn_ += instances.size();
+}
+
+void RenderQueue::draw(const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix, const DrawMode drawMode, LightClusters* clusters,
+	const QVector<PointLight>* deferredLights, TaskPool* pool)
+{
+	for (RenderBatch& batch : batches_) {
+		if (batch.instances.isEmpty() || (deferredLights && batch.lights == deferredLights)) {
+			continue;
+		}
+		drawBatch(batch, batch.instances, viewPosition, viewMatrix, projectionMatrix, drawMode, clusters);
+	}
+	drawTranslucent(viewPosition, viewMatrix, projectionMatrix, drawMode, clusters, pool);
+	releaseTextures();
+}
+
+void RenderQueue::drawTranslucent(const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix, const DrawMode drawMode, LightClusters* clusters,
+	TaskPool* pool)
+{
+	const int count = translucent_.size();
+	if (count == 0) {
+		return;
+	}
+
+	// Depth of each node's origin along the view's z axis, farthest lowest; the model
+	// matrix is column major, so the origin is its last column
+	const QVector4D row = viewMatrix.row(2);
+	translucentDepths_.resize(count);
+	for (int ii = 0; ii < count; ++ii) {
+		const float* model = translucent_[ii].modelMatrix;
+		translucentDepths_[ii] = row.x() * model[12] + row.y() * model[13] + row.z() * model[14] + row.w();
+	}
+	translucentOrder_.sort(translucentDepths_.constData(), count, pool);
+	const quint32* order = translucentOrder_.order();
+
+	// Blend over everything opaque without hiding each other
+	QOpenGLFunctions* gl = QOpenGLContext::currentContext()->functions();
+	gl->glEnable(GL_BLEND);
+	gl->glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	gl->glDepthMask(GL_FALSE);
+	int begin = 0;
+	while (begin < count) {
+		const int batch = translucentBatches_[order[begin]];
+		run_.resize(0);
+		int end = begin;
+		while (end < count && translucentBatches_[order[end]] == batch) {
+			run_ << translucent_[order[end]];
+			++end;
+		}
+		drawBatch(batches_[batch], run_, viewPosition, viewMatrix, projectionMatrix, drawMode, clusters);
+		begin = end;
+	}
+	gl->glDepthMask(GL_TRUE);
+	gl->glDisable(GL_BLEND);
+	translucentDrawn_ += count;
+}
+
+void RenderQueue::drawGeometry(const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix, const QVector<PointLight>* deferredLights)
+{
+	for (RenderBatch& batch : batches_) {
+		if (batch.instances.isEmpty() || batch.lights != deferredLights) {
+			continue;
+		}
+		drawBatch(batch, batch.instances, viewPosition, viewMatrix, projectionMatrix, DrawMode::GBUFFER, nullptr);
+	}
+	releaseTextures();
+}
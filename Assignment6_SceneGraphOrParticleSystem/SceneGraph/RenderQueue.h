@@ -0,0 +1,76 @@
+#pragma once
+
+#include <QtCore>
+#include <QtGui>
+#include "RadixSort.h"
+#include "SceneNode.h"
+
+class TaskPool;
+
+// All nodes that can be drawn together with one instanced draw call:
+// same geometry, same lights, same texture arrays.
+struct RenderBatch {
+	Renderable* renderable;
+	QVector<PointLight>* lights;
+	TextureArray* diffuseMaps;
+	TextureArray* normalMaps;
+	QVector<InstanceData> instances;
+};
+
+// Gathers scene graph nodes into batches every frame and draws each batch at once.
+//
+// Translucent nodes are kept apart and drawn last, farthest first, blended over what's
+// behind them. Their depths are radix sorted starting from the last frame's order, which
+// usually still holds, and each run of neighbors in that order sharing a batch is one draw.
+class RenderQueue
+{
+public:
+	RenderQueue();
+
+	// Empty every batch, keeping their storage for the next frame
+	void clear();
+	// Queue a node to be drawn with the given world space model matrix
+	void submit(const SceneNode* node, const QMatrix4x4& worldSpaceModelMatrix);
+	// Issue one draw call per non-empty batch. Batches lit by the lights the clusters
+	// were built from are shaded through them. Batches lit by deferredLights are
+	// skipped, having been drawn by drawGeometry() and shaded by the deferred renderer.
+	// Translucent nodes follow, whatever their lights; they're sorted on pool's threads
+	// when given.
+	void draw(const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix, const DrawMode drawMode, LightClusters* clusters = nullptr,
+		const QVector<PointLight>* deferredLights = nullptr, TaskPool* pool = nullptr);
+	// Draw every opaque batch lit by deferredLights into the bound G-buffer
+	void drawGeometry(const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix, const QVector<PointLight>* deferredLights);
+
+	// Stats from the draws since the last clear()
+	inline int drawCalls() const { return drawCalls_; }
+	inline int instancesDrawn() const { return instancesDrawn_; }
+	// Material textures bound. Batches sharing texture arrays draw without rebinding.
+	inline int textureBinds() const { return textureBinds_; }
+	// Translucent instances drawn, and how their order was found
+	inline int translucentDrawn() const { return translucentDrawn_; }
+	inline RadixSort::Path translucentSortPath() const { return translucentOrder_.lastPath(); }
+
+private:
+	void drawBatch(RenderBatch& batch, const QVector<InstanceData>& instances, const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix,
+		const DrawMode drawMode, LightClusters* clusters);
+	void drawTranslucent(const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix, const DrawMode drawMode, LightClusters* clusters,
+		TaskPool* pool);
+	void bindTexture(int unit, TextureArray* maps);
+	void releaseTextures();
+
+	QVector<RenderBatch> batches_;
+	// Translucent instances in submission order, with the index of their batch
+	QVector<InstanceData> translucent_;
+	QVector<int> translucentBatches_;
+	QVector<float> translucentDepths_;
+	RadixSort translucentOrder_;
+	// One run of sorted translucent instances
+	QVector<InstanceData> run_;
+	int drawCalls_;
+	int instancesDrawn_;
+	int textureBinds_;
+	int translucentDrawn_;
+	// What's on the diffuse and normal map units during a draw() or drawGeometry()
+	static const int TEXTURE_UNITS = 2;
+	QOpenGLTexture* boundTextures_[TEXTURE_UNITS];
+};
@@ -4,8 +4,12 @@
 #include <QtGui>
 #include <QtOpenGL>
 #include <QOpenGLFunctions_3_3_core>
+#include <QOpenGLFunctions_4_3_Core>
+#include <cstddef>
 
-Renderable::Renderable() : vbo_(QOpenGLBuffer::VertexBuffer), ibo_(QOpenGLBuffer::IndexBuffer), numTris_(0), vertexSize_(0)
+bool Renderable::uberShader_ = false;
+
+Renderable::Renderable() : shader_(nullptr), vbo_(QOpenGLBuffer::VertexBuffer), ibo_(QOpenGLBuffer::IndexBuffer), instanceVbo_(QOpenGLBuffer::VertexBuffer), numTris_(0), vertexSize_(0)
 {
 
 }
@@ -18,6 +22,9 @@ Renderable::~Renderable()
 	if (ibo_.isCreated()) {
 		ibo_.destroy();
 	}
+	if (instanceVbo_.isCreated()) {
+		instanceVbo_.destroy();
+	}
 	if (vao_.isCreated()) {
 		vao_.destroy();
 	}
@@ -25,20 +32,46 @@ Renderable::~Renderable()
 
 void Renderable::createShaders()
 {
-	QString vertexFilename = "../../vert.glsl";
-	bool ok = shader_.addShaderFromSourceFile(QOpenGLShader::Vertex, vertexFilename);
-	if (!ok) {
-		qDebug() << shader_.log();
+	// Vertex inputs are the same in every variant, so set them up with the default one
+	shader_ = shaderFor(DrawMode::DEFAULT, false, 1);
+}
+
+QOpenGLShaderProgram* Renderable::shaderFor(DrawMode drawMode, bool normalMaps, int lightCount, bool clustered)
+{
+	// Only the lit modes use lights, and only lit modes and normal debug use normal maps,
+	// so leave them out of the other variants rather than compiling duplicates
+	const bool lit = drawMode == DrawMode::DEFAULT || drawMode == DrawMode::LIGHTING_DEBUG;
+	normalMaps = normalMaps && (lit || drawMode == DrawMode::NORM_DEBUG || drawMode == DrawMode::GBUFFER);
+	clustered = clustered && lit;
+	lightCount = lit && !clustered ? qBound(0, lightCount, int(MAX_POINT_LIGHTS)) : 0;
+	// The G-buffer has its own outputs, so it is always a specialized variant
+	const bool uber = uberShader_ && drawMode != DrawMode::GBUFFER;
+
+	const int key = uber ? -1 : (int(drawMode) << 8) | (normalMaps ? 1 << 7 : 0) | (clustered ? 1 << 6 : 0) | lightCount;
+	auto it = permutations_.find(key);
+	if (it != permutations_.end()) {
+		return it.value();
 	}
-	QString fragmentFilename = "../../frag.glsl";
-	ok = shader_.addShaderFromSourceFile(QOpenGLShader::Fragment, fragmentFilename);
-	if (!ok) {
-		qDebug() << shader_.log();
+
+	QStringList defines;
+	if (uber) {
+		defines << "UBER_SHADER";
 	}
-	ok = shader_.link();
-	if (!ok) {
-		qDebug() << shader_.log();
+	else {
+		defines << QString("DRAW_MODE %1").arg(int(drawMode)) << QString("NUM_POINT_LIGHTS %1").arg(lightCount);
+		if (normalMaps) {
+			defines << "NORMAL_MAPS";
+		}
+		if (clustered) {
+			defines << "CLUSTERED_LIGHTS"
+				<< QString("CLUSTER_TILES_X %1").arg(int(LightClusters::TILES_X))
+				<< QString("CLUSTER_TILES_Y %1").arg(int(LightClusters::TILES_Y))
+				<< QString("CLUSTER_SLICES %1").arg(int(LightClusters::SLICES));
+		}
 	}
+	QOpenGLShaderProgram* program = ShaderCache::instance().program("../../vert.glsl", "../../frag.glsl", defines);
+	permutations_.insert(key, program);
+	return program;
 }
 
 void Renderable::init(const QVector<Vertex>& vertices, const QVector<Face>& faces)
@@ -51,6 +84,12 @@ void Renderable::init(const QVector<Vertex>& vertices, const QVector<Face>& face
 	// set our number of triangles.
 	numTris_ = faces.size();
 
+	bounds_ = BoundingBox();
+	for (const Vertex& vertex : vertices) {
+		bounds_.expand(QVector3D(vertex.position.x, vertex.position.y, vertex.position.z));
+	}
+	bvh_.build(vertices, faces);
+
 	// Setup our shader.
 	createShaders();
 
@@ -71,92 +110,172 @@ void Renderable::init(const QVector<Vertex>& vertices, const QVector<Face>& face
 
 	// Make sure we setup our shader inputs properly
 	// position
-	shader_.enableAttributeArray(0);
-	shader_.setAttributeBuffer(0, GL_FLOAT, 0, 3, vertexSize_);
+	shader_->enableAttributeArray(0);
+	shader_->setAttributeBuffer(0, GL_FLOAT, 0, 3, vertexSize_);
 	// texture coords
-	shader_.enableAttributeArray(1);
-	shader_.setAttributeBuffer(1, GL_FLOAT, 3 * sizeof(float), 2, vertexSize_);
+	shader_->enableAttributeArray(1);
+	shader_->setAttributeBuffer(1, GL_FLOAT, 3 * sizeof(float), 2, vertexSize_);
 	// normal
-	shader_.enableAttributeArray(2);
-	shader_.setAttributeBuffer(2, GL_FLOAT, 5 * sizeof(float), 3, vertexSize_);
-	// tangent
-	shader_.enableAttributeArray(3);
-	shader_.setAttributeBuffer(3, GL_FLOAT, 8 * sizeof(float), 3, vertexSize_);
+	shader_->enableAttributeArray(2);
+	shader_->setAttributeBuffer(2, GL_FLOAT, 5 * sizeof(float), 3, vertexSize_);
+	// tangent, with the bitangent handedness in w
+	shader_->enableAttributeArray(3);
+	shader_->setAttributeBuffer(3, GL_FLOAT, 8 * sizeof(float), 4, vertexSize_);
+
+	// Per-instance attributes advance once per instance instead of once per vertex
+	instanceVbo_.create();
+	instanceVbo_.setUsagePattern(QOpenGLBuffer::StreamDraw);
+	instanceVbo_.bind();
+	const int instanceSize = sizeof(InstanceData);
+	// model matrix, one column per location
+	for (int col = 0; col < 4; ++col) {
+		shader_->enableAttributeArray(4 + col);
+		shader_->setAttributeBuffer(4 + col, GL_FLOAT, offsetof(InstanceData, modelMatrix) + col * 4 * sizeof(float), 4, instanceSize);
+		glVertexAttribDivisor(4 + col, 1);
+	}
+	// normal matrix, one column per location
+	for (int col = 0; col < 3; ++col) {
+		shader_->enableAttributeArray(8 + col);
+		shader_->setAttributeBuffer(8 + col, GL_FLOAT, offsetof(InstanceData, normalMatrix) + col * 3 * sizeof(float), 3, instanceSize);
+		glVertexAttribDivisor(8 + col, 1);
+	}
+	// diffuse and normal map layers
+	shader_->enableAttributeArray(11);
+	shader_->setAttributeBuffer(11, GL_FLOAT, offsetof(InstanceData, diffuseLayer), 3, instanceSize);
+	glVertexAttribDivisor(11, 1);
+	// and where in those layers their atlas regions are
+	shader_->enableAttributeArray(12);
+	shader_->setAttributeBuffer(12, GL_FLOAT, offsetof(InstanceData, diffuseRegion), 4, instanceSize);
+	glVertexAttribDivisor(12, 1);
+	shader_->enableAttributeArray(13);
+	shader_->setAttributeBuffer(13, GL_FLOAT, offsetof(InstanceData, normalRegion), 4, instanceSize);
+	glVertexAttribDivisor(13, 1);
 
 	// Release our vao and THEN release our buffers.
 	vao_.release();
 	vbo_.release();
 	ibo_.release();
+	instanceVbo_.release();
 }
 
-void Renderable::draw(const QMatrix4x4& worldSpaceModelMatrix, const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix, 
-	const DrawMode drawMode, QOpenGLTexture* diffuseMap, QOpenGLTexture* normalMap, QVector<PointLight>* lights)
+void Renderable::draw(const QVector<InstanceData>& instances, const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix, 
+	const DrawMode drawMode, QOpenGLTexture* diffuseMaps, QOpenGLTexture* normalMaps, QVector<PointLight>* lights, LightClusters* clusters)
 {
-	// Create normal matrix
-	const QMatrix3x3 normalMatrix = worldSpaceModelMatrix.normalMatrix();
-
-	// Bind shader
-	shader_.bind();
-
-	const bool hasDiffuseMap = diffuseMap && diffuseMap->isCreated();
-	const bool hasNormalMap = normalMap && normalMap->isCreated();
-
-	// Set our matrix uniforms!
-	shader_.setUniformValue("modelMatrix", worldSpaceModelMatrix);
-	shader_.setUniformValue("viewPosition", viewPosition);
-	shader_.setUniformValue("viewMatrix", viewMatrix);
-	shader_.setUniformValue("projectionMatrix", projectionMatrix);
-	shader_.setUniformValue("normalMatrix", normalMatrix);
-	shader_.setUniformValue("drawMode", int(drawMode));
-	shader_.setUniformValue("hasNormalMap", hasNormalMap);
-	for (int ii = 0; ii < lights->size(); ++ii) {
+	drawFaces(instances, 0, numTris_, viewPosition, viewMatrix, projectionMatrix, drawMode, diffuseMaps, normalMaps, lights, clusters);
+}
+
+void Renderable::drawFaces(const QVector<InstanceData>& instances, int firstFace, int faceCount, const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix,
+	const DrawMode drawMode, QOpenGLTexture* diffuseMaps, QOpenGLTexture* normalMaps, QVector<PointLight>* lights, LightClusters* clusters)
+{
+	if (instances.isEmpty() || faceCount <= 0) {
+		return;
+	}
+
+	const bool clustered = beginDraw(viewPosition, viewMatrix, projectionMatrix, drawMode, diffuseMaps, normalMaps, lights, clusters);
+
+	// Upload this frame's instances. Re-allocating orphans last frame's storage,
+	// so we never wait on the GPU to finish reading it.
+	instanceVbo_.bind();
+	instanceVbo_.allocate(instances.constData(), instances.size() * sizeof(InstanceData));
+	instanceVbo_.release();
+
+	// Draw!
+	glDrawElementsInstanced(GL_TRIANGLES, faceCount * 3, GL_UNSIGNED_INT, reinterpret_cast<void*>(qintptr(firstFace) * sizeof(Face)), instances.size());
+
+	endDraw(clustered, clusters);
+}
+
+void Renderable::drawIndirect(GLuint commands, int commandCount, const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix,
+	const DrawMode drawMode, QOpenGLTexture* diffuseMaps, QOpenGLTexture* normalMaps, QVector<PointLight>* lights, LightClusters* clusters)
+{
+	// Multi-draw indirect isn't in the ES 3.1 set, so it comes from the 4.3 functions
+	QOpenGLContext* context = QOpenGLContext::currentContext();
+	if (commandCount <= 0 || context->isOpenGLES() || context->format().version() < qMakePair(4, 3)) {
+		return;
+	}
+	QOpenGLFunctions_4_3_Core* gl = context->versionFunctions<QOpenGLFunctions_4_3_Core>();
+	if (!gl) {
+		return;
+	}
+
+	const bool clustered = beginDraw(viewPosition, viewMatrix, projectionMatrix, drawMode, diffuseMaps, normalMaps, lights, clusters);
+
+	// The indirect buffer binding isn't part of the vao
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands);
+	gl->glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, commandCount, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	endDraw(clustered, clusters);
+}
+
+bool Renderable::beginDraw(const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix,
+	const DrawMode drawMode, QOpenGLTexture* diffuseMaps, QOpenGLTexture* normalMaps, QVector<PointLight>* lights, LightClusters* clusters)
+{
+	const bool hasDiffuseMaps = diffuseMaps && diffuseMaps->isCreated();
+	const bool hasNormalMaps = normalMaps && normalMaps->isCreated();
+	const int lightCount = lights ? qMin(lights->size(), int(MAX_POINT_LIGHTS)) : 0;
+	const bool uber = uberShader_ && drawMode != DrawMode::GBUFFER;
+	const bool lit = uber || drawMode == DrawMode::DEFAULT || drawMode == DrawMode::LIGHTING_DEBUG;
+	// The uber shader keeps its fixed light array for comparison
+	const bool clustered = lit && !uber && clusters && clusters->covers(lights);
+
+	// Bind the variant specialized for this draw
+	shader_ = shaderFor(drawMode, hasNormalMaps, lightCount, clustered);
+	shader_->bind();
+
+	// Set our per-draw uniforms! Per-node matrices come from the instance buffer.
+	shader_->setUniformValue("viewPosition", viewPosition);
+	shader_->setUniformValue("viewMatrix", viewMatrix);
+	shader_->setUniformValue("projectionMatrix", projectionMatrix);
+	if (uber) {
+		shader_->setUniformValue("drawMode", int(drawMode));
+		shader_->setUniformValue("hasNormalMaps", hasNormalMaps);
+		shader_->setUniformValue("pointLightCount", lightCount);
+	}
+	if (clustered) {
+		clusters->bind(shader_, CLUSTER_TEXTURE_UNIT);
+	}
+	for (int ii = 0; lit && !clustered && ii < lightCount; ++ii) {
 		const PointLight& light = (*lights)[ii];
 		const int buflen = 64;
 		char buffer[buflen];
 
 		sprintf_s(buffer, buflen, "pointLights[%i].position", ii);
-		shader_.setUniformValue(buffer, light.position);
+		shader_->setUniformValue(buffer, light.position);
 		sprintf_s(buffer, buflen, "pointLights[%i].color", ii);
-		shader_.setUniformValue(buffer, light.color);
+		shader_->setUniformValue(buffer, light.color);
 		sprintf_s(buffer, buflen, "pointLights[%i].ambientIntensity", ii);
-		shader_.setUniformValue(buffer, light.ambientIntensity);
+		shader_->setUniformValue(buffer, light.ambientIntensity);
 		sprintf_s(buffer, buflen, "pointLights[%i].specularIntensity", ii);
-		shader_.setUniformValue(buffer, light.specularIntensity);
+		shader_->setUniformValue(buffer, light.specularIntensity);
 		sprintf_s(buffer, buflen, "pointLights[%i].constant", ii);
-		shader_.setUniformValue(buffer, light.constant);
+		shader_->setUniformValue(buffer, light.constant);
 		sprintf_s(buffer, buflen, "pointLights[%i].linear", ii);
-		shader_.setUniformValue(buffer, light.linear);
+		shader_->setUniformValue(buffer, light.linear);
 		sprintf_s(buffer, buflen, "pointLights[%i].quadratic", ii);
-		shader_.setUniformValue(buffer, light.quadratic);
+		shader_->setUniformValue(buffer, light.quadratic);
 	}
 
-	// Bind VAO
-	vao_.bind();
-
-	// Bind textures
-	if (hasDiffuseMap) {
-		glActiveTexture(GL_TEXTURE0);
-		diffuseMap->bind();
-		shader_.setUniformValue(shader_.attributeLocation("diffuseMap"), GL_TEXTURE0);
+	// The texture arrays are already bound
+	if (hasDiffuseMaps) {
+		shader_->setUniformValue("diffuseMaps", 0);
 	}
-	if (hasNormalMap) {
-		glActiveTexture(GL_TEXTURE1);
-		normalMap->bind();
-		shader_.setUniformValue("normalMap", GL_TEXTURE1 - GL_TEXTURE0);
+	if (hasNormalMaps) {
+		shader_->setUniformValue("normalMaps", 1);
 	}
 
-	// Draw!
-	glDrawElements(GL_TRIANGLES, numTris_ * 3, GL_UNSIGNED_INT, 0);
+	// Bind VAO
+	vao_.bind();
+	return clustered;
+}
 
-	// Un-bind textures
-	if (hasDiffuseMap) {
-		diffuseMap->release();
-	}
-	if (hasNormalMap) {
-		normalMap->release();
+void Renderable::endDraw(bool clustered, LightClusters* clusters)
+{
+	if (clustered) {
+		clusters->release(CLUSTER_TEXTURE_UNIT);
 	}
 
 	// Un-bind VAO and shader
 	vao_.release();
-	shader_.release();
+	shader_->release();
 }
@@ -3,41 +3,94 @@
 #include <QtCore>
 #include <QtGui>
 #include <QtOpenGL>
+#include "ShaderCache.h"
 #include "Structs.h"
+#include "Bounds.h"
+#include "Bvh.h"
+#include "LightClusters.h"
 
 enum class DrawMode {
 	DEFAULT = 0,
 	WIREFRAME = 1,
 	TEX_DEBUG = 2,
 	NORM_DEBUG = 3,
-	LIGHTING_DEBUG = 4
+	LIGHTING_DEBUG = 4,
+	// Writes the G-buffer for deferred shading rather than a color
+	GBUFFER = 5
 };
 
-class Renderable: protected QOpenGLFunctions
+class Renderable: protected QOpenGLExtraFunctions
 {
 protected:
-	// For now, we have only one shader per object
-	QOpenGLShaderProgram shader_;
+	// The shader variant for the current draw. Variants are shared by every Renderable
+	// using the same shaders; the ShaderCache owns them.
+	QOpenGLShaderProgram* shader_;
+	// Variants we've already looked up, keyed by draw mode, normal maps, clustering and light count
+	QHash<int, QOpenGLShaderProgram*> permutations_;
 	// For now, we have a single unified buffer per object
 	QOpenGLBuffer vbo_;
 	// Make sure we have an index buffer.
 	QOpenGLBuffer ibo_;
+	// Per-instance transforms and texture layers, refilled every draw
+	QOpenGLBuffer instanceVbo_;
 	// We have a single draw call, so a single vao
 	QOpenGLVertexArrayObject vao_;
 	// Keep track of how many triangles we actually have to draw in our ibo
 	unsigned int numTris_;
 	int vertexSize_;
+	// Model-space bounds of our vertices
+	BoundingBox bounds_;
+	// Our triangles in model space, shared by every instance for ray queries
+	Bvh bvh_;
 
 	// Create our shader and fix it up
 	void createShaders();
+	// Get the shader compiled for exactly this combination of features
+	QOpenGLShaderProgram* shaderFor(DrawMode drawMode, bool normalMaps, int lightCount, bool clustered = false);
+	// Bind the variant for a draw with its uniforms set, and our vao. Returns whether it
+	// shades through the clusters, which endDraw() releases.
+	bool beginDraw(const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix,
+		const DrawMode drawMode, QOpenGLTexture* diffuseMaps, QOpenGLTexture* normalMaps, QVector<PointLight>* lights, LightClusters* clusters);
+	void endDraw(bool clustered, LightClusters* clusters);
+
+	// Use the single runtime-branching shader instead of specialized variants
+	static bool uberShader_;
 
 public:
 	Renderable();
 	virtual ~Renderable();
 
 	virtual void init(const QVector<Vertex>& vertices, const QVector<Face>& faces);
-	virtual void draw(const QMatrix4x4& worldSpaceModelMatrix, const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix, 
-		const DrawMode drawMode, QOpenGLTexture* diffuseMap, QOpenGLTexture* normalMap, QVector<PointLight>* lights);
+	// Draw every instance with a single instanced draw call.
+	// diffuseMaps and normalMaps are 2D array textures indexed by each instance's layers.
+	// The caller binds them to texture units 0 and 1, so batches sharing them don't rebind.
+	// With clusters built from these lights, every light is shaded through the clusters
+	// instead of the first MAX_POINT_LIGHTS as uniforms.
+	virtual void draw(const QVector<InstanceData>& instances, const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix, 
+		const DrawMode drawMode, QOpenGLTexture* diffuseMaps, QOpenGLTexture* normalMaps, QVector<PointLight>* lights, LightClusters* clusters = nullptr);
+	// Draw every instance with only faces [firstFace, firstFace + faceCount), such as one
+	// level of detail of a mesh holding several
+	void drawFaces(const QVector<InstanceData>& instances, int firstFace, int faceCount, const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix,
+		const DrawMode drawMode, QOpenGLTexture* diffuseMaps, QOpenGLTexture* normalMaps, QVector<PointLight>* lights, LightClusters* clusters = nullptr);
+	// Draw commandCount DrawElementsIndirectCommands from commands with one glMultiDrawElementsIndirect.
+	// Their instances are read from instanceBuffer(), which the caller has filled on the GPU.
+	// Needs GL 4.3; does nothing on older contexts.
+	void drawIndirect(GLuint commands, int commandCount, const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix,
+		const DrawMode drawMode, QOpenGLTexture* diffuseMaps, QOpenGLTexture* normalMaps, QVector<PointLight>* lights, LightClusters* clusters = nullptr);
+
+	// Where the vao reads per-instance attributes from, laid out as InstanceData. draw() and
+	// drawFaces() reallocate it with their instances.
+	inline QOpenGLBuffer& instanceBuffer() { return instanceVbo_; }
+	inline int faceCount() const { return numTris_; }
+	inline const BoundingBox& bounds() const { return bounds_; }
+	inline const Bvh& bvh() const { return bvh_; }
+
+	static inline void setUberShader(bool enabled) { uberShader_ = enabled; }
+	static inline bool uberShader() { return uberShader_; }
+	// Most point lights one shader variant supports
+	static const int MAX_POINT_LIGHTS = 8;
+	// First texture unit used by light clusters
+	static const int CLUSTER_TEXTURE_UNIT = 2;
 
 private:
 
@@ -8,15 +8,16 @@ public:
 	RotatingNode(Renderable* renderable = nullptr, float rotationsPerSecond = 1.0f, const QVector3D& rotationAxis = QVector3D(0, 1, 0));
 	~RotatingNode() {}
 
-	void update(const qint64 msSinceLastFrame) override;
-
 	inline float getRotationsPerSecond() const { return rotationsPerSecond; }
-	inline void setRotationsPerSecond(float rotationsPerSecond) { this->rotationsPerSecond = rotationsPerSecond; }
+	inline void setRotationsPerSecond(float rotationsPerSecond) { this->rotationsPerSecond = rotationsPerSecond; updateSpin(); }
 
 	inline QVector3D getRotationAxis() const { return rotationAxis; }
-	inline void setRotationAxis(const QVector3D& rotationAxis) { this->rotationAxis = rotationAxis; }
+	inline void setRotationAxis(const QVector3D& rotationAxis) { this->rotationAxis = rotationAxis; updateSpin(); }
 
 private:
+	// Rotation is integrated by the TransformHierarchy, not per node
+	inline void updateSpin() { setSpin(rotationAxis, 360.0f * rotationsPerSecond); }
+
 	float rotationsPerSecond;
 	QVector3D rotationAxis;
 };
@@ -0,0 +1,327 @@
+#include "SceneBvh.h"
+#include "Bounds.h"
+#include "SceneNode.h"
+#include "TransformHierarchy.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCENE_BVH_SSE
+#endif
+
+// Distance along the ray to where it enters node's box, or INFINITY if it misses it before tMax
+static inline float enter(const Bvh::Node& node, const Vec3& origin, const Vec3& inverseDirection, float tMax)
+{
+	float tEnter = 0.0f;
+	float tExit = tMax;
+	for (int axis = 0; axis < 3; ++axis) {
+		float tNear = (node.lower[axis] - origin[axis]) * inverseDirection[axis];
+		float tFar = (node.upper[axis] - origin[axis]) * inverseDirection[axis];
+		if (tNear > tFar) {
+			std::swap(tNear, tFar);
+		}
+		tEnter = std::max(tEnter, tNear);
+		tExit = std::min(tExit, tFar);
+	}
+	return tEnter <= tExit ? tEnter : INFINITY;
+}
+
+#ifdef SCENE_BVH_SSE
+// enter() for four rays, as Bvh traces packets
+static inline __m128 enter4(const Bvh::Node& node, const __m128* origin, const __m128* inverseDirection, __m128 tMax)
+{
+	__m128 tEnter = _mm_setzero_ps();
+	__m128 tExit = tMax;
+	for (int axis = 0; axis < 3; ++axis) {
+		const __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.lower[axis]), origin[axis]), inverseDirection[axis]);
+		const __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.upper[axis]), origin[axis]), inverseDirection[axis]);
+		tEnter = _mm_max_ps(tEnter, _mm_min_ps(t0, t1));
+		tExit = _mm_min_ps(tExit, _mm_max_ps(t0, t1));
+	}
+	const __m128 inside = _mm_cmple_ps(tEnter, tExit);
+	return _mm_or_ps(_mm_and_ps(inside, tEnter), _mm_andnot_ps(inside, _mm_set1_ps(INFINITY)));
+}
+#endif
+
+SceneBvh::SceneBvh()
+{}
+
+void SceneBvh::clear()
+{
+	instances_.clear();
+	boxes_.clear();
+	top_ = Bvh();
+}
+
+void SceneBvh::addInstance(const Bvh* mesh, const QMatrix4x4& toWorld, int id)
+{
+	if (!mesh || mesh->isEmpty()) {
+		return;
+	}
+	instances_.push_back(Instance{ mesh, toWorld, toWorld.inverted(), id });
+}
+
+Bvh::Stats SceneBvh::build(int threadCount)
+{
+	// Each instance's box is its mesh's root box, carried into the world
+	std::vector<Vec3> lowers(instances_.size());
+	std::vector<Vec3> uppers(instances_.size());
+	boxes_.resize(instances_.size());
+	for (size_t ii = 0; ii < instances_.size(); ++ii) {
+		const Bvh::Node& root = instances_[ii].mesh->nodes()[0];
+		const BoundingBox box = BoundingBox(QVector3D(root.lower[0], root.lower[1], root.lower[2]),
+			QVector3D(root.upper[0], root.upper[1], root.upper[2])).transformed(instances_[ii].toWorld);
+		lowers[ii] = Vec3(box.min);
+		uppers[ii] = Vec3(box.max);
+		boxes_[ii] = Bvh::Node{ { box.min.x(), box.min.y(), box.min.z() }, 0, { box.max.x(), box.max.y(), box.max.z() }, 0 };
+	}
+	return top_.build(lowers, uppers, threadCount);
+}
+
+Bvh::Stats SceneBvh::build(const TransformHierarchy& hierarchy, int threadCount)
+{
+	instances_.clear();
+	for (int i = 0; i < hierarchy.size(); ++i) {
+		const SceneNode* node = hierarchy.node(i);
+		if (node->getRenderable()) {
+			QMatrix4x4 toWorld = hierarchy.world(i);
+			toWorld.scale(node->getModelScale());
+			addInstance(&node->getRenderable()->bvh(), toWorld, i);
+		}
+	}
+	return build(threadCount);
+}
+
+bool SceneBvh::intersect(const Vec3& origin, const Vec3& direction, Hit& hit, float tMax) const
+{
+	hit.t = tMax;
+	hit.instance = -1;
+	hit.face = -1;
+	hit.u = hit.v = 0.0f;
+	const std::vector<Bvh::Node>& nodes = top_.nodes();
+	const Vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	if (nodes.empty() || enter(nodes[0], origin, inverseDirection, tMax) == INFINITY) {
+		return false;
+	}
+
+	// Nearer child first, as in Bvh::intersect, with instances in place of triangles
+	int stack[Bvh::MAX_DEPTH];
+	float stackEnter[Bvh::MAX_DEPTH];
+	int size = 0;
+	int current = 0;
+	for (;;) {
+		const Bvh::Node& node = nodes[current];
+		if (node.count > 0) {
+			for (int ii = node.first; ii < node.first + node.count; ++ii) {
+				const int index = top_.faceOrder()[ii];
+				const Instance& instance = instances_[index];
+				const Vec3 modelOrigin(instance.toModel.map(QVector3D(origin.x, origin.y, origin.z)));
+				const Vec3 modelDirection(instance.toModel.mapVector(QVector3D(direction.x, direction.y, direction.z)));
+				Bvh::Hit meshHit;
+				if (instance.mesh->intersect(modelOrigin, modelDirection, meshHit, hit.t)) {
+					hit.t = meshHit.t;
+					hit.instance = index;
+					hit.face = meshHit.face;
+					hit.u = meshHit.u;
+					hit.v = meshHit.v;
+				}
+			}
+		} else {
+			int nearChild = node.first;
+			int farChild = node.first + 1;
+			float nearEnter = enter(nodes[nearChild], origin, inverseDirection, hit.t);
+			float farEnter = enter(nodes[farChild], origin, inverseDirection, hit.t);
+			if (farEnter < nearEnter) {
+				std::swap(nearChild, farChild);
+				std::swap(nearEnter, farEnter);
+			}
+			if (nearEnter != INFINITY) {
+				if (farEnter != INFINITY) {
+					stack[size] = farChild;
+					stackEnter[size] = farEnter;
+					++size;
+				}
+				current = nearChild;
+				continue;
+			}
+		}
+
+		current = -1;
+		while (size > 0) {
+			--size;
+			if (stackEnter[size] <= hit.t) {
+				current = stack[size];
+				break;
+			}
+		}
+		if (current < 0) {
+			break;
+		}
+	}
+	return hit.instance >= 0;
+}
+
+void SceneBvh::intersect(const Bvh::Packet& packet, int count, Hit* hits) const
+{
+	// Every ray's closest hit so far; rays past count look no distance at all, so they never
+	// enter anything
+	float bestT[Bvh::MAX_PACKET];
+	Vec3 origins[Bvh::MAX_PACKET];
+	Vec3 directions[Bvh::MAX_PACKET];
+	Vec3 inverseDirections[Bvh::MAX_PACKET];
+	for (int ii = 0; ii < Bvh::MAX_PACKET; ++ii) {
+		const int ray = ii < count ? ii : 0;
+		bestT[ii] = ii < count ? packet.tMax[ii] : -1.0f;
+		origins[ii] = Vec3(packet.origin[0][ray], packet.origin[1][ray], packet.origin[2][ray]);
+		directions[ii] = Vec3(packet.direction[0][ray], packet.direction[1][ray], packet.direction[2][ray]);
+		inverseDirections[ii] = Vec3(1.0f / directions[ii].x, 1.0f / directions[ii].y, 1.0f / directions[ii].z);
+	}
+	for (int ii = 0; ii < count; ++ii) {
+		hits[ii].t = packet.tMax[ii];
+		hits[ii].instance = -1;
+		hits[ii].face = -1;
+		hits[ii].u = hits[ii].v = 0.0f;
+	}
+	const std::vector<Bvh::Node>& nodes = top_.nodes();
+	if (nodes.empty()) {
+		return;
+	}
+
+#ifdef SCENE_BVH_SSE
+	// Top tree boxes are tested eight rays at a time, as two groups of four
+	__m128 origin4[2][3], inverse4[2][3];
+	for (int group = 0; group < 2; ++group) {
+		for (int axis = 0; axis < 3; ++axis) {
+			float lanes[2][4];
+			for (int lane = 0; lane < 4; ++lane) {
+				lanes[0][lane] = origins[group * 4 + lane][axis];
+				lanes[1][lane] = inverseDirections[group * 4 + lane][axis];
+			}
+			origin4[group][axis] = _mm_loadu_ps(lanes[0]);
+			inverse4[group][axis] = _mm_loadu_ps(lanes[1]);
+		}
+	}
+	// Bit per ray that reaches node before its closest hit
+	const auto entering = [&](const Bvh::Node& node) {
+		const __m128 infinity = _mm_set1_ps(INFINITY);
+		const int low = _mm_movemask_ps(_mm_cmpneq_ps(enter4(node, origin4[0], inverse4[0], _mm_loadu_ps(bestT)), infinity));
+		const int high = _mm_movemask_ps(_mm_cmpneq_ps(enter4(node, origin4[1], inverse4[1], _mm_loadu_ps(bestT + 4)), infinity));
+		return low | high << 4;
+	};
+	// Where the first of the rays enters a node, INFINITY if none of them reach it
+	const auto enterAny = [&](const Bvh::Node& node) {
+		__m128 value = _mm_min_ps(enter4(node, origin4[0], inverse4[0], _mm_loadu_ps(bestT)),
+			enter4(node, origin4[1], inverse4[1], _mm_loadu_ps(bestT + 4)));
+		value = _mm_min_ps(value, _mm_shuffle_ps(value, value, _MM_SHUFFLE(1, 0, 3, 2)));
+		value = _mm_min_ps(value, _mm_shuffle_ps(value, value, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtss_f32(value);
+	};
+#else
+	const auto entering = [&](const Bvh::Node& node) {
+		int mask = 0;
+		for (int ii = 0; ii < count; ++ii) {
+			mask |= enter(node, origins[ii], inverseDirections[ii], bestT[ii]) != INFINITY ? 1 << ii : 0;
+		}
+		return mask;
+	};
+	const auto enterAny = [&](const Bvh::Node& node) {
+		float nearest = INFINITY;
+		for (int ii = 0; ii < count; ++ii) {
+			nearest = std::min(nearest, enter(node, origins[ii], inverseDirections[ii], bestT[ii]));
+		}
+		return nearest;
+	};
+#endif
+	const auto farthest = [&]() {
+		float t = 0.0f;
+		for (int ii = 0; ii < count; ++ii) {
+			t = std::max(t, bestT[ii]);
+		}
+		return t;
+	};
+	if (enterAny(nodes[0]) == INFINITY) {
+		return;
+	}
+
+	// The same walk as Bvh's, with instances in place of triangles
+	int stack[Bvh::MAX_DEPTH];
+	float stackEnter[Bvh::MAX_DEPTH];
+	int size = 0;
+	int current = 0;
+	Bvh::Packet model;
+	Bvh::Hit meshHits[Bvh::MAX_PACKET];
+	int rays[Bvh::MAX_PACKET];
+	for (;;) {
+		const Bvh::Node& node = nodes[current];
+		if (node.count > 0) {
+			for (int ii = node.first; ii < node.first + node.count; ++ii) {
+				const int index = top_.faceOrder()[ii];
+				const Instance& instance = instances_[index];
+				// Only the rays reaching the instance's own box go in, packed to the front so a
+				// few stragglers are traced as one group of four rather than two
+				const int reaching = entering(boxes_[index]);
+				int active = 0;
+				for (int ray = 0; ray < count; ++ray) {
+					if (!(reaching & 1 << ray)) {
+						continue;
+					}
+					const QVector3D modelOrigin = instance.toModel.map(QVector3D(origins[ray].x, origins[ray].y, origins[ray].z));
+					const QVector3D modelDirection = instance.toModel.mapVector(QVector3D(directions[ray].x, directions[ray].y, directions[ray].z));
+					for (int axis = 0; axis < 3; ++axis) {
+						model.origin[axis][active] = modelOrigin[axis];
+						model.direction[axis][active] = modelDirection[axis];
+					}
+					model.tMax[active] = bestT[ray];
+					rays[active] = ray;
+					++active;
+				}
+				if (active == 0) {
+					continue;
+				}
+				instance.mesh->intersect(model, active, meshHits);
+				for (int lane = 0; lane < active; ++lane) {
+					if (meshHits[lane].face >= 0) {
+						Hit& hit = hits[rays[lane]];
+						hit.t = bestT[rays[lane]] = meshHits[lane].t;
+						hit.instance = index;
+						hit.face = meshHits[lane].face;
+						hit.u = meshHits[lane].u;
+						hit.v = meshHits[lane].v;
+					}
+				}
+			}
+		} else {
+			int nearChild = node.first;
+			int farChild = node.first + 1;
+			float nearEnter = enterAny(nodes[nearChild]);
+			float farEnter = enterAny(nodes[farChild]);
+			if (farEnter < nearEnter) {
+				std::swap(nearChild, farChild);
+				std::swap(nearEnter, farEnter);
+			}
+			if (nearEnter != INFINITY) {
+				if (farEnter != INFINITY) {
+					stack[size] = farChild;
+					stackEnter[size] = farEnter;
+					++size;
+				}
+				current = nearChild;
+				continue;
+			}
+		}
+
+		current = -1;
+		while (size > 0) {
+			--size;
+			if (stackEnter[size] <= farthest()) {
+				current = stack[size];
+				break;
+			}
+		}
+		if (current < 0) {
+			break;
+		}
+	}
+}
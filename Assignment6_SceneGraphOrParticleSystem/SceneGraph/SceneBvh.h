@@ -0,0 +1,62 @@
+#pragma once
+
+#include <QtGui>
+#include "Bvh.h"
+
+#include <vector>
+
+class TransformHierarchy;
+
+// Two-level hierarchy for tracing rays through the scene. Each mesh has one Bvh over its own
+// triangles in model space (Renderable::bvh()); this builds a top-level tree over instances of
+// them, a mesh and the transform that places it. Rays walk the top tree in world space and are
+// carried into the model space of every instance they reach, so a mesh drawn a thousand times,
+// like the solar system's sphere, is stored once.
+//
+// Transforms are affine and model-space rays aren't renormalized, so t means the same distance
+// in every instance and hits compare directly.
+class SceneBvh
+{
+public:
+	struct Instance {
+		const Bvh* mesh;
+		QMatrix4x4 toWorld;
+		QMatrix4x4 toModel;
+		int id;
+	};
+
+	struct Hit {
+		float t;
+		int instance;	// Index into instances(), -1 for a miss
+		int face;		// Index into the instance's mesh faces
+		float u, v;
+	};
+
+	SceneBvh();
+
+	void clear();
+	// Place mesh in the world with toWorld. It must outlive the tree.
+	void addInstance(const Bvh* mesh, const QMatrix4x4& toWorld, int id = -1);
+	// Build the top-level tree over the instances added so far
+	Bvh::Stats build(int threadCount = 0);
+	// Rebuild from every node of hierarchy with a renderable, at its world matrix and model
+	// scale, its id being its index in hierarchy
+	Bvh::Stats build(const TransformHierarchy& hierarchy, int threadCount = 0);
+
+	// Closest hit along origin + t * direction in world space, with t in (0, tMax]
+	bool intersect(const Vec3& origin, const Vec3& direction, Hit& hit, float tMax = 1e30f) const;
+	// Closest hits of the first count rays of packet. The top tree is walked once for all of
+	// them and each instance reached traces them as a packet.
+	void intersect(const Bvh::Packet& packet, int count, Hit* hits) const;
+
+	inline const std::vector<Instance>& instances() const { return instances_; }
+	inline const Bvh& top() const { return top_; }
+	// The top tree and the instances, leaving out the meshes they share
+	inline size_t bytes() const { return top_.bytes() + instances_.size() * (sizeof(Instance) + sizeof(Bvh::Node)); }
+
+private:
+	std::vector<Instance> instances_;
+	// Each instance's world box, as a node so the top tree's box test applies
+	std::vector<Bvh::Node> boxes_;
+	Bvh top_;
+};
@@ -1,43 +1,79 @@
 #include "SceneNode.h"
 
-SceneNode::SceneNode(Renderable* renderable): parent(nullptr), modelScale(1, 1, 1), diffuseMap(QOpenGLTexture::Target2D), normalMap(QOpenGLTexture::Target2D), lights(nullptr)
+SceneNode::SceneNode(Renderable* renderable): parent(nullptr), hierarchy(nullptr), transformIndex(-1), modelScale(1, 1, 1),
+	diffuseMaps(nullptr), diffuseTexture(-1), normalMaps(nullptr), normalTexture(-1), lights(nullptr), opacity(1.0f), occluder(nullptr)
 {
 	this->renderable = renderable;
 }
 
 SceneNode::~SceneNode() {
-	if (diffuseMap.isCreated()) {
-		diffuseMap.destroy();
-	}
-	if (normalMap.isCreated()) {
-		normalMap.destroy();
-	}
 	for (SceneNode* child : children) {
 		delete child;
 	}
 }
 
-void SceneNode::update(const qint64 msSinceLastFrame) {
-	if (parent) {
-		worldTransform = parent->worldTransform * localTransform;
+void SceneNode::addChild(SceneNode* node) {
+	node->parent = this;
+	children << node;
+	// The flattened order no longer matches the tree
+	if (hierarchy) {
+		hierarchy->invalidate();
+	}
+}
+
+void SceneNode::setModelScale(const QVector3D& scale) {
+	modelScale = scale;
+	// Bounds are cached with the model scale applied
+	if (hierarchy) {
+		hierarchy->invalidate();
+	}
+}
+
+void SceneNode::setLocalTranslation(const QVector3D& translation) {
+	if (hierarchy) {
+		hierarchy->setTranslation(transformIndex, translation);
 	}
 	else {
-		worldTransform = localTransform;
+		local.translation = translation;
 	}
+}
 
-	for (SceneNode* child : children) {
-		child->update(msSinceLastFrame);
+void SceneNode::setLocalRotation(const QQuaternion& rotation) {
+	if (hierarchy) {
+		hierarchy->setRotation(transformIndex, rotation);
+	}
+	else {
+		local.rotation = rotation;
 	}
 }
 
-void SceneNode::draw(const QMatrix4x4& worldSpaceModelMatrix, const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix, const DrawMode drawMode) {
-	if (renderable)
-	{
-		renderable->draw(worldSpaceModelMatrix, viewPosition, viewMatrix, projectionMatrix, drawMode, &diffuseMap, &normalMap, lights);
+void SceneNode::setLocalScale(const QVector3D& scale) {
+	if (hierarchy) {
+		hierarchy->setScale(transformIndex, scale);
+	}
+	else {
+		local.scale = scale;
 	}
 }
 
-void SceneNode::addChild(SceneNode* node) {
-	node->parent = this;
-	children << node;
+void SceneNode::setSpin(const QVector3D& axis, float degreesPerSecond) {
+	if (hierarchy) {
+		hierarchy->setSpin(transformIndex, axis, degreesPerSecond);
+	}
+	else {
+		local.spinAxis = axis;
+		local.spinDegreesPerSecond = degreesPerSecond;
+	}
+}
+
+LocalTransform SceneNode::getLocal() const {
+	return hierarchy ? hierarchy->local(transformIndex) : local;
+}
+
+QMatrix4x4 SceneNode::getWorldTransform() const {
+	if (hierarchy) {
+		return hierarchy->world(transformIndex);
+	}
+	// Not flattened yet, so walk up the tree
+	return parent ? parent->getWorldTransform() * getLocalTransform() : getLocalTransform();
 }
\ No newline at end of file
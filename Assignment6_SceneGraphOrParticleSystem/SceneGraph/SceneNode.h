@@ -3,39 +3,66 @@
 #include <QtCore>
 #include <QtOpenGL>
 #include "Renderable.h"
+#include "TextureArray.h"
+#include "TransformHierarchy.h"
+
+struct OccluderMesh;
 
 class SceneNode {
 public:
 	SceneNode(Renderable* renderable = nullptr);
 	virtual ~SceneNode();
 
-	// Update and draw
-	virtual void update(const qint64 msSinceLastFrame);
-	virtual void draw(const QMatrix4x4& worldSpaceModelMatrix, const QVector3D& viewPosition, const QMatrix4x4& viewMatrix, const QMatrix4x4& projectionMatrix, const DrawMode drawMode);
-
 	// Add children
 	void addChild(SceneNode* node);
 
-	// Setters/getters
-	inline void setLocalTransform(const QMatrix4x4& transform) { localTransform = transform; }
-	inline const QMatrix4x4& getLocalTransform() const { return localTransform; }
+	// Local transform. Once the scene has been flattened into a TransformHierarchy
+	// these read and write the hierarchy's arrays; world transforms live there too.
+	void setLocalTranslation(const QVector3D& translation);
+	void setLocalRotation(const QQuaternion& rotation);
+	void setLocalScale(const QVector3D& scale);
+	// Rotate continuously about axis
+	void setSpin(const QVector3D& axis, float degreesPerSecond);
+	LocalTransform getLocal() const;
+	inline QMatrix4x4 getLocalTransform() const { return getLocal().toMatrix(); }
+	QMatrix4x4 getWorldTransform() const;
 
-	inline const QMatrix4x4& getWorldTransform() const { return worldTransform; }
+	inline TransformHierarchy* getHierarchy() const { return hierarchy; }
+	inline int getTransformIndex() const { return transformIndex; }
+	inline void attach(TransformHierarchy* hierarchy, int transformIndex) { this->hierarchy = hierarchy; this->transformIndex = transformIndex; }
 
 	inline const QVector3D& getModelScale() const { return modelScale; }
-	inline void setModelScale(const QVector3D& scale) { modelScale = scale; }
+	void setModelScale(const QVector3D& scale);
 	
 	inline void setRenderable(Renderable* renderable) { this->renderable = renderable; }
 	inline Renderable* getRenderable() const { return renderable; }
 
-	inline const QOpenGLTexture& getDiffuseMap() const { return diffuseMap; }
-	inline void setDiffuseMap(const QImage& diffuseMap) { this->diffuseMap.setData(diffuseMap); }
+	// Textures live in shared array textures, so nodes can be drawn together. A node only
+	// keeps the index of its texture; the array knows which layer and region that is.
+	inline TextureArray* getDiffuseMaps() const { return diffuseMaps; }
+	inline int getDiffuseTexture() const { return diffuseTexture; }
+	inline void setDiffuseMap(TextureArray* maps, const QImage& diffuseMap) { diffuseMaps = maps; diffuseTexture = maps->addImage(diffuseMap); }
+	// Decode the file in the background; the node shows a placeholder until it arrives
+	inline void setDiffuseMap(TextureArray* maps, const QString& diffuseFile) { diffuseMaps = maps; diffuseTexture = maps->addFile(diffuseFile); }
+	// Share a texture already in the array
+	inline void setDiffuseTexture(TextureArray* maps, int texture) { diffuseMaps = maps; diffuseTexture = texture; }
 	
-	inline const QOpenGLTexture& getNormalMap() const { return normalMap; }
-	inline void setNormalMap(const QImage& normalMap) { this->normalMap.setData(normalMap); }
+	inline TextureArray* getNormalMaps() const { return normalMaps; }
+	inline int getNormalTexture() const { return normalTexture; }
+	inline void setNormalMap(TextureArray* maps, const QImage& normalMap) { normalMaps = maps; normalTexture = maps->addImage(normalMap); }
+	inline void setNormalMap(TextureArray* maps, const QString& normalFile) { normalMaps = maps; normalTexture = maps->addFile(normalFile); }
 
 	inline void setLights(QVector<PointLight>* lights) { this->lights = lights; }
 	inline QVector<PointLight>* getLights() const { return lights; }
+
+	// Below 1 the node is translucent, drawn after opaque nodes and farthest first
+	inline float getOpacity() const { return opacity; }
+	inline void setOpacity(float opacity) { this->opacity = opacity; }
+
+	// Drawn into the occlusion culler's depth buffer, at the node's world transform and model
+	// scale, to hide what is behind the node. Only for opaque nodes; the mesh is not owned.
+	inline const OccluderMesh* getOccluder() const { return occluder; }
+	inline void setOccluder(const OccluderMesh* mesh) { occluder = mesh; }
 	
 	// Iterators for children
 	inline QVector<SceneNode*>::const_iterator begin() { return children.begin(); }
@@ -47,14 +74,20 @@ protected:
 	
 	Renderable* renderable;
 	
-	QMatrix4x4 localTransform;
-	QMatrix4x4 worldTransform;
+	// Only used until the node is attached to a hierarchy
+	LocalTransform local;
+	TransformHierarchy* hierarchy;
+	int transformIndex;
 	QVector3D modelScale;
 
-	QOpenGLTexture diffuseMap;
-	QOpenGLTexture normalMap;
+	TextureArray* diffuseMaps;
+	int diffuseTexture;
+	TextureArray* normalMaps;
+	int normalTexture;
 
 	QVector<PointLight>* lights;
+	float opacity;
+	const OccluderMesh* occluder;
 };
 
 
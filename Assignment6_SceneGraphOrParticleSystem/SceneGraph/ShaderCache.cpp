@@ -0,0 +1,186 @@
+#include "ShaderCache.h"
+
+#include <cstring>
+
+ShaderCache& ShaderCache::instance()
+{
+	static ShaderCache cache;
+	return cache;
+}
+
+ShaderCache::ShaderCache() : context_(nullptr), binariesSupported_(false), binaryDirectory_("shadercache"),
+	compiledCount_(0), binaryLoadCount_(0), buildMs_(0.0)
+{}
+
+void ShaderCache::initialize()
+{
+	QOpenGLContext* context = QOpenGLContext::currentContext();
+	if (context == context_) {
+		return;
+	}
+	if (context_ && !programs_.isEmpty()) {
+		qDebug() << "ShaderCache: programs from a previous context were not cleared";
+	}
+	context_ = context;
+	initializeOpenGLFunctions();
+
+	// Program binaries are core in 4.1 and an extension before that
+	GLint formats = 0;
+	if (context->format().version() >= qMakePair(4, 1) || context->hasExtension("GL_ARB_get_program_binary")) {
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	}
+	binariesSupported_ = formats > 0;
+
+	driverKey_ = QByteArray(reinterpret_cast<const char*>(glGetString(GL_VENDOR))) + '\n' +
+		QByteArray(reinterpret_cast<const char*>(glGetString(GL_RENDERER))) + '\n' +
+		QByteArray(reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+}
+
+void ShaderCache::setBinaryDirectory(const QString& directory)
+{
+	binaryDirectory_ = directory;
+}
+
+const QByteArray& ShaderCache::source(const QString& file)
+{
+	auto it = sources_.find(file);
+	if (it == sources_.end()) {
+		QFile f(file);
+		if (!f.open(QIODevice::ReadOnly)) {
+			qDebug() << "ShaderCache: could not open" << file;
+		}
+		it = sources_.insert(file, f.readAll());
+	}
+	return it.value();
+}
+
+QByteArray ShaderCache::injectDefines(const QByteArray& source, const QStringList& defines)
+{
+	if (defines.isEmpty()) {
+		return source;
+	}
+	QByteArray block;
+	for (const QString& define : defines) {
+		block += "#define " + define.toUtf8() + "\n";
+	}
+	// #version has to stay the first statement
+	int insertAt = 0;
+	if (source.trimmed().startsWith("#version")) {
+		const int newline = source.indexOf('\n', source.indexOf("#version"));
+		insertAt = newline < 0 ? source.size() : newline + 1;
+	}
+	QByteArray result = source;
+	result.insert(insertAt, block);
+	return result;
+}
+
+QOpenGLShaderProgram* ShaderCache::program(const QString& vertexFile, const QString& fragmentFile, const QStringList& defines)
+{
+	initialize();
+
+	const QByteArray vertexSource = injectDefines(source(vertexFile), defines);
+	const QByteArray fragmentSource = injectDefines(source(fragmentFile), defines);
+
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	hash.addData(vertexSource);
+	hash.addData("\0", 1);
+	hash.addData(fragmentSource);
+	const QByteArray key = hash.result();
+
+	auto it = programs_.find(key);
+	if (it != programs_.end()) {
+		return it.value();
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+
+	QOpenGLShaderProgram* program = new QOpenGLShaderProgram();
+	program->create();
+
+	// A driver update invalidates old binaries, so the driver is part of the file name
+	QString binaryPath;
+	if (binariesSupported_) {
+		const QByteArray fileKey = QCryptographicHash::hash(key + driverKey_, QCryptographicHash::Sha1).toHex();
+		binaryPath = binaryDirectory_ + "/" + QString::fromLatin1(fileKey) + ".bin";
+	}
+
+	if (!binaryPath.isEmpty() && loadBinary(binaryPath, program)) {
+		++binaryLoadCount_;
+	}
+	else {
+		bool ok = program->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexSource);
+		if (!ok) {
+			qDebug() << vertexFile << program->log();
+		}
+		ok = program->addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentSource);
+		if (!ok) {
+			qDebug() << fragmentFile << program->log();
+		}
+		if (binariesSupported_) {
+			glProgramParameteri(program->programId(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+		ok = program->link();
+		if (!ok) {
+			qDebug() << program->log();
+		}
+		else if (!binaryPath.isEmpty()) {
+			saveBinary(binaryPath, program);
+		}
+		++compiledCount_;
+	}
+
+	buildMs_ += timer.nsecsElapsed() / 1e6;
+	programs_.insert(key, program);
+	return program;
+}
+
+bool ShaderCache::loadBinary(const QString& path, QOpenGLShaderProgram* program)
+{
+	QFile file(path);
+	if (!file.open(QIODevice::ReadOnly)) {
+		return false;
+	}
+	const QByteArray contents = file.readAll();
+	if (contents.size() <= int(sizeof(GLenum))) {
+		return false;
+	}
+
+	// The file is the binary format followed by the binary itself
+	GLenum format;
+	memcpy(&format, contents.constData(), sizeof(GLenum));
+	glProgramBinary(program->programId(), format, contents.constData() + sizeof(GLenum), contents.size() - sizeof(GLenum));
+
+	// With no shaders attached, link() just reports whether the binary was accepted
+	if (!program->link()) {
+		qDebug() << "ShaderCache: rejected stale binary" << path;
+		return false;
+	}
+	return true;
+}
+
+void ShaderCache::saveBinary(const QString& path, QOpenGLShaderProgram* program)
+{
+	GLint length = 0;
+	glGetProgramiv(program->programId(), GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) {
+		return;
+	}
+
+	QByteArray contents(int(sizeof(GLenum)) + length, Qt::Uninitialized);
+	GLenum format = 0;
+	glGetProgramBinary(program->programId(), length, nullptr, &format, contents.data() + sizeof(GLenum));
+	memcpy(contents.data(), &format, sizeof(GLenum));
+
+	QDir().mkpath(binaryDirectory_);
+	QFile file(path);
+	if (!file.open(QIODevice::WriteOnly) || file.write(contents) != contents.size()) {
+		qDebug() << "ShaderCache: could not write" << path;
+	}
+}
+
+void ShaderCache::clear()
+{
+	qDeleteAll(programs_);
+	programs_.clear();
+}
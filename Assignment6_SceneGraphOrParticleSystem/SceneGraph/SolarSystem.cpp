@@ -2,6 +2,15 @@
 #include "RotatingNode.h"
 #include "Sphere.h"
 
+#include <random>
+
+namespace {
+	// Translucent ice chunks circling Jupiter
+	const int RING_CHUNKS = 160;
+	// Rocks in the belt at startup
+	const int ASTEROIDS = 10000;
+}
+
 
 void SolarSystem::createGeometryAndLights()
 {
@@ -12,6 +21,30 @@ void SolarSystem::createGeometryAndLights()
 		sphere->init(sphereTris.vertices(), sphereTris.faces());
 	}
 
+	if (!occluderSphere)
+	{
+		// The drawn sphere's faces are all at least 0.993 from its centre, so this stays inside
+		const Sphere coarse(0.99, 12, 8);
+		occluderSphere = new OccluderMesh(coarse.vertices(), coarse.faces());
+	}
+
+	if (!diffuseMaps)
+	{
+		diffuseMaps = new TextureArray();
+	}
+
+	if (!asteroid)
+	{
+		QVector<Vertex> vertices;
+		QVector<Face> faces;
+		QVector<GpuCuller::Lod> lods;
+		asteroidMesh(vertices, faces, lods);
+		asteroid = new Renderable();
+		asteroid->init(vertices, faces);
+		asteroidBelt = new GpuCuller();
+		asteroidBelt->create(asteroid, lods, 1.0f);
+	}
+
 	if (!sunLight)
 	{
 		sunLight = new QVector<PointLight>();
@@ -28,17 +61,105 @@ void SolarSystem::createGeometryAndLights()
 void SolarSystem::deleteGeometryAndLights()
 {
 	if (sphere) { delete sphere; }
+	if (occluderSphere) { delete occluderSphere; }
+	if (asteroidBelt) { asteroidBelt->destroy(); delete asteroidBelt; }
+	if (asteroid) { delete asteroid; }
+	if (diffuseMaps) { delete diffuseMaps; }
 	if (sunLight) { delete sunLight; }
 	if (lightForSun) { delete lightForSun; }
 }
 
+void SolarSystem::setSwarmLightCount(int count)
+{
+	if (!sunLight) {
+		return;
+	}
+	// The sun's light always comes first
+	sunLight->resize(1);
+	swarmOrbits.resize(0);
+
+	// Same seed every time, so a given count always gives the same swarm
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	for (int ii = 0; ii < count; ++ii) {
+		const QVector4D orbit(3.0f + 22.0f * unit(rng), 4.0f * unit(rng) - 2.0f, 6.2831853f * unit(rng), (0.0002f + 0.0006f * unit(rng)) * (unit(rng) < 0.5f ? -1.0f : 1.0f));
+		swarmOrbits << orbit;
+		const QColor hue = QColor::fromHsvF(unit(rng), 0.8, 1.0);
+		// Steep falloff keeps each light to a few units around it
+		sunLight->append(PointLight(QVector3D(), 0.5f * QVector3D(hue.redF(), hue.greenF(), hue.blueF()), 0.0f, 0.5f, 1.0f, 1.0f, 8.0f));
+	}
+	animateLights(0);
+}
+
+void SolarSystem::animateLights(qint64 msSinceLastFrame)
+{
+	for (int ii = 0; ii < swarmOrbits.size(); ++ii) {
+		QVector4D& orbit = swarmOrbits[ii];
+		orbit.setZ(std::fmod(orbit.z() + orbit.w() * msSinceLastFrame, 6.2831853f));
+		(*sunLight)[ii + 1].position = QVector3D(orbit.x() * std::cos(orbit.z()), orbit.y(), orbit.x() * std::sin(orbit.z()));
+	}
+}
+
+void SolarSystem::asteroidMesh(QVector<Vertex>& vertices, QVector<Face>& faces, QVector<GpuCuller::Lod>& lods)
+{
+	// Near rocks get the finest sphere; far ones cover a few pixels, so a coarse one will do
+	const int sectors[] = { 20, 10, 6 };
+	const int stacks[] = { 14, 7, 4 };
+	const float maxDistances[] = { 10.0f, 25.0f, 0.0f };
+	vertices.resize(0);
+	faces.resize(0);
+	lods.resize(0);
+	for (int lod = 0; lod < 3; ++lod) {
+		const Sphere sphere(1.0, sectors[lod], stacks[lod]);
+		const unsigned int base = vertices.size();
+		GpuCuller::Lod level;
+		level.firstFace = faces.size();
+		level.faceCount = sphere.faces().size();
+		level.maxDistance = maxDistances[lod];
+		lods << level;
+		vertices << sphere.vertices();
+		for (const Face& face : sphere.faces()) {
+			faces << Face(base + face.a, base + face.b, base + face.c);
+		}
+	}
+}
+
+QVector<GpuCuller::Instance> SolarSystem::generateAsteroids(int count)
+{
+	// Same seed every time, so a given count always gives the same belt
+	std::mt19937 rng(4321);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	QVector<GpuCuller::Instance> asteroids(count);
+	for (GpuCuller::Instance& rock : asteroids) {
+		const float angle = 6.2831853f * unit(rng);
+		const float radius = 14.0f + 5.0f * unit(rng);
+		rock.centerScale[0] = radius * std::cos(angle);
+		rock.centerScale[1] = unit(rng) - 0.5f;
+		rock.centerScale[2] = radius * std::sin(angle);
+		rock.centerScale[3] = 0.03f + 0.06f * unit(rng);
+		const QQuaternion rotation = QQuaternion(unit(rng) - 0.5f, unit(rng) - 0.5f, unit(rng) - 0.5f, unit(rng) - 0.5f).normalized();
+		rock.rotation[0] = rotation.x();
+		rock.rotation[1] = rotation.y();
+		rock.rotation[2] = rotation.z();
+		rock.rotation[3] = rotation.scalar();
+	}
+	return asteroids;
+}
+
+void SolarSystem::setAsteroidCount(int count)
+{
+	if (asteroidBelt) {
+		asteroidBelt->setInstances(generateAsteroids(count));
+	}
+}
+
 SolarSystem::~SolarSystem()
 {
 	deleteGeometryAndLights();
 }
 
 
-SolarSystem::SolarSystem(): sphere(nullptr), sunLight(nullptr), lightForSun(nullptr)
+SolarSystem::SolarSystem(): sphere(nullptr), occluderSphere(nullptr), asteroid(nullptr), asteroidBelt(nullptr), diffuseMaps(nullptr), sunLight(nullptr), lightForSun(nullptr)
 {
 	// Prepare texture directory
 	QDir texDir = QDir::current();
@@ -47,20 +168,12 @@ SolarSystem::SolarSystem(): sphere(nullptr), sunLight(nullptr), lightForSun(null
 	}
 	texDir.cd("textures");
 
-	// Helper function for loading textures
-	auto loadImage = [&](const QString& imageName) -> QImage
+	// Helper function for locating textures. They are decoded in the background.
+	auto texturePath = [&](const QString& imageName) -> QString
 	{
-		return QImage(texDir.filePath(imageName));
+		return texDir.filePath(imageName);
 	};
 
-	// Helper function for constructing transforms
-	auto translationMatrix = [](const QVector3D& translation) -> QMatrix4x4
-	{
-		QMatrix4x4 matrix = QMatrix4x4();
-		matrix.translate(translation);
-		return matrix;
-	};
-	
 	qDebug() << "Loading solar system...";
 	createGeometryAndLights();
 
@@ -68,101 +181,156 @@ SolarSystem::SolarSystem(): sphere(nullptr), sunLight(nullptr), lightForSun(null
 	qDebug() << "  Loading Sun...";
 	SceneNode* sun = new RotatingNode(sphere, 0.02f);
 	sun->setModelScale(QVector3D(3.0f, 3.0f, 3.0f));
-	sun->setDiffuseMap(loadImage("sun.ppm"));
+	sun->setDiffuseMap(diffuseMaps, texturePath("sun.ppm"));
 	sun->setLights(lightForSun);
+	sun->setOccluder(occluderSphere);
 	addChild(sun);
 
 	// ~~~~~~~~~~ MERCURY ~~~~~~~~~~
 	qDebug() << "  Loading Mercury...";
 	SceneNode* mercury = new RotatingNode(sphere, 0.02f);
-	mercury->setLocalTransform(translationMatrix(QVector3D(-2.0f, 0.0f, -5.0f)));
+	mercury->setLocalTranslation(QVector3D(-2.0f, 0.0f, -5.0f));
 	mercury->setModelScale(QVector3D(0.25f, 0.25f, 0.25f));
-	mercury->setDiffuseMap(loadImage("mercury.ppm"));
+	mercury->setDiffuseMap(diffuseMaps, texturePath("mercury.ppm"));
 	mercury->setLights(sunLight);
+	mercury->setOccluder(occluderSphere);
 	sun->addChild(mercury);
 
 	// ~~~~~~~~~~ VENUS ~~~~~~~~~~
 	qDebug() << "  Loading Venus...";
 	SceneNode* venus = new RotatingNode(sphere, 0.03f);
-	venus->setLocalTransform(translationMatrix(QVector3D(6.0f, 0.0f, 3.0f)));
+	venus->setLocalTranslation(QVector3D(6.0f, 0.0f, 3.0f));
 	venus->setModelScale(QVector3D(0.35f, 0.35f, 0.35f));
-	venus->setDiffuseMap(loadImage("venus.ppm"));
+	venus->setDiffuseMap(diffuseMaps, texturePath("venus.ppm"));
 	venus->setLights(sunLight);
+	venus->setOccluder(occluderSphere);
 	sun->addChild(venus);
 
 	// ~~~~~~~~~~ EARTH & MOON ~~~~~~~~~~
 	qDebug() << "  Loading Earth...";
 	SceneNode* earth = new RotatingNode(sphere, 0.05f);
-	earth->setLocalTransform(translationMatrix(QVector3D(10.0f, 0.0f, 0.0f)));
+	earth->setLocalTranslation(QVector3D(10.0f, 0.0f, 0.0f));
 	earth->setModelScale(QVector3D(0.5f, 0.5f, 0.5f));
-	earth->setDiffuseMap(loadImage("earth.ppm"));
+	earth->setDiffuseMap(diffuseMaps, texturePath("earth.ppm"));
 	earth->setLights(sunLight);
+	earth->setOccluder(occluderSphere);
 	sun->addChild(earth);
 
 	qDebug() << "    Loading Moon...";
 	SceneNode* moon = new RotatingNode(sphere, 0.0f);
-	moon->setLocalTransform(translationMatrix(QVector3D(0.0f, 0.0f, 1.0f)));
+	moon->setLocalTranslation(QVector3D(0.0f, 0.0f, 1.0f));
 	moon->setModelScale(QVector3D(0.1f, 0.1f, 0.1f));
-	moon->setDiffuseMap(loadImage("moon.ppm"));
+	moon->setDiffuseMap(diffuseMaps, texturePath("moon.ppm"));
 	moon->setLights(sunLight);
 	earth->addChild(moon);
 
 	// ~~~~~~~~~~ MARS & MOONS ~~~~~~~~~~
 	qDebug() << "  Loading Mars...";
 	SceneNode* mars = new RotatingNode(sphere, 0.045f);
-	mars->setLocalTransform(translationMatrix(QVector3D(-10.0f, 0.0f, 5.0f)));
+	mars->setLocalTranslation(QVector3D(-10.0f, 0.0f, 5.0f));
 	mars->setModelScale(QVector3D(0.4f, 0.4f, 0.4f));
-	mars->setDiffuseMap(loadImage("mars.ppm"));
+	mars->setDiffuseMap(diffuseMaps, texturePath("mars.ppm"));
 	mars->setLights(sunLight);
+	mars->setOccluder(occluderSphere);
 	sun->addChild(mars);
 
 	qDebug() << "    Loading Phobos...";
 	SceneNode* phobos = new RotatingNode(sphere, 0.07f);
-	phobos->setLocalTransform(translationMatrix(QVector3D(-0.4f, 0.0f, -0.4f)));
+	phobos->setLocalTranslation(QVector3D(-0.4f, 0.0f, -0.4f));
 	phobos->setModelScale(QVector3D(0.09f, 0.09f, 0.09f));
-	phobos->setDiffuseMap(loadImage("moon.ppm"));
+	phobos->setDiffuseMap(diffuseMaps, texturePath("moon.ppm"));
 	phobos->setLights(sunLight);
 	mars->addChild(phobos);
 
 	qDebug() << "    Loading Deimos...";
 	SceneNode* deimos = new RotatingNode(sphere, 0.05f);
-	deimos->setLocalTransform(translationMatrix(QVector3D(-0.2f, 0.0f, 0.5f)));
+	deimos->setLocalTranslation(QVector3D(-0.2f, 0.0f, 0.5f));
 	deimos->setModelScale(QVector3D(0.08f, 0.08f, 0.08f));
-	deimos->setDiffuseMap(loadImage("moon.ppm"));
+	deimos->setDiffuseMap(diffuseMaps, texturePath("moon.ppm"));
 	deimos->setLights(sunLight);
 	mars->addChild(deimos);
 
 	// ~~~~~~~~~~ JUPITER & MOONS ~~~~~~~~~~
 	qDebug() << "  Loading Jupiter...";
 	SceneNode* jupiter = new RotatingNode(sphere, 0.06f);
-	jupiter->setLocalTransform(translationMatrix(QVector3D(13.0f, 0.0f, 18.0f)));
+	jupiter->setLocalTranslation(QVector3D(13.0f, 0.0f, 18.0f));
 	jupiter->setModelScale(QVector3D(1.5f, 1.5f, 1.5f));
-	jupiter->setDiffuseMap(loadImage("jupiter.ppm"));
+	jupiter->setDiffuseMap(diffuseMaps, texturePath("jupiter.ppm"));
 	jupiter->setLights(sunLight);
+	jupiter->setOccluder(occluderSphere);
 	sun->addChild(jupiter);
 
 	qDebug() << "    Loading Europa...";
 	SceneNode* europa = new RotatingNode(sphere, 0.08f);
-	europa->setLocalTransform(translationMatrix(QVector3D(2.0f, 0.0f, 0.0f)));
+	europa->setLocalTranslation(QVector3D(2.0f, 0.0f, 0.0f));
 	europa->setModelScale(QVector3D(0.12f, 0.12f, 0.12f));
-	europa->setDiffuseMap(loadImage("europa.ppm"));
+	europa->setDiffuseMap(diffuseMaps, texturePath("europa.ppm"));
 	europa->setLights(sunLight);
 	jupiter->addChild(europa);
 
 	qDebug() << "    Loading Ganymede...";
 	SceneNode* ganymede = new RotatingNode(sphere, 0.08f);
-	ganymede->setLocalTransform(translationMatrix(QVector3D(-1.5f, 0.0f, 2.5f)));
+	ganymede->setLocalTranslation(QVector3D(-1.5f, 0.0f, 2.5f));
 	ganymede->setModelScale(QVector3D(0.15f, 0.15f, 0.15f));
-	ganymede->setDiffuseMap(loadImage("ganymede.ppm"));
+	ganymede->setDiffuseMap(diffuseMaps, texturePath("ganymede.ppm"));
 	ganymede->setLights(sunLight);
 	jupiter->addChild(ganymede);
 
 	qDebug() << "    Loading Io...";
 	SceneNode* io = new RotatingNode(sphere, 0.08f);
-	io->setLocalTransform(translationMatrix(QVector3D(-1.0f, 0.0f, -2.0f)));
+	io->setLocalTranslation(QVector3D(-1.0f, 0.0f, -2.0f));
 	io->setModelScale(QVector3D(0.1f, 0.1f, 0.1f));
-	io->setDiffuseMap(loadImage("io.ppm"));
+	io->setDiffuseMap(diffuseMaps, texturePath("io.ppm"));
 	io->setLights(sunLight);
 	jupiter->addChild(io);
-}
 
+	// ~~~~~~~~~~ TRANSLUCENT ~~~~~~~~~~
+	// Hazy atmospheres, and a ring of ice around Jupiter; they're drawn last, farthest first
+	qDebug() << "  Loading atmospheres and Jupiter's ring...";
+	auto solidColor = [](const QColor& color) -> QImage
+	{
+		QImage image(4, 4, QImage::Format_RGB32);
+		image.fill(color);
+		return image;
+	};
+	const QImage haze = solidColor(QColor(200, 220, 255));
+	SceneNode* earthAtmosphere = new SceneNode(sphere);
+	earthAtmosphere->setModelScale(QVector3D(0.56f, 0.56f, 0.56f));
+	earthAtmosphere->setDiffuseMap(diffuseMaps, haze);
+	earthAtmosphere->setLights(sunLight);
+	earthAtmosphere->setOpacity(0.3f);
+	earth->addChild(earthAtmosphere);
+
+	SceneNode* venusAtmosphere = new SceneNode(sphere);
+	venusAtmosphere->setModelScale(QVector3D(0.42f, 0.42f, 0.42f));
+	venusAtmosphere->setDiffuseMap(diffuseMaps, solidColor(QColor(255, 230, 170)));
+	venusAtmosphere->setLights(sunLight);
+	venusAtmosphere->setOpacity(0.45f);
+	venus->addChild(venusAtmosphere);
+
+	// Same seed every time, so the ring always looks the same
+	std::mt19937 random(11);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	const int ice = diffuseMaps->addImage(solidColor(QColor(220, 235, 255)));
+	for (int ii = 0; ii < RING_CHUNKS; ++ii) {
+		const float angle = 6.28318531f * (ii + unit(random)) / RING_CHUNKS;
+		const float radius = 2.6f + 0.6f * unit(random);
+		const float size = 0.03f + 0.04f * unit(random);
+		SceneNode* chunk = new SceneNode(sphere);
+		chunk->setLocalTranslation(QVector3D(radius * std::cos(angle), 0.1f * (unit(random) - 0.5f), radius * std::sin(angle)));
+		chunk->setModelScale(QVector3D(size, size, size));
+		chunk->setDiffuseTexture(diffuseMaps, ice);
+		chunk->setLights(sunLight);
+		chunk->setOpacity(0.5f);
+		jupiter->addChild(chunk);
+	}
+
+	// ~~~~~~~~~~ ASTEROID BELT ~~~~~~~~~~
+	qDebug() << "  Loading the asteroid belt...";
+	asteroidBelt->setDiffuseTexture(diffuseMaps, diffuseMaps->addImage(solidColor(QColor(140, 125, 110))));
+	asteroidBelt->setLights(sunLight);
+	setAsteroidCount(ASTEROIDS);
+
+	// Every planet texture is a layer of one array, so the whole system draws without rebinding
+	diffuseMaps->create();
+}
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "SceneNode.h"
+#include "OcclusionCuller.h"
+#include "GpuCuller.h"
 
 class SolarSystem final: public SceneNode
 {
@@ -11,8 +13,33 @@ public:
 	void createGeometryAndLights();
 	void deleteGeometryAndLights();
 
+	// Lights shared by every planet
+	inline QVector<PointLight>* planetLights() const { return sunLight; }
+	// Small colored lights orbiting among the planets, to stress many-light shading
+	void setSwarmLightCount(int count);
+	inline int swarmLightCount() const { return swarmOrbits.size(); }
+	void animateLights(qint64 msSinceLastFrame);
+
+	// A belt of rocks between Mars and Jupiter, too many to be scene nodes, culled and drawn
+	// by a GpuCuller
+	void setAsteroidCount(int count);
+	inline int asteroidCount() const { return asteroidBelt ? asteroidBelt->instanceCount() : 0; }
+	inline GpuCuller* asteroids() const { return asteroidBelt; }
+
+	// The rock every asteroid instances: three spheres, finest first, as its levels of detail
+	static void asteroidMesh(QVector<Vertex>& vertices, QVector<Face>& faces, QVector<GpuCuller::Lod>& lods);
+	// count asteroids scattered around the belt, the same ones for the same count
+	static QVector<GpuCuller::Instance> generateAsteroids(int count);
+
 protected:
 	Renderable* sphere;
+	// A coarse sphere inside the drawn one, for the planets to hide what is behind them
+	OccluderMesh* occluderSphere;
+	Renderable* asteroid;
+	GpuCuller* asteroidBelt;
+	TextureArray* diffuseMaps;
 	QVector<PointLight>* sunLight;
 	QVector<PointLight>* lightForSun;
+	// Orbit of each swarm light: radius, height, angle, angular speed per ms
+	QVector<QVector4D> swarmOrbits;
 };
@@ -2,62 +2,17 @@
 // I was having some issues with the provided implementation so I used this one instead
 
 #include "Sphere.h"
-
-// based on https://www.gamasutra.com/view/feature/129939/messing_with_tangent_space.php
-// and https://learnopengl.com/Advanced-Lighting/Normal-Mapping
-QVector<Vec3> getFaceTangents(const QVector<Face>& faces, const QVector<Vertex>& vertices) {
-	QVector<Vec3> tangents(faces.size());
-	for (int ii = 0; ii < faces.size(); ++ii) {
-		Face face = faces[ii];
-
-		Vertex v1 = vertices[face.a];
-		Vertex v2 = vertices[face.b];
-		Vertex v3 = vertices[face.c];
-
-		Vec3 edge1 = v2.position - v1.position;
-		Vec3 edge2 = v3.position - v1.position;
-
-		Vec2 deltaUV1 = v2.texCoord - v1.texCoord;
-		Vec2 deltaUV2 = v3.texCoord - v1.texCoord;
-
-		float f = 1.0f / (deltaUV1.u * deltaUV2.v - deltaUV2.u * deltaUV1.v);
-
-		Vec3 tangent;
-		tangent.x = f * (deltaUV2.v * edge1.x - deltaUV1.v * edge2.x);
-		tangent.y = f * (deltaUV2.v * edge1.y - deltaUV1.v * edge2.y);
-		tangent.z = f * (deltaUV2.v * edge1.z - deltaUV1.v * edge2.z);
-		tangent.normalize();
-
-		tangents[ii] = tangent;
-	}
-
-	return tangents;
-}
-
-// based on https://www.gamasutra.com/view/feature/129939/messing_with_tangent_space.php
-// and https://learnopengl.com/Advanced-Lighting/Normal-Mapping
-void setVertexTangents(const QVector<Vec3>& faceTangents, const QVector<Face>& faces, QVector<Vertex>& vertices) {
-	// Calculate cumulative tangents for each vertex
-	// Don't need to average because we normalize it anyway
-	for (int ii = 0; ii < faces.size(); ++ii) {
-		Face face = faces[ii];
-		for (int jj = 0; jj < 3; ++jj) {
-			vertices[face[jj]].tangent += faceTangents[ii];
-		}
-	}
-
-	// Normalize each vertex's tangent
-	for (Vertex& vert : vertices) {
-		vert.tangent.normalize();
-	}
-}
-
+#include "TangentSpace.h"
 
 // Calls the initalization routine
 Sphere::Sphere() : radius_(1.0), sectorCount_(30), stackCount_(30) {
 	init();
 }
 
+Sphere::Sphere(double radius, int sectorCount, int stackCount) : radius_(radius), sectorCount_(sectorCount), stackCount_(stackCount) {
+	init();
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // build vertices of sphere with smooth shading using parametric equation
 // x = r * cos(u) * cos(v)
@@ -120,7 +75,7 @@ void Sphere::init() {
 	for (int i = 0; i < stackCount_; ++i)
 	{
 		k1 = i * (sectorCount_ + 1);									// beginning of current stack
-		k2 = k1 + stackCount_ + 1;										// beginning of next stack
+		k2 = k1 + sectorCount_ + 1;										// beginning of next stack
 
 		for (int j = 0; j < sectorCount_; ++j, ++k1, ++k2)
 		{
@@ -139,10 +94,8 @@ void Sphere::init() {
 		}
 	}
 
-	// calculate tangents (per face) after reading all file data
-	QVector<Vec3> faceTangents = getFaceTangents(faces_, vertices_);
-	// set vertex tangents based on all faces a vertex is part of
-	setVertexTangents(faceTangents, faces_, vertices_);
+	// calculate tangent frames once all vertices and faces are in
+	TangentSpace::generate(vertices_, faces_);
 }
 
 
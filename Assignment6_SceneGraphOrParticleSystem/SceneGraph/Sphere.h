@@ -13,6 +13,8 @@ class Sphere {
 public:
 	// Constructor for the Sphere
 	Sphere();
+	// A coarser or finer sphere; the default is 30 by 30 of radius 1
+	Sphere(double radius, int sectorCount, int stackCount);
 	// The intialization routine for this object.
 	void init();
 
@@ -1,5 +1,6 @@
 #include "Structs.h"
 #include <cmath>
+#include <algorithm>
 
 // ~~~~~~~~~~ VEC3 ~~~~~~~~~~
 Vec3::Vec3() : x(0), y(0), z(0) {}
@@ -92,16 +93,17 @@ const float& Vec2::operator[](int i) const {
 
 
 // ~~~~~~~~~~ VERTEX ~~~~~~~~~~
-Vertex::Vertex() : position(), texCoord(), normal(), tangent() {}
+Vertex::Vertex() : position(), texCoord(), normal(), tangent(), handedness(1.0f) {}
 
-Vertex::Vertex(Vec3 pos, Vec2 tex, Vec3 norm, Vec3 tan) : position(pos), texCoord(tex), normal(norm), tangent(tan) {}
+Vertex::Vertex(Vec3 pos, Vec2 tex, Vec3 norm, Vec3 tan, float handedness) : position(pos), texCoord(tex), normal(norm), tangent(tan), handedness(handedness) {}
 
 bool Vertex::operator==(Vertex other) const {
 	return
 		position == other.position &&
 		texCoord == other.texCoord &&
 		normal == other.normal &&
-		tangent == other.tangent;
+		tangent == other.tangent &&
+		handedness == other.handedness;
 }
 
 
@@ -130,3 +132,18 @@ const unsigned int& Face::operator[](int i) const {
 PointLight::PointLight() : position(), color(), ambientIntensity(0), specularIntensity(0), constant(0), linear(0), quadratic(0) {}
 PointLight::PointLight(QVector3D position, QVector3D color, float ambientIntensity, float specularIntensity, float constant, float linear, float quadratic) :
 	position(position), color(color), ambientIntensity(ambientIntensity), specularIntensity(specularIntensity), constant(constant), linear(linear), quadratic(quadratic) {}
+
+
+// ~~~~~~~~~~ INSTANCEDATA ~~~~~~~~~~
+InstanceData::InstanceData() : modelMatrix(), normalMatrix(), diffuseLayer(-1), normalLayer(-1), opacity(1), diffuseRegion{ 0, 0, 1, 1 }, normalRegion{ 0, 0, 1, 1 } {}
+
+InstanceData::InstanceData(const QMatrix4x4& worldSpaceModelMatrix, int diffuseLayer, int normalLayer,
+	const QVector4D& diffuseRegion, const QVector4D& normalRegion, float opacity) :
+	diffuseLayer(float(diffuseLayer)), normalLayer(float(normalLayer)), opacity(opacity),
+	diffuseRegion{ diffuseRegion.x(), diffuseRegion.y(), diffuseRegion.z(), diffuseRegion.w() },
+	normalRegion{ normalRegion.x(), normalRegion.y(), normalRegion.z(), normalRegion.w() }
+{
+	std::copy(worldSpaceModelMatrix.constData(), worldSpaceModelMatrix.constData() + 16, modelMatrix);
+	const QMatrix3x3 normal = worldSpaceModelMatrix.normalMatrix();
+	std::copy(normal.constData(), normal.constData() + 9, normalMatrix);
+}
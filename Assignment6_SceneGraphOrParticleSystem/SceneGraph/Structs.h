@@ -43,9 +43,11 @@ struct Vertex {
 	Vec2 texCoord;
 	Vec3 normal;
 	Vec3 tangent;
+	// -1 where the UVs are mirrored, so the bitangent is -cross(normal, tangent)
+	float handedness;
 
 	Vertex();
-	Vertex(Vec3 pos, Vec2 tex, Vec3 norm, Vec3 tan);
+	Vertex(Vec3 pos, Vec2 tex, Vec3 norm, Vec3 tan, float handedness = 1.0f);
 
 	bool operator==(Vertex other) const;
 };
@@ -73,3 +75,21 @@ struct PointLight {
 	PointLight();
 	PointLight(QVector3D position, QVector3D color, float ambientIntensity = 0.5f, float specularIntensity = 0.5f, float constant = 1.0f, float linear = 0.09f, float quadratic = 0.032f);
 };
+
+// Per-instance data streamed to the GPU for instanced draws.
+// Laid out as raw floats so it can be uploaded as-is.
+struct InstanceData {
+	float modelMatrix[16];
+	float normalMatrix[9];
+	float diffuseLayer;
+	float normalLayer;
+	// Alpha of everything the instance draws; read with the layers as one attribute
+	float opacity;
+	// Where in their layers the node's textures are: UV offset in xy, scale in zw
+	float diffuseRegion[4];
+	float normalRegion[4];
+
+	InstanceData();
+	InstanceData(const QMatrix4x4& worldSpaceModelMatrix, int diffuseLayer, int normalLayer,
+		const QVector4D& diffuseRegion = QVector4D(0, 0, 1, 1), const QVector4D& normalRegion = QVector4D(0, 0, 1, 1), float opacity = 1.0f);
+};
@@ -0,0 +1,237 @@
+#include "TangentSpace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TANGENT_SPACE_SSE
+#endif
+
+// Below this many faces, starting threads costs more than it saves
+static const int PARALLEL_FACES = 16384;
+
+static inline Vec3 cross(const Vec3& a, const Vec3& b) {
+	return Vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+static inline float dot(const Vec3& a, const Vec3& b) {
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+// Split [0, count) into one contiguous range per thread, each a multiple of grain long, and
+// run function(chunk, begin, end) on each, with the calling thread taking the first
+template<typename Function>
+static void parallelFor(int count, int threadCount, int grain, Function function) {
+	const int chunkSize = ((count + threadCount - 1) / threadCount + grain - 1) / grain * grain;
+	std::vector<std::thread> threads;
+	for (int chunk = 1; chunk < threadCount; ++chunk) {
+		const int begin = chunk * chunkSize;
+		const int end = std::min(count, begin + chunkSize);
+		if (begin < end) {
+			threads.emplace_back(function, chunk, begin, end);
+		}
+	}
+	function(0, 0, std::min(count, chunkSize));
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
+
+// Face frames, one component per array so four faces fill an SSE register.
+// Each is the face's unit tangent and bitangent scaled by its area, or zero for
+// faces without a frame.
+struct FaceFrames {
+	std::vector<float> tx, ty, tz;
+	std::vector<float> bx, by, bz;
+};
+
+// Frames for faces [begin, end); returns how many were degenerate
+static int faceFrames(const QVector<Vertex>& vertices, const QVector<Face>& faces, FaceFrames& frames, int begin, int end) {
+	int degenerate = 0;
+	int ii = begin;
+#ifdef TANGENT_SPACE_SSE
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 signBit = _mm_set1_ps(-0.0f);
+	const __m128 tiny = _mm_set1_ps(1e-30f);
+	for (; ii + 4 <= end; ii += 4) {
+		// Gather four faces' corners into registers, one face per lane
+		float p[3][3][4];
+		float uv[3][2][4];
+		for (int lane = 0; lane < 4; ++lane) {
+			const Face& face = faces[ii + lane];
+			for (int corner = 0; corner < 3; ++corner) {
+				const Vertex& vertex = vertices[face[corner]];
+				p[corner][0][lane] = vertex.position.x;
+				p[corner][1][lane] = vertex.position.y;
+				p[corner][2][lane] = vertex.position.z;
+				uv[corner][0][lane] = vertex.texCoord.u;
+				uv[corner][1][lane] = vertex.texCoord.v;
+			}
+		}
+		__m128 e1[3], e2[3];
+		for (int axis = 0; axis < 3; ++axis) {
+			const __m128 p0 = _mm_loadu_ps(p[0][axis]);
+			e1[axis] = _mm_sub_ps(_mm_loadu_ps(p[1][axis]), p0);
+			e2[axis] = _mm_sub_ps(_mm_loadu_ps(p[2][axis]), p0);
+		}
+		const __m128 u0 = _mm_loadu_ps(uv[0][0]);
+		const __m128 v0 = _mm_loadu_ps(uv[0][1]);
+		const __m128 du1 = _mm_sub_ps(_mm_loadu_ps(uv[1][0]), u0);
+		const __m128 dv1 = _mm_sub_ps(_mm_loadu_ps(uv[1][1]), v0);
+		const __m128 du2 = _mm_sub_ps(_mm_loadu_ps(uv[2][0]), u0);
+		const __m128 dv2 = _mm_sub_ps(_mm_loadu_ps(uv[2][1]), v0);
+
+		// Only the sign of the UV determinant matters once the frame is normalized,
+		// so there's no division to blow up on degenerate UVs
+		const __m128 det = _mm_sub_ps(_mm_mul_ps(du1, dv2), _mm_mul_ps(du2, dv1));
+		const __m128 sign = _mm_or_ps(_mm_and_ps(det, signBit), one);
+		__m128 t[3], b[3];
+		for (int axis = 0; axis < 3; ++axis) {
+			t[axis] = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(e1[axis], dv2), _mm_mul_ps(e2[axis], dv1)), sign);
+			b[axis] = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(e2[axis], du1), _mm_mul_ps(e1[axis], du2)), sign);
+		}
+		const __m128 nx = _mm_sub_ps(_mm_mul_ps(e1[1], e2[2]), _mm_mul_ps(e1[2], e2[1]));
+		const __m128 ny = _mm_sub_ps(_mm_mul_ps(e1[2], e2[0]), _mm_mul_ps(e1[0], e2[2]));
+		const __m128 nz = _mm_sub_ps(_mm_mul_ps(e1[0], e2[1]), _mm_mul_ps(e1[1], e2[0]));
+		const __m128 area = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)));
+		const __m128 t2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(t[0], t[0]), _mm_mul_ps(t[1], t[1])), _mm_mul_ps(t[2], t[2]));
+		const __m128 b2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b[0], b[0]), _mm_mul_ps(b[1], b[1])), _mm_mul_ps(b[2], b[2]));
+
+		const __m128 valid = _mm_and_ps(_mm_and_ps(_mm_cmpneq_ps(det, zero), _mm_cmpgt_ps(area, zero)),
+			_mm_and_ps(_mm_cmpgt_ps(t2, zero), _mm_cmpgt_ps(b2, zero)));
+		const __m128 tScale = _mm_and_ps(_mm_div_ps(area, _mm_sqrt_ps(_mm_max_ps(t2, tiny))), valid);
+		const __m128 bScale = _mm_and_ps(_mm_div_ps(area, _mm_sqrt_ps(_mm_max_ps(b2, tiny))), valid);
+		_mm_storeu_ps(&frames.tx[ii], _mm_mul_ps(t[0], tScale));
+		_mm_storeu_ps(&frames.ty[ii], _mm_mul_ps(t[1], tScale));
+		_mm_storeu_ps(&frames.tz[ii], _mm_mul_ps(t[2], tScale));
+		_mm_storeu_ps(&frames.bx[ii], _mm_mul_ps(b[0], bScale));
+		_mm_storeu_ps(&frames.by[ii], _mm_mul_ps(b[1], bScale));
+		_mm_storeu_ps(&frames.bz[ii], _mm_mul_ps(b[2], bScale));
+
+		const int validLanes = _mm_movemask_ps(valid);
+		degenerate += 4 - ((validLanes & 1) + ((validLanes >> 1) & 1) + ((validLanes >> 2) & 1) + ((validLanes >> 3) & 1));
+	}
+#endif
+	// Whatever doesn't fill a batch
+	for (; ii < end; ++ii) {
+		const Face& face = faces[ii];
+		const Vertex& v0 = vertices[face.a];
+		const Vertex& v1 = vertices[face.b];
+		const Vertex& v2 = vertices[face.c];
+		const Vec3 e1 = v1.position - v0.position;
+		const Vec3 e2 = v2.position - v0.position;
+		const Vec2 duv1 = v1.texCoord - v0.texCoord;
+		const Vec2 duv2 = v2.texCoord - v0.texCoord;
+
+		const float det = duv1.u * duv2.v - duv2.u * duv1.v;
+		const float sign = det < 0.0f ? -1.0f : 1.0f;
+		Vec3 t(sign * (e1.x * duv2.v - e2.x * duv1.v), sign * (e1.y * duv2.v - e2.y * duv1.v), sign * (e1.z * duv2.v - e2.z * duv1.v));
+		Vec3 b(sign * (e2.x * duv1.u - e1.x * duv2.u), sign * (e2.y * duv1.u - e1.y * duv2.u), sign * (e2.z * duv1.u - e1.z * duv2.u));
+		const float area = cross(e1, e2).length();
+		const float tLength = t.length();
+		const float bLength = b.length();
+
+		if (det == 0.0f || area == 0.0f || tLength == 0.0f || bLength == 0.0f) {
+			t = b = Vec3(0.0f, 0.0f, 0.0f);
+			++degenerate;
+		}
+		else {
+			t = Vec3(t.x * area / tLength, t.y * area / tLength, t.z * area / tLength);
+			b = Vec3(b.x * area / bLength, b.y * area / bLength, b.z * area / bLength);
+		}
+		frames.tx[ii] = t.x;
+		frames.ty[ii] = t.y;
+		frames.tz[ii] = t.z;
+		frames.bx[ii] = b.x;
+		frames.by[ii] = b.y;
+		frames.bz[ii] = b.z;
+	}
+	return degenerate;
+}
+
+TangentSpace::Stats TangentSpace::generate(QVector<Vertex>& vertices, const QVector<Face>& faces, int threadCount) {
+	const int faceCount = faces.size();
+	const int vertexCount = vertices.size();
+	if (threadCount <= 0) {
+		threadCount = faceCount >= PARALLEL_FACES ? int(std::max(std::thread::hardware_concurrency(), 1u)) : 1;
+	}
+
+	// Faces around each vertex
+	std::vector<int> faceStart(vertexCount + 1, 0);
+	for (const Face& face : faces) {
+		for (int jj = 0; jj < 3; ++jj) {
+			++faceStart[face[jj] + 1];
+		}
+	}
+	for (int ii = 0; ii < vertexCount; ++ii) {
+		faceStart[ii + 1] += faceStart[ii];
+	}
+	std::vector<int> faceList(faceCount * 3);
+	std::vector<int> cursor(faceStart.begin(), faceStart.end() - 1);
+	for (int ii = 0; ii < faceCount; ++ii) {
+		for (int jj = 0; jj < 3; ++jj) {
+			faceList[cursor[faces[ii][jj]]++] = ii;
+		}
+	}
+
+	// Each face's frame
+	FaceFrames frames;
+	frames.tx.resize(faceCount);
+	frames.ty.resize(faceCount);
+	frames.tz.resize(faceCount);
+	frames.bx.resize(faceCount);
+	frames.by.resize(faceCount);
+	frames.bz.resize(faceCount);
+	std::vector<int> degenerate(threadCount, 0);
+	const QVector<Vertex>& source = vertices;
+	// Chunks start on a batch of four, so faces land in the same batches (and get bit for
+	// bit the same frames) however many threads there are
+	parallelFor(faceCount, threadCount, 4, [&](int chunk, int begin, int end) {
+		degenerate[chunk] = faceFrames(source, faces, frames, begin, end);
+	});
+
+	// Each vertex sums the frames of its faces, then orthogonalizes (Gram-Schmidt)
+	std::vector<int> leftHanded(threadCount, 0);
+	Vertex* out = vertices.data();
+	parallelFor(vertexCount, threadCount, 1, [&](int chunk, int begin, int end) {
+		for (int ii = begin; ii < end; ++ii) {
+			Vec3 t(0.0f, 0.0f, 0.0f);
+			Vec3 b(0.0f, 0.0f, 0.0f);
+			for (int kk = faceStart[ii]; kk < faceStart[ii + 1]; ++kk) {
+				const int face = faceList[kk];
+				t += Vec3(frames.tx[face], frames.ty[face], frames.tz[face]);
+				b += Vec3(frames.bx[face], frames.by[face], frames.bz[face]);
+			}
+
+			Vertex& vertex = out[ii];
+			const float normalLength = vertex.normal.length();
+			const Vec3 n = normalLength > 0.0f ? vertex.normal.normalized() : vertex.normal;
+			const float tn = dot(t, n);
+			Vec3 tangent(t.x - n.x * tn, t.y - n.y * tn, t.z - n.z * tn);
+			if (tangent.length() < 1e-12f) {
+				// No UVs to follow, or the tangent lies along the normal: any perpendicular will do
+				tangent = cross(n, std::fabs(n.x) < 0.9f ? Vec3(1.0f, 0.0f, 0.0f) : Vec3(0.0f, 1.0f, 0.0f));
+				if (tangent.length() == 0.0f) {
+					tangent = Vec3(1.0f, 0.0f, 0.0f);
+				}
+			}
+			tangent.normalize();
+			vertex.tangent = tangent;
+			vertex.handedness = dot(cross(n, tangent), b) < 0.0f ? -1.0f : 1.0f;
+			leftHanded[chunk] += vertex.handedness < 0.0f;
+		}
+	});
+
+	Stats stats;
+	stats.degenerateFaces = 0;
+	stats.leftHanded = 0;
+	for (int chunk = 0; chunk < threadCount; ++chunk) {
+		stats.degenerateFaces += degenerate[chunk];
+		stats.leftHanded += leftHanded[chunk];
+	}
+	return stats;
+}
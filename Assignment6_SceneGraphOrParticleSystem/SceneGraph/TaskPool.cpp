@@ -0,0 +1,121 @@
+#include "TaskPool.h"
+
+#include <algorithm>
+
+// The pool and queue index of the current thread, if it is a worker
+static thread_local const TaskPool* currentPool = nullptr;
+static thread_local int currentIndex = 0;
+
+TaskPool::TaskPool(int threadCount) : queuedTasks_(0), stopping_(false)
+{
+	threadCount = std::max(threadCount, 1);
+
+	// Queue 0 belongs to whichever outside thread submits and waits
+	for (int ii = 0; ii < threadCount; ++ii) {
+		queues_.emplace_back(new Queue());
+	}
+	for (int ii = 1; ii < threadCount; ++ii) {
+		workers_.emplace_back(&TaskPool::workerLoop, this, ii);
+	}
+}
+
+TaskPool::~TaskPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex_);
+		stopping_ = true;
+	}
+	sleepCondition_.notify_all();
+	for (std::thread& worker : workers_) {
+		worker.join();
+	}
+}
+
+void TaskPool::run(TaskGroup& group, std::function<void()> task)
+{
+	group.pending.fetch_add(1, std::memory_order_relaxed);
+
+	Queue& queue = *queues_[currentQueue()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back({ std::move(task), &group });
+	}
+	queuedTasks_.fetch_add(1, std::memory_order_release);
+
+	// Taking the lock orders us after any worker that is about to sleep, so it can't miss this
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex_);
+	}
+	sleepCondition_.notify_one();
+}
+
+void TaskPool::wait(TaskGroup& group)
+{
+	const int self = currentQueue();
+	while (group.pending.load(std::memory_order_acquire) > 0) {
+		if (!runOne(self)) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+void TaskPool::workerLoop(int index)
+{
+	currentPool = this;
+	currentIndex = index;
+
+	for (;;) {
+		if (runOne(index)) {
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex_);
+		sleepCondition_.wait(lock, [this]() { return stopping_ || queuedTasks_.load(std::memory_order_acquire) > 0; });
+		if (stopping_) {
+			return;
+		}
+	}
+}
+
+bool TaskPool::runOne(int self)
+{
+	Task task;
+	bool found = false;
+
+	// Newest task from our own queue first
+	{
+		Queue& own = *queues_[self];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty()) {
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			found = true;
+		}
+	}
+
+	// Otherwise steal the oldest task from someone else; those tend to be the biggest
+	const int queueCount = int(queues_.size());
+	for (int offset = 1; !found && offset < queueCount; ++offset) {
+		Queue& victim = *queues_[(self + offset) % queueCount];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tasks.empty()) {
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			found = true;
+		}
+	}
+
+	if (!found) {
+		return false;
+	}
+
+	queuedTasks_.fetch_sub(1, std::memory_order_relaxed);
+	task.function();
+	task.group->pending.fetch_sub(1, std::memory_order_release);
+	return true;
+}
+
+int TaskPool::currentQueue() const
+{
+	return currentPool == this ? currentIndex : 0;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tasks that can be waited on together
+class TaskGroup
+{
+public:
+	TaskGroup() : pending(0) {}
+
+private:
+	friend class TaskPool;
+	std::atomic<int> pending;
+};
+
+// A work-stealing thread pool. Every worker owns a deque: it pushes and pops its own
+// tasks at the back (newest first, for cache locality) and, when it runs dry, steals
+// the oldest task from the front of another worker's deque.
+class TaskPool
+{
+public:
+	// threadCount includes the calling thread, which helps out while it waits
+	explicit TaskPool(int threadCount = std::thread::hardware_concurrency());
+	~TaskPool();
+
+	inline int threadCount() const { return int(queues_.size()); }
+
+	// Queue a task as part of group. Tasks may queue more tasks.
+	void run(TaskGroup& group, std::function<void()> task);
+	// Block until every task in group has finished, running queued tasks meanwhile
+	void wait(TaskGroup& group);
+
+private:
+	struct Task {
+		std::function<void()> function;
+		TaskGroup* group;
+	};
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	void workerLoop(int index);
+	// Run one task from our own queue, or stolen from another. False if none were found.
+	bool runOne(int self);
+	// Which queue the calling thread pushes to
+	int currentQueue() const;
+
+	std::vector<std::unique_ptr<Queue>> queues_;
+	std::vector<std::thread> workers_;
+
+	std::atomic<int> queuedTasks_;
+	std::mutex sleepMutex_;
+	std::condition_variable sleepCondition_;
+	bool stopping_;
+};
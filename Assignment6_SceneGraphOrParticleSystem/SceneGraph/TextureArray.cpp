@@ -0,0 +1,165 @@
+#include "TextureArray.h"
+#include "TextureLoader.h"
+
+#include <algorithm>
+
+namespace {
+
+// Atlas regions start and end on multiples of this many texels, so each of the first
+// ATLAS_MIP_LEVELS levels of a region lines up exactly with the same level of the array
+const int ATLAS_ALIGNMENT = 16;
+const int ATLAS_MIP_LEVELS = 5;
+// Texels wrapped around each atlas region, so repeating and filtering stay seamless
+const int ATLAS_GUTTER = 16;
+
+inline int alignUp(int value)
+{
+	return (value + ATLAS_ALIGNMENT - 1) / ATLAS_ALIGNMENT * ATLAS_ALIGNMENT;
+}
+
+}
+
+TextureArray::TextureArray(TextureCache::Content content) : texture_(QOpenGLTexture::Target2DArray), content_(content), layerCount_(0), atlas_(false)
+{}
+
+TextureArray::~TextureArray()
+{
+	TextureLoader::instance().cancel(&texture_);
+	if (texture_.isCreated()) {
+		texture_.destroy();
+	}
+}
+
+int TextureArray::addImage(const QImage& image)
+{
+	images_ << image;
+	files_ << QString();
+	return images_.size() - 1;
+}
+
+int TextureArray::addFile(const QString& path)
+{
+	auto found = fileIndices_.constFind(path);
+	if (found != fileIndices_.constEnd()) {
+		return found.value();
+	}
+	images_ << QImage();
+	files_ << path;
+	fileIndices_.insert(path, images_.size() - 1);
+	return images_.size() - 1;
+}
+
+void TextureArray::create()
+{
+	const int count = images_.size();
+	if (count == 0) {
+		return;
+	}
+
+	// Files haven't been decoded yet, but their headers give their size. Missing files
+	// show up as a small white region rather than garbage.
+	QVector<QSize> sizes(count);
+	QSize layerSize(1, 1);
+	for (int i = 0; i < count; ++i) {
+		QSize size = files_[i].isEmpty() ? images_[i].size() : QImageReader(files_[i]).size();
+		if (size.isEmpty()) {
+			size = QSize(ATLAS_ALIGNMENT, ATLAS_ALIGNMENT);
+		}
+		sizes[i] = size;
+		layerSize = layerSize.expandedTo(size);
+	}
+	atlas_ = std::any_of(sizes.begin(), sizes.end(), [&](const QSize& size) { return size != layerSize; });
+	if (atlas_) {
+		layerSize = QSize(alignUp(layerSize.width()), alignUp(layerSize.height()));
+	}
+
+	// Textures that fill a layer, or wouldn't fit in one with their gutter, get a whole
+	// layer to themselves, as in a plain array. The rest are packed onto shelves, tallest first.
+	struct Placement {
+		int layer;
+		QPoint offset;
+		QSize size;
+		int gutter;
+	};
+	QVector<Placement> placements(count);
+	QVector<int> packed;
+	regions_.fill(Region(), count);
+	layerCount_ = 0;
+	for (int i = 0; i < count; ++i) {
+		const QSize aligned(alignUp(sizes[i].width()), alignUp(sizes[i].height()));
+		if (!atlas_ || aligned.width() + 2 * ATLAS_GUTTER > layerSize.width() || aligned.height() + 2 * ATLAS_GUTTER > layerSize.height()) {
+			placements[i] = { layerCount_, QPoint(0, 0), layerSize, 0 };
+			regions_[i] = Region(layerCount_++);
+		} else {
+			placements[i] = { -1, QPoint(0, 0), aligned, ATLAS_GUTTER };
+			packed << i;
+		}
+	}
+	std::stable_sort(packed.begin(), packed.end(), [&](int a, int b) { return placements[a].size.height() > placements[b].size.height(); });
+
+	int layer = -1;
+	QPoint shelf(0, 0);
+	int shelfHeight = 0;
+	for (int i : packed) {
+		Placement& placement = placements[i];
+		const QSize padded = placement.size + QSize(2 * ATLAS_GUTTER, 2 * ATLAS_GUTTER);
+		if (layer >= 0 && shelf.x() + padded.width() > layerSize.width()) {
+			// Start the next shelf
+			shelf = QPoint(0, shelf.y() + shelfHeight);
+			shelfHeight = 0;
+		}
+		if (layer < 0 || shelf.y() + padded.height() > layerSize.height()) {
+			layer = layerCount_++;
+			shelf = QPoint(0, 0);
+			shelfHeight = 0;
+		}
+		placement.layer = layer;
+		placement.offset = shelf;
+		shelf.rx() += padded.width();
+		shelfHeight = qMax(shelfHeight, padded.height());
+
+		// Rows are flipped to bottom-up before upload, so the offset measures from the bottom
+		// of the layer just like v does
+		regions_[i] = Region(layer, QVector4D(
+			float(placement.offset.x() + ATLAS_GUTTER) / layerSize.width(), float(placement.offset.y() + ATLAS_GUTTER) / layerSize.height(),
+			float(placement.size.width()) / layerSize.width(), float(placement.size.height()) / layerSize.height()));
+	}
+
+	texture_.create();
+	texture_.setSize(layerSize.width(), layerSize.height());
+	texture_.setLayers(layerCount_);
+	texture_.setFormat(QOpenGLTexture::RGBA8_UNorm);
+	// Deeper levels would blend atlas regions into each other
+	texture_.setMipLevels(atlas_ ? qMin(texture_.maximumMipLevels(), ATLAS_MIP_LEVELS) : texture_.maximumMipLevels());
+	texture_.allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8);
+	texture_.setMinMagFilters(QOpenGLTexture::LinearMipMapLinear, QOpenGLTexture::Linear);
+	texture_.setWrapMode(QOpenGLTexture::Repeat);
+
+	// While textures load, sample only the smallest level, which costs next to nothing to fill.
+	// The loader drops the base level back to 0 once every texture is in.
+	const int placeholderLevel = texture_.mipLevels() - 1;
+	QImage placeholder(qMax(1, layerSize.width() >> placeholderLevel), qMax(1, layerSize.height() >> placeholderLevel), QImage::Format_RGBA8888);
+	placeholder.fill(Qt::white);
+	for (int l = 0; l < layerCount_; ++l) {
+		texture_.setData(placeholderLevel, l, QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, placeholder.constBits());
+	}
+	texture_.setMipBaseLevel(placeholderLevel);
+
+	TextureLoader& loader = TextureLoader::instance();
+	for (int i = 0; i < count; ++i) {
+		const Placement& placement = placements[i];
+		if (files_[i].isEmpty()) {
+			loader.loadLayer(&texture_, placement.layer, images_[i], placement.size, content_, placement.offset, placement.gutter);
+		} else {
+			loader.loadLayer(&texture_, placement.layer, files_[i], placement.size, content_, placement.offset, placement.gutter);
+		}
+	}
+	qDebug().noquote() << QString("Texture array: %1 textures in %2 %3x%4 layers%5")
+		.arg(count).arg(layerCount_).arg(layerSize.width()).arg(layerSize.height())
+		.arg(atlas_ ? QString(", %1 packed into an atlas").arg(packed.size()) : QString());
+
+	// The pixels are on their way to the GPU
+	images_.clear();
+	files_.clear();
+	fileIndices_.clear();
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <QtCore>
+#include <QtGui>
+#include <QtOpenGL>
+#include "TextureCache.h"
+
+// A set of textures stored in a single GL_TEXTURE_2D_ARRAY, so every node that samples
+// from it can be drawn without rebinding textures. When the textures all share one size
+// each fills a layer of its own. Mixed sizes become an atlas instead: textures smaller
+// than a layer are packed together onto shared layers, and nodes remap their UVs into
+// their texture's region.
+class TextureArray
+{
+public:
+	// Where a texture was placed: its layer, and its region of that layer as a UV offset
+	// in xy and a UV scale in zw
+	struct Region {
+		int layer;
+		QVector4D rect;
+
+		Region(int layer = -1, const QVector4D& rect = QVector4D(0, 0, 1, 1)) : layer(layer), rect(rect) {}
+	};
+
+	// content decides how the mip chains are filtered
+	TextureArray(TextureCache::Content content = TextureCache::Content::Color);
+	~TextureArray();
+
+	// Queue an image and return its index
+	int addImage(const QImage& image);
+	// Queue a file and return its index. Files are decoded in the background by the
+	// TextureLoader, and the same file always shares one index.
+	int addFile(const QString& path);
+	// Lay out the textures, allocate the array and start loading them. Must be called with
+	// a current GL context. Until every texture has arrived the array samples a white
+	// placeholder level.
+	void create();
+
+	// Where texture index lives. Valid once the array is created.
+	inline const Region& region(int index) const { return regions_[index]; }
+
+	inline bool isCreated() const { return texture_.isCreated(); }
+	inline bool isAtlas() const { return atlas_; }
+	inline int textureCount() const { return isCreated() ? regions_.size() : images_.size(); }
+	inline int layerCount() const { return layerCount_; }
+	inline QOpenGLTexture* texture() { return &texture_; }
+
+private:
+	QOpenGLTexture texture_;
+	TextureCache::Content content_;
+	// Null where the texture comes from a file
+	QVector<QImage> images_;
+	QVector<QString> files_;
+	QHash<QString, int> fileIndices_;
+	QVector<Region> regions_;
+	int layerCount_;
+	bool atlas_;
+};
@@ -0,0 +1,415 @@
+#include "TextureCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTURE_CACHE_SSE
+#endif
+
+namespace {
+
+const quint32 CACHE_MAGIC = 0x5350494d;	// "MIPS"
+const quint32 CACHE_VERSION = 2;
+
+enum Flags { FLAG_MIRRORED = 1, FLAG_NORMAL = 2 };
+
+// Everything a cached chain depends on, followed in the file by each level's pixels
+struct Header {
+	quint32 magic;
+	quint32 version;
+	// The source file the chain was made from
+	qint64 sourceBytes;
+	qint64 sourceModified;
+	// Size asked for, or 0x0 for the source's own size
+	quint32 requestedWidth;
+	quint32 requestedHeight;
+	quint32 flags;
+	quint32 gutter;
+	quint32 reserved;	// Keeps the header free of padding
+	// Size of the first level and number of levels stored
+	quint32 width;
+	quint32 height;
+	quint32 levels;
+};
+
+// The key for a load with these settings, with the source file's details left zero
+Header requestKey(const QSize& size, bool mirror, TextureCache::Content content, int gutter)
+{
+	Header key;
+	std::memset(&key, 0, sizeof(key));
+	key.magic = CACHE_MAGIC;
+	key.version = CACHE_VERSION;
+	key.requestedWidth = size.isValid() ? quint32(size.width()) : 0;
+	key.requestedHeight = size.isValid() ? quint32(size.height()) : 0;
+	key.flags = (mirror ? FLAG_MIRRORED : 0) | (content == TextureCache::Content::Normal ? FLAG_NORMAL : 0);
+	key.gutter = quint32(qMax(gutter, 0));
+	return key;
+}
+
+// Kaiser-windowed sinc halving each axis: 8 source pixels per output pixel
+const int KAISER_TAPS = 8;
+const float KAISER_ALPHA = 4.0f;
+const float PI = 3.14159265358979f;
+
+struct Tables {
+	float toLinear[256];
+	uchar toSrgb[4096];
+	float kaiser[KAISER_TAPS];
+
+	Tables()
+	{
+		for (int i = 0; i < 256; ++i) {
+			const float c = i / 255.0f;
+			toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		for (int i = 0; i < 4096; ++i) {
+			const float l = i / 4095.0f;
+			const float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+			toSrgb[i] = uchar(c * 255.0f + 0.5f);
+		}
+
+		// Output pixel x is centered between source pixels 2x and 2x+1, so the taps sit
+		// 0.5, 1.5, 2.5 and 3.5 source pixels either side of it
+		float sum = 0.0f;
+		for (int i = 0; i < KAISER_TAPS; ++i) {
+			const float d = i - (KAISER_TAPS - 1) * 0.5f;
+			const float t = d / (KAISER_TAPS * 0.5f);
+			const float window = besselI0(KAISER_ALPHA * std::sqrt(1.0f - t * t)) / besselI0(KAISER_ALPHA);
+			const float x = PI * d * 0.5f;
+			kaiser[i] = window * std::sin(x) / x;
+			sum += kaiser[i];
+		}
+		for (int i = 0; i < KAISER_TAPS; ++i) {
+			kaiser[i] /= sum;
+		}
+	}
+
+	static float besselI0(float x)
+	{
+		float sum = 1.0f;
+		float term = 1.0f;
+		for (int k = 1; k < 20; ++k) {
+			const float f = x / (2.0f * k);
+			term *= f * f;
+			sum += term;
+		}
+		return sum;
+	}
+};
+
+const Tables& tables()
+{
+	static const Tables t;
+	return t;
+}
+
+inline float saturate(float v)
+{
+	return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+}
+
+// RGBA8 to linear RGBA floats
+std::vector<float> toFloat(const QImage& image, TextureCache::Content content)
+{
+	const Tables& t = tables();
+	const int width = image.width();
+	const int height = image.height();
+	std::vector<float> pixels(size_t(width) * height * 4);
+	for (int y = 0; y < height; ++y) {
+		const uchar* src = image.constScanLine(y);
+		float* dst = &pixels[size_t(y) * width * 4];
+		for (int x = 0; x < width * 4; x += 4) {
+			for (int c = 0; c < 3; ++c) {
+				dst[x + c] = content == TextureCache::Content::Color ? t.toLinear[src[x + c]] : src[x + c] / 255.0f;
+			}
+			dst[x + 3] = src[x + 3] / 255.0f;
+		}
+	}
+	return pixels;
+}
+
+QImage toImage(const std::vector<float>& pixels, int width, int height, TextureCache::Content content)
+{
+	const Tables& t = tables();
+	QImage image(width, height, QImage::Format_RGBA8888);
+	for (int y = 0; y < height; ++y) {
+		const float* src = &pixels[size_t(y) * width * 4];
+		uchar* dst = image.scanLine(y);
+		for (int x = 0; x < width * 4; x += 4) {
+			float r = src[x], g = src[x + 1], b = src[x + 2];
+			if (content == TextureCache::Content::Normal) {
+				// Averaging shortens normals, so put them back on the unit sphere
+				const float nx = r * 2.0f - 1.0f, ny = g * 2.0f - 1.0f, nz = b * 2.0f - 1.0f;
+				const float length = std::sqrt(nx * nx + ny * ny + nz * nz);
+				const float scale = length > 0.0f ? 0.5f / length : 0.5f;
+				r = nx * scale + 0.5f;
+				g = ny * scale + 0.5f;
+				b = nz * scale + 0.5f;
+				dst[x] = uchar(saturate(r) * 255.0f + 0.5f);
+				dst[x + 1] = uchar(saturate(g) * 255.0f + 0.5f);
+				dst[x + 2] = uchar(saturate(b) * 255.0f + 0.5f);
+			} else {
+				dst[x] = t.toSrgb[int(saturate(r) * 4095.0f + 0.5f)];
+				dst[x + 1] = t.toSrgb[int(saturate(g) * 4095.0f + 0.5f)];
+				dst[x + 2] = t.toSrgb[int(saturate(b) * 4095.0f + 0.5f)];
+			}
+			dst[x + 3] = uchar(saturate(src[x + 3]) * 255.0f + 0.5f);
+		}
+	}
+	return image;
+}
+
+// dst += weight * src for one RGBA pixel
+inline void madd(float* dst, const float* src, float weight)
+{
+#ifdef TEXTURE_CACHE_SSE
+	_mm_storeu_ps(dst, _mm_add_ps(_mm_loadu_ps(dst), _mm_mul_ps(_mm_loadu_ps(src), _mm_set1_ps(weight))));
+#else
+	for (int c = 0; c < 4; ++c) {
+		dst[c] += src[c] * weight;
+	}
+#endif
+}
+
+// Average each 2x2 block. Odd edges repeat their last row or column.
+void downsampleBox(const std::vector<float>& src, int width, int height, std::vector<float>& dst, int dstWidth, int dstHeight)
+{
+	for (int y = 0; y < dstHeight; ++y) {
+		const float* row0 = &src[size_t(std::min(2 * y, height - 1)) * width * 4];
+		const float* row1 = &src[size_t(std::min(2 * y + 1, height - 1)) * width * 4];
+		float* out = &dst[size_t(y) * dstWidth * 4];
+		for (int x = 0; x < dstWidth; ++x) {
+			const int x0 = std::min(2 * x, width - 1) * 4;
+			const int x1 = std::min(2 * x + 1, width - 1) * 4;
+#ifdef TEXTURE_CACHE_SSE
+			const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+				_mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+			_mm_storeu_ps(out + x * 4, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+			for (int c = 0; c < 4; ++c) {
+				out[x * 4 + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]) * 0.25f;
+			}
+#endif
+		}
+	}
+}
+
+// Separable Kaiser filter: halve the rows into scratch, then halve the columns into dst.
+// Taps past an edge clamp to it. The filter rings slightly, so values may leave [0, 1]
+// until they are encoded.
+void downsampleKaiser(const std::vector<float>& src, int width, int height, std::vector<float>& dst, int dstWidth, int dstHeight, std::vector<float>& scratch)
+{
+	const float* weights = tables().kaiser;
+	const int first = -(KAISER_TAPS / 2 - 1);
+
+	scratch.assign(size_t(height) * dstWidth * 4, 0.0f);
+	for (int y = 0; y < height; ++y) {
+		const float* in = &src[size_t(y) * width * 4];
+		float* out = &scratch[size_t(y) * dstWidth * 4];
+		for (int x = 0; x < dstWidth; ++x) {
+			for (int k = 0; k < KAISER_TAPS; ++k) {
+				const int sx = std::min(std::max(2 * x + first + k, 0), width - 1);
+				madd(out + x * 4, in + sx * 4, weights[k]);
+			}
+		}
+	}
+
+	std::fill(dst.begin(), dst.end(), 0.0f);
+	for (int y = 0; y < dstHeight; ++y) {
+		float* out = &dst[size_t(y) * dstWidth * 4];
+		for (int k = 0; k < KAISER_TAPS; ++k) {
+			const int sy = std::min(std::max(2 * y + first + k, 0), height - 1);
+			const float* in = &scratch[size_t(sy) * dstWidth * 4];
+			for (int x = 0; x < dstWidth * 4; x += 4) {
+				madd(out + x, in + x, weights[k]);
+			}
+		}
+	}
+}
+
+TextureCache::MipChain mapChain(const QString& path, const Header& key)
+{
+	QSharedPointer<QFile> file(new QFile(path));
+	if (!file->open(QIODevice::ReadOnly) || file->size() < qint64(sizeof(Header))) {
+		return TextureCache::MipChain();
+	}
+	const uchar* data = file->map(0, file->size());
+	if (!data) {
+		return TextureCache::MipChain();
+	}
+
+	Header header;
+	std::memcpy(&header, data, sizeof(header));
+	if (header.magic != key.magic || header.version != key.version ||
+		header.sourceBytes != key.sourceBytes || header.sourceModified != key.sourceModified ||
+		header.requestedWidth != key.requestedWidth || header.requestedHeight != key.requestedHeight ||
+		header.flags != key.flags || header.gutter != key.gutter || header.width == 0 || header.height == 0) {
+		return TextureCache::MipChain();
+	}
+
+	// Every level must be there, down to 1x1, and nothing else
+	TextureCache::MipChain chain;
+	int width = int(header.width);
+	int height = int(header.height);
+	qint64 offset = sizeof(Header);
+	for (quint32 level = 0; level < header.levels; ++level) {
+		const qint64 bytes = qint64(width) * height * 4;
+		if (offset + bytes > file->size()) {
+			return TextureCache::MipChain();
+		}
+		chain.levels << TextureCache::Level{ data + offset, width, height };
+		offset += bytes;
+		if (width == 1 && height == 1) {
+			break;
+		}
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+	const TextureCache::Level& last = chain.levels.last();
+	if (chain.levels.size() != int(header.levels) || last.width != 1 || last.height != 1 || offset != file->size()) {
+		return TextureCache::MipChain();
+	}
+	chain.file = file;
+	return chain;
+}
+
+bool saveChain(const QString& path, Header header, const TextureCache::MipChain& chain)
+{
+	header.width = quint32(chain.levels[0].width);
+	header.height = quint32(chain.levels[0].height);
+	header.levels = quint32(chain.levels.size());
+
+	// Written aside and renamed into place, so two loads of one file can't interleave
+	QSaveFile file(path);
+	if (!file.open(QIODevice::WriteOnly)) {
+		return false;
+	}
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	for (const TextureCache::Level& level : chain.levels) {
+		file.write(reinterpret_cast<const char*>(level.bits), qint64(level.width) * level.height * 4);
+	}
+	return file.commit();
+}
+
+}
+
+qint64 TextureCache::MipChain::bytes() const
+{
+	qint64 total = 0;
+	for (const Level& level : levels) {
+		total += qint64(level.width) * level.height * 4;
+	}
+	return total;
+}
+
+TextureCache::MipChain TextureCache::build(const QImage& source, Content content, Filter filter)
+{
+	MipChain chain;
+	if (source.isNull()) {
+		return chain;
+	}
+
+	QImage image = source.convertToFormat(QImage::Format_RGBA8888);
+	chain.images << image;
+
+	int width = image.width();
+	int height = image.height();
+	std::vector<float> pixels = toFloat(image, content);
+	std::vector<float> next;
+	std::vector<float> scratch;
+	while (width > 1 || height > 1) {
+		const int nextWidth = std::max(1, width / 2);
+		const int nextHeight = std::max(1, height / 2);
+		next.resize(size_t(nextWidth) * nextHeight * 4);
+		if (filter == Filter::Box) {
+			downsampleBox(pixels, width, height, next, nextWidth, nextHeight);
+		} else {
+			downsampleKaiser(pixels, width, height, next, nextWidth, nextHeight, scratch);
+		}
+		// Each level is filtered from the unrounded one above it
+		chain.images << toImage(next, nextWidth, nextHeight, content);
+		pixels.swap(next);
+		width = nextWidth;
+		height = nextHeight;
+	}
+
+	for (const QImage& level : chain.images) {
+		chain.levels << Level{ level.constBits(), level.width(), level.height() };
+	}
+	return chain;
+}
+
+QImage TextureCache::prepare(const QImage& source, const QSize& size, bool mirror, int gutter)
+{
+	QImage image = source;
+	if (size.isValid() && image.size() != size) {
+		image = image.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+	}
+	if (mirror) {
+		image = image.mirrored();
+	}
+	if (gutter <= 0) {
+		return image;
+	}
+
+	image = image.convertToFormat(QImage::Format_RGBA8888);
+	const int width = image.width();
+	const int height = image.height();
+	QImage padded(width + 2 * gutter, height + 2 * gutter, QImage::Format_RGBA8888);
+	for (int y = 0; y < padded.height(); ++y) {
+		const quint32* src = reinterpret_cast<const quint32*>(image.constScanLine(((y - gutter) % height + height) % height));
+		quint32* dst = reinterpret_cast<quint32*>(padded.scanLine(y));
+		for (int x = 0; x < padded.width(); ++x) {
+			dst[x] = src[((x - gutter) % width + width) % width];
+		}
+	}
+	return padded;
+}
+
+TextureCache::MipChain TextureCache::load(const QString& sourcePath, const QSize& size, bool mirror, Content content, int gutter, bool* cacheHit)
+{
+	if (cacheHit) {
+		*cacheHit = false;
+	}
+	const QFileInfo source(sourcePath);
+	if (!source.exists()) {
+		return MipChain();
+	}
+
+	Header key = requestKey(size, mirror, content, gutter);
+	key.sourceBytes = source.size();
+	key.sourceModified = source.lastModified().toMSecsSinceEpoch();
+
+	const QString path = cachePath(sourcePath, size, mirror, content, gutter);
+	MipChain chain = mapChain(path, key);
+	if (!chain.isNull()) {
+		if (cacheHit) {
+			*cacheHit = true;
+		}
+		return chain;
+	}
+
+	const QImage image(sourcePath);
+	if (image.isNull()) {
+		return MipChain();
+	}
+	chain = build(prepare(image, size, mirror, gutter), content);
+	if (!saveChain(path, key, chain)) {
+		qDebug() << "TextureCache: could not write" << path;
+	}
+	return chain;
+}
+
+QString TextureCache::cachePath(const QString& sourcePath, const QSize& size, bool mirror, Content content, int gutter)
+{
+	// The source file's details stay out of the name, so a changed source rewrites its
+	// file instead of leaving the old one behind
+	const Header key = requestKey(size, mirror, content, gutter);
+	const QByteArray keyHash = QCryptographicHash::hash(QByteArray(reinterpret_cast<const char*>(&key), sizeof(key)), QCryptographicHash::Sha1).toHex().left(8);
+	const QFileInfo info(sourcePath);
+	return info.dir().filePath(info.completeBaseName() + "." + QString::fromLatin1(keyHash) + ".mips");
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <QtCore>
+#include <QtGui>
+#include <QtOpenGL>
+#include "TextureCache.h"
+
+// Loads texture files without stalling the frame. Mip chains are read from the
+// TextureCache (or decoded and built on a miss) on the global QThreadPool, and the render
+// thread uploads them level by level through a pixel buffer object, smallest level first,
+// within a per-frame time budget. Textures show a placeholder until their pixels arrive.
+//
+// Textures stay owned by the caller, which must cancel its loads before destroying them.
+class TextureLoader : protected QOpenGLExtraFunctions
+{
+public:
+	static TextureLoader& instance();
+
+	// Give texture a 1x1 placeholder now and the file's pixels once they are loaded. Each
+	// uploaded level becomes the texture's base level, so it sharpens as the chain comes in.
+	// Must be called with a current GL context.
+	void load(QOpenGLTexture* texture, const QString& path, const QColor& placeholder = Qt::white,
+		TextureCache::Content content = TextureCache::Content::Color);
+	// Fill every level of one layer of an allocated 2D array texture with the file, scaled
+	// to size and flipped to GL's bottom-up rows. For atlases, a gutter of texels wrapped
+	// from the opposite edges goes around the image (see TextureCache::prepare) and the
+	// padded block is placed at offset. The array's base level is dropped to 0 once every
+	// queued layer is in.
+	void loadLayer(QOpenGLTexture* arrayTexture, int layer, const QString& path, const QSize& size,
+		TextureCache::Content content = TextureCache::Content::Color, const QPoint& offset = QPoint(0, 0), int gutter = 0);
+	// The same for an image already in memory, whose chain is built on the pool
+	void loadLayer(QOpenGLTexture* arrayTexture, int layer, const QImage& image, const QSize& size,
+		TextureCache::Content content = TextureCache::Content::Color, const QPoint& offset = QPoint(0, 0), int gutter = 0);
+	// Forget all loads into texture, including ones still being decoded
+	void cancel(QOpenGLTexture* texture);
+
+	// Upload mip levels until budgetMs has passed, and at least one so loading always
+	// moves forward. Must be called with the loading context current. Returns the count.
+	int upload(double budgetMs);
+
+	// Drop every load and delete the pixel buffer. The owning context must be current.
+	void clear();
+
+	// Loads queued but not uploaded yet
+	inline int pending() const { return jobs_.size(); }
+	inline int uploadedCount() const { return uploadedCount_; }
+	// Uploads that came straight from a cache file
+	inline int cachedCount() const { return cachedCount_; }
+	inline qint64 uploadedBytes() const { return uploadedBytes_; }
+	// Total time spent uploading on the render thread, in milliseconds
+	inline double uploadMs() const { return uploadMs_; }
+
+private:
+	struct Job {
+		QOpenGLTexture* texture;
+		int layer;	// -1 for a whole 2D texture
+		QPoint offset;	// Where the first level goes within the layer
+		QString path;
+	};
+	struct Decoded {
+		int id;
+		TextureCache::MipChain chain;
+		bool cacheHit;
+	};
+	class DecodeTask;
+
+	TextureLoader();
+	TextureLoader(const TextureLoader&) = delete;
+	TextureLoader& operator=(const TextureLoader&) = delete;
+
+	void initialize();
+	int queue(const Job& job, const QImage& image, const QSize& size, bool mirror, TextureCache::Content content, int gutter);
+	// Called by the decode threads
+	void finished(int id, const TextureCache::MipChain& chain, bool cacheHit);
+	// Take the next decoded chain whose load is still wanted and get its texture ready
+	bool beginNext();
+	void uploadLevel(const Job& job, const TextureCache::Level& level, int index);
+	void layerDone(QOpenGLTexture* texture);
+	void resetCurrent();
+
+	QOpenGLContext* context_;
+	GLuint pixelBuffer_;
+
+	// Only touched by the render thread
+	QHash<int, Job> jobs_;
+	// Layers still to come for each array texture
+	QHash<QOpenGLTexture*, int> remainingLayers_;
+	int nextId_;
+	// The chain being uploaded and the next level of it to go, smallest first; -1 when idle
+	Decoded current_;
+	int currentLevel_;
+
+	// Handed over from the decode threads
+	QMutex mutex_;
+	QVector<Decoded> decoded_;
+
+	int uploadedCount_;
+	int cachedCount_;
+	qint64 uploadedBytes_;
+	double uploadMs_;
+};
@@ -0,0 +1,319 @@
+#include "TransformHierarchy.h"
+#include "SceneNode.h"
+
+// Build translation * rotation * scale directly, without QMatrix4x4's general-purpose multiplies
+static QMatrix4x4 composeTransform(const QVector3D& t, const QQuaternion& q, const QVector3D& s)
+{
+	const float x = q.x(), y = q.y(), z = q.z(), w = q.scalar();
+	const float xx = x * x, yy = y * y, zz = z * z;
+	const float xy = x * y, xz = x * z, yz = y * z;
+	const float wx = w * x, wy = w * y, wz = w * z;
+
+	return QMatrix4x4(
+		(1.0f - 2.0f * (yy + zz)) * s.x(), 2.0f * (xy - wz) * s.y(), 2.0f * (xz + wy) * s.z(), t.x(),
+		2.0f * (xy + wz) * s.x(), (1.0f - 2.0f * (xx + zz)) * s.y(), 2.0f * (yz - wx) * s.z(), t.y(),
+		2.0f * (xz - wy) * s.x(), 2.0f * (yz + wx) * s.y(), (1.0f - 2.0f * (xx + yy)) * s.z(), t.z(),
+		0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+// Distance along the ray to where it enters box, or INFINITY if it misses it before tMax
+static float enterBox(const BoundingBox& box, const QVector3D& origin, const QVector3D& inverseDirection, float tMax)
+{
+	if (box.isEmpty()) {
+		return INFINITY;
+	}
+	float tEnter = 0.0f;
+	float tExit = tMax;
+	for (int axis = 0; axis < 3; ++axis) {
+		const float t0 = (box.min[axis] - origin[axis]) * inverseDirection[axis];
+		const float t1 = (box.max[axis] - origin[axis]) * inverseDirection[axis];
+		tEnter = qMax(tEnter, qMin(t0, t1));
+		tExit = qMin(tExit, qMax(t0, t1));
+	}
+	return tEnter <= tExit ? tEnter : INFINITY;
+}
+
+// ~~~~~~~~~~ LOCALTRANSFORM ~~~~~~~~~~
+LocalTransform::LocalTransform() : translation(0, 0, 0), rotation(), scale(1, 1, 1), spinAxis(0, 1, 0), spinDegreesPerSecond(0) {}
+
+QMatrix4x4 LocalTransform::toMatrix() const
+{
+	return composeTransform(translation, rotation, scale);
+}
+
+
+// ~~~~~~~~~~ TRANSFORMHIERARCHY ~~~~~~~~~~
+TransformHierarchy::TransformHierarchy() : anyDirty_(false), lastUpdateCount_(0), parallelGrainSize_(4096), needsRebuild_(false)
+{}
+
+void TransformHierarchy::build(SceneNode* root)
+{
+	// Read every node's transform before we start overwriting our arrays
+	QVector<SceneNode*> order;
+	QVector<int> parents;
+	QVector<LocalTransform> locals;
+
+	// Iterative preorder traversal, so very deep hierarchies can't overflow the stack
+	QVector<QPair<SceneNode*, int>> stack;
+	stack << qMakePair(root, -1);
+	while (!stack.isEmpty()) {
+		const QPair<SceneNode*, int> top = stack.takeLast();
+		SceneNode* node = top.first;
+		const int index = order.size();
+		order << node;
+		parents << top.second;
+		locals << node->getLocal();
+
+		// Push children in reverse so they come out in their original order
+		QVector<SceneNode*> children;
+		for (auto it = node->begin(); it != node->end(); ++it) {
+			children << *it;
+		}
+		for (int ii = children.size() - 1; ii >= 0; --ii) {
+			stack << qMakePair(children[ii], index);
+		}
+	}
+
+	const int count = order.size();
+	nodes_ = order;
+	parents_ = parents;
+	translations_.resize(count);
+	rotations_.resize(count);
+	scales_.resize(count);
+	spinAxes_.resize(count);
+	spinRates_.resize(count);
+	locals_.resize(count);
+	worlds_.resize(count);
+	localDirty_.fill(1, count);
+	worldChanged_.fill(0, count);
+	boundsDirty_.fill(0, count);
+	localBounds_.resize(count);
+	ownBounds_.resize(count);
+	subtreeBounds_.resize(count);
+	spinning_.resize(0);
+
+	for (int i = 0; i < count; ++i) {
+		const LocalTransform& local = locals[i];
+		translations_[i] = local.translation;
+		rotations_[i] = local.rotation;
+		scales_[i] = local.scale;
+		spinAxes_[i] = local.spinAxis;
+		spinRates_[i] = local.spinDegreesPerSecond;
+		if (local.spinDegreesPerSecond != 0.0f) {
+			spinning_ << i;
+		}
+		const Renderable* renderable = nodes_[i]->getRenderable();
+		localBounds_[i] = renderable ? renderable->bounds().scaled(nodes_[i]->getModelScale()) : BoundingBox();
+		nodes_[i]->attach(this, i);
+	}
+
+	// In preorder a subtree ends where the last descendant of its last child ends. Walking
+	// backwards, every child's subtree is complete before it's added to its parent's.
+	subtreeEnds_.resize(count);
+	subtreeRenderables_.resize(count);
+	for (int i = 0; i < count; ++i) {
+		subtreeEnds_[i] = i + 1;
+		subtreeRenderables_[i] = nodes_[i]->getRenderable() ? 1 : 0;
+	}
+	for (int i = count - 1; i > 0; --i) {
+		const int p = parents_[i];
+		subtreeEnds_[p] = qMax(subtreeEnds_[p], subtreeEnds_[i]);
+		subtreeRenderables_[p] += subtreeRenderables_[i];
+	}
+
+	anyDirty_ = count > 0;
+	needsRebuild_ = false;
+}
+
+void TransformHierarchy::animate(const qint64 msSinceLastFrame)
+{
+	const float seconds = float(msSinceLastFrame) / 1000.0f;
+	for (int i : spinning_) {
+		const QQuaternion delta = QQuaternion::fromAxisAndAngle(spinAxes_[i], spinRates_[i] * seconds);
+		// Re-normalize so accumulated rounding error never skews the rotation
+		rotations_[i] = (rotations_[i] * delta).normalized();
+		markDirty(i);
+	}
+}
+
+void TransformHierarchy::update(TaskPool* pool)
+{
+	lastUpdateCount_ = 0;
+	if (!anyDirty_) {
+		// Nothing moved since the last update
+		worldChanged_.fill(0);
+		return;
+	}
+
+	const int count = nodes_.size();
+	if (!pool || pool->threadCount() < 2 || count < parallelGrainSize_) {
+		lastUpdateCount_ = updateRange(0, count);
+	}
+	else {
+		std::atomic<int> updated(0);
+		TaskGroup group;
+		updateSubtreeParallel(0, *pool, group, updated);
+		pool->wait(group);
+		lastUpdateCount_ = updated.load();
+	}
+
+	if (lastUpdateCount_ > 0) {
+		updateBounds();
+	}
+	anyDirty_ = false;
+}
+
+void TransformHierarchy::updateBounds()
+{
+	// Walking preorder backwards finishes every subtree before its root
+	for (int i = nodes_.size() - 1; i >= 0; --i) {
+		if (worldChanged_[i]) {
+			ownBounds_[i] = localBounds_[i].transformed(worlds_[i]);
+			boundsDirty_[i] = 1;
+		}
+		if (!boundsDirty_[i]) {
+			continue;
+		}
+
+		BoundingBox bounds = ownBounds_[i];
+		for (int child = i + 1; child < subtreeEnds_[i]; child = subtreeEnds_[child]) {
+			bounds.merge(subtreeBounds_[child]);
+		}
+		subtreeBounds_[i] = bounds;
+		boundsDirty_[i] = 0;
+
+		const int p = parents_[i];
+		if (p >= 0) {
+			boundsDirty_[p] = 1;
+		}
+	}
+}
+
+int TransformHierarchy::updateRange(int begin, int end)
+{
+	int updated = 0;
+	for (int i = begin; i < end; ++i) {
+		const int p = parents_[i];
+		const bool parentChanged = p >= 0 && worldChanged_[p];
+
+		if (localDirty_[i]) {
+			locals_[i] = composeTransform(translations_[i], rotations_[i], scales_[i]);
+			localDirty_[i] = 0;
+		}
+		else if (!parentChanged) {
+			worldChanged_[i] = 0;
+			continue;
+		}
+
+		worlds_[i] = p >= 0 ? worlds_[p] * locals_[i] : locals_[i];
+		worldChanged_[i] = 1;
+		++updated;
+	}
+	return updated;
+}
+
+void TransformHierarchy::updateSubtreeParallel(int root, TaskPool& pool, TaskGroup& group, std::atomic<int>& updated)
+{
+	// The root goes first, since every child reads its world matrix
+	int count = updateRange(root, root + 1);
+
+	// Siblings' subtrees are independent. Big ones become tasks of their own; runs of
+	// small siblings are contiguous in preorder, so they are batched into one range.
+	const int end = subtreeEnds_[root];
+	int batchBegin = root + 1;
+	for (int child = root + 1; child < end; child = subtreeEnds_[child]) {
+		const int childEnd = subtreeEnds_[child];
+		if (childEnd - child >= parallelGrainSize_) {
+			if (batchBegin < child) {
+				pool.run(group, [this, batchBegin, child, &updated]() { updated += updateRange(batchBegin, child); });
+			}
+			pool.run(group, [this, child, &pool, &group, &updated]() { updateSubtreeParallel(child, pool, group, updated); });
+			batchBegin = childEnd;
+		}
+		else if (childEnd - batchBegin >= parallelGrainSize_) {
+			pool.run(group, [this, batchBegin, childEnd, &updated]() { updated += updateRange(batchBegin, childEnd); });
+			batchBegin = childEnd;
+		}
+	}
+
+	// Whatever small siblings are left we do ourselves
+	count += updateRange(batchBegin, end);
+	updated += count;
+}
+
+LocalTransform TransformHierarchy::local(int i) const
+{
+	LocalTransform local;
+	local.translation = translations_[i];
+	local.rotation = rotations_[i];
+	local.scale = scales_[i];
+	local.spinAxis = spinAxes_[i];
+	local.spinDegreesPerSecond = spinRates_[i];
+	return local;
+}
+
+void TransformHierarchy::setTranslation(int i, const QVector3D& translation)
+{
+	translations_[i] = translation;
+	markDirty(i);
+}
+
+void TransformHierarchy::setRotation(int i, const QQuaternion& rotation)
+{
+	rotations_[i] = rotation;
+	markDirty(i);
+}
+
+void TransformHierarchy::setScale(int i, const QVector3D& scale)
+{
+	scales_[i] = scale;
+	markDirty(i);
+}
+
+void TransformHierarchy::setSpin(int i, const QVector3D& axis, float degreesPerSecond)
+{
+	spinAxes_[i] = axis;
+	const bool wasSpinning = spinRates_[i] != 0.0f;
+	spinRates_[i] = degreesPerSecond;
+	if (!wasSpinning && degreesPerSecond != 0.0f) {
+		spinning_ << i;
+	}
+	else if (wasSpinning && degreesPerSecond == 0.0f) {
+		spinning_.removeAt(spinning_.indexOf(i));
+	}
+}
+
+bool TransformHierarchy::intersect(const QVector3D& origin, const QVector3D& direction, RayHit& hit) const
+{
+	hit.node = -1;
+	hit.face = -1;
+	hit.u = hit.v = 0.0f;
+	hit.t = 1e30f;
+	const QVector3D inverseDirection(1.0f / direction.x(), 1.0f / direction.y(), 1.0f / direction.z());
+	int i = 0;
+	while (i < nodes_.size()) {
+		if (enterBox(subtreeBounds_[i], origin, inverseDirection, hit.t) == INFINITY) {
+			i = subtreeEnds_[i];
+			continue;
+		}
+		const SceneNode* node = nodes_[i];
+		const Renderable* renderable = node->getRenderable();
+		if (renderable && enterBox(ownBounds_[i], origin, inverseDirection, hit.t) != INFINITY) {
+			// Into the renderable's model space, without renormalizing, so t is still a
+			// world distance and compares across nodes
+			QMatrix4x4 toWorld = worlds_[i];
+			toWorld.scale(node->getModelScale());
+			const QMatrix4x4 toModel = toWorld.inverted();
+			Bvh::Hit meshHit;
+			if (renderable->bvh().intersect(Vec3(toModel.map(origin)), Vec3(toModel.mapVector(direction)), meshHit, hit.t)) {
+				hit.node = i;
+				hit.face = meshHit.face;
+				hit.u = meshHit.u;
+				hit.v = meshHit.v;
+				hit.t = meshHit.t;
+			}
+		}
+		++i;
+	}
+	return hit.node >= 0;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <QtCore>
+#include <QtGui>
+#include <atomic>
+#include "Bounds.h"
+#include "TaskPool.h"
+
+class SceneNode;
+
+// A node's transform relative to its parent, plus an optional constant spin
+struct LocalTransform {
+	QVector3D translation;
+	QQuaternion rotation;
+	QVector3D scale;
+	QVector3D spinAxis;
+	float spinDegreesPerSecond;
+
+	LocalTransform();
+
+	// translation * rotation * scale
+	QMatrix4x4 toMatrix() const;
+};
+
+// Closest triangle a ray hit in the hierarchy
+struct RayHit {
+	int node;		// Index of the node hit, -1 for a miss
+	int face;		// Into the faces its renderable was built from
+	float u, v;		// Barycentrics of the face's second and third corners
+	float t;		// Distance along the ray
+};
+
+// The scene graph's transforms flattened into parallel arrays (structure of arrays).
+// Nodes are stored in depth-first preorder, so a parent always comes before its
+// children and every subtree occupies the contiguous range [i, subtreeEnd(i)).
+// Only nodes whose local transform changed, and their descendants, are recomputed.
+class TransformHierarchy
+{
+public:
+	TransformHierarchy();
+
+	// Flatten the tree under root. Nodes keep their current local transforms.
+	void build(SceneNode* root);
+	// Set when nodes are added after build(); the next frame should rebuild.
+	inline bool needsRebuild() const { return needsRebuild_; }
+	inline void invalidate() { needsRebuild_ = true; }
+
+	// Advance every spinning node's rotation
+	void animate(const qint64 msSinceLastFrame);
+	// Recompute world matrices for dirty nodes and everything below them, then
+	// refresh the world bounds of everything that moved and of its ancestors.
+	// With a pool, independent sibling subtrees are updated in parallel; the
+	// result is identical to the serial update.
+	void update(TaskPool* pool = nullptr);
+	// Subtrees smaller than this are updated serially within one task
+	inline void setParallelGrainSize(int nodes) { parallelGrainSize_ = qMax(nodes, 1); }
+
+	// Per-node access, indexed in preorder
+	inline int size() const { return nodes_.size(); }
+	inline SceneNode* node(int i) const { return nodes_[i]; }
+	inline int parent(int i) const { return parents_[i]; }
+	inline int subtreeEnd(int i) const { return subtreeEnds_[i]; }
+	// Nodes with a renderable in [i, subtreeEnd(i))
+	inline int subtreeRenderables(int i) const { return subtreeRenderables_[i]; }
+	inline const QMatrix4x4& world(int i) const { return worlds_[i]; }
+	// World bounds of the node's own renderable, and of it plus all its descendants
+	inline const BoundingBox& ownBounds(int i) const { return ownBounds_[i]; }
+	inline const BoundingBox& subtreeBounds(int i) const { return subtreeBounds_[i]; }
+	// Number of world matrices recomputed by the last update()
+	inline int lastUpdateCount() const { return lastUpdateCount_; }
+
+	// Closest renderable triangle along a world-space ray, as of the last update(). Walks the
+	// nodes in preorder, skipping any subtree whose world bounds the ray misses or reaches
+	// only past the closest hit so far, and tests each renderable's Bvh in its model space.
+	bool intersect(const QVector3D& origin, const QVector3D& direction, RayHit& hit) const;
+
+	LocalTransform local(int i) const;
+	void setTranslation(int i, const QVector3D& translation);
+	void setRotation(int i, const QQuaternion& rotation);
+	void setScale(int i, const QVector3D& scale);
+	void setSpin(int i, const QVector3D& axis, float degreesPerSecond);
+
+private:
+	inline void markDirty(int i) { localDirty_[i] = 1; anyDirty_ = true; }
+	// Update nodes [begin, end) in order. Returns how many world matrices were recomputed.
+	int updateRange(int begin, int end);
+	// Update root, then queue its child subtrees as tasks
+	void updateSubtreeParallel(int root, TaskPool& pool, TaskGroup& group, std::atomic<int>& updated);
+	// Merge bounds bottom-up for nodes whose world matrix changed and their ancestors
+	void updateBounds();
+
+	QVector<SceneNode*> nodes_;
+	QVector<int> parents_;
+	QVector<int> subtreeEnds_;
+	QVector<int> subtreeRenderables_;
+
+	// Local TRS
+	QVector<QVector3D> translations_;
+	QVector<QQuaternion> rotations_;
+	QVector<QVector3D> scales_;
+	QVector<QVector3D> spinAxes_;
+	QVector<float> spinRates_;
+	// Indices of nodes with a non-zero spin, so animate() skips static nodes
+	QVector<int> spinning_;
+
+	// Cached matrices
+	QVector<QMatrix4x4> locals_;
+	QVector<QMatrix4x4> worlds_;
+
+	// Renderable bounds with the node's model scale applied, then in world space
+	QVector<BoundingBox> localBounds_;
+	QVector<BoundingBox> ownBounds_;
+	QVector<BoundingBox> subtreeBounds_;
+
+	// Dirty flags. worldChanged_ tells children their parent moved this update.
+	QVector<quint8> localDirty_;
+	QVector<quint8> worldChanged_;
+	QVector<quint8> boundsDirty_;
+	bool anyDirty_;
+
+	int lastUpdateCount_;
+	int parallelGrainSize_;
+	bool needsRebuild_;
+};
@@ -1,7 +1,43 @@
 #version 330
 
-// ~~~~~~~~~~ CONSTANTS ~~~~~~~~~~
+// ~~~~~~~~~~ PERMUTATIONS ~~~~~~~~~~
+// Renderable compiles one variant of this shader per combination of these defines,
+// so the compiler strips every branch and light the variant doesn't use.
+//   DRAW_MODE         0 default, 1 wireframe, 2 texture debug, 3 normal debug, 4 lighting debug,
+//                     5 G-buffer for DeferredRenderer
+//   NORMAL_MAPS       defined when normal maps are bound
+//   NUM_POINT_LIGHTS  number of point lights
+//   CLUSTERED_LIGHTS  shade any number of lights from LightClusters' per-cluster lists
+// UBER_SHADER instead builds the single runtime-branching shader, for comparison.
+#ifdef UBER_SHADER
+#define NUM_POINT_LIGHTS 8
+uniform int drawMode;
+uniform bool hasNormalMaps;
+uniform int pointLightCount;
+#define DRAW_MODE drawMode
+#define HAS_NORMAL_MAPS hasNormalMaps
+#define POINT_LIGHT_COUNT min(pointLightCount, NUM_POINT_LIGHTS)
+#else
+#ifndef DRAW_MODE
+#define DRAW_MODE 0
+#endif
+#ifndef NUM_POINT_LIGHTS
 #define NUM_POINT_LIGHTS 1
+#endif
+#ifdef NORMAL_MAPS
+#define HAS_NORMAL_MAPS true
+#else
+#define HAS_NORMAL_MAPS false
+#endif
+#define POINT_LIGHT_COUNT NUM_POINT_LIGHTS
+#if DRAW_MODE == 5
+#define G_BUFFER
+#endif
+#endif
+// Only normal mapping needs the tangent basis; vert.glsl skips it otherwise
+#if defined(NORMAL_MAPS) || defined(UBER_SHADER)
+#define TANGENT_SPACE
+#endif
 
 // ~~~~~~~~~~ STRUCTS ~~~~~~~~~~
 struct PointLight {
@@ -19,75 +55,146 @@ in VS_OUT {
 	vec3 fragPos;
 	vec2 texCoords;
 	vec3 norm;
+#ifdef TANGENT_SPACE
 	mat3 tangentToWorld;
+#endif
+	flat vec3 layers;
+	flat vec4 diffuseRegion;
+	flat vec4 normalRegion;
 } fs_in;
 
 // ~~~~~~~~~~ OUTPUTS ~~~~~~~~~~
-out vec4 fragColor;
+// The G-buffer pass writes albedo here and fills the other render targets too
+layout(location = 0) out vec4 fragColor;
+#ifdef G_BUFFER
+layout(location = 1) out vec4 fragNormal;
+layout(location = 2) out float fragDepth;
+#endif
 
 // ~~~~~~~~~~ UNIFORMS ~~~~~~~~~~
 uniform vec3 viewPosition;
-uniform int drawMode;
-uniform bool hasNormalMap;
-uniform sampler2D diffuseMap;
-uniform sampler2D normalMap;
+uniform sampler2DArray diffuseMaps;
+uniform sampler2DArray normalMaps;
+#if NUM_POINT_LIGHTS > 0
 uniform PointLight pointLights[NUM_POINT_LIGHTS];
+#endif
+#ifdef CLUSTERED_LIGHTS
+// Laid out by LightClusters: (offset, count) per cluster, light indices, 3 texels per light
+uniform usamplerBuffer clusterRanges;
+uniform usamplerBuffer clusterLightIndices;
+uniform samplerBuffer clusterLights;
+uniform mat4 viewMatrix;
+uniform vec2 clusterTileScale;
+uniform vec2 clusterDepthScaleBias;
+
+vec3 clusteredPointLights(vec3 normal, vec3 viewDir);
+#endif
 
 vec3 allPointLights(vec3 normal, vec3 viewDir);
 vec3 calcPointLight(PointLight light, vec3 normal, vec3 viewDir); 
 
+// Sample a texture from its region of an atlas layer, repeating it within the region.
+// Gradients come from the unwrapped coordinates, so the wrap doesn't drop to the smallest
+// mip, and the gutter around each region keeps filtering from reaching its neighbors.
+vec4 sampleRegion(sampler2DArray maps, float layer, vec4 region) {
+	vec2 uv = region.xy + fract(fs_in.texCoords) * region.zw;
+	return textureGrad(maps, vec3(uv, layer), dFdx(fs_in.texCoords) * region.zw, dFdy(fs_in.texCoords) * region.zw);
+}
+
 void main() {
 	// Calculate normal in world space based on normal map
-	vec3 normal;
-	if (hasNormalMap) {
-		normal = texture(normalMap, fs_in.texCoords).rgb;
+	vec3 normal = fs_in.norm;
+#ifdef TANGENT_SPACE
+	if (HAS_NORMAL_MAPS && fs_in.layers.y >= 0.0) {
+		normal = sampleRegion(normalMaps, fs_in.layers.y, fs_in.normalRegion).rgb;
 		normal = normal * 2.0 - 1.0;
 		normal = normalize(fs_in.tangentToWorld * normal);
-	} else {
-		normal = fs_in.norm;
 	}
+#endif
 
 	// Get view direction
 	vec3 viewDir = normalize(viewPosition - fs_in.fragPos);
 
 	// Store final texture color
-	vec3 diffuseColor = texture(diffuseMap, fs_in.texCoords).rgb;
+	vec3 diffuseColor = sampleRegion(diffuseMaps, fs_in.layers.x, fs_in.diffuseRegion).rgb;
+
+#ifdef G_BUFFER
+	// Store what lighting needs and leave the shading to DeferredRenderer.
+	// gl_FragCoord.w is 1 / view space depth under a perspective projection.
+	fragColor = vec4(diffuseColor, 1.0);
+	fragNormal = vec4(normalize(normal), 0.0);
+	fragDepth = 1.0 / gl_FragCoord.w;
+	return;
+#endif
 
 	// ~~~~~~~~~~ DRAWING MODES ~~~~~~~~~~
 	// Default mode
-	if (drawMode == 0) {
+	if (DRAW_MODE == 0) {
 		vec3 lighting = allPointLights(normal, viewDir);
 		fragColor = vec4(diffuseColor * lighting, 1.0);
 	} 
 	// Wireframe mode
-	else if (drawMode == 1) {
+	else if (DRAW_MODE == 1) {
 		fragColor = vec4(1.0, 1.0, 1.0, 1.0);
 	}
 	// Texture debug mode
-	else if (drawMode == 2) {
+	else if (DRAW_MODE == 2) {
 		fragColor = vec4(fs_in.texCoords, 0.0, 1.0);
 	}
 	// Normal debug mode
-	else if (drawMode == 3) {
+	else if (DRAW_MODE == 3) {
 		fragColor = vec4(normal * 0.5 + 0.5, 1.0);
 	}
 	// Lighting debug mode
-	else if (drawMode == 4) {
+	else if (DRAW_MODE == 4) {
 		vec3 lighting = allPointLights(normal, viewDir);
 		fragColor = vec4(lighting, 1.0);
 	}
+	// Translucent nodes are blended by their opacity
+	fragColor.a = fs_in.layers.z;
 }
 
 vec3 allPointLights(vec3 normal, vec3 viewDir) {
 	vec3 lighting = vec3(0);
 
-	for (int ii = 0; ii < NUM_POINT_LIGHTS; ++ii) {
+#if NUM_POINT_LIGHTS > 0
+	for (int ii = 0; ii < POINT_LIGHT_COUNT; ++ii) {
 		lighting += calcPointLight(pointLights[ii], normal, viewDir);
 	}
+#endif
+#ifdef CLUSTERED_LIGHTS
+	lighting += clusteredPointLights(normal, viewDir);
+#endif
 
 	return lighting;
 }
 
+#ifdef CLUSTERED_LIGHTS
+vec3 clusteredPointLights(vec3 normal, vec3 viewDir) {
+	// Find our cluster from the screen tile and exponential depth slice
+	float depth = -(viewMatrix * vec4(fs_in.fragPos, 1.0)).z;
+	ivec2 tile = min(ivec2(gl_FragCoord.xy * clusterTileScale), ivec2(CLUSTER_TILES_X - 1, CLUSTER_TILES_Y - 1));
+	int slice = clamp(int(log(max(depth, 1e-4)) * clusterDepthScaleBias.x + clusterDepthScaleBias.y), 0, CLUSTER_SLICES - 1);
+	int cluster = tile.x + CLUSTER_TILES_X * (tile.y + CLUSTER_TILES_Y * slice);
+	uvec2 range = texelFetch(clusterRanges, cluster).xy;
+
+	vec3 lighting = vec3(0);
+	for (uint ii = 0u; ii < range.y; ++ii) {
+		int index = int(texelFetch(clusterLightIndices, int(range.x + ii)).r) * 3;
+		vec4 t0 = texelFetch(clusterLights, index);
+		vec4 t1 = texelFetch(clusterLights, index + 1);
+		vec4 t2 = texelFetch(clusterLights, index + 2);
+		PointLight light = PointLight(t0.xyz, t1.rgb, t1.a, t2.x, t2.y, t2.z, t2.w);
+
+		// Fade to exactly zero at the assignment radius so cluster edges never show
+		float ratio = length(light.position - fs_in.fragPos) / t0.w;
+		float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+		lighting += calcPointLight(light, normal, viewDir) * (window * window);
+	}
+	return lighting;
+}
+#endif
+
 vec3 calcPointLight(PointLight light, vec3 normal, vec3 viewDir)
 {
 	// (1) Compute ambient light
@@ -7,8 +7,33 @@
 #include <QtOpenGL>
 
 #include "App.h"
+#include "Benchmarks.h"
 
 int main(int argc, char** argv) {
+  // Headless benchmarks: ./App --bench-transforms [nodeCount]
+  //                       ./App --bench-parallel [nodeCount]
+  //                       ./App --bench-raytrace [nodeCount]
+  //                       ./App --bench-occlusion [nodeCount]
+  //                       ./App --bench-gpu-culling [instanceCount]
+  if (argc > 1 && QString(argv[1]) == "--bench-transforms") {
+    return runTransformBenchmark(argc > 2 ? QString(argv[2]).toInt() : 100000);
+  }
+  if (argc > 1 && QString(argv[1]) == "--bench-parallel") {
+    return runParallelBenchmark(argc > 2 ? QString(argv[2]).toInt() : 1000000);
+  }
+  if (argc > 1 && QString(argv[1]) == "--bench-raytrace") {
+    return runRaytraceBenchmark(argc > 2 ? QString(argv[2]).toInt() : 1000);
+  }
+  if (argc > 1 && QString(argv[1]) == "--bench-occlusion") {
+    return runOcclusionBenchmark(argc > 2 ? QString(argv[2]).toInt() : 10000);
+  }
+  if (argc > 1 && QString(argv[1]) == "--bench-gpu-culling") {
+    // Needs a GL context, so a GUI application without a window
+    QGuiApplication headless(argc, argv);
+    QDir::setCurrent(headless.applicationDirPath());
+    return runGpuCullingBenchmark(argc > 2 ? QString(argv[2]).toInt() : 50000);
+  }
+
   QApplication a(argc, argv);
   QString appDir = a.applicationDirPath();
   QDir::setCurrent(appDir);
@@ -1,44 +1,65 @@
 #version 330
 
+// Only normal mapping needs the tangent basis (see the permutations in frag.glsl)
+#if defined(NORMAL_MAPS) || defined(UBER_SHADER)
+#define TANGENT_SPACE
+#endif
+
 // ~~~~~~~~~~ INPUTS ~~~~~~~~~~
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec2 textureCoords;
 layout(location = 2) in vec3 normal;
-layout(location = 3) in vec3 tangent;
+layout(location = 3) in vec4 tangent;		// w < 0 for a left-handed tangent basis
+
+// ~~~~~~~~~~ PER-INSTANCE INPUTS ~~~~~~~~~~
+layout(location = 4) in mat4 modelMatrix;		// occupies locations 4-7
+layout(location = 8) in mat3 normalMatrix;	// occupies locations 8-10
+layout(location = 11) in vec3 textureLayers;	// (diffuse layer, normal layer, opacity)
+layout(location = 12) in vec4 diffuseRegion;	// atlas region within the layer: (offset, scale)
+layout(location = 13) in vec4 normalRegion;
 
 // ~~~~~~~~~~ OUTPUTS ~~~~~~~~~~
 out VS_OUT {
 	vec3 fragPos;
 	vec2 texCoords;
 	vec3 norm;
+#ifdef TANGENT_SPACE
 	mat3 tangentToWorld;
+#endif
+	flat vec3 layers;
+	flat vec4 diffuseRegion;
+	flat vec4 normalRegion;
 } vs_out;
 
 // ~~~~~~~~~~ UNIFORMS ~~~~~~~~~~
-uniform mat4 modelMatrix;
 uniform mat4 viewMatrix;
 uniform mat4 projectionMatrix;
-uniform mat3 normalMatrix;
 
 void main()
 {
 	// Output fragment position
 	vs_out.fragPos = vec3(modelMatrix * vec4(position, 1.0));
 
-	// Output texture coords
+	// Output texture coords and which array layers to sample them from
 	vs_out.texCoords = textureCoords;
+	vs_out.layers = textureLayers;
+	vs_out.diffuseRegion = diffuseRegion;
+	vs_out.normalRegion = normalRegion;
 
 	// Output normal (in world space)
 	vs_out.norm = normalize(normalMatrix * normal);
 
+#ifdef TANGENT_SPACE
 	// Create world-to-tangent space matrix
-	vec3 T = normalize(normalMatrix * tangent);
+	vec3 T = normalize(normalMatrix * tangent.xyz);
 	vec3 N = normalize(normalMatrix * normal);
 	// re-orthogonalize T with respect to N
 	T = normalize(T - dot(T, N) * N);
-	// then retrieve perpendicular vector B with the cross product of T and N
-	vec3 B = cross(N, T);
+	// then retrieve perpendicular vector B with the cross product of T and N,
+	// flipped where the UVs are mirrored
+	vec3 B = cross(N, T) * (tangent.w < 0.0 ? -1.0 : 1.0);
 	vs_out.tangentToWorld = mat3(T, B, N);
+#endif
 
 	// Output vertex position
 	gl_Position = projectionMatrix*viewMatrix*modelMatrix*vec4(position, 1.0);
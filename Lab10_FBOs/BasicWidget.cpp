@@ -15,10 +15,12 @@ BasicWidget::BasicWidget(QWidget* parent) : QOpenGLWidget(parent), logger_(this)
 
 BasicWidget::~BasicWidget()
 {
+    makeCurrent();
     for (auto renderable : renderables_) {
         delete renderable;
     }
     renderables_.clear();
+    ShaderCache::instance().clear();
 	// Make sure to clean up.
     vbo_.release();
     vbo_.destroy();
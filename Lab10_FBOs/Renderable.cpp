@@ -3,7 +3,7 @@
 #include <QtGui>
 #include <QtOpenGL>
 
-Renderable::Renderable() : vbo_(QOpenGLBuffer::VertexBuffer), ibo_(QOpenGLBuffer::IndexBuffer), texture_(QOpenGLTexture::Target2D), numTris_(0), vertexSize_(0), rotationAxis_(0.0, 0.0, 1.0), rotationSpeed_(0.15), isFilled_(false)
+Renderable::Renderable() : shader_(nullptr), vbo_(QOpenGLBuffer::VertexBuffer), ibo_(QOpenGLBuffer::IndexBuffer), texture_(QOpenGLTexture::Target2D), numTris_(0), vertexSize_(0), rotationAxis_(0.0, 0.0, 1.0), rotationSpeed_(0.15), isFilled_(false)
 {
 	rotationAngle_ = 0.0;
 }
@@ -26,20 +26,8 @@ Renderable::~Renderable()
 
 void Renderable::createShaders()
 {
-	QString vertexFilename = "../../vert.glsl";
-	bool ok = shader_.addShaderFromSourceFile(QOpenGLShader::Vertex, vertexFilename);
-	if (!ok) {
-		qDebug() << shader_.log();
-	}
-	QString fragmentFilename = "../../frag.glsl";
-	ok = shader_.addShaderFromSourceFile(QOpenGLShader::Fragment, fragmentFilename);
-	if (!ok) {
-		qDebug() << shader_.log();
-	}
-	ok = shader_.link();
-	if (!ok) {
-		qDebug() << shader_.log();
-	}
+	// Every Renderable uses the same shaders, so they all share one cached program
+	shader_ = ShaderCache::instance().program("../../vert.glsl", "../../frag.glsl");
 }
 
 void Renderable::init(const QVector<QVector3D>& positions, const QVector<QVector3D>& normals, const QVector<QVector2D>& texCoords, const QVector<unsigned int>& indexes, const QString& textureFile)
@@ -106,12 +94,12 @@ void Renderable::init(const QVector<QVector3D>& positions, const QVector<QVector
 	delete[] idxAr;
 
 	// Make sure we setup our shader inputs properly
-	shader_.enableAttributeArray(0);
-	shader_.setAttributeBuffer(0, GL_FLOAT, 0, 3, vertexSize_ * sizeof(float));
-	shader_.enableAttributeArray(1);
-	shader_.setAttributeBuffer(1, GL_FLOAT, 3 * sizeof(float), 3, vertexSize_ * sizeof(float));
-	shader_.enableAttributeArray(2);
-	shader_.setAttributeBuffer(2, GL_FLOAT, (3+3) * sizeof(float), 2, vertexSize_ * sizeof(float));
+	shader_->enableAttributeArray(0);
+	shader_->setAttributeBuffer(0, GL_FLOAT, 0, 3, vertexSize_ * sizeof(float));
+	shader_->enableAttributeArray(1);
+	shader_->setAttributeBuffer(1, GL_FLOAT, 3 * sizeof(float), 3, vertexSize_ * sizeof(float));
+	shader_->enableAttributeArray(2);
+	shader_->setAttributeBuffer(2, GL_FLOAT, (3+3) * sizeof(float), 2, vertexSize_ * sizeof(float));
 
 	// Release our vao and THEN release our buffers.
 	vao_.release();
@@ -151,20 +139,20 @@ void Renderable::draw(const QMatrix4x4& world, const QMatrix4x4& view, const QMa
 	QMatrix4x4 modelMat = modelMatrix_ * rotMatrix;
 	modelMat = world * modelMat;
 	// Make sure our state is what we want
-	shader_.bind();
+	shader_->bind();
 	// Set our matrix uniforms!
 	QMatrix4x4 id;
 	id.setToIdentity();
-	shader_.setUniformValue("modelMatrix", modelMat);
-	shader_.setUniformValue("viewMatrix", view);
-	shader_.setUniformValue("projectionMatrix", projection);
+	shader_->setUniformValue("modelMatrix", modelMat);
+	shader_->setUniformValue("viewMatrix", view);
+	shader_->setUniformValue("projectionMatrix", projection);
 
 	vao_.bind();
 	texture_.bind();
 	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 	texture_.release();
 	vao_.release();
-	shader_.release();
+	shader_->release();
 }
 
 void Renderable::setModelMatrix(const QMatrix4x4& transform)
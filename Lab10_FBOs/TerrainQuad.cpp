@@ -88,13 +88,13 @@ void TerrainQuad::draw(const QMatrix4x4& world, const QMatrix4x4& view, const QM
     modelMat = modelMat * rotMatrix;
     modelMat = world * modelMat;
     // Make sure our state is what we want
-    shader_.bind();
+    shader_->bind();
     // Set our matrix uniforms!
     QMatrix4x4 id;
     id.setToIdentity();
-    shader_.setUniformValue("modelMatrix", modelMat);
-    shader_.setUniformValue("viewMatrix", view);
-    shader_.setUniformValue("projectionMatrix", projection);
+    shader_->setUniformValue("modelMatrix", modelMat);
+    shader_->setUniformValue("viewMatrix", view);
+    shader_->setUniformValue("projectionMatrix", projection);
 
     vao_.bind();
     texture_.bind();
@@ -107,5 +107,5 @@ void TerrainQuad::draw(const QMatrix4x4& world, const QMatrix4x4& view, const QM
     heightTexture_.release();
     texture_.release();
     vao_.release();
-    shader_.release();
+    shader_->release();
 }
\ No newline at end of file
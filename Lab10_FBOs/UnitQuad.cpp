@@ -47,15 +47,15 @@ void UnitQuad::update(const qint64 msSinceLastFrame)
     // super wonky.  Instead, just move the light on the z axis.
     newPos.setX(0.5);
     // TODO:  Understand how the light gets initialized/setup.
-    shader_.bind();
-    shader_.setUniformValue("pointLights[0].color", 1.0f, 1.0f, 1.0f);
-    shader_.setUniformValue("pointLights[0].position", newPos);
+    shader_->bind();
+    shader_->setUniformValue("pointLights[0].color", 1.0f, 1.0f, 1.0f);
+    shader_->setUniformValue("pointLights[0].position", newPos);
 
-    shader_.setUniformValue("pointLights[0].ambientIntensity", 0.5f);
-    shader_.setUniformValue("pointLights[0].specularStrength", 0.5f);
-    shader_.setUniformValue("pointLights[0].constant", 1.0f);
-    shader_.setUniformValue("pointLights[0].linear", 0.09f);
-    shader_.setUniformValue("pointLights[0].quadratic", 0.032f);
+    shader_->setUniformValue("pointLights[0].ambientIntensity", 0.5f);
+    shader_->setUniformValue("pointLights[0].specularStrength", 0.5f);
+    shader_->setUniformValue("pointLights[0].constant", 1.0f);
+    shader_->setUniformValue("pointLights[0].linear", 0.09f);
+    shader_->setUniformValue("pointLights[0].quadratic", 0.032f);
 
-    shader_.release();
+    shader_->release();
 }
\ No newline at end of file
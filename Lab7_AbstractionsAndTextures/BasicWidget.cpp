@@ -14,6 +14,7 @@ BasicWidget::~BasicWidget()
 		delete renderable;
 	}
 	renderables_.clear();
+	ShaderCache::instance().clear();
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -3,14 +3,15 @@
 #include <QtCore>
 #include <QtGui>
 #include <QtOpenGL>
+#include "ShaderCache.h"
 
 class Renderable
 {
 protected:
 	// Each renderable has its own model matrix
 	QMatrix4x4 modelMatrix_;
-	// For now, we have only one shader per object
-	QOpenGLShaderProgram shader_;
+	// Shared by every Renderable using the same shaders; the ShaderCache owns it
+	QOpenGLShaderProgram* shader_;
 	// For now, we have only one texture per object
 	QOpenGLTexture texture_;
 	// For now, we have a single unified buffer per object
@@ -14,10 +14,12 @@ BasicWidget::BasicWidget(QWidget* parent) : QOpenGLWidget(parent), logger_(this)
 
 BasicWidget::~BasicWidget()
 {
+    makeCurrent();
     for (auto renderable : renderables_) {
         delete renderable;
     }
     renderables_.clear();
+    ShaderCache::instance().clear();
 }
 
 //////////////////////////////////////////////////////////////////////
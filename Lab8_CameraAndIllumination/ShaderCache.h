@@ -0,0 +1,60 @@
+#pragma once
+
+#include <QtCore>
+#include <QtGui>
+#include <QtOpenGL>
+
+// Process-wide cache of linked shader programs. Programs are keyed by a hash of
+// their sources and defines, so every Renderable asking for the same shaders shares
+// one program. Linked programs are also saved with glGetProgramBinary and loaded
+// on the next launch instead of being compiled again.
+//
+// Programs belong to the context that was current when they were created, and
+// the cache owns them.
+class ShaderCache : protected QOpenGLExtraFunctions
+{
+public:
+	static ShaderCache& instance();
+
+	// Get a linked program for these shader files. Each define is injected after the
+	// #version line as "#define <define>", e.g. "NORMAL_MAP" or "LIGHT_COUNT 4".
+	QOpenGLShaderProgram* program(const QString& vertexFile, const QString& fragmentFile, const QStringList& defines = QStringList());
+
+	// Delete every program. The owning context must be current.
+	void clear();
+
+	// Where program binaries are saved. Defaults to "shadercache" in the working directory.
+	void setBinaryDirectory(const QString& directory);
+
+	inline int programCount() const { return programs_.size(); }
+	// How the programs were made: compiled from source, or loaded from a saved binary
+	inline int compiledCount() const { return compiledCount_; }
+	inline int binaryLoadCount() const { return binaryLoadCount_; }
+	// Total time spent making programs, in milliseconds
+	inline double buildMs() const { return buildMs_; }
+
+private:
+	ShaderCache();
+	ShaderCache(const ShaderCache&) = delete;
+	ShaderCache& operator=(const ShaderCache&) = delete;
+
+	void initialize();
+	const QByteArray& source(const QString& file);
+	static QByteArray injectDefines(const QByteArray& source, const QStringList& defines);
+
+	bool loadBinary(const QString& path, QOpenGLShaderProgram* program);
+	void saveBinary(const QString& path, QOpenGLShaderProgram* program);
+
+	QOpenGLContext* context_;
+	bool binariesSupported_;
+	// Binaries are only valid for the driver that made them
+	QByteArray driverKey_;
+	QString binaryDirectory_;
+
+	QHash<QString, QByteArray> sources_;
+	QHash<QByteArray, QOpenGLShaderProgram*> programs_;
+
+	int compiledCount_;
+	int binaryLoadCount_;
+	double buildMs_;
+};
@@ -36,7 +36,7 @@ void UnitQuad::init(const QString& textureFile, QList<std::shared_ptr<PointLight
 
 void UnitQuad::update(const qint64 msSinceLastFrame)
 {
-	shader_.bind();
+	shader_->bind();
 	for (int ii = 0; ii < lights_.size(); ii++)
 	{
 		std::shared_ptr<PointLight> light = lights_[ii];
@@ -46,13 +46,13 @@ void UnitQuad::update(const qint64 msSinceLastFrame)
 		// super wonky.  Instead, just move the light on the z axis.
 		
 		std::string prefix = "pointLights[" + std::to_string(ii) + "].";
-		shader_.setUniformValue((prefix + "color").c_str(), light->color());
-		shader_.setUniformValue((prefix + "position").c_str(), lightPos);
-		shader_.setUniformValue((prefix + "ambientIntensity").c_str(), light->ambientIntensity());
-		shader_.setUniformValue((prefix + "specularIntensity").c_str(), light->specularIntensity());
-		shader_.setUniformValue((prefix + "constant").c_str(), light->constant());
-		shader_.setUniformValue((prefix + "linear").c_str(), light->linear());
-		shader_.setUniformValue((prefix + "quadratic").c_str(), light->quadratic());
+		shader_->setUniformValue((prefix + "color").c_str(), light->color());
+		shader_->setUniformValue((prefix + "position").c_str(), lightPos);
+		shader_->setUniformValue((prefix + "ambientIntensity").c_str(), light->ambientIntensity());
+		shader_->setUniformValue((prefix + "specularIntensity").c_str(), light->specularIntensity());
+		shader_->setUniformValue((prefix + "constant").c_str(), light->constant());
+		shader_->setUniformValue((prefix + "linear").c_str(), light->linear());
+		shader_->setUniformValue((prefix + "quadratic").c_str(), light->quadratic());
 	}
-	shader_.release();
+	shader_->release();
 }
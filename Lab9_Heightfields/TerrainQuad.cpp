@@ -94,13 +94,13 @@ void TerrainQuad::draw(const QMatrix4x4& world, const QMatrix4x4& view, const QM
     modelMat = modelMat * rotMatrix;
     modelMat = world * modelMat;
     // Make sure our state is what we want
-    shader_.bind();
+    shader_->bind();
     // Set our matrix uniforms!
     QMatrix4x4 id;
     id.setToIdentity();
-    shader_.setUniformValue("modelMatrix", modelMat);
-    shader_.setUniformValue("viewMatrix", view);
-    shader_.setUniformValue("projectionMatrix", projection);
+    shader_->setUniformValue("modelMatrix", modelMat);
+    shader_->setUniformValue("viewMatrix", view);
+    shader_->setUniformValue("projectionMatrix", projection);
 
     vao_.bind();
 
@@ -114,8 +114,8 @@ void TerrainQuad::draw(const QMatrix4x4& world, const QMatrix4x4& view, const QM
 
     // Setup our shader uniforms for multiple textures.  Make sure we use the correct
     // texture units as defined above!
-    shader_.setUniformValue("tex", GL_TEXTURE0);
-    shader_.setUniformValue("colorTex", GL_TEXTURE1 - GL_TEXTURE0);
+    shader_->setUniformValue("tex", GL_TEXTURE0);
+    shader_->setUniformValue("colorTex", GL_TEXTURE1 - GL_TEXTURE0);
 
 		for (unsigned int s = 0; s < numStrips_; ++s) {
 			unsigned int offset = s * numIdxPerStrip_ * sizeof(GL_UNSIGNED_INT);
@@ -126,5 +126,5 @@ void TerrainQuad::draw(const QMatrix4x4& world, const QMatrix4x4& view, const QM
     texture_.release();
 //    f.glActiveTexture(GL_TEXTURE0);
     vao_.release();
-    shader_.release();
+    shader_->release();
 }
\ No newline at end of file